@@ -22,6 +22,9 @@
 
 static GenericModem modem;
 static ROT* _rot = NULL;
+
+// Channel left open for the next run, see Applet::selectWarm
+static const char* state_path = "/tmp/jwtexample.state";
  
 
 /** 
@@ -40,7 +43,7 @@ int initialize(const char *modem_port)
     _rot = new ROT();
     _rot->init(&modem);
 
-    if (!_rot->select(false)) { // true - basic channel, false - new logical channel
+    if (!_rot->selectWarm(state_path)) { // logical channel of the previous run, or a new one
         printf("\nError: cannot select applet!\n");
         return -1;
     }
@@ -24,6 +24,13 @@
 
 #define USE_ROT_APPLET 1
 
+#define APPLET_MAX_SESSIONS 4		// sessions tracked at once, see closeSessions
+#define APPLET_SWEEP_SESSIONS 6		// session numbers closed by sweepSessions
+#define APPLET_SESSION_CLOSE 0x01	// P1 of an init command closing its session
+
+#define APPLET_STATE_PATH_LEN 256	// longest state file path, see selectWarm
+#define APPLET_STATE_AID_LEN 16		// longest AID recorded in a state file
+
 #ifdef __cplusplus
 
 /**
@@ -54,9 +61,23 @@ class Applet {
 	void init(const SEInterface *se);
 
 	/**
-	 * Close all the sessions
+	 * Close the applet sessions opened through this instance and not
+	 * ended yet, if any. Nothing is sent when none is open.
 	 */
 	void closeSessions();
+
+	/**
+	 * Close the compute signature sessions 0 to APPLET_SWEEP_SESSIONS - 1
+	 * whether they are open or not, best effort, for an applet whose state
+	 * is unknown, e.g. after a crash.
+	 */
+	void sweepSessions();
+
+	/**
+	 * Returns the number of sessions opened through this instance and not
+	 * ended yet
+	 */
+	uint8_t getOpenSessions(void);
 	
 	/**
 	 * Check if the applet is selected
@@ -72,6 +93,41 @@ class Applet {
 	 */
 	bool select(bool isBasic = true);
 
+	/**
+	 * Select the applet on a logical channel, reusing the channel recorded
+	 * in a state file by a previous process when the applet still answers
+	 * on it: one SELECT instead of MANAGE CHANNEL and SELECT. Otherwise
+	 * the recorded channel is closed if it is still open, a new one is
+	 * selected and recorded.
+	 *
+	 * The channel is left open when the instance is destroyed, and the
+	 * state file updated with the extended length support learnt
+	 * meanwhile; deselect() closes it and removes the file. A state file
+	 * must not be shared by processes running at the same time.
+	 * 
+	 * @param[in]  statePath path of the state file, created if needed
+	 * @return true in case select was successful, false otherwise.
+	 */
+	bool selectWarm(const char *statePath);
+
+	/**
+	 * Use a logical channel on which the applet is already selected, e.g.
+	 * one leased from an SEChannelPool, without selecting it again.
+	 * deselect() then leaves the channel open for its owner.
+	 * 
+	 * @param[in]  channel the logical channel, 1 to SE_MAX_CHANNELS - 1
+	 * @return true in case of success, false if the channel is invalid or
+	 *         the applet is already selected.
+	 */
+	bool attach(uint8_t channel);
+
+	/**
+	 * Returns the AID of the applet, e.g. to open an SEChannelPool on it
+	 *
+	 * @param[out]  aidLen length of the AID
+	 */
+	const uint8_t *getAid(uint16_t *aidLen);
+
 	/**
 	 * Deselect the applet by closing the channel opened during the
 	 * select phase.
@@ -79,6 +135,22 @@ class Applet {
 	 * @return true in case deselect was successful, false otherwise.
 	 */
 	bool deselect(void);
+	/**
+	 * Take the transaction lock of the Secure Element interface, so that
+	 * a sequence of commands to the applet is not interleaved with
+	 * commands of other threads (see SEInterface::lock).
+	 * 
+	 * @return true once the lock is held, false if no interface is configured.
+	 */
+	bool lock(void);
+
+	/**
+	 * Release the transaction lock taken with lock().
+	 * 
+	 * @return true in case of success, false otherwise.
+	 */
+	bool unlock(void);
+
 	/**
 	 * Transmit an APDU case 1 to the applet through the corresponding 
 	 * channel.
@@ -133,6 +205,57 @@ class Applet {
 	 */
 	bool transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, uint16_t dataLen, uint8_t le);
 
+	/**
+	 * Transmit an APDU of any case to the applet through the corresponding 
+	 * channel, with extended length encoding when data or le do not fit in
+	 * a short APDU (see SEInterface::transmitExtended).
+	 * 
+	 * @param[in]  cla CLA value for APDU command 
+	 * @param[in]  ins INS value for APDU command 
+	 * @param[in]  p1 P1 value for APDU command 
+	 * @param[in]  p2 P2 value for APDU command 
+	 * @param[in]  data pointer to the data buffer for APDU command, nullptr if none
+	 * @param[in]  dataLen length of the data buffer
+	 * @param[in]  le expected response length up to 65536, 0 if no response data is expected
+	 * @return true in case transmit was successful, false otherwise.
+	 */
+	bool transmitExtended(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, uint16_t dataLen, uint32_t le);
+
+	/**
+	 * Transmit a payload of any length to the applet through the
+	 * corresponding channel as a chain of commands, header followed by data
+	 * (see SEInterface::transmitChained).
+	 * 
+	 * @param[in]  cla CLA value for APDU command 
+	 * @param[in]  ins INS value for APDU command 
+	 * @param[in]  p1 P1 value for APDU command, that of the last segment
+	 * @param[in]  p2 P2 value for APDU command 
+	 * @param[in]  header pointer to the first part of the payload, nullptr if none
+	 * @param[in]  headerLen length of the first part of the payload
+	 * @param[in]  data pointer to the second part of the payload, nullptr if none
+	 * @param[in]  dataLen length of the second part of the payload
+	 * @param[in]  le expected response length to the last segment, 0 if none
+	 * @param[in]  chaining APDU_CHAINING_CLA or APDU_CHAINING_P1
+	 * @return zero in case all segments were accepted, ERR_INVALID_RESPONSE
+	 *         if one but the last was refused, nonzero otherwise.
+	 */
+	int transmitChained(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2,
+			const uint8_t *header, uint16_t headerLen, const uint8_t *data, uint32_t dataLen,
+			uint32_t le, uint8_t chaining);
+
+	/**
+	 * Transmit a batch of commands to the applet as one unit (see
+	 * SEInterface::transmitBatch). The channel is set in the CLA of each
+	 * command.
+	 * 
+	 * @param[in, out]  commands the commands, see SEBatchCommand
+	 * @param[in]  count number of commands
+	 * @param[out]  executed number of commands sent, nullptr if not needed
+	 * @return zero in case every command was answered an expected status
+	 *         word, ERR_INVALID_RESPONSE on an unexpected one, nonzero otherwise.
+	 */
+	int transmitBatch(SEBatchCommand *commands, uint16_t count, uint16_t *executed);
+
 	/**
 	 * Get status word from the data response received after the last 
 	 * successful transmit
@@ -157,11 +280,47 @@ class Applet {
 	 * @return the length of the response, 0 otherwise.
 	 */
 	uint16_t getResponseLength(void);
+
+	/**
+	 * Get the response received after the last successful transmit without
+	 * copying it (see SEInterface::getResponseView). The view is
+	 * invalidated by the next transmit.
+	 * 
+	 * @return a view of the response, empty with sw 0 if there is none.
+	 */
+	SEResponseView getResponseView(void);
 protected:
 	SEInterface *_seiface; // Secure Element on which is installed the targetted applet.
 	uint8_t _channel;	   // channel value
 	bool _isSelected;	   // flag to indicate if the applet is currently selected.
 	bool _isBasic;		   // flag to indicate if the applet has been selected through basic channel.
+	bool _isAttached;	   // flag to indicate if the channel was given to attach() and is not ours to close.
+
+	// Sessions open on the applet: init command and session number (P2)
+	uint8_t _sessionIns[APPLET_MAX_SESSIONS];
+	uint8_t _sessionNumber[APPLET_MAX_SESSIONS];
+	uint8_t _sessionCount;
+
+	/**
+	 * Record a session opened by the init command ins, or ended. Sessions
+	 * past APPLET_MAX_SESSIONS are left to sweepSessions.
+	 * 
+	 * @param[in]  ins INS of the init command of the session
+	 * @param[in]  session session number, P2 of the init command
+	 * @param[in]  open true once opened, false once ended
+	 */
+	void trackSession(uint8_t ins, uint8_t session, bool open);
+
+	// State file of a selection made by selectWarm, empty otherwise
+	char _statePath[APPLET_STATE_PATH_LEN];
+
+	/**
+	 * Write the channel, the AID and the extended length support to the
+	 * state file of selectWarm.
+	 * 
+	 * @return true in case of success, false otherwise.
+	 */
+	bool saveState(void);
 	uint8_t *_aid;		   // Applet's AID
 	uint16_t _aidLen;	   // Applet's AID length
 };
@@ -176,6 +335,7 @@ void Applet_destroy(Applet* applet);
 void Applet_init(Applet* applet, SEInterface* seiface);
 bool Applet_is_selected(Applet* applet);
 bool Applet_select(Applet* applet, bool is_basic);
+bool Applet_select_warm(Applet* applet, const char* state_path);
 bool Applet_deselect(Applet* applet);
 		
 bool Applet_transmit_case1(Applet* applet, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2);
@@ -183,9 +343,12 @@ bool Applet_transmit_case2(Applet* applet, uint8_t cla, uint8_t ins, uint8_t p1,
 bool Applet_transmit_case3(Applet* applet, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t* data, uint16_t data_len);
 bool Applet_transmit_case4(Applet* applet, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t* data, uint16_t data_len, uint8_t le);
 
+int Applet_transmit_batch(Applet* applet, SEBatchCommand* commands, uint16_t count, uint16_t* executed);
+
 uint16_t Applet_get_status_word(Applet* applet);
 uint16_t Applet_get_response(Applet* applet, uint8_t* data);
 uint16_t Applet_get_response_length(Applet* applet);
+SEResponseView Applet_get_response_view(Applet* applet);
 		
 #endif
 
@@ -24,6 +24,7 @@
 
 #define CMD_MAX_LEN					255
 #define ECC_PUBLIC_KEY_LEN  				0x45
+#define ECC_MAX_SCALAR_LEN				0x42	// r and s of P-521
 #define MAX_CONTAINER_ID_LEN				0x16
 
 #define CONTAINER_ID_LENGTH			1
@@ -33,6 +34,12 @@
 #define CONTAINER_ID_CLIENT_EPHEMERAL_KEY	4
 #define CONTAINER_ID_SERVER_EPHEMERAL_KEY       5
 
+// Container cache, see ROT::setCache
+#define ROT_CACHE_OFF			0	// every read goes to the applet
+#define ROT_CACHE_ON			1	// files read once, then served from memory until invalidated
+#define ROT_CACHE_REVALIDATE		2	// as ROT_CACHE_ON, the file length checked with GET DATA on each use
+#define ROT_CACHE_MAX_ENTRIES		4	// files kept, the oldest one dropped first
+
 // Mode of Operation
 #define OPERATION_MODE_FULL_TEXT	1
 #define OPERATION_MODE_LAST_BLOCK	2
@@ -89,6 +96,8 @@ typedef struct
 
 #ifdef __cplusplus
 
+#include <vector>
+
 /**
  * The class is an implementation of GSMA Specification "IoT Security Applet Interface Description".
  * https://www.gsma.com/iot/wp-content/uploads/2019/12/IoT.05-v1-IoT-Security-Applet-Interface-Description.pdf
@@ -99,6 +108,15 @@ class ROT: public Applet {
 	 * Create an instance of ROT
 	 */
 	ROT(void);
+
+	/**
+	 * Create an instance of ROT for an IoT SAFE applet instance installed
+	 * under another AID, e.g. next to the default one.
+	 *
+	 * @param[in]  aid the aid buffer, kept by reference
+	 * @param[in]  aidLen the length of aid
+	 */
+	ROT(const uint8_t *aid, uint16_t aidLen);
 	/**
 	 * Destrcutor
 	 */
@@ -115,6 +133,23 @@ class ROT: public Applet {
 	 * @return 0 in case operation was successful, error code otherwise.
 	 */
 	int getCertificateByContainerId(const uint8_t *containerId, uint16_t containerIdLen, uint8_t **cert, uint16_t *certLen);
+
+	/**
+	 * Keep the files read by getCertificateByContainerId in memory, keyed
+	 * by container id and label, so that reading one again sends no APDU
+	 * (ROT_CACHE_ON) or a single GET DATA checking its length
+	 * (ROT_CACHE_REVALIDATE). Off by default. generateKeyPairByContainerId
+	 * and putServerPublicKey empty the cache; files changed by other means
+	 * need invalidateCache().
+	 * 
+	 * @param[in]  mode ROT_CACHE_OFF, ROT_CACHE_ON or ROT_CACHE_REVALIDATE
+	 */
+	void setCache(uint8_t mode);
+
+	/**
+	 * Empty the container cache, see setCache.
+	 */
+	void invalidateCache(void);
 	
 	/**
 	 * Generate a random buffer with specified length
@@ -127,6 +162,8 @@ class ROT: public Applet {
 
 	/**
 	 * Prepare context in applet prior computing a signature.
+	 * When the Secure Element interface is shared between threads, hold
+	 * lock() from signInit to signFinal.
 	 * 
 	 * @param[in]  containerId specify the container id of the certificate
 	 * @param[in]  containerIdLen length of the container
@@ -141,12 +178,31 @@ class ROT: public Applet {
 	 * 
 	 * @param[in]  hash a buffer which contain data to encrypt using key to compute signature
 	 * @param[in]  hash_len the length of hash buffer
-	 * @param[out]  signature a buffer which will contain the resulted signature
-	 * @param[in, out]  signature_len the length of signature buffer
-	 * @return 0 in case operation was successful, error code otherwise.
+	 * @param[out]  signature a buffer which will contain the resulted signature, DER encoded
+	 * @param[in, out]  signature_len the length of signature buffer, then of the signature
+	 * @return 0 in case operation was successful, ERR_INVALID_LENGTH if the
+	 *         signature does not fit the buffer, error code otherwise.
 	 */
 	int signFinal(const uint8_t *hash, uint16_t hashLen, uint8_t *signature, uint16_t *signatureLen);
 
+	/**
+	 * Compute signature over a whole message, hashed by the applet. Messages
+	 * longer than one APDU are sent through command chaining.
+	 * 
+	 * @param[in]  containerId specify the container id of the key
+	 * @param[in]  containerIdLen length of the container
+	 * @param[in]  algorithm the targetted signature algorithm, 
+	 * 				all algorithms are defined in "SIGN ALGORITHM".
+	 * @param[in]  data the message to sign
+	 * @param[in]  dataLen the length of the message
+	 * @param[out]  signature a buffer which will contain the resulted signature, DER encoded
+	 * @param[in, out]  signatureLen the length of signature buffer, then of the signature
+	 * @return 0 in case operation was successful, ERR_INVALID_LENGTH if the
+	 *         signature does not fit the buffer, error code otherwise.
+	 */
+	int signData(const uint8_t *containerId, uint16_t containerIdLen, uint32_t algorithm,
+				 const uint8_t *data, uint32_t dataLen, uint8_t *signature, uint16_t *signatureLen);
+
 
 	/**
 	 * Get key pair stored on the container identify by the provided id.
@@ -245,6 +301,20 @@ class ROT: public Applet {
 
     private:
 	RotKeyPair _keypairs;
+
+	// Container cache, see setCache
+	typedef struct {
+		std::vector<uint8_t> key;	// container id and label TLVs, as sent to the applet
+		std::vector<uint8_t> data;	// as returned by readFile
+	} CacheEntry;
+	uint8_t _cacheMode;
+	std::vector<CacheEntry> _cache;
+
+	// Copy a cached file into a new buffer, true if it was found and is still valid
+	bool readCached(const uint8_t *key, uint16_t keyLen,
+				 const uint8_t *fileId, uint16_t fileIdLen,
+				 const uint8_t *fileLbl, uint16_t fileLblLen,
+				 uint8_t **data, uint16_t *dataLen);
 	uint16_t getFileLength(const uint8_t *fileId, uint16_t fileIdLen,
 				 const uint8_t *fileLbl, uint16_t fileLblLen);
     int readFile(const uint8_t *path, uint16_t pathLen,
@@ -297,12 +367,16 @@ void ROT_destroy(ROT* rot);
 int ROT_get_certificate_by_container_id(ROT* rot, const uint8_t *container_id, uint16_t containerIdLen, uint8_t **cert, uint16_t *cert_len);
 bool ROT_get_key_pair_by_container_id(ROT* rot, uint8_t container_id, mias_key_pair_t** kp);
 
+void ROT_set_cache(ROT* rot, uint8_t mode);
+void ROT_invalidate_cache(ROT* rot);
+
 bool ROT_generate_random(ROT* rot, uint8_t* data, uint16_t dataLen);
 int ROT_generate_key_pair_by_container_id(ROT* rot, const uint8_t* container_id, uint16_t containerIdLen,, RotKeyPair* kp);
 
 int ROT_sign_init(ROT* rot, const uint8_t *containerId, uint16_t containerIdLen, uint32_t algorithm);
 int ROT_sign_final(ROT* rot, uint8_t* hash, uint16_t hash_len, uint8_t* signature, uint16_t* signature_len);
 int ROT_sign_final_ECDSA(ROT* rot, const uint8_t* hash, uint16_t hash_len, uint8_t* signature, uint16_t* signature_len);
+int ROT_sign_data(ROT* rot, const uint8_t *containerId, uint16_t containerIdLen, uint32_t algorithm, const uint8_t* data, uint32_t data_len, uint8_t* signature, uint16_t* signature_len);
 int ROT_put_server_public_key(ROT* rot, uint8_t container_id, uint8_t* pubKey, uint16_t pubKeyLen);
 int ROT_compute_DH_for_keypair(ROT* rot, ROT* rot, const uint8_t *clientEphContainerId, uint16_t clientEphContainerIdLen, 
 					const uint8_t *serverEphContainerId, uint16_t serverEphContainerIdLen,
@@ -0,0 +1,139 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_APPLET_REGISTRY_H__
+#define __SE_APPLET_REGISTRY_H__
+
+#include "Applet.h"
+
+#define SE_REGISTRY_MAX_APPLETS 8	// applets registered at once
+
+/**
+ * Applets of one Secure Element, e.g. the IoT SAFE applet and an operator
+ * applet, each selected on a logical channel of its own, so that switching
+ * from one to the other sends no SELECT.
+ *
+ * An applet is selected on first use, on a channel opened with MANAGE
+ * CHANNEL. When the Secure Element has no channel left, the channel of the
+ * applet least recently used, with no session open, is taken over: one
+ * SELECT on that logical channel, never on the basic one.
+ *
+ * Every method takes the transaction lock of the interface. A thread which
+ * uses an applet while others may take its channel over keeps the lock
+ * from use() to the end of its commands (SETransaction or Applet::lock).
+ */
+class SEAppletRegistry
+{
+public:
+	/**
+	 * @param[in]  se the Secure Element interface shared by the applets
+	 */
+	SEAppletRegistry(SEInterface *se);
+
+	/**
+	 * Deselects the applets and closes their channels, see remove().
+	 */
+	~SEAppletRegistry(void);
+
+	/**
+	 * Register an applet, configured with the interface of the registry.
+	 * It is selected on first use.
+	 *
+	 * @param[in]  applet the applet, kept by reference until removed
+	 * @return true in case of success, false if the registry is full or
+	 *         an applet with the same AID is registered.
+	 */
+	bool add(Applet *applet);
+
+	/**
+	 * Deselect an applet and close the channel the registry opened for it.
+	 *
+	 * @param[in]  applet the applet given to add()
+	 * @return true in case of success, false if it is not registered.
+	 */
+	bool remove(Applet *applet);
+
+	/**
+	 * Returns the applet registered with an AID, nullptr if none
+	 *
+	 * @param[in]  aid the AID
+	 * @param[in]  aidLen length of aid
+	 */
+	Applet *find(const uint8_t *aid, uint16_t aidLen);
+
+	/**
+	 * Have an applet selected on its channel, selecting it if it is not.
+	 *
+	 * @param[in]  aid the AID of a registered applet
+	 * @param[in]  aidLen length of aid
+	 * @return the applet, ready for commands, nullptr if it is not
+	 *         registered or could not be selected.
+	 */
+	Applet *use(const uint8_t *aid, uint16_t aidLen);
+
+	/**
+	 * Have a registered applet selected on its channel, see
+	 * use(const uint8_t *, uint16_t).
+	 *
+	 * @param[in]  applet the applet given to add()
+	 * @return true once the applet is ready for commands, false otherwise.
+	 */
+	bool use(Applet *applet);
+
+	/**
+	 * Returns the logical channel the registry opened for an applet,
+	 * SE_CHANNEL_NONE if it has none
+	 *
+	 * @param[in]  applet the applet given to add()
+	 */
+	uint8_t getChannel(Applet *applet);
+
+	/**
+	 * Returns the number of registered applets
+	 */
+	uint8_t getCount(void);
+
+	SEAppletRegistry(const SEAppletRegistry &) = delete;
+	SEAppletRegistry &operator=(const SEAppletRegistry &) = delete;
+
+private:
+	typedef struct
+	{
+		Applet *applet;
+		uint8_t channel;	// channel opened for the applet, SE_CHANNEL_NONE if none
+		uint32_t lastUse;	// value of _clock when last used
+	} Entry;
+
+	SEInterface *_se;
+	Entry _entries[SE_REGISTRY_MAX_APPLETS];
+	uint8_t _count;
+	uint32_t _clock;	// incremented on each use
+
+	// Index of applet in _entries, _count if not registered
+	uint8_t indexOf(Applet *applet);
+
+	// Open a channel, or take over that of the applet least recently used
+	uint8_t takeChannel(uint8_t index);
+
+	// SELECT the applet of entry on channel, true if it answered a success
+	bool select(Entry *entry, uint8_t channel);
+
+	// MANAGE CHANNEL close
+	void closeChannel(uint8_t channel);
+};
+
+#endif /* __SE_APPLET_REGISTRY_H__ */
@@ -0,0 +1,170 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_CHANNEL_POOL_H__
+#define __SE_CHANNEL_POOL_H__
+
+#include "SEInterface.h"
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * Logical channels opened once on an applet and leased to concurrent
+ * operations, so that independent sessions (signature, random, PRF) each
+ * run on a channel of their own instead of queueing behind one.
+ *
+ * open() sends MANAGE CHANNEL and SELECT for each channel; a released
+ * channel goes back to the pool with the applet still selected, the next
+ * lessee uses it through Applet::attach without selecting it again.
+ * Channels 4 to 19 are sent with the further interindustry class coding
+ * (see seClaForChannel).
+ *
+ * acquire() may wait for a lessee to release a channel, so it must not be
+ * called while holding the transaction lock of the interface.
+ *
+ * Lock order: the transaction lock of the interface, then the pool mutex.
+ * open(), close() and release() send APDUs and take both in that order,
+ * so a lessee may release its channel while holding an SETransaction;
+ * acquire() and the getters take the pool mutex only.
+ */
+class SEChannelPool
+{
+public:
+	/**
+	 * @param[in]  aid AID of the applet selected on the channels, kept by reference
+	 * @param[in]  aidLen length of aid
+	 */
+	SEChannelPool(const uint8_t *aid, uint16_t aidLen);
+
+	/**
+	 * Closes the channels, see close().
+	 */
+	~SEChannelPool(void);
+
+	/**
+	 * Open logical channels and select the applet on each, until count
+	 * are open or the Secure Element refuses another one.
+	 *
+	 * @param[in]  se the Secure Element interface
+	 * @param[in]  count number of channels wanted, up to SE_MAX_CHANNELS - 1
+	 * @return the number of channels open, 0 if none could be.
+	 */
+	uint8_t open(SEInterface *se, uint8_t count);
+
+	/**
+	 * Close the channels of the pool with MANAGE CHANNEL. Channels leased
+	 * at that time are closed when released.
+	 */
+	void close(void);
+
+	/**
+	 * Lease a channel, waiting for one to be released if all are leased.
+	 *
+	 * @param[in]  timeout longest wait in ms
+	 * @return the channel, SE_CHANNEL_NONE if none was released in time or
+	 *         the pool is closed.
+	 */
+	uint8_t acquire(uint32_t timeout);
+
+	/**
+	 * Give a leased channel back to the pool.
+	 *
+	 * @param[in]  channel the channel returned by acquire()
+	 * @param[in]  reselect select the applet again before the next lease,
+	 *             e.g. after a failure which may have left the applet in an
+	 *             unknown state; the channel is closed if that fails.
+	 */
+	void release(uint8_t channel, bool reselect = false);
+
+	/**
+	 * Returns the number of channels of the pool, leased or not
+	 */
+	uint8_t getSize(void);
+
+	/**
+	 * Returns the number of channels not leased
+	 */
+	uint8_t getAvailable(void);
+
+	SEChannelPool(const SEChannelPool &) = delete;
+	SEChannelPool &operator=(const SEChannelPool &) = delete;
+
+private:
+	SEInterface *_se;	// set by open(), unchanged while channels are open
+	const uint8_t *_aid;
+	uint16_t _aidLen;
+	bool _closed;		// close() called, channels released from now on are closed
+
+	// One bit per channel
+	uint32_t _channels;	// open channels of the pool
+	uint32_t _available;	// open channels not leased
+	std::mutex _mutex;
+	std::condition_variable _released;
+
+	// SELECT the applet on channel, true if it answered a success
+	bool select(uint8_t channel);
+
+	// MANAGE CHANNEL close
+	void closeChannel(uint8_t channel);
+};
+
+/**
+ * Holds a channel of an SEChannelPool from construction to destruction.
+ */
+class SEChannelLease
+{
+public:
+	SEChannelLease(SEChannelPool *pool, uint32_t timeout = APDU_DEFAULT_TIMEOUT) : _pool(pool),
+		_channel(pool->acquire(timeout)), _reselect(false)
+	{
+	}
+
+	~SEChannelLease(void)
+	{
+		if (_channel != SE_CHANNEL_NONE)
+		{
+			_pool->release(_channel, _reselect);
+		}
+	}
+
+	/**
+	 * Returns the leased channel, SE_CHANNEL_NONE if none was
+	 */
+	uint8_t getChannel(void)
+	{
+		return _channel;
+	}
+
+	/**
+	 * Have the applet selected again when the channel is released, see
+	 * SEChannelPool::release.
+	 */
+	void setReselect(void)
+	{
+		_reselect = true;
+	}
+
+	SEChannelLease(const SEChannelLease &) = delete;
+	SEChannelLease &operator=(const SEChannelLease &) = delete;
+
+private:
+	SEChannelPool *_pool;
+	uint8_t _channel;
+	bool _reselect;
+};
+
+#endif /* __SE_CHANNEL_POOL_H__ */
@@ -35,7 +35,43 @@
 #define APDU_CMD_HEADER_LE_LEN 1
 #define APDU_RESPONSE_LEN 2
 #define APDU_RESPONSE_MAX_PAYLOAD 256
-#define APDU_MAX_RESPONSE_LEN (APDU_RESPONSE_LEN + APDU_RESPONSE_MAX_PAYLOAD)
+
+// Extended length APDUs (ISO 7816-4, 3 bytes Lc and Le): largest command data
+// and response data handled, the internal buffers are sized after it.
+// Build with APDU_EXTENDED_MAX_DATA_LEN=0 to support short APDUs only.
+#ifndef APDU_EXTENDED_MAX_DATA_LEN
+#define APDU_EXTENDED_MAX_DATA_LEN 2048
+#endif
+#define APDU_EXTENDED_HEADER_LEN 7
+#define APDU_EXTENDED_LE_LEN 2
+#define APDU_EXTENDED_LC_OFFSET 5
+#define APDU_EXTENDED_DATA_OFFSET 7
+
+#if APDU_EXTENDED_MAX_DATA_LEN > MAX_APDU_DATA_LEN
+#define APDU_MAX_CMD_LEN (APDU_EXTENDED_HEADER_LEN + APDU_EXTENDED_MAX_DATA_LEN + APDU_EXTENDED_LE_LEN)
+#define APDU_MAX_PAYLOAD APDU_EXTENDED_MAX_DATA_LEN
+#else
+#define APDU_MAX_CMD_LEN (APDU_CMD_HEADER_LEN + MAX_APDU_DATA_LEN + APDU_CMD_HEADER_LE_LEN)
+#define APDU_MAX_PAYLOAD APDU_RESPONSE_MAX_PAYLOAD
+#endif
+#define APDU_MAX_RESPONSE_LEN (APDU_RESPONSE_LEN + APDU_MAX_PAYLOAD)
+
+// Command chaining: ISO 7816-4 CLA bit, or P1 bit set on the last segment only
+#define APDU_CHAINING_CLA 0
+#define APDU_CHAINING_P1 1
+#define APDU_CHAINING_CLA_BIT 0x10
+#define APDU_CHAINING_P1_LAST 0x80
+#define APDU_SHORT_MAX_DATA_LEN 255
+
+// Largest response data gathered through 61xx / GET RESPONSE (at most 65533)
+#ifndef APDU_RESPONSE_MAX_ACCUMULATED_LEN
+#define APDU_RESPONSE_MAX_ACCUMULATED_LEN 8192
+#endif
+
+// Extended length support of the Secure Element
+#define APDU_EXTENDED_AUTO 0	// unknown, detected by the first extended APDU
+#define APDU_EXTENDED_ON 1	// supported
+#define APDU_EXTENDED_OFF 2	// not supported, short APDUs only
 
 
 // Error Code
@@ -47,9 +83,15 @@
 #define ERR_INVALID_RESPONSE 5
 #define ERR_INVALID_PARAMETERS 6
 #define ERR_OUT_OF_MEMORY 7
+#define ERR_TIMEOUT 8
+
+// Default deadline (in milliseconds) for one APDU exchange, 0 waits forever
+#define APDU_DEFAULT_TIMEOUT 10000
 
 #define SW_DATA_AVAILABLE					0x6100
 #define SW_NO_INFOMATION_GIVEN					0x6300
+#define SW_WRONG_LENGTH						0x6700
+#define SW_CHANNEL_NOT_SUPPORTED					0x6881
 #define SW_EXECUTION_OK						0x9000
 #define SW_OK							0x9100
 
@@ -60,10 +102,90 @@
 
 //#define APDU_DEBUG
 
+/**
+ * Response to the last command, read in place: data points into the
+ * receive buffer and stays valid until the next transmit of the same
+ * thread through the same interface.
+ */
+typedef struct SEResponseView {
+	const uint8_t *data;	// response data, nullptr if none
+	uint16_t dataLen;	// length of data, status word excluded
+	uint16_t sw;		// status word, 0 if no response
+} SEResponseView;
+
+/**
+ * One command of a batch (see SEInterface::transmitBatch): the APDU, the
+ * status words it may be answered with, and where its response goes.
+ */
+typedef struct SEBatchCommand {
+	uint8_t cla;
+	uint8_t ins;
+	uint8_t p1;
+	uint8_t p2;
+	const uint8_t *data;	// command data, nullptr if none
+	uint16_t dataLen;
+	uint32_t le;		// expected response length up to 65536, 0 if none
+	uint16_t sw;		// accepted status word...
+	uint16_t swMask;	// ...on these bits, 0 accepts any
+	uint8_t *response;	// receives the response data, nullptr to drop it
+	uint16_t responseLen;	// in: size of response, out: length of the response data
+	uint16_t responseSw;	// out: status word, 0 if the command was not sent
+} SEBatchCommand;
+
+#define SE_BATCH_SW_ANY 0x0000	// swMask accepting any status word
+#define SE_BATCH_SW_EXACT 0xFFFF	// swMask comparing the whole status word
+#define SE_BATCH_SW_SW1 0xFF00	// swMask comparing SW1 only, e.g. 61xx
+
+// Logical channels
+#define SE_MAX_CHANNELS 20	// basic channel 0 and logical channels 1 to 19
+#define SE_CHANNEL_NONE 0xFF	// no channel
+#define SE_CLA_FURTHER_INTERINDUSTRY 0x40	// class coding of channels 4 to 19
+
+/**
+ * CLA of a command on a logical channel: first interindustry coding
+ * (cla | channel) for channels 0 to 3, further interindustry coding
+ * (0x40 | channel - 4) for channels 4 to 19, which has no room for the
+ * secure messaging bits. The proprietary and chaining bits are kept.
+ *
+ * @param[in]  cla CLA of the command on the basic channel
+ * @param[in]  channel channel from 0 to SE_MAX_CHANNELS - 1
+ * @return the CLA to send.
+ */
+static inline uint8_t seClaForChannel(uint8_t cla, uint8_t channel)
+{
+	if (channel < 4)
+	{
+		return (uint8_t) ((cla & ~0x03) | channel);
+	}
+	return (uint8_t) ((cla & (0x80 | APDU_CHAINING_CLA_BIT)) | SE_CLA_FURTHER_INTERINDUSTRY | ((channel - 4) & 0x0F));
+}
+
+/**
+ * Returns the logical channel a CLA is coded for, see seClaForChannel
+ */
+static inline uint8_t seClaChannel(uint8_t cla)
+{
+	return (cla & SE_CLA_FURTHER_INTERINDUSTRY) ? (uint8_t) (4 + (cla & 0x0F)) : (uint8_t) (cla & 0x03);
+}
+
 #ifdef __cplusplus
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// Response to the last command of one thread, see SEInterface.cpp
+struct SEResponseState;
+
 /**
  * The class is for APDU commands transmission and response.
+ *
+ * An instance can be shared between threads: each APDU exchange holds the
+ * transaction lock, and the response (getStatusWord, getResponse,
+ * getResponseLength) is the one of the last command sent by the calling
+ * thread. Sequences of commands which must not be interleaved with other
+ * threads' commands, such as a signature init and update, are framed with
+ * lock() and unlock() or an SETransaction.
  */
 class SEInterface
 {
@@ -77,7 +199,23 @@ public:
 	/**
 	 * Destrcutor
 	 */
-	~SEInterface(void){};
+	virtual ~SEInterface(void);
+
+	/**
+	 * Take the transaction lock: no other thread can transmit until the
+	 * calling thread releases it. The lock is recursive, each lock() is
+	 * released by one unlock().
+	 * 
+	 * @return true once the lock is held.
+	 */
+	bool lock(void);
+
+	/**
+	 * Release the transaction lock taken with lock().
+	 * 
+	 * @return true in case of success, false if the calling thread does not hold the lock.
+	 */
+	bool unlock(void);
 
 	/**
 	 * Transmit an APDU case 1 
@@ -133,6 +271,89 @@ public:
 	 */
 	int transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, uint16_t dataLen, uint8_t le);
 
+	/**
+	 * Transmit an APDU of any case. Short encoding is used when data and le
+	 * fit, extended length encoding otherwise. When the Secure Element does
+	 * not support extended length, an APDU whose data fits is sent again in
+	 * short form with le limited to 256 bytes.
+	 * 
+	 * @param[in]  cla CLA value for APDU command 
+	 * @param[in]  ins INS value for APDU command 
+	 * @param[in]  p1 P1 value for APDU command 
+	 * @param[in]  p2 P2 value for APDU command 
+	 * @param[in]  data pointer to the data buffer for APDU command, nullptr if none
+	 * @param[in]  dataLen length of the data buffer
+	 * @param[in]  le expected response length up to 65536, 0 if no response data is expected
+	 * @return zero in case transmit was successful, ERR_INVALID_LENGTH if the
+	 *         APDU requires extended length which is not available, nonzero otherwise.
+	 */
+	int transmitExtended(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, uint16_t dataLen, uint32_t le);
+
+	/**
+	 * Transmit a payload of any length as a chain of commands and keep the
+	 * response to the last one. The payload is header followed by data, both
+	 * sent from the caller's buffers: a TLV tag and length built on the stack
+	 * can prefix a large value without copying it. Segments use extended
+	 * length when the Secure Element supports it, 255 bytes otherwise.
+	 * 
+	 * With APDU_CHAINING_CLA every segment but the last has the CLA chaining
+	 * bit (0x10) set. With APDU_CHAINING_P1 every segment but the last has
+	 * bit 0x80 of P1 cleared, the IoT Safe applet convention.
+	 * 
+	 * @param[in]  cla CLA value for APDU command 
+	 * @param[in]  ins INS value for APDU command 
+	 * @param[in]  p1 P1 value for APDU command, that of the last segment
+	 * @param[in]  p2 P2 value for APDU command 
+	 * @param[in]  header pointer to the first part of the payload, nullptr if none
+	 * @param[in]  headerLen length of the first part of the payload
+	 * @param[in]  data pointer to the second part of the payload, nullptr if none
+	 * @param[in]  dataLen length of the second part of the payload
+	 * @param[in]  le expected response length to the last segment, 0 if none
+	 * @param[in]  chaining APDU_CHAINING_CLA or APDU_CHAINING_P1
+	 * @return zero in case every segment was sent and all but the last were
+	 *         answered 9000, ERR_INVALID_RESPONSE if a segment was refused
+	 *         (see getStatusWord), nonzero otherwise.
+	 */
+	int transmitChained(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2,
+			const uint8_t *header, uint16_t headerLen, const uint8_t *data, uint32_t dataLen,
+			uint32_t le, uint8_t chaining);
+
+	/**
+	 * Transmit a batch of commands as one unit, holding the transaction
+	 * lock. Each command is sent as with transmitExtended, its response
+	 * data copied to its response buffer and its status word checked
+	 * against sw on the bits of swMask. The batch stops at the first
+	 * command which fails or is answered an unexpected status word; the
+	 * commands after it are not sent (responseSw 0).
+	 * 
+	 * Transports able to overlap exchanges (e.g. encode or send the next
+	 * command while a response is parsed) may override it.
+	 * 
+	 * @param[in, out]  commands the commands, see SEBatchCommand
+	 * @param[in]  count number of commands
+	 * @param[out]  executed number of commands sent, nullptr if not needed
+	 * @return zero in case every command was answered an expected status
+	 *         word, ERR_INVALID_RESPONSE on an unexpected one,
+	 *         ERR_INVALID_LENGTH if a response does not fit its buffer,
+	 *         nonzero otherwise.
+	 */
+	virtual int transmitBatch(SEBatchCommand *commands, uint16_t count, uint16_t *executed);
+
+	/**
+	 * Set the extended length support of the Secure Element, APDU_EXTENDED_AUTO
+	 * by default: the first extended APDU tells whether it is supported.
+	 * 
+	 * @param[in]  mode APDU_EXTENDED_AUTO, APDU_EXTENDED_ON or APDU_EXTENDED_OFF
+	 */
+	void setExtendedLength(uint8_t mode);
+
+	/**
+	 * Returns the extended length support of the Secure Element
+	 * 
+	 * @return APDU_EXTENDED_AUTO while unknown, APDU_EXTENDED_ON or APDU_EXTENDED_OFF.
+	 */
+	uint8_t getExtendedLength(void);
+
 	/**
 	 * Get status word from the data response received after the last 
 	 * successful transmit
@@ -158,27 +379,134 @@ public:
 	 */
 	uint16_t getResponseLength(void);
 
+	/**
+	 * Get the response received after the last successful transmit without
+	 * copying it. The view is invalidated by the next transmit.
+	 * 
+	 * @return a view of the response, empty with sw 0 if there is none.
+	 */
+	SEResponseView getResponseView(void);
+
+	/**
+	 * Set the deadline applied to each APDU exchange with the Secure Element.
+	 * A transmit which does not complete in time returns ERR_TIMEOUT.
+	 * 
+	 * @param[in]  timeout deadline in milliseconds, 0 to wait forever
+	 */
+	void setTimeout(uint32_t timeout);
+
+	/**
+	 * Returns the deadline applied to each APDU exchange
+	 * 
+	 * @return the deadline in milliseconds, 0 if waiting forever.
+	 */
+	uint32_t getTimeout(void);
+
+	/**
+	 * Set the largest response data gathered when the Secure Element
+	 * announces more data with 61xx. Chunks fetched with GET RESPONSE are
+	 * joined in a buffer growing up to this length, so getResponse returns
+	 * the whole response; a longer one fails the transmit with
+	 * ERR_OUT_OF_MEMORY.
+	 * 
+	 * @param[in]  maxLen the ceiling in bytes, at most 65533
+	 */
+	void setMaxResponseLength(uint16_t maxLen);
+
+	/**
+	 * Returns the largest response data gathered over GET RESPONSE
+	 * 
+	 * @return the ceiling in bytes.
+	 */
+	uint16_t getMaxResponseLength(void);
+
 protected:
 	// Low layer implementation to transmit an APDU and retrieve the corresponding APDU Response
+	// responseLen holds the capacity of response on input, the response length on output
 	// Returns true in case transmit was successful, false otherwise
+	// Implementations must honour _timeout and set _timedOut when it expired
 	virtual bool transmitApdu(uint8_t *apdu, uint16_t apduLen, uint8_t *response, uint16_t *responseLen) = 0;
 
+	// Low layer of another interface, for interfaces decorating it (trace,
+	// fault injection...): runs se->transmitApdu holding se's transaction
+	// lock, under the deadline of the caller, and sets the caller's _timedOut
+	bool forwardApdu(SEInterface *se, uint8_t *apdu, uint16_t apduLen, uint8_t *response, uint16_t *responseLen);
+
+	uint32_t _timeout;	// deadline in ms for one APDU exchange
+	bool _timedOut;		// set by transmitApdu when the deadline expired
+
 private:
 	// Internal buffers
-	uint8_t _apdu[APDU_CMD_HEADER_LEN + MAX_APDU_DATA_LEN + APDU_CMD_HEADER_LE_LEN];//total 262
+	uint8_t _apdu[APDU_MAX_CMD_LEN];//total 262 for short APDUs only
 	uint16_t _apduLen;
-	uint8_t _apduResponse[APDU_MAX_RESPONSE_LEN];//total 258
-	uint16_t _apduResponseLen;
+	bool _apduExtended;	// _apdu uses extended length encoding
+	uint8_t _extendedLength;	// APDU_EXTENDED_*
+	uint16_t _maxResponseLen;
+	bool _responseTooLong;		// last transmit failed on _maxResponseLen or memory
+
+	// Transaction lock, _owner and _depth are only written by the owner
+	std::recursive_mutex _lock;
+	std::atomic<std::thread::id> _owner;
+	uint32_t _depth;
+
+	// Key of this instance in the per thread responses
+	uint32_t _id;
+
+	// Response state of the calling thread, created on first use
+	SEResponseState *responseState(void);
+
+	// Append to the accumulated response of state at offset *len, false if limit is exceeded
+	bool accumulate(SEResponseState *state, const uint8_t *data, uint16_t dataLen, uint16_t *len, uint32_t limit);
+
+	// Error code of the last failed transmit
+	int transmitError(void);
+
+	// Encode an APDU whose data is part1 followed by part2, see transmitExtended
+	int transmitParts(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2,
+			const uint8_t *part1, uint16_t part1Len, const uint8_t *part2, uint16_t part2Len, uint32_t le);
 
 	// 'In between' layer implementation which auto handle 6Cxx and 61xx response
 	// Stack:
 	//  - transmitApdu
 	//  - transmit
 	//  - transmit (case 1 ... 4)
+	// 61xx chains are followed iteratively, the chunks joined in the
+	// calling thread's response state
 	// Returns true in case transmit was successful, false otherwise
 	bool transmit(void);
 };
 
+/**
+ * Holds the transaction lock of an SEInterface from construction to
+ * destruction, so that a sequence of commands is not interleaved with
+ * commands of other threads.
+ */
+class SETransaction
+{
+public:
+	SETransaction(SEInterface *se) : _se(se)
+	{
+		if (_se != nullptr)
+		{
+			_se->lock();
+		}
+	}
+
+	~SETransaction(void)
+	{
+		if (_se != nullptr)
+		{
+			_se->unlock();
+		}
+	}
+
+	SETransaction(const SETransaction &) = delete;
+	SETransaction &operator=(const SETransaction &) = delete;
+
+private:
+	SEInterface *_se;
+};
+
 #else 
 
 typedef struct SEInterface SEInterface; 
@@ -191,9 +519,17 @@ bool SEInterface_transmit_case2(SEInterface* seiface, uint8_t cla, uint8_t ins,
 bool SEInterface_transmit_case3(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t* data, uint16_t data_len);
 bool SEInterface_transmit_case4(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t* data, uint16_t data_len, uint8_t le);
 
+int SEInterface_transmit_extended(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t* data, uint16_t data_len, uint32_t le);
+void SEInterface_set_extended_length(SEInterface* seiface, uint8_t mode);
+int SEInterface_transmit_chained(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t* header, uint16_t header_len, uint8_t* data, uint32_t data_len, uint32_t le, uint8_t chaining);
+int SEInterface_transmit_batch(SEInterface* seiface, SEBatchCommand* commands, uint16_t count, uint16_t* executed);
+
 uint16_t SEInterface_get_status_word(SEInterface* seiface);
 uint16_t SEInterface_get_response(SEInterface* seiface, uint8_t* data);
 uint16_t SEInterface_get_response_length(SEInterface* seiface);
+SEResponseView SEInterface_get_response_view(SEInterface* seiface);
+void SEInterface_set_timeout(SEInterface* seiface, uint32_t timeout);
+void SEInterface_set_max_response_length(SEInterface* seiface, uint16_t max_len);
 
 #endif
 
@@ -0,0 +1,240 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_METRICS_H__
+#define __SE_METRICS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+
+// Process wide instrumentation of the middleware: operations of the ROT
+// and Applet layers, APDU exchanges per INS, status words, 61xx/6Cxx
+// retries, AT+CSIM commands and UART bytes. Off by default; when off each
+// instrumented call costs one relaxed atomic load, so it stays compiled in.
+//
+// Latencies go to log-linear histograms (HDR style): values below
+// SE_HISTOGRAM_SUB_COUNT us are exact, larger ones fall in
+// SE_HISTOGRAM_SUB_COUNT buckets per power of two, 12.5% wide.
+
+// Operations
+#define SE_METRICS_OP_SELECT		0
+#define SE_METRICS_OP_DESELECT		1
+#define SE_METRICS_OP_GET_CERTIFICATE	2
+#define SE_METRICS_OP_GENERATE_RANDOM	3
+#define SE_METRICS_OP_SIGN_INIT		4
+#define SE_METRICS_OP_SIGN_FINAL	5
+#define SE_METRICS_OP_SIGN_DATA		6
+#define SE_METRICS_OP_GENERATE_KEY_PAIR	7
+#define SE_METRICS_OP_PUT_PUBLIC_KEY	8
+#define SE_METRICS_OP_COMPUTE_DH	9
+#define SE_METRICS_OP_COMPUTE_PRF	10
+#define SE_METRICS_OP_COUNT		11
+
+// Counters
+#define SE_METRICS_RETRIES_61XX		0	// GET RESPONSE sent after 61xx
+#define SE_METRICS_RETRIES_6CXX		1	// command sent again after 6Cxx
+#define SE_METRICS_APDU_TIMEOUTS	2	// APDU exchanges past their deadline
+#define SE_METRICS_AT_COMMANDS		3	// AT+CSIM sent
+#define SE_METRICS_AT_ERRORS		4	// AT+CSIM answered ERROR or +CME ERROR
+#define SE_METRICS_UART_BYTES_OUT	5
+#define SE_METRICS_UART_BYTES_IN	6
+#define SE_METRICS_CACHE_HITS		7	// files served by the ROT container cache
+#define SE_METRICS_CACHE_MISSES		8	// files read from the applet with the cache on
+#define SE_METRICS_COUNTER_COUNT	9
+
+#define SE_HISTOGRAM_SUB_BITS		3
+#define SE_HISTOGRAM_SUB_COUNT		(1 << SE_HISTOGRAM_SUB_BITS)
+#define SE_HISTOGRAM_MAX_EXPONENT	31	// up to 2^32 us, larger values in the last bucket
+#define SE_HISTOGRAM_BUCKETS		((SE_HISTOGRAM_MAX_EXPONENT - SE_HISTOGRAM_SUB_BITS + 2) * SE_HISTOGRAM_SUB_COUNT)
+
+#define SE_METRICS_MAX_STATUS_WORDS	64	// distinct status words counted, then otherStatusWords
+
+typedef struct SEHistogramSnapshot {
+	uint64_t count;
+	uint64_t sum;		// us
+	uint64_t max;		// us
+	uint64_t buckets[SE_HISTOGRAM_BUCKETS];
+} SEHistogramSnapshot;
+
+typedef struct SEOperationSnapshot {
+	uint64_t count;
+	uint64_t errors;
+	SEHistogramSnapshot latency;
+} SEOperationSnapshot;
+
+typedef struct SEInsSnapshot {
+	uint8_t ins;
+	uint64_t count;		// APDU exchanges
+	uint64_t errors;	// exchanges the transport failed
+	uint64_t commandBytes;
+	uint64_t responseBytes;	// status words included
+	SEHistogramSnapshot latency;
+} SEInsSnapshot;
+
+typedef struct SEStatusWordCount {
+	uint16_t sw;
+	uint64_t count;
+} SEStatusWordCount;
+
+/**
+ * Copy of the metrics at one time, see seMetricsSnapshot.
+ */
+struct SEMetricsSnapshot {
+	SEOperationSnapshot operations[SE_METRICS_OP_COUNT];
+	std::vector<SEInsSnapshot> ins;			// INS sent at least once, ascending
+	std::vector<SEStatusWordCount> statusWords;	// ascending
+	uint64_t otherStatusWords;	// past SE_METRICS_MAX_STATUS_WORDS distinct ones
+	uint64_t counters[SE_METRICS_COUNTER_COUNT];
+};
+
+extern std::atomic<bool> seMetricsActive;
+
+/**
+ * @return true if the metrics are recorded.
+ */
+static inline bool seMetricsEnabled(void)
+{
+	return seMetricsActive.load(std::memory_order_relaxed);
+}
+
+/**
+ * Start or stop recording. The metrics recorded so far are kept.
+ */
+void seMetricsEnable(bool enable);
+
+/**
+ * Set every metric to zero.
+ */
+void seMetricsReset(void);
+
+/**
+ * Returns the CLOCK_MONOTONIC time in ns
+ */
+uint64_t seMetricsNow(void);
+
+/**
+ * Record an operation, see SEMetricsTimer.
+ */
+void seMetricsRecordOperation(uint8_t operation, uint64_t ns, bool failed);
+
+/**
+ * Record an APDU exchange with the Secure Element.
+ *
+ * @param[in]  ins INS of the command
+ * @param[in]  commandLen length of the command
+ * @param[in]  responseLen length of the response, status word included, 0 if failed
+ * @param[in]  ns duration of the exchange
+ * @param[in]  failed the transport failed
+ */
+void seMetricsRecordApdu(uint8_t ins, uint16_t commandLen, uint16_t responseLen, uint64_t ns, bool failed);
+
+/**
+ * Record a status word.
+ */
+void seMetricsRecordStatusWord(uint16_t sw);
+
+void seMetricsAdd(uint8_t counter, uint64_t n);
+
+/**
+ * Add n to a counter if the metrics are recorded.
+ */
+static inline void seMetricsCount(uint8_t counter, uint64_t n)
+{
+	if (seMetricsEnabled())
+	{
+		seMetricsAdd(counter, n);
+	}
+}
+
+/**
+ * Copy every metric. Counters are read one by one while others may be
+ * recording, a snapshot is not atomic as a whole.
+ */
+void seMetricsSnapshot(SEMetricsSnapshot *snapshot);
+
+/**
+ * Value below which a fraction of the recorded values lie.
+ *
+ * @param[in]  histogram the histogram
+ * @param[in]  quantile from 0 to 1, e.g. 0.99
+ * @return the upper bound in us of the bucket holding that value, 0 if empty.
+ */
+uint64_t seHistogramPercentile(const SEHistogramSnapshot *histogram, double quantile);
+
+/**
+ * Name of an operation, e.g. "sign_init".
+ */
+const char *seMetricsOperationName(uint8_t operation);
+
+/**
+ * Write a snapshot in the Prometheus text exposition format, metrics
+ * prefixed with iotsafe_.
+ *
+ * @return false if writing failed.
+ */
+bool seMetricsWritePrometheus(const SEMetricsSnapshot *snapshot, FILE *f);
+
+/**
+ * Times an operation from construction to destruction, recorded as
+ * failed unless done() was given a success.
+ */
+class SEMetricsTimer
+{
+public:
+	explicit SEMetricsTimer(uint8_t operation) : _operation(operation),
+		_start(seMetricsEnabled() ? seMetricsNow() : 0), _failed(true)
+	{
+	}
+
+	~SEMetricsTimer(void)
+	{
+		if (_start != 0)
+		{
+			seMetricsRecordOperation(_operation, seMetricsNow() - _start, _failed);
+		}
+	}
+
+	/**
+	 * @return result, an ERR_* code, ERR_NOERR for a success.
+	 */
+	int done(int result)
+	{
+		_failed = (result != 0);
+		return result;
+	}
+
+	/**
+	 * @return ok, true for a success.
+	 */
+	bool done(bool ok)
+	{
+		_failed = !ok;
+		return ok;
+	}
+
+	SEMetricsTimer(const SEMetricsTimer &) = delete;
+	SEMetricsTimer &operator=(const SEMetricsTimer &) = delete;
+
+private:
+	uint8_t _operation;
+	uint64_t _start;
+	bool _failed;
+};
+
+#endif /* __SE_METRICS_H__ */
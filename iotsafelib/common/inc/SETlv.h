@@ -0,0 +1,380 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_TLV_H__
+#define __SE_TLV_H__
+
+#include "SEInterface.h"
+
+#define TLV_SHORT_MAX_LEN 0xFF	// one byte length of the ROT command TLVs
+
+/**
+ * Size of a TLV with a one byte length, 0 for an optional one left out
+ * because its value is empty. Usable in constant expressions, e.g. to
+ * size the fixed part of a command at compile time.
+ */
+constexpr uint32_t seTlvSize(uint32_t valueLen)
+{
+	return (valueLen == 0) ? 0 : 2 + valueLen;
+}
+
+/**
+ * Size of a sequence of TLVs with one byte lengths.
+ */
+template <typename... Lens>
+constexpr uint32_t seTlvSize(uint32_t valueLen, Lens... lens)
+{
+	return seTlvSize(valueLen) + seTlvSize(lens...);
+}
+
+/**
+ * Writes the TLVs of a command in a caller buffer. The first error is
+ * kept and stops any further write, so a whole command is built then
+ * checked once with error().
+ */
+class SETlvBuilder {
+public:
+	template <size_t N>
+	explicit SETlvBuilder(uint8_t (&buffer)[N]) : _buffer(buffer), _capacity(N), _len(0), _error(ERR_NOERR)
+	{
+	}
+
+	/**
+	 * Appends a TLV with a one byte length.
+	 *
+	 * @param tag the tag.
+	 * @param value the value, may be nullptr only if empty.
+	 * @param len the length of value, at most TLV_SHORT_MAX_LEN.
+	 */
+	SETlvBuilder& add(uint8_t tag, const uint8_t *value, uint16_t len)
+	{
+		uint8_t *p;
+
+		if (value == nullptr && len > 0)
+		{
+			return fail(ERR_INVALID_PARAMETERS);
+		}
+		if (len > TLV_SHORT_MAX_LEN)
+		{
+			return fail(ERR_INVALID_LENGTH);
+		}
+		p = reserve(2 + len);
+		if (p != nullptr)
+		{
+			p[0] = tag;
+			p[1] = (uint8_t) len;
+			if (len > 0)
+			{
+				memcpy(p + 2, value, len);
+			}
+		}
+		return *this;
+	}
+
+	/**
+	 * Appends a TLV left out when its value is empty.
+	 */
+	SETlvBuilder& addOptional(uint8_t tag, const uint8_t *value, uint16_t len)
+	{
+		return (len == 0) ? *this : add(tag, value, len);
+	}
+
+	/**
+	 * Appends a TLV of a one byte value.
+	 */
+	SETlvBuilder& addUint8(uint8_t tag, uint8_t value)
+	{
+		return add(tag, &value, 1);
+	}
+
+	/**
+	 * Appends a TLV of a big endian two bytes value.
+	 */
+	SETlvBuilder& addUint16(uint8_t tag, uint16_t value)
+	{
+		uint8_t bytes[2] = { (uint8_t) (value >> 8), (uint8_t) value };
+
+		return add(tag, bytes, sizeof(bytes));
+	}
+
+	/**
+	 * Appends a TLV of a big endian four bytes value.
+	 */
+	SETlvBuilder& addUint32(uint8_t tag, uint32_t value)
+	{
+		uint8_t bytes[4] = { (uint8_t) (value >> 24), (uint8_t) (value >> 16), (uint8_t) (value >> 8), (uint8_t) value };
+
+		return add(tag, bytes, sizeof(bytes));
+	}
+
+	/**
+	 * Appends the tag and the BER length of a value sent apart, e.g.
+	 * through command chaining.
+	 *
+	 * @param tag the tag.
+	 * @param len the length of the value, below 2^24.
+	 */
+	SETlvBuilder& addHeader(uint8_t tag, uint32_t len)
+	{
+		uint8_t lenBytes = (len < 0x80) ? 0 : (len < 0x100) ? 1 : (len < 0x10000) ? 2 : 3;
+		uint8_t *p;
+
+		if (len >= 0x1000000)
+		{
+			return fail(ERR_INVALID_LENGTH);
+		}
+		p = reserve(2 + lenBytes);
+		if (p != nullptr)
+		{
+			*p++ = tag;
+			if (lenBytes > 0)
+			{
+				*p++ = 0x80 | lenBytes;
+			}
+			while (lenBytes > 1)
+			{
+				*p++ = (uint8_t) (len >> (8 * --lenBytes));
+			}
+			*p = (uint8_t) len;
+		}
+		return *this;
+	}
+
+	/**
+	 * @return ERR_NOERR, ERR_INVALID_PARAMETERS if a value was nullptr or
+	 *         ERR_INVALID_LENGTH if the command does not fit the buffer.
+	 */
+	int error(void) const
+	{
+		return _error;
+	}
+
+	const uint8_t* data(void) const
+	{
+		return _buffer;
+	}
+
+	uint16_t length(void) const
+	{
+		return _len;
+	}
+
+private:
+	// The one bounds check of the command
+	uint8_t* reserve(uint32_t len)
+	{
+		uint8_t *p;
+
+		if (_error != ERR_NOERR)
+		{
+			return nullptr;
+		}
+		if (len > (uint32_t) (_capacity - _len))
+		{
+			fail(ERR_INVALID_LENGTH);
+			return nullptr;
+		}
+		p = _buffer + _len;
+		_len += (uint16_t) len;
+		return p;
+	}
+
+	SETlvBuilder& fail(int error)
+	{
+		if (_error == ERR_NOERR)
+		{
+			_error = error;
+		}
+		return *this;
+	}
+
+	uint8_t *_buffer;
+	uint16_t _capacity;
+	uint16_t _len;
+	int _error;
+};
+
+/**
+ * One TLV of a response, read in place: value points into the parsed
+ * buffer and stays valid as long as it does.
+ */
+typedef struct SETlvView {
+	uint32_t tag;		// tag bytes, big endian, e.g. 0x9F21 for a two bytes tag
+	const uint8_t *value;	// value, in the parsed buffer
+	uint32_t len;		// length of value
+} SETlvView;
+
+/**
+ * Reads a BER length: one byte below 0x80, else 0x81 to 0x84 followed by
+ * up to four bytes. The indefinite form 0x80 is refused.
+ *
+ * @param p the length bytes.
+ * @param avail the bytes available at p.
+ * @param[out] len the length read.
+ * @return the number of length bytes, 0 if malformed or truncated.
+ */
+static inline uint32_t seTlvReadLength(const uint8_t *p, uint32_t avail, uint32_t *len)
+{
+	uint32_t lenBytes;
+	uint32_t value = 0;
+	uint32_t i;
+
+	if (avail == 0)
+	{
+		return 0;
+	}
+	if (p[0] < 0x80)
+	{
+		*len = p[0];
+		return 1;
+	}
+	lenBytes = p[0] & 0x7F;
+	if (lenBytes == 0 || lenBytes > 4 || lenBytes >= avail)
+	{
+		return 0;
+	}
+	for (i = 1; i <= lenBytes; i++)
+	{
+		value = (value << 8) | p[i];
+	}
+	*len = value;
+	return 1 + lenBytes;
+}
+
+/**
+ * Iterates over the BER-TLVs of a buffer without copying them: tags of up
+ * to three bytes, lengths of up to four, and every value checked to lie
+ * within the buffer. A constructed value is iterated with a reader of its
+ * own, e.g. SETlvReader(tlv).
+ */
+class SETlvReader {
+public:
+	SETlvReader(const uint8_t *data, uint32_t len) : _p(data), _end((data != nullptr) ? data + len : data), _error(data == nullptr && len > 0)
+	{
+	}
+
+	/**
+	 * Reader of the TLVs within the value of a constructed TLV.
+	 */
+	explicit SETlvReader(const SETlvView &tlv) : SETlvReader(tlv.value, tlv.len)
+	{
+	}
+
+	/**
+	 * Reads the next TLV.
+	 *
+	 * @param[out] tlv the TLV read.
+	 * @return false at the end of the buffer or if it is malformed, see
+	 *         error().
+	 */
+	bool next(SETlvView *tlv)
+	{
+		const uint8_t *p = _p;
+		uint32_t avail = (uint32_t) (_end - p);
+		uint32_t tag;
+		uint32_t len;
+
+		if (avail < 2)
+		{
+			return (avail == 0) ? false : fail();
+		}
+		// One byte tag and short length, the TLVs of the IoT SAFE applet.
+		// Read into locals first: stores through tlv may alias the bytes.
+		tag = p[0];
+		len = p[1];
+		if ((tag & 0x1F) != 0x1F && len < 0x80 && len <= avail - 2)
+		{
+			_p = p + 2 + len;
+			tlv->tag = tag;
+			tlv->len = len;
+			tlv->value = p + 2;
+			return true;
+		}
+		return nextLong(tlv, avail);
+	}
+
+	/**
+	 * Reads TLVs up to the next one with the given tag.
+	 *
+	 * @param tag the tag looked for.
+	 * @param[out] tlv the TLV found.
+	 * @return false if not found or the buffer is malformed.
+	 */
+	bool find(uint32_t tag, SETlvView *tlv)
+	{
+		while (next(tlv))
+		{
+			if (tlv->tag == tag)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	 * @return true if a malformed or truncated TLV stopped the reader.
+	 */
+	bool error(void) const
+	{
+		return _error;
+	}
+
+private:
+	// Multiple bytes tag or long form length
+	bool nextLong(SETlvView *tlv, uint32_t avail)
+	{
+		uint32_t tagLen = 1;
+		uint32_t lenBytes;
+		uint32_t tag = _p[0];
+
+		if ((tag & 0x1F) == 0x1F)
+		{
+			// Subsequent tag bytes while bit 8 is set
+			do
+			{
+				if (tagLen == avail || tagLen == 3)
+				{
+					return fail();
+				}
+				tag = (tag << 8) | _p[tagLen];
+			} while (_p[tagLen++] & 0x80);
+		}
+		lenBytes = seTlvReadLength(_p + tagLen, avail - tagLen, &tlv->len);
+		if (lenBytes == 0 || tlv->len > avail - tagLen - lenBytes)
+		{
+			return fail();
+		}
+		tlv->tag = tag;
+		tlv->value = _p + tagLen + lenBytes;
+		_p = tlv->value + tlv->len;
+		return true;
+	}
+
+	bool fail(void)
+	{
+		_error = true;
+		_p = _end;
+		return false;
+	}
+
+	const uint8_t *_p;
+	const uint8_t *_end;
+	bool _error;
+};
+
+#endif
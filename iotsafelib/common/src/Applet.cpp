@@ -16,7 +16,67 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "Applet.h"
+#include "SEMetrics.h"
+
+// State file of selectWarm, one line: magic, version, channel, extended length mode, AID in hex
+#define APPLET_STATE_MAGIC "iotsafe-channel"
+#define APPLET_STATE_VERSION 1
+
+/**
+ * Format an AID in hex for the state file
+ *
+ * @param[out]  hex the string, 2 * APPLET_STATE_AID_LEN + 1 bytes
+ * @return false if the AID is too long to be recorded, true otherwise.
+ */
+static bool formatAid(const uint8_t *aid, uint16_t aidLen, char *hex)
+{
+    if (aidLen > APPLET_STATE_AID_LEN)
+    {
+        return false;
+    }
+    for (uint16_t i = 0; i < aidLen; i++)
+    {
+        snprintf(hex + 2 * i, 3, "%02X", aid[i]);
+    }
+    hex[2 * aidLen] = '\0';
+    return true;
+}
+
+/**
+ * Read the state file of selectWarm, recorded for the applet whose AID is
+ * given in hex
+ *
+ * @param[out]  channel the recorded channel
+ * @param[out]  mode the recorded extended length support, APDU_EXTENDED_*
+ * @return true if the file holds a valid state for the applet, false otherwise.
+ */
+static bool loadState(const char *path, const char *aidHex, uint8_t *channel, uint8_t *mode)
+{
+    char hex[2 * APPLET_STATE_AID_LEN + 1];
+    unsigned int version;
+    unsigned int ch;
+    unsigned int md;
+    FILE *f;
+    bool ok;
+
+    f = fopen(path, "r");
+    if (f == nullptr)
+    {
+        return false;
+    }
+    ok = (fscanf(f, APPLET_STATE_MAGIC " %u %u %u %32s", &version, &ch, &md, hex) == 4);
+    fclose(f);
+    if (!ok || (version != APPLET_STATE_VERSION) || (ch == 0) || (ch >= SE_MAX_CHANNELS) ||
+        (md > APDU_EXTENDED_OFF) || (strcmp(hex, aidHex) != 0))
+    {
+        return false;
+    }
+    *channel = (uint8_t)ch;
+    *mode = (uint8_t)md;
+    return true;
+}
 
 /**
  * Create an instance of Applet and settings its corresponding AID.
@@ -30,13 +90,22 @@ Applet::Applet(const uint8_t *aid, uint16_t aidLen)
     _channel = 0;
     _isBasic = false;
     _isSelected = false;
+    _isAttached = false;
+    _sessionCount = 0;
+    _statePath[0] = '\0';
     _aid = const_cast<uint8_t *>(aid);
     _aidLen = aidLen;
 }
 
 Applet::~Applet(void)
 {
-    if (isSelected())
+    if (isSelected() && (_statePath[0] != '\0'))
+    {
+        // Left open for the next process, see selectWarm
+        closeSessions();
+        saveState();
+    }
+    else if (isSelected())
     {
         deselect();
     }
@@ -54,12 +123,81 @@ void Applet::init(const SEInterface *seiface)
 }
 
 /**
- * Close all the sessions
+ * Close the applet sessions opened through this instance and not
+ * ended yet, if any. Nothing is sent when none is open.
  */
 void Applet::closeSessions()
 {
-    for (uint8_t i = 0; i < 6; i++)
-        (this->_seiface)->transmit(this->_channel, 0x2A, 0x01, i, 0x00);
+    if (_seiface == nullptr)
+    {
+        return;
+    }
+    while (_sessionCount > 0)
+    {
+        _sessionCount--;
+        _seiface->transmit(seClaForChannel(0x00, _channel), _sessionIns[_sessionCount], APPLET_SESSION_CLOSE,
+                           _sessionNumber[_sessionCount], 0x00);
+    }
+}
+
+/**
+ * Close the compute signature sessions 0 to APPLET_SWEEP_SESSIONS - 1
+ * whether they are open or not, best effort, for an applet whose state
+ * is unknown, e.g. after a crash.
+ */
+void Applet::sweepSessions()
+{
+    if (_seiface == nullptr)
+    {
+        return;
+    }
+    closeSessions();
+    for (uint8_t i = 0; i < APPLET_SWEEP_SESSIONS; i++)
+    {
+        _seiface->transmit(seClaForChannel(0x00, _channel), 0x2A, APPLET_SESSION_CLOSE, i, 0x00);
+    }
+}
+
+/**
+ * Returns the number of sessions opened through this instance and not
+ * ended yet
+ */
+uint8_t Applet::getOpenSessions(void)
+{
+    return _sessionCount;
+}
+
+/**
+ * Record a session opened by the init command ins, or ended. Sessions
+ * past APPLET_MAX_SESSIONS are left to sweepSessions.
+ * 
+ * @param[in]  ins INS of the init command of the session
+ * @param[in]  session session number, P2 of the init command
+ * @param[in]  open true once opened, false once ended
+ */
+void Applet::trackSession(uint8_t ins, uint8_t session, bool open)
+{
+    uint8_t i;
+
+    for (i = 0; i < _sessionCount; i++)
+    {
+        if ((_sessionIns[i] == ins) && (_sessionNumber[i] == session))
+        {
+            break;
+        }
+    }
+    if (open && (i == _sessionCount) && (_sessionCount < APPLET_MAX_SESSIONS))
+    {
+        _sessionIns[_sessionCount] = ins;
+        _sessionNumber[_sessionCount] = session;
+        _sessionCount++;
+    }
+    else if (!open && (i < _sessionCount))
+    {
+        _sessionCount--;
+        _sessionIns[i] = _sessionIns[_sessionCount];
+        _sessionNumber[i] = _sessionNumber[_sessionCount];
+    }
 }
 
 /**
@@ -80,8 +218,18 @@ bool Applet::isSelected(void)
  */
 bool Applet::select(bool isBasic /* = true */)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_SELECT);
+
     if (_seiface != nullptr)
     {
+        // MANAGE CHANNEL and SELECT go together
+        SETransaction transaction(_seiface);
+
+        // A new selection starts without sessions
+        _isAttached = false;
+        _sessionCount = 0;
+        _statePath[0] = '\0';
+
         if (isBasic)
         {
             _channel = 0;
@@ -91,7 +239,7 @@ bool Applet::select(bool isBasic /* = true */)
                 {
                     _isSelected = true;
                     _isBasic = true;
-                    return true;
+                    return timer.done(true);
                 }
             }
         }
@@ -102,11 +250,11 @@ bool Applet::select(bool isBasic /* = true */)
             if(_seiface->transmit(0x00, 0x70, 0x00, 0x00, 0x01) == ERR_NOERR) {
                 if(_seiface->getStatusWord() == SW_EXECUTION_OK || ((_seiface->getStatusWord() & 0xFF00) == SW_OK)) {
                     _seiface->getResponse(&_channel);
-                    if(_seiface->transmit(0x00 | _channel, 0xA4, 0x04, 0x00, _aid, _aidLen) == ERR_NOERR) {
+                    if(_seiface->transmit(seClaForChannel(0x00, _channel), 0xA4, 0x04, 0x00, _aid, _aidLen) == ERR_NOERR) {
                         if((_seiface->getStatusWord() == SW_EXECUTION_OK) || ((_seiface->getStatusWord() & 0xFF00) == SW_DATA_AVAILABLE)) {
                             _isSelected = true;
                             _isBasic = false;
-                            return true;
+                            return timer.done(true);
                         }
                     }
                         
@@ -116,7 +264,139 @@ bool Applet::select(bool isBasic /* = true */)
         }
     }
 	
-    return false;
+    return timer.done(false);
+}
+
+/**
+ * Select the applet on a logical channel, reusing the channel recorded
+ * in a state file by a previous process when the applet still answers
+ * on it: one SELECT instead of MANAGE CHANNEL and SELECT. Otherwise
+ * the recorded channel is closed if it is still open, a new one is
+ * selected and recorded.
+ * 
+ * @param[in]  statePath path of the state file, created if needed
+ * @return true in case select was successful, false otherwise.
+ */
+bool Applet::selectWarm(const char *statePath)
+{
+    char aidHex[2 * APPLET_STATE_AID_LEN + 1];
+    uint8_t channel;
+    uint8_t mode;
+
+    if ((_seiface == nullptr) || _isSelected || (statePath == nullptr) ||
+        (strlen(statePath) >= APPLET_STATE_PATH_LEN) || !formatAid(_aid, _aidLen, aidHex))
+    {
+        return false;
+    }
+
+    SETransaction transaction(_seiface);
+
+    if (loadState(statePath, aidHex, &channel, &mode))
+    {
+        // Select the applet again on the recorded channel, which fails if the
+        // channel was closed meanwhile
+        if ((_seiface->transmit(seClaForChannel(0x00, channel), 0xA4, 0x04, 0x00, _aid, _aidLen) == ERR_NOERR) &&
+            ((_seiface->getStatusWord() == SW_EXECUTION_OK) || ((_seiface->getStatusWord() & 0xFF00) == SW_DATA_AVAILABLE) ||
+             ((_seiface->getStatusWord() & 0xFF00) == SW_OK)))
+        {
+            _channel = channel;
+            _isSelected = true;
+            _isBasic = false;
+            _isAttached = false;
+            _sessionCount = 0;
+            if (_seiface->getExtendedLength() == APDU_EXTENDED_AUTO)
+            {
+                _seiface->setExtendedLength(mode);
+            }
+            strcpy(_statePath, statePath);
+            return true;
+        }
+
+        // Stale: close the channel unless the card already did, e.g. after a reset
+        if ((_seiface->getStatusWord() != 0) && (_seiface->getStatusWord() != SW_CHANNEL_NOT_SUPPORTED))
+        {
+            _seiface->transmit(0x00, 0x70, 0x80, channel);
+        }
+    }
+
+    if (!select(false))
+    {
+        remove(statePath);
+        return false;
+    }
+    strcpy(_statePath, statePath);
+    saveState();
+    return true;
+}
+
+/**
+ * Write the channel, the AID and the extended length support to the
+ * state file of selectWarm. The file is written aside then renamed, a
+ * process never reads half a state.
+ * 
+ * @return true in case of success, false otherwise.
+ */
+bool Applet::saveState(void)
+{
+    char aidHex[2 * APPLET_STATE_AID_LEN + 1];
+    char tmp[APPLET_STATE_PATH_LEN + 4];
+    FILE *f;
+    bool ok;
+
+    if ((_statePath[0] == '\0') || (_seiface == nullptr) || !formatAid(_aid, _aidLen, aidHex))
+    {
+        return false;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", _statePath);
+    f = fopen(tmp, "w");
+    if (f == nullptr)
+    {
+        return false;
+    }
+    ok = (fprintf(f, APPLET_STATE_MAGIC " %u %u %u %s\n", APPLET_STATE_VERSION, _channel,
+                  _seiface->getExtendedLength(), aidHex) > 0);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || (rename(tmp, _statePath) != 0))
+    {
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Use a logical channel on which the applet is already selected, e.g.
+ * one leased from an SEChannelPool, without selecting it again.
+ * deselect() then leaves the channel open for its owner.
+ * 
+ * @param[in]  channel the logical channel, 1 to SE_MAX_CHANNELS - 1
+ * @return true in case of success, false if the channel is invalid or
+ *         the applet is already selected.
+ */
+bool Applet::attach(uint8_t channel)
+{
+    if ((_seiface == nullptr) || _isSelected || (channel == 0) || (channel >= SE_MAX_CHANNELS))
+    {
+        return false;
+    }
+    _channel = channel;
+    _isSelected = true;
+    _isBasic = false;
+    _isAttached = true;
+    _sessionCount = 0;
+    _statePath[0] = '\0';
+    return true;
+}
+
+/**
+ * Returns the AID of the applet, e.g. to open an SEChannelPool on it
+ *
+ * @param[out]  aidLen length of the AID
+ */
+const uint8_t *Applet::getAid(uint16_t *aidLen)
+{
+    *aidLen = _aidLen;
+    return _aid;
 }
 
 /**
@@ -127,29 +407,78 @@ bool Applet::select(bool isBasic /* = true */)
  */
 bool Applet::deselect(void)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_DESELECT);
+
     if (_seiface != nullptr)
     {
-        if (_isSelected && !_isBasic)
+        SETransaction transaction(_seiface);
+
+        if (_isSelected && _isAttached)
+        {
+            // The channel belongs to whoever attached it, and goes back without our sessions
+            closeSessions();
+            _isSelected = false;
+            _isAttached = false;
+        }
+        else if (_isSelected && !_isBasic)
         {
             if (_channel != 0)
             {
-                if (_seiface->transmit(_channel, 0x70, 0x80, _channel, 0x00) == ERR_NOERR)
+                if (_seiface->transmit(seClaForChannel(0x00, _channel), 0x70, 0x80, _channel, 0x00) == ERR_NOERR)
                 {
                     if (_seiface->getStatusWord() == SW_EXECUTION_OK)
                     {
+                        // Closing the channel ended its sessions
                         _isSelected = false;
+                        _sessionCount = 0;
+                        if (_statePath[0] != '\0')
+                        {
+                            remove(_statePath);
+                            _statePath[0] = '\0';
+                        }
                     }
                 }
             }
         }
         else if (_isSelected && _isBasic)
         {
+            closeSessions();
             _isSelected = false;
         }
     }
+    timer.done(!_isSelected);
     return _isSelected;
 }
 
+/**
+ * Take the transaction lock of the Secure Element interface, see
+ * SEInterface::lock.
+ * 
+ * @return true once the lock is held, false if no interface is configured.
+ */
+bool Applet::lock(void)
+{
+    if (_seiface != nullptr)
+    {
+        return _seiface->lock();
+    }
+    return false;
+}
+
+/**
+ * Release the transaction lock taken with lock().
+ * 
+ * @return true in case of success, false otherwise.
+ */
+bool Applet::unlock(void)
+{
+    if (_seiface != nullptr)
+    {
+        return _seiface->unlock();
+    }
+    return false;
+}
+
 /**
  * Transmit an APDU case 1 to the applet through the corresponding 
  * channel.
@@ -162,7 +491,7 @@ bool Applet::deselect(void)
  */
 bool Applet::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2) {
 	if(_isSelected) {
-		return (_seiface->transmit(cla | _channel, ins, p1, p2) == ERR_NOERR);
+		return (_seiface->transmit(seClaForChannel(cla, _channel), ins, p1, p2) == ERR_NOERR);
 	}
 	return false;
 }
@@ -180,7 +509,7 @@ bool Applet::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2) {
  */
 bool Applet::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t le) {
 	if(_isSelected) {
-		return (_seiface->transmit(cla | _channel, ins, p1, p2, le) == ERR_NOERR);
+		return (_seiface->transmit(seClaForChannel(cla, _channel), ins, p1, p2, le) == ERR_NOERR);
 	}
 	return false;
 }
@@ -201,7 +530,7 @@ bool Applet::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const ui
 {
     if (_isSelected)
     {
-        return (_seiface->transmit(cla | _channel, ins, p1, p2, data, dataLen) == ERR_NOERR);
+        return (_seiface->transmit(seClaForChannel(cla, _channel), ins, p1, p2, data, dataLen) == ERR_NOERR);
     }
     return false;
 }
@@ -223,11 +552,87 @@ bool Applet::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const ui
 {
     if (_isSelected)
     {
-        return (_seiface->transmit(cla | _channel, ins, p1, p2, data, dataLen, le) == ERR_NOERR);
+        return (_seiface->transmit(seClaForChannel(cla, _channel), ins, p1, p2, data, dataLen, le) == ERR_NOERR);
+    }
+    return false;
+}
+
+/**
+ * Transmit an APDU of any case to the applet through the corresponding 
+ * channel, with extended length encoding when data or le do not fit in
+ * a short APDU (see SEInterface::transmitExtended).
+ * 
+ * @param[in]  cla CLA value for APDU command 
+ * @param[in]  ins INS value for APDU command 
+ * @param[in]  p1 P1 value for APDU command 
+ * @param[in]  p2 P2 value for APDU command 
+ * @param[in]  data pointer to the data buffer for APDU command, nullptr if none
+ * @param[in]  dataLen length of the data buffer
+ * @param[in]  le expected response length up to 65536, 0 if no response data is expected
+ * @return true in case transmit was successful, false otherwise.
+ */
+bool Applet::transmitExtended(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, uint16_t dataLen, uint32_t le)
+{
+    if (_isSelected)
+    {
+        return (_seiface->transmitExtended(seClaForChannel(cla, _channel), ins, p1, p2, data, dataLen, le) == ERR_NOERR);
     }
     return false;
 }
 
+/**
+ * Transmit a payload of any length to the applet through the
+ * corresponding channel as a chain of commands, header followed by data
+ * (see SEInterface::transmitChained).
+ * 
+ * @param[in]  cla CLA value for APDU command 
+ * @param[in]  ins INS value for APDU command 
+ * @param[in]  p1 P1 value for APDU command, that of the last segment
+ * @param[in]  p2 P2 value for APDU command 
+ * @param[in]  header pointer to the first part of the payload, nullptr if none
+ * @param[in]  headerLen length of the first part of the payload
+ * @param[in]  data pointer to the second part of the payload, nullptr if none
+ * @param[in]  dataLen length of the second part of the payload
+ * @param[in]  le expected response length to the last segment, 0 if none
+ * @param[in]  chaining APDU_CHAINING_CLA or APDU_CHAINING_P1
+ * @return zero in case all segments were accepted, ERR_INVALID_RESPONSE
+ *         if one but the last was refused, nonzero otherwise.
+ */
+int Applet::transmitChained(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2,
+        const uint8_t *header, uint16_t headerLen, const uint8_t *data, uint32_t dataLen,
+        uint32_t le, uint8_t chaining)
+{
+    if (!_isSelected)
+    {
+        return ERR_INVALID_OPERATION;
+    }
+    return _seiface->transmitChained(seClaForChannel(cla, _channel), ins, p1, p2, header, headerLen, data, dataLen, le, chaining);
+}
+
+/**
+ * Transmit a batch of commands to the applet as one unit (see
+ * SEInterface::transmitBatch). The channel is set in the CLA of each
+ * command.
+ * 
+ * @param[in, out]  commands the commands, see SEBatchCommand
+ * @param[in]  count number of commands
+ * @param[out]  executed number of commands sent, nullptr if not needed
+ * @return zero in case every command was answered an expected status
+ *         word, ERR_INVALID_RESPONSE on an unexpected one, nonzero otherwise.
+ */
+int Applet::transmitBatch(SEBatchCommand *commands, uint16_t count, uint16_t *executed)
+{
+    if (!_isSelected)
+    {
+        return ERR_INVALID_OPERATION;
+    }
+    for (uint16_t i = 0; (commands != nullptr) && (i < count); i++)
+    {
+        commands[i].cla = seClaForChannel(commands[i].cla, _channel);
+    }
+    return _seiface->transmitBatch(commands, count, executed);
+}
+
 /**
  * Get status word from the data response received after the last 
  * successful transmit
@@ -283,6 +688,25 @@ uint16_t Applet::getResponseLength(void)
     return len;
 }
 
+/**
+ * Get the response received after the last successful transmit without
+ * copying it (see SEInterface::getResponseView). The view is
+ * invalidated by the next transmit.
+ * 
+ * @return a view of the response, empty with sw 0 if there is none.
+ */
+SEResponseView Applet::getResponseView(void)
+{
+    SEResponseView view = { nullptr, 0, 0 };
+
+    if (_isSelected)
+    {
+        view = _seiface->getResponseView();
+    }
+
+    return view;
+}
+
 
 /** C Accessors	***************************************************************/
 
@@ -306,6 +730,10 @@ extern "C" bool Applet_select(Applet* applet, bool is_basic) {
 	return applet->select(is_basic);
 }
 
+extern "C" bool Applet_select_warm(Applet* applet, const char* state_path) {
+	return applet->selectWarm(state_path);
+}
+
 extern "C" bool Applet_deselect(Applet* applet) {
 	return applet->deselect();
 }
@@ -326,6 +754,10 @@ extern "C" bool Applet_transmit_case4(Applet* applet, uint8_t cla, uint8_t ins,
 	return applet->transmit(cla, ins, p1, p2, data, data_len, le);
 }
 
+extern "C" int Applet_transmit_batch(Applet* applet, SEBatchCommand* commands, uint16_t count, uint16_t* executed) {
+	return applet->transmitBatch(commands, count, executed);
+}
+
 extern "C" uint16_t Applet_get_status_word(Applet* applet) {
 	return applet->getStatusWord();
 }
@@ -337,3 +769,7 @@ extern "C" uint16_t Applet_get_response(Applet* applet, uint8_t* data) {
 extern "C" uint16_t Applet_get_response_length(Applet* applet) {
 	return applet->getResponseLength();
 }
+
+extern "C" SEResponseView Applet_get_response_view(Applet* applet) {
+	return applet->getResponseView();
+}
@@ -19,6 +19,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "ROT.h"
+#include "SEMetrics.h"
+#include "SETlv.h"
 
 /** Constants *******************************************************************/
 // AID for IoTSafe Applet
@@ -28,7 +30,16 @@ static uint8_t AID[] = { 0xA0, 0x00, 0x00, 0x00, 0x30, 0x53, 0xF1, 0x24, 0x01, 0
 /**
  * Create an instance of ROT
  */
-ROT::ROT(void) : Applet(AID, sizeof(AID)),_keypairs{} 
+ROT::ROT(void) : Applet(AID, sizeof(AID)),_keypairs{}, _cacheMode(ROT_CACHE_OFF) 
+{
+
+}
+
+/**
+ * Create an instance of ROT for an IoT SAFE applet instance installed
+ * under another AID
+ */
+ROT::ROT(const uint8_t *aid, uint16_t aidLen) : Applet(aid, aidLen),_keypairs{}, _cacheMode(ROT_CACHE_OFF) 
 {
 
 }
@@ -45,50 +56,23 @@ ROT::ROT(void) : Applet(AID, sizeof(AID)),_keypairs{}
 uint16_t  ROT::getFileLength(
 				 const uint8_t *fileId, uint16_t fileIdLen,
 				 const uint8_t *fileLbl, uint16_t fileLblLen){
-    uint8_t data[50];
     uint16_t result = -1;
-    uint16_t cmdLen = fileIdLen + fileLblLen;
-    cmdLen += (fileIdLen > 0) ? 2 : 0;  // tag length
-    cmdLen += (fileLblLen > 0) ? 2 : 0; // tag length
-
-    if (cmdLen > CMD_MAX_LEN)
-    {
-        return ERR_INVALID_PARAMETERS;
-    }
+    uint8_t cmd[CMD_MAX_LEN];
+    SETlvBuilder tlv(cmd);
 
-    uint8_t cmd[CMD_MAX_LEN];     
-    uint16_t index = 0;
-    uint16_t offset = 0;
-    if (fileIdLen > 0)
-    {
-        if (!fileId)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x83;
-        cmd[index++] = (uint8_t)(fileIdLen & 0xFF);
-        memcpy(cmd + index, fileId, fileIdLen);
-        index += fileIdLen;
-    }        
-    if (fileLblLen > 0)
+    tlv.addOptional(0x83, fileId, fileIdLen)
+       .addOptional(0x73, fileLbl, fileLblLen);
+    if (tlv.error() != ERR_NOERR)
     {
-        if (!fileLbl)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x73;
-        cmd[index++] = (uint8_t)(fileLblLen & 0xFF);
-        memcpy(cmd + index, fileLbl, fileLblLen);
-        index += fileLblLen;
+        return -1;
     }
 
-    if (transmit(_channel, 0xCB, 0xC3, 0x00, cmd, cmdLen, 0) &&
+    if (transmit(0x00, 0xCB, 0xC3, 0x00, tlv.data(), tlv.length(), 0) &&
         getStatusWord() == SW_EXECUTION_OK)
     {
-        uint16_t len = getResponse(data); 
-        if(len == 0){
-            return -1;
-        }
+        SEResponseView view = getResponseView();
+        SETlvReader reader(view.data, view.dataLen);
+        SETlvView tlv;
         result = 0;
         //search for tag 20 within the response'
         /**
@@ -100,24 +84,19 @@ uint16_t  ROT::getFileLength(
          *      21 01 XX
          *      20 02 XX YY
         */
-        //starting index is different because some version of applet return C3 while other return the content of C3 only
-        if(data[0] == 0xC3){
-            index = 2;
-        }
-        else{
-            index = 0;
-        }
-        
-        while(result == 0 && index<len){
-            //check if the tag is 0x20
-            if(data[index] == 0x20){
-                //get the length of the file
-                result = (data[index + 2 ]<<8) + data[index + 3];
-            }
-            else{
-                //move the index to the next tag
-                index = index + 2 + data[index+1];
+        //some version of applet return C3 while other return the content of C3 only
+        if (view.dataLen > 0 && view.data[0] == 0xC3)
+        {
+            if (!reader.next(&tlv))
+            {
+                return -1;
             }
+            reader = SETlvReader(tlv);
+        }
+        if (reader.find(0x20, &tlv) && tlv.len == 2)
+        {
+            //get the length of the file
+            result = (tlv.value[0] << 8) | tlv.value[1];
         }
 
         //not found, return 0
@@ -136,6 +115,46 @@ uint16_t  ROT::getFileLength(
 
 }
 
+bool ROT::readCached(const uint8_t *key, uint16_t keyLen,
+                     const uint8_t *fileId, uint16_t fileIdLen,
+                     const uint8_t *fileLbl, uint16_t fileLblLen,
+                     uint8_t **data, uint16_t *dataLen)
+{
+    std::vector<CacheEntry>::iterator entry;
+
+    for (entry = _cache.begin(); entry != _cache.end(); ++entry)
+    {
+        if ((entry->key.size() == keyLen) && (memcmp(entry->key.data(), key, keyLen) == 0))
+        {
+            break;
+        }
+    }
+    if (entry == _cache.end())
+    {
+        seMetricsCount(SE_METRICS_CACHE_MISSES, 1);
+        return false;
+    }
+
+    // The applet still holds a file of the same length, the terminating NUL aside
+    if ((_cacheMode == ROT_CACHE_REVALIDATE) &&
+        (getFileLength(fileId, fileIdLen, fileLbl, fileLblLen) != entry->data.size() - 1))
+    {
+        _cache.erase(entry);
+        seMetricsCount(SE_METRICS_CACHE_MISSES, 1);
+        return false;
+    }
+
+    *data = (uint8_t *)malloc(entry->data.size());
+    if (*data == nullptr)
+    {
+        return false;
+    }
+    memcpy(*data, entry->data.data(), entry->data.size());
+    *dataLen = (uint16_t)entry->data.size();
+    seMetricsCount(SE_METRICS_CACHE_HITS, 1);
+    return true;
+}
+
 int ROT::readFile(const uint8_t *path, uint16_t pathLen,
                   const uint8_t *fileId, uint16_t fileIdLen,
                   const uint8_t *fileLbl, uint16_t fileLblLen,
@@ -151,44 +170,28 @@ int ROT::readFile(const uint8_t *path, uint16_t pathLen,
         return ERR_INVALID_PARAMETERS;
     }
 
-    if (transmit(_channel, 0xA4, 0x04, 0x00, path, pathLen) &&
-        getStatusWord() == SW_EXECUTION_OK)
+    uint8_t cmd[CMD_MAX_LEN];
+    SETlvBuilder tlv(cmd);
+    tlv.addOptional(0x83, fileId, fileIdLen)
+       .addOptional(0x73, fileLbl, fileLblLen);
+    if (tlv.error() != ERR_NOERR)
     {
-	uint16_t offset = 0;
-        uint8_t toread;
+        return ERR_INVALID_PARAMETERS;
+    }
 
-        uint16_t cmdLen = fileIdLen + fileLblLen;
-        cmdLen += (fileIdLen > 0) ? 2 : 0;  // tag length
-        cmdLen += (fileLblLen > 0) ? 2 : 0; // tag length
+    // SELECT, then READ BINARY until the whole file is read
+    SETransaction transaction(_seiface);
+    bool cacheable = (_cacheMode != ROT_CACHE_OFF) && (*dataLen == 0);
 
-        if (cmdLen > CMD_MAX_LEN)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        uint8_t cmd[CMD_MAX_LEN];
-        uint16_t index = 0;
-        if (fileIdLen > 0)
-        {
-            if (!fileId)
-            {
-                return ERR_INVALID_PARAMETERS;
-            }
-            cmd[index++] = 0x83;
-            cmd[index++] = (uint8_t)(fileIdLen & 0xFF);
-            memcpy(cmd + index, fileId, fileIdLen);
-            index += fileIdLen;
-        }
-        if (fileLblLen > 0)
-        {
-            if (!fileLbl)
-            {
-                return ERR_INVALID_PARAMETERS;
-            }
-            cmd[index++] = 0x73;
-            cmd[index++] = (uint8_t)(fileLblLen & 0xFF);
-            memcpy(cmd + index, fileLbl, fileLblLen);
-            index += fileLblLen;
-        }
+    if (cacheable && readCached(tlv.data(), tlv.length(), fileId, fileIdLen, fileLbl, fileLblLen, data, dataLen))
+    {
+        return ERR_NOERR;
+    }
+
+    if (transmit(0x00, 0xA4, 0x04, 0x00, path, pathLen) &&
+        getStatusWord() == SW_EXECUTION_OK)
+    {
+	uint16_t offset = 0;
 
         //if length is not specified, read the length infortmation of the file
         if(*dataLen == 0){
@@ -216,14 +219,22 @@ int ROT::readFile(const uint8_t *path, uint16_t pathLen,
             p0 = offset >> 8;
             p1 = offset & 0xFF;
 
-            if (cmdLen > CMD_MAX_LEN) {
-                return ERR_INVALID_PARAMETERS;
-            }
-
-            if (transmit(_channel, 0xB0, p0, p1, cmd, cmdLen, 0) &&
+            // Ask for the rest of the file at once: with extended length a
+            // certificate comes in one round trip, else 256 bytes at a time
+            if (transmitExtended(0x00, 0xB0, p0, p1, tlv.data(), tlv.length(), *dataLen - offset) &&
                 getStatusWord() == SW_EXECUTION_OK)
             {
-                uint16_t len = getResponse(&(*data)[offset]); 
+                SEResponseView view = getResponseView();
+                uint16_t len = view.dataLen;
+                // More than asked for would overrun the buffer
+                if (len > *dataLen - offset)
+                {
+                    len = *dataLen - offset;
+                }
+                if (len > 0)
+                {
+                    memcpy(&(*data)[offset], view.data, len);
+                }
                 offset += len;
                 result = ERR_NOERR;
                 if (len == 0)
@@ -242,6 +253,16 @@ int ROT::readFile(const uint8_t *path, uint16_t pathLen,
         {
             // Succeed
             (*data)[offset] = '\0';
+            if (cacheable && (offset == *dataLen))
+            {
+                if (_cache.size() == ROT_CACHE_MAX_ENTRIES)
+                {
+                    _cache.erase(_cache.begin());
+                }
+                _cache.push_back(CacheEntry());
+                _cache.back().key.assign(tlv.data(), tlv.data() + tlv.length());
+                _cache.back().data.assign(*data, *data + offset + 1);
+            }
             *dataLen += 1;
         }
         else if (*data != nullptr)
@@ -261,11 +282,15 @@ int ROT::getRandom(uint8_t *data, uint16_t dataLen)
         return ERR_INVALID_PARAMETERS;
     }
 
-    if ((transmit(_channel, 0x84, 0x00, 0x00, dataLen) == true) &&
-        (getStatusWord() == SW_EXECUTION_OK || getStatusWord() == SW_NO_INFOMATION_GIVEN) &&
-        (getResponse(data) == dataLen))
+    if (transmit(0x00, 0x84, 0x00, 0x00, dataLen) == true)
     {
-        return ERR_NOERR;
+        SEResponseView view = getResponseView();
+        if ((view.sw == SW_EXECUTION_OK || view.sw == SW_NO_INFOMATION_GIVEN) &&
+            view.dataLen == dataLen)
+        {
+            memcpy(data, view.data, dataLen);
+            return ERR_NOERR;
+        }
     }
     return result;
 }
@@ -278,84 +303,55 @@ int ROT::generateKeypair(const uint8_t *keyId, uint16_t keyIdLen,
 {
     int result = ERR_GENERIC;
     // Construct command
-    uint16_t cmdLen = keyIdLen + keyLblLen;
-    cmdLen += (keyIdLen > 0) ? 2 : 0;  // + tag length
-    cmdLen += (keyLblLen > 0) ? 2 : 0; // + tag length
-    if (cmdLen > CMD_MAX_LEN)
-    {
-        return ERR_INVALID_PARAMETERS;
-    }
     uint8_t cmd[CMD_MAX_LEN];
-    uint16_t index = 0;
-    if (keyIdLen > 0)
-    {
-        if (!keyId)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x84;
-        cmd[index++] = keyIdLen;
-        memcpy(cmd + index, keyId, keyIdLen);
-        index += keyIdLen;
-    }
-    if (keyLblLen > 0)
+    SETlvBuilder tlv(cmd);
+    tlv.addOptional(0x84, keyId, keyIdLen)
+       .addOptional(0x74, keyLbl, keyLblLen);
+    if (tlv.error() != ERR_NOERR)
     {
-        if (!keyLbl)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x74;
-        cmd[index++] = keyLblLen;
-        memcpy(cmd + index, keyLbl, keyLblLen);
-        index += keyLblLen;
-    }
-
-    if (cmdLen > CMD_MAX_LEN) {
         return ERR_INVALID_PARAMETERS;
     }
-    
+
     // Send command
-    if (transmit(_channel, 0xB9, 0x00, 0x00, cmd, cmdLen, 0x00) &&
+    if (transmit(0x00, 0xB9, 0x00, 0x00, tlv.data(), tlv.length(), 0x00) &&
         getStatusWord() == SW_EXECUTION_OK)
     {
-        uint16_t dataLen = getResponseLength();
-        uint8_t *data = (uint8_t *)malloc(dataLen * sizeof(uint8_t));
-        if (data == nullptr) 
-        {
-            return ERR_OUT_OF_MEMORY;
-        }
-        getResponse(data);
-        uint16_t index = 0;
-        // Get private key ID
-        if (data[index++] == 0x84)
-        {
-            *privKeyIdLen = data[index++];
-            memcpy(privKeyId, data + index, *privKeyIdLen);
-            index += *privKeyIdLen;
-        }
-        // Get public key ID
-        if (data[index++] == 0x85)
+        // Parsed in place: private key ID, public key ID and public key data
+        SEResponseView view = getResponseView();
+        SETlvReader reader(view.data, view.dataLen);
+        SETlvView tlv;
+        if (view.dataLen == 0)
         {
-            *pubKeyIdLen = data[index++];
-            memcpy(pubKeyId, data + index, *pubKeyIdLen);
-            index += *pubKeyIdLen;
+            return ERR_INVALID_RESPONSE;
         }
-        // Get public key data
-        if (data[index++] == 0x34)
+        while (reader.next(&tlv))
         {
-            *pubKeyDataLen = data[index++];
-            if (*pubKeyDataLen != 0x45)
+            // Values larger than the key pair buffers are refused, other tags skipped
+            if ((tlv.tag == 0x84 || tlv.tag == 0x85) && tlv.len > MAX_CONTAINER_ID_LEN)
             {
-                result = ERR_INVALID_RESPONSE;
+                return ERR_INVALID_RESPONSE;
+            }
+            if (tlv.tag == 0x84)
+            {
+                memcpy(privKeyId, tlv.value, tlv.len);
+                *privKeyIdLen = tlv.len;
+            }
+            else if (tlv.tag == 0x85)
+            {
+                memcpy(pubKeyId, tlv.value, tlv.len);
+                *pubKeyIdLen = tlv.len;
+            }
+            else if (tlv.tag == 0x34)
+            {
+                if (tlv.len != ECC_PUBLIC_KEY_LEN)
+                {
+                    return ERR_INVALID_RESPONSE;
+                }
+                memcpy(pubKeyData, tlv.value, tlv.len);
+                *pubKeyDataLen = tlv.len;
             }
-            memcpy(pubKeyData, data + index, *pubKeyDataLen);
-            index += *pubKeyDataLen;
-        }
-        if (data)
-        {
-            free(data);
         }
-        result = ERR_NOERR;
+        result = reader.error() ? ERR_INVALID_RESPONSE : ERR_NOERR;
     }
     return result;
 }
@@ -366,62 +362,27 @@ int ROT::computeSignatureInit(const uint8_t *keyId, uint16_t keyIdLen,
                               uint8_t operationMode, uint16_t hashAlgo, uint8_t signAlgo)
 {
     int result = ERR_GENERIC;
-    // Construct command
-    uint16_t cmdLen = keyIdLen + keyLblLen + 3 + 4 + 3; // 3 for TLV tag and len
-    cmdLen += (keyIdLen > 0) ? 2 : 0;                   // + tag length
-    cmdLen += (keyLblLen > 0) ? 2 : 0;                  // + tag length
-    if (cmdLen > CMD_MAX_LEN)
-    {
-        return ERR_INVALID_LENGTH;
-    }
+    // Construct command: key, then mode of operation, hash and signature
+    // algorithms; a key id or label too long for the command fails below
     uint8_t cmd[CMD_MAX_LEN];
-    uint16_t index = 0;
-    if (keyIdLen > 0)
+    SETlvBuilder tlv(cmd);
+    tlv.addOptional(0x84, keyId, keyIdLen)
+       .addOptional(0x74, keyLbl, keyLblLen)
+       .addUint8(0xA1, operationMode)
+       .addUint16(0x91, hashAlgo)
+       .addUint8(0x92, signAlgo);
+    if (tlv.error() != ERR_NOERR)
     {
-        if (!keyId)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x84;
-        cmd[index++] = keyIdLen;
-        memcpy(cmd + index, keyId, keyIdLen);
-        index += keyIdLen;
-    }
-    if (keyLblLen > 0)
-    {
-        if (!keyLbl)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x74;
-        cmd[index++] = keyLblLen;
-        memcpy(cmd + index, keyLbl, keyLblLen);
-        index += keyLblLen;
-    }
-    //// mode of operation
-    cmd[index++] = 0xA1;
-    cmd[index++] = 0x01;
-    cmd[index++] = operationMode;
-    //// hash algorithm
-    cmd[index++] = 0x91;
-    cmd[index++] = 0x02;
-    cmd[index++] = (uint8_t)(hashAlgo >> 8);
-    cmd[index++] = (uint8_t)(hashAlgo & 0xFF);
-    //// signature algorithm
-    cmd[index++] = 0x92;
-    cmd[index++] = 0x01;
-    cmd[index++] = signAlgo;
-
-    if (cmdLen > CMD_MAX_LEN) {
-        return ERR_INVALID_PARAMETERS;
+        return tlv.error();
     }
 
     //TODO:Check
     // Send command
-    if (transmit(_channel, 0x2A, 0x00, 0x00, cmd, cmdLen))
+    if (transmit(0x00, 0x2A, 0x00, 0x00, tlv.data(), tlv.length()))
     {
         if (getStatusWord() == SW_EXECUTION_OK)
         {
+            trackSession(0x2A, 0x00, true);
             result = ERR_NOERR;
         }
         else
@@ -432,70 +393,26 @@ int ROT::computeSignatureInit(const uint8_t *keyId, uint16_t keyIdLen,
     return result;
 }
 
-uint32_t constructTlvLength(uint8_t *tlv, uint32_t valLen)
+// DER INTEGER of an unsigned big endian value: minimal, positive, at
+// most ECC_MAX_SCALAR_LEN bytes. Only returns the encoded size if der is null
+static uint16_t derInteger(uint8_t *der, const uint8_t *value, uint32_t len)
 {
-    uint32_t lenBytesToCopy = 0;
-    if (tlv == nullptr)
-    {
-        // Error: null pointer
-        return lenBytesToCopy;
-    }
-    if (valLen < 0x80)
-    {
-        tlv[0] = (uint8_t)valLen;
-        lenBytesToCopy = 1;
-    }
-    else if (valLen < 0x100)
-    {
-        tlv[0] = 0x81;
-        tlv[1] = (uint8_t)valLen;
-        lenBytesToCopy = 2;
-    }
-    else if (valLen < 0x10000)
-    {
-        tlv[0] = 0x82;
-        tlv[1] = (uint8_t)(valLen / 0x100);
-        tlv[2] = (uint8_t)(valLen % 0x100);
-        lenBytesToCopy = 3;
-    }
-    else if (valLen < 0x1000000)
-    {
-        tlv[0] = 0x83;
-        tlv[1] = (uint8_t)(valLen / 0x10000);
-        tlv[2] = (uint8_t)(valLen / 0x100);
-        tlv[3] = (uint8_t)(valLen % 0x100);
-        lenBytesToCopy = 4;
-    }
-    return lenBytesToCopy;
-}
+    uint16_t index = 0;
 
-uint32_t tlvParserLength(uint8_t* tlv, uint32_t* length) {
-    uint32_t numOfBytes = 1;
-    uint32_t numOfEncodingBytes = 1;
-    
-    if ((*tlv) == 0x80) {
-        // Unknown length
-        *length = 0;
-        return numOfBytes;
+    while (len > 1 && value[0] == 0x00 && (value[1] & 0x80) == 0) {
+        value++;
+        len--;
     }
-    
-    if (((*tlv) & 0x80) != 0) {
-        // First bit of byte 1 is on, the total encoding bytes is the diff with 0x80
-        numOfEncodingBytes = ((*tlv) - 0x80);
-        numOfBytes = numOfEncodingBytes + 1; // Adding the first byte
-        tlv = &(tlv[1]);
+    if (der == nullptr) {
+        return 2 + len + (value[0] >> 7);
     }
-
-    // Big-endian encoding assumed (though not specifically documented in ISO)
-    uint32_t ret = 0;
-    uint32_t curByte = 0;
-    for (; curByte < numOfEncodingBytes; curByte++) {
-        ret = (ret << 8) + tlv[curByte];
+    der[index++] = 0x02;
+    der[index++] = len + (value[0] >> 7);
+    if (value[0] & 0x80) {
+        der[index++] = 0x00;
     }
-    
-    // Return
-    *length = ret;
-    return numOfBytes;
+    memcpy(der + index, value, len);
+    return index + len;
 }
 
 //TODO:Check
@@ -507,124 +424,84 @@ int ROT::computeSignatureUpdate(uint8_t operationMode,
 {
     int result = ERR_GENERIC;
     uint8_t cmd[CMD_MAX_LEN];
-    uint8_t response[512];
+    SETlvBuilder tlv(cmd);
     uint16_t index = 0;
+    const uint8_t *text = nullptr;
+    uint32_t textLen = 0;
 
-    if (data == nullptr) 
+    if (data == nullptr || sign == nullptr || signLen == nullptr) 
     {
         return ERR_INVALID_PARAMETERS;
     }
 
     if (operationMode == OPERATION_MODE_FULL_TEXT) {
-        // Construct command 
-        cmd[index++] = 0x9B;
-        int tlvLength = constructTlvLength(cmd + index, dataLen);
-        index += tlvLength;
-        // first command length if the command cannot fit into one command
-        bool isSingleCmd = false;
-        int firstCmdLen = CMD_MAX_LEN - tlvLength - 1;  
-        if (dataLen < firstCmdLen) {
-            isSingleCmd = true;
-            firstCmdLen = dataLen + 2;  //frist command length if one command can done
-        }
-        memcpy(cmd+index, data, firstCmdLen);
-        uint32_t dataOffset = firstCmdLen;
-        if (!isSingleCmd) {
-            // multi command process
-            while (dataOffset < dataLen) {
-                memcpy(cmd, data + dataOffset, CMD_MAX_LEN);
-                if(transmit(0x00, 0x2B, 0x00, 0x00, cmd, CMD_MAX_LEN, 0x00)) {
-                    if(getStatusWord() != 0x9000) {
-                        return ERR_INVALID_RESPONSE;
-                    }
-                }
-                dataOffset += CMD_MAX_LEN;
-            }
-            // Last command
-            index = dataLen - dataOffset;
-            memcpy(cmd, data + dataOffset, index);
-        } else {
-            index = dataLen + 2;  // command length 
-        }
+        // Construct command header, the data follows it through chaining
+        tlv.addHeader(0x9B, dataLen);
+        text = data;
+        textLen = dataLen;
     } else if (operationMode == OPERATION_MODE_LAST_BLOCK) {
-        if (intermediateHash == nullptr) 
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-	// Construct command 
-        //// Last block to hash
-        cmd[index++] = 0x9A;
-        if (dataLen > 0x80) {
-            return ERR_INVALID_LENGTH;
-        }
-        cmd[index++] = dataLen;
-        memcpy(cmd+index, data, dataLen);
-        index += dataLen;
-        //// Intermediate hash
-        cmd[index++] = 0x9C;
-        if (intermediateHashLen < 0x20 || intermediateHashLen > 0x40) {
+        if (dataLen > 0x80 || intermediateHashLen < 0x20 || intermediateHashLen > 0x40) {
             return ERR_INVALID_LENGTH;
         }
-        cmd[index++] = intermediateHashLen;
-        memcpy(cmd+index, intermediateHash, intermediateHashLen);
-        index += intermediateHashLen;
-        //// Number of bytes already hashed
-        cmd[index++] = 0x9D;
-        cmd[index++] = 0x04;
-        cmd[index++] = (uint8_t) (hashedBytes >> 24);
-        cmd[index++] = (uint8_t) (hashedBytes >> 16);
-        cmd[index++] = (uint8_t) (hashedBytes >> 8);
-        cmd[index++] = (uint8_t) (hashedBytes & 0xFF);
+        // Last block to hash, intermediate hash and number of bytes already hashed
+        tlv.add(0x9A, data, dataLen)
+           .add(0x9C, intermediateHash, intermediateHashLen)
+           .addUint32(0x9D, hashedBytes);
     } else if (operationMode == OPERATION_MODE_PADDING) {
-        // Construct command 
-        cmd[index++] = 0x9E;
         if (dataLen > 0x40) {
             return ERR_INVALID_LENGTH;
         }
-        cmd[index++] = dataLen;
-        memcpy(cmd+index, data, dataLen);
-        index += dataLen;
+        tlv.add(0x9E, data, dataLen);
     } else {
         return ERR_INVALID_OPERATION;
     }
+    if (tlv.error() != ERR_NOERR) {
+        return tlv.error();
+    }
 
-    // Send command
-    if(transmit(0x00, 0x2B, 0x80, 0x00, cmd, index, 0x00)) {
-        if(getStatusWord() == 0x9000) {
-            uint16_t responseLength = getResponse(response);
+    // Send command, chained when the text does not fit in one APDU
+    if (transmitChained(0x00, 0x2B, 0x80, 0x00, tlv.data(), tlv.length(), text, textLen, 256, APDU_CHAINING_P1) == ERR_NOERR) {
+        // The signature is parsed in place, straight into the DER output
+        SEResponseView view = getResponseView();
+        if(view.sw == SW_EXECUTION_OK) {
+            // The last update ends the session
+            trackSession(0x2A, 0x00, false);
             uint32_t length = 0;
-            if (response[0] != 0x33) {
+            if (view.dataLen < 2 || view.data[0] != 0x33) {
                 return ERR_INVALID_RESPONSE;
             }
+            const uint8_t *tlvLength = view.data + 1;
+            uint32_t avail = view.dataLen - 1;
             //handle leading 0
-            if(response[1] == 0x00){
-                //move the remaining data to the front
-                memcpy((response + 1),(response + 2),responseLength-2);
+            if (tlvLength[0] == 0x00) {
+                tlvLength++;
+                avail--;
+            }
+
+            // r then s, of the same length
+            uint32_t numOfBytes = seTlvReadLength(tlvLength, avail, &length);
+            if (numOfBytes == 0 || length > avail - numOfBytes || length == 0 || (length & 1) != 0 ||
+                length / 2 > ECC_MAX_SCALAR_LEN) {
+                return ERR_INVALID_RESPONSE;
+            }
+            const uint8_t* respSign = tlvLength + numOfBytes;
+
+            // SEQUENCE of r and s, in long form beyond 127 bytes (P-521);
+            // *signLen is the capacity of sign until it holds the DER size
+            uint16_t seqLen = derInteger(nullptr, respSign, length / 2) +
+                              derInteger(nullptr, respSign + length / 2, length / 2);
+            if ((seqLen < 0x80 ? 2 : 3) + seqLen > *signLen) {
+                return ERR_INVALID_LENGTH;
             }
 
-            uint8_t numOfBytes = tlvParserLength(response + 1, &length);
-            uint8_t* respSign = response + 1 + numOfBytes;
-            
             index = 0;
             sign[index++] = 0x30;
-            index++;  // length of remaining data
-            sign[index++] = 0x02;
-            sign[index++] = length / 2; // length of r
-            if (respSign[0] & 0x80) {
-                sign[index - 1] += 1;   // length of r
-                sign[index++] = 0x00;
+            if (seqLen >= 0x80) {
+                sign[index++] = 0x81;
             }
-            memcpy(sign+index, respSign, length / 2);
-            index += length / 2;
-            sign[index++] = 0x02;
-            sign[index++] = length / 2; // length of s
-            if (respSign[length / 2] & 0x80) {
-                sign[index - 1] += 1;   // length of s
-                sign[index++] = 0x00;
-            }
-            memcpy(sign+index, respSign + length / 2, length / 2);
-            index += length / 2;
-            sign[1] = index - 2;   // length of remaining data
+            sign[index++] = seqLen;
+            index += derInteger(sign + index, respSign, length / 2);                // r
+            index += derInteger(sign + index, respSign + length / 2, length / 2);   // s
             *signLen = index;
             result = ERR_NOERR;
         }
@@ -640,64 +517,25 @@ int ROT::computeDH(const uint8_t *privKeyId, uint16_t privKeyIdLen,
 {
     bool result = ERR_INVALID_RESPONSE;
     uint8_t cmd[CMD_MAX_LEN];
-    uint16_t index = 0;
-
-    if (privKeyIdLen > 0)
-    {
-        if (!privKeyId)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x84;
-        cmd[index++] = privKeyIdLen;
-        memcpy(cmd + index, privKeyId, privKeyIdLen);
-        index += privKeyIdLen;
-    }
-    if (pubKeyIdLen > 0)
-    {
-        if (!pubKeyId)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x85;
-        cmd[index++] = pubKeyIdLen;
-        memcpy(cmd + index, pubKeyId, pubKeyIdLen);
-        index += pubKeyIdLen;
-    }
-    if (privLblLen > 0)
-    {
-        if (!privLbl)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x74;
-        cmd[index++] = privLblLen;
-        memcpy(cmd + index, privLbl, privLblLen);
-        index += privLblLen;
-    }
-    if (pubLblLen > 0)
-    {
-        if (!pubLbl)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x75;
-        cmd[index++] = pubLblLen;
-        memcpy(cmd + index, pubLbl, pubLblLen);
-        index += pubLblLen;
-    }
+    SETlvBuilder tlv(cmd);
 
-    if (index > CMD_MAX_LEN) {
+    tlv.addOptional(0x84, privKeyId, privKeyIdLen)
+       .addOptional(0x85, pubKeyId, pubKeyIdLen)
+       .addOptional(0x74, privLbl, privLblLen)
+       .addOptional(0x75, pubLbl, pubLblLen);
+    if (tlv.error() != ERR_NOERR) {
         return ERR_INVALID_PARAMETERS;
     }
 
     // Send command
-    if (transmit(_channel, 0x46, 0x00, 0x00, cmd, index, 0x00) &&
+    if (transmit(0x00, 0x46, 0x00, 0x00, tlv.data(), tlv.length(), 0x00) &&
         getStatusWord() == SW_EXECUTION_OK)
     {
-        *sharedSecretLen = getResponse(sharedSecret);
+        SEResponseView view = getResponseView();
+        *sharedSecretLen = view.dataLen;
         if (*sharedSecretLen > 0)
         {
+            memcpy(sharedSecret, view.data, view.dataLen);
             return ERR_NOERR;
         }
     }
@@ -715,73 +553,27 @@ int ROT::computePRF(uint8_t mode,
 {
     bool result = ERR_INVALID_RESPONSE;
     uint8_t cmd[CMD_MAX_LEN];
-    uint16_t index = 0;
-
-    if (secretIdLen > 0)
-    {
-        if (!secretId)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x86;
-        cmd[index++] = secretIdLen;
-        memcpy(cmd + index, secretId, secretIdLen);
-        index += secretIdLen;
-    }
-    if (secretLblLen > 0)
-    {
-        if (!secretLbl)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x76;
-        cmd[index++] = secretLblLen;
-        memcpy(cmd + index, secretLbl, secretLblLen);
-        index += secretLblLen;
-    }
-    if (secretLen > 0)
-    {
-        if (!secret)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0xD1;
-        cmd[index++] = secretLen;
-        memcpy(cmd + index, secret, secretLen);
-        index += secretLen;
-    }
-    if (pmsLen > 0)
-    {
-        if (!pms)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0xD4;
-        cmd[index++] = pmsLen;
-        memcpy(cmd + index, pms, pmsLen);
-        index += pmsLen;
-    }
-    // Construct lable and seed
-    cmd[index++] = 0xD2;
-    cmd[index++] = lblSeedLen;
-    memcpy(cmd + index, lblSeed, lblSeedLen);
-    index += lblSeedLen;
-    // construct pseudo random length
-    cmd[index++] = 0xD3;
-    cmd[index++] = 0x01;
-    cmd[index++] = pRandomLen;
-
-    if (index > CMD_MAX_LEN) {
+    SETlvBuilder tlv(cmd);
+
+    // Secret, then label and seed and the pseudo random length
+    tlv.addOptional(0x86, secretId, secretIdLen)
+       .addOptional(0x76, secretLbl, secretLblLen)
+       .addOptional(0xD1, secret, secretLen)
+       .addOptional(0xD4, pms, pmsLen)
+       .add(0xD2, lblSeed, lblSeedLen)
+       .addUint8(0xD3, (uint8_t) pRandomLen);
+    if (tlv.error() != ERR_NOERR) {
         return ERR_INVALID_PARAMETERS;
     }
 
     // Send command
-    if (transmit(_channel, 0x48, mode, 0x00, cmd, index, 0x00) &&
+    if (transmit(0x00, 0x48, mode, 0x00, tlv.data(), tlv.length(), 0x00) &&
         getStatusWord() == SW_EXECUTION_OK)
     {
-        int length = getResponse(pRandom);
-        if (length == pRandomLen)
+        SEResponseView view = getResponseView();
+        if (view.dataLen == pRandomLen)
         {
+            memcpy(pRandom, view.data, pRandomLen);
             return ERR_NOERR;
         }
     }
@@ -794,39 +586,19 @@ int ROT::putPublicKeyInit(const uint8_t *pubKeyId, uint16_t pubKeyIdLen,
 {
     bool result = ERR_INVALID_RESPONSE;
     uint8_t cmd[CMD_MAX_LEN];
-    uint16_t index = 0;
-
-    if (pubKeyIdLen > 0)
-    {
-        if (!pubKeyId)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x85;
-        cmd[index++] = pubKeyIdLen;
-        memcpy(cmd + index, pubKeyId, pubKeyIdLen);
-        index += pubKeyIdLen;
-    }
-    if (pubKeyLblLen > 0)
-    {
-        if (!pubKeyLbl)
-        {
-            return ERR_INVALID_PARAMETERS;
-        }
-        cmd[index++] = 0x75;
-        cmd[index++] = pubKeyLblLen;
-        memcpy(cmd + index, pubKeyLbl, pubKeyLblLen);
-        index += pubKeyLblLen;
-    }
+    SETlvBuilder tlv(cmd);
 
-    if (index > CMD_MAX_LEN) {
+    tlv.addOptional(0x85, pubKeyId, pubKeyIdLen)
+       .addOptional(0x75, pubKeyLbl, pubKeyLblLen);
+    if (tlv.error() != ERR_NOERR) {
         return ERR_INVALID_PARAMETERS;
     }
 
     // Send command
-    if (transmit(_channel, 0x24, 0x00, 0x00, cmd, index, 0x00) &&
+    if (transmit(0x00, 0x24, 0x00, 0x00, tlv.data(), tlv.length(), 0x00) &&
         getStatusWord() == SW_EXECUTION_OK)
     {
+        trackSession(0x24, 0x00, true);
         return ERR_NOERR;
     }
 
@@ -835,61 +607,24 @@ int ROT::putPublicKeyInit(const uint8_t *pubKeyId, uint16_t pubKeyIdLen,
 
 int ROT::putPublicKeyUpdate(const uint8_t *pubKey, uint16_t pubKeyLen)
 {
-    bool result = ERR_INVALID_RESPONSE;
-    uint8_t cmd[CMD_MAX_LEN];
-    uint16_t index = 0;
+    int result = ERR_INVALID_RESPONSE;
+    uint8_t cmd[4];
+    SETlvBuilder tlv(cmd);
     // Null pointer checking
     if (!pubKey)
     {
         return ERR_INVALID_PARAMETERS;
     }
 
-    // Construct command
-    cmd[index++] = 0x34;
-    uint32_t tlvLength = constructTlvLength(cmd + index, pubKeyLen);
-    index += tlvLength;
-    // first command length if the command cannot fit into one command
-    bool isSingleCmd = false;
-    int firstCmdLen = CMD_MAX_LEN - tlvLength - 1;
-    if (pubKeyLen < firstCmdLen)
-    {
-        isSingleCmd = true;
-        firstCmdLen = pubKeyLen + 2; //first command length if one command can done
-    }
-    memcpy(cmd + index, pubKey, firstCmdLen);
-    uint32_t dataOffset = firstCmdLen;
-    if (!isSingleCmd)
-    {
-        // multi command process
-        while (dataOffset < pubKeyLen)
-        {
-            memcpy(cmd, pubKey + dataOffset, CMD_MAX_LEN);
-            if (transmit(_channel, 0xD8, 0x00, 0x00, cmd, CMD_MAX_LEN, 0x00))
-            {
-                if (getStatusWord() != SW_EXECUTION_OK)
-                {
-                    return ERR_INVALID_RESPONSE;
-                }
-            }
-            dataOffset += CMD_MAX_LEN;
-        }
-        // Last command
-        index = pubKeyLen - dataOffset;
-        memcpy(cmd, pubKey + dataOffset, index);
-    }
-    else
-    {
-        index = pubKeyLen + 2; // command length
-    }
-
-    if (index > CMD_MAX_LEN) {
-        return ERR_INVALID_PARAMETERS;
-    }
+    // Construct command header, the key follows it through chaining
+    tlv.addHeader(0x34, pubKeyLen);
 
     // Send command
-    if (transmit(_channel, 0xD8, 0x80, 0x00, cmd, index, 0x00) &&
+    if (transmitChained(0x00, 0xD8, 0x80, 0x00, tlv.data(), tlv.length(), pubKey, pubKeyLen, 256, APDU_CHAINING_P1) == ERR_NOERR &&
         getStatusWord() == SW_EXECUTION_OK)
     {
+        // The last update ends the session
+        trackSession(0x24, 0x00, false);
         return ERR_NOERR;
     }
 
@@ -899,47 +634,106 @@ int ROT::putPublicKeyUpdate(const uint8_t *pubKey, uint16_t pubKeyLen)
 /** Public *******************************************************************/
 int ROT::getCertificateByContainerId(const uint8_t *containerId, uint16_t containerIdLen, uint8_t **cert, uint16_t *certLen)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_GET_CERTIFICATE);
+
     	printf("getCertificateByContainerId %d\r\n", *containerId);
-	return readFile(const_cast<uint8_t *>(AID), sizeof AID, containerId, containerIdLen, nullptr, 0, cert, certLen);
+	return timer.done(readFile(_aid, _aidLen, containerId, containerIdLen, nullptr, 0, cert, certLen));
+}
+
+/**
+ * Keep the files read by getCertificateByContainerId in memory, see
+ * ROT.h. Switching the cache off empties it.
+ */
+void ROT::setCache(uint8_t mode)
+{
+    SETransaction transaction(_seiface);
+
+    _cacheMode = mode;
+    if (mode == ROT_CACHE_OFF)
+    {
+        _cache.clear();
+    }
+}
+
+/**
+ * Empty the container cache
+ */
+void ROT::invalidateCache(void)
+{
+    SETransaction transaction(_seiface);
+
+    _cache.clear();
 }
 
 int ROT::generateRandom(uint8_t *data, uint16_t dataLen)
 {
-    return getRandom(data, dataLen);
+    SEMetricsTimer timer(SE_METRICS_OP_GENERATE_RANDOM);
+
+    return timer.done(getRandom(data, dataLen));
 }
 
 
 int ROT::signInit(const uint8_t *containerId, uint16_t containerIdLen, uint32_t algorithm)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_SIGN_INIT);
     uint8_t operationMode = OPERATION_MODE_PADDING;
 
     uint16_t hashAlgo = algorithm >> 8;
     uint8_t signAlgo = algorithm & 0xFF;
 
-    return computeSignatureInit(containerId, containerIdLen,
-                                nullptr, 0,
-                                operationMode, hashAlgo, signAlgo);
+    return timer.done(computeSignatureInit(containerId, containerIdLen,
+                                           nullptr, 0,
+                                           operationMode, hashAlgo, signAlgo));
 }
 
 int ROT::signFinal(const uint8_t *hash, uint16_t hash_len,
                    uint8_t *signature, uint16_t *signature_len)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_SIGN_FINAL);
     uint8_t operationMode = OPERATION_MODE_PADDING;
 
-    return computeSignatureUpdate(operationMode,
-                                  hash, hash_len,
-                                  nullptr, 0,
-                                  0,
-                                  signature, signature_len);
+    return timer.done(computeSignatureUpdate(operationMode,
+                                             hash, hash_len,
+                                             nullptr, 0,
+                                             0,
+                                             signature, signature_len));
+}
+
+int ROT::signData(const uint8_t *containerId, uint16_t containerIdLen, uint32_t algorithm,
+                  const uint8_t *data, uint32_t dataLen, uint8_t *signature, uint16_t *signatureLen)
+{
+    SEMetricsTimer timer(SE_METRICS_OP_SIGN_DATA);
+    uint8_t operationMode = OPERATION_MODE_FULL_TEXT;
+    uint16_t hashAlgo = algorithm >> 8;
+    uint8_t signAlgo = algorithm & 0xFF;
+    SETransaction transaction(_seiface);
+
+    int result = computeSignatureInit(containerId, containerIdLen,
+                                      nullptr, 0,
+                                      operationMode, hashAlgo, signAlgo);
+    if (result != ERR_NOERR)
+    {
+        return timer.done(result);
+    }
+    return timer.done(computeSignatureUpdate(operationMode,
+                                             data, dataLen,
+                                             nullptr, 0,
+                                             0,
+                                             signature, signatureLen));
 }
 
 int ROT::generateKeyPairByContainerId(const uint8_t *containerId, uint16_t containerIdLen, RotKeyPair *kp)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_GENERATE_KEY_PAIR);
+
     if (kp == nullptr)
     {
-        return ERR_INVALID_PARAMETERS;
+        return timer.done(ERR_INVALID_PARAMETERS);
     }
 
+    // A new key makes the cached certificates stale
+    invalidateCache();
+
     RotKeyPair keyPair;
     int result = generateKeypair(
         containerId, containerIdLen,
@@ -952,20 +746,26 @@ int ROT::generateKeyPairByContainerId(const uint8_t *containerId, uint16_t conta
         memcpy(kp, &keyPair, sizeof(RotKeyPair));
     }
 
-    return result;
+    return timer.done(result);
 }
 
 int ROT::putServerPublicKey(const uint8_t *containerId, uint16_t containerIdLen, const uint8_t *pubKey, uint16_t pubKeyLen)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_PUT_PUBLIC_KEY);
+    SETransaction transaction(_seiface);
+
+    // Whatever the outcome, cached containers may be stale
+    _cache.clear();
+
     int result = putPublicKeyInit(containerId, containerIdLen, nullptr, 0);
     if (result != ERR_NOERR)
     {
-        return result;
+        return timer.done(result);
     }
 
     result = putPublicKeyUpdate(pubKey, pubKeyLen);
 
-    return result;
+    return timer.done(result);
 }
 
 
@@ -977,12 +777,13 @@ int ROT::computeDHforKeypair(
     uint8_t *sharedSecret,
     uint16_t *sharedSecretLen)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_COMPUTE_DH);
     int result = computeDH(clientEphContainerId, clientEphContainerIdLen,
                            serverEphContainerId, serverEphContainerIdLen,
                            nullptr, 0,
                            nullptr, 0,
                            sharedSecret, sharedSecretLen);
-    return result;
+    return timer.done(result);
 }
 
 int ROT::computePRFwithSecret(const uint8_t *secret, uint16_t secretLen,
@@ -990,11 +791,12 @@ int ROT::computePRFwithSecret(const uint8_t *secret, uint16_t secretLen,
                               const uint8_t *seed, uint16_t seedLen,
                               uint8_t *data, uint16_t dataLen)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_COMPUTE_PRF);
     uint16_t lblSeedLen = labelLen + seedLen;
     uint8_t *lblSeed = (uint8_t *)malloc(lblSeedLen);
     if (lblSeed == nullptr)
     {
-        return ERR_OUT_OF_MEMORY;
+        return timer.done(ERR_OUT_OF_MEMORY);
     }
     memcpy(lblSeed, label, labelLen);
     memcpy(lblSeed + labelLen, seed, seedLen);
@@ -1007,7 +809,7 @@ int ROT::computePRFwithSecret(const uint8_t *secret, uint16_t secretLen,
                             lblSeed, lblSeedLen,
                             data, dataLen);
     free(lblSeed);
-    return result;
+    return timer.done(result);
 }
 
 int ROT::computePRFwithPSK(const uint8_t *secretId, uint16_t secretIdLen,
@@ -1015,11 +817,12 @@ int ROT::computePRFwithPSK(const uint8_t *secretId, uint16_t secretIdLen,
                            const uint8_t *seed, uint16_t seedLen,
                            uint8_t *data, uint16_t dataLen)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_COMPUTE_PRF);
     uint16_t lblSeedLen = labelLen + seedLen;
     uint8_t *lblSeed = (uint8_t *)malloc(lblSeedLen);
     if (lblSeed == nullptr)
     {
-        return ERR_OUT_OF_MEMORY;
+        return timer.done(ERR_OUT_OF_MEMORY);
     }
     memcpy(lblSeed, label, labelLen);
     memcpy(lblSeed + labelLen, seed, seedLen);
@@ -1032,7 +835,7 @@ int ROT::computePRFwithPSK(const uint8_t *secretId, uint16_t secretIdLen,
                             lblSeed, lblSeedLen,
                             data, dataLen);
     free(lblSeed);
-    return result;
+    return timer.done(result);
 }
 
 int ROT::computePRFwithPSKECDHE(const uint8_t *secretId, uint16_t secretIdLen,
@@ -1041,11 +844,12 @@ int ROT::computePRFwithPSKECDHE(const uint8_t *secretId, uint16_t secretIdLen,
                                 const uint8_t *seed, uint16_t seedLen,
                                 uint8_t *data, uint16_t dataLen)
 {
+    SEMetricsTimer timer(SE_METRICS_OP_COMPUTE_PRF);
     uint16_t lblSeedLen = labelLen + seedLen;
     uint8_t *lblSeed = (uint8_t *)malloc(lblSeedLen);
     if (lblSeed == nullptr)
     {
-        return ERR_OUT_OF_MEMORY;
+        return timer.done(ERR_OUT_OF_MEMORY);
     }
     memcpy(lblSeed, label, labelLen);
     memcpy(lblSeed + labelLen, seed, seedLen);
@@ -1058,7 +862,7 @@ int ROT::computePRFwithPSKECDHE(const uint8_t *secretId, uint16_t secretIdLen,
                             lblSeed, lblSeedLen,
                             data, dataLen);
     free(lblSeed);
-    return result;
+    return timer.done(result);
 }
 
 /** C Accessors	***************************************************************/
@@ -1075,6 +879,14 @@ extern "C" int ROT_get_certificate_by_container_id(ROT* rot, const uint8_t *cont
 	return rot->getCertificateByContainerId(container_id, containerIdLen, cert, cert_len);
 }
 
+extern "C" void ROT_set_cache(ROT* rot, uint8_t mode) {
+    rot->setCache(mode);
+}
+
+extern "C" void ROT_invalidate_cache(ROT* rot) {
+    rot->invalidateCache();
+}
+
 extern "C" bool ROT_generate_random(ROT* rot, uint8_t* data, uint16_t dataLen) {
     return rot->generateRandom(data, dataLen);
 }
@@ -1095,6 +907,10 @@ extern "C" int ROT_sign_final_ECDSA(ROT* rot, const uint8_t* hash, uint16_t hash
 	return rot->signFinal(hash, hash_len, signature, signature_len);
 }
 
+extern "C" int ROT_sign_data(ROT* rot, const uint8_t *containerId, uint16_t containerIdLen, uint32_t algorithm, const uint8_t* data, uint32_t data_len, uint8_t* signature, uint16_t* signature_len) {
+	return rot->signData(containerId, containerIdLen, algorithm, data, data_len, signature, signature_len);
+}
+
 
 extern "C" int ROT_compute_DH_for_keypair(ROT* rot, const uint8_t *clientEphContainerId, uint16_t clientEphContainerIdLen, 
 					const uint8_t *serverEphContainerId, uint16_t serverEphContainerIdLen,
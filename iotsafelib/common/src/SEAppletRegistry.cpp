@@ -0,0 +1,244 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <string.h>
+#include "SEAppletRegistry.h"
+#include "SEMetrics.h"
+
+#define INS_MANAGE_CHANNEL 0x70
+#define INS_SELECT 0xA4
+
+SEAppletRegistry::SEAppletRegistry(SEInterface *se) : _se(se), _entries{}, _count(0), _clock(0)
+{
+}
+
+SEAppletRegistry::~SEAppletRegistry(void)
+{
+	while (_count > 0)
+	{
+		remove(_entries[_count - 1].applet);
+	}
+}
+
+uint8_t SEAppletRegistry::indexOf(Applet *applet)
+{
+	uint8_t index;
+
+	for (index = 0; index < _count; index++)
+	{
+		if (_entries[index].applet == applet)
+		{
+			break;
+		}
+	}
+	return index;
+}
+
+bool SEAppletRegistry::select(Entry *entry, uint8_t channel)
+{
+	const uint8_t *aid;
+	uint16_t aidLen;
+	uint16_t sw;
+
+	aid = entry->applet->getAid(&aidLen);
+	if (_se->transmit(seClaForChannel(0x00, channel), INS_SELECT, 0x04, 0x00, aid, aidLen) != ERR_NOERR)
+	{
+		return false;
+	}
+	sw = _se->getStatusWord();
+	return (sw == SW_EXECUTION_OK) || ((sw & 0xFF00) == SW_DATA_AVAILABLE) || ((sw & 0xFF00) == SW_OK);
+}
+
+void SEAppletRegistry::closeChannel(uint8_t channel)
+{
+	_se->transmit(0x00, INS_MANAGE_CHANNEL, 0x80, channel);
+}
+
+uint8_t SEAppletRegistry::takeChannel(uint8_t index)
+{
+	SEResponseView view;
+	Entry *victim = nullptr;
+	uint8_t channel;
+
+	if ((_se->transmit(0x00, INS_MANAGE_CHANNEL, 0x00, 0x00, 0x01) == ERR_NOERR) &&
+		(_se->getStatusWord() == SW_EXECUTION_OK))
+	{
+		view = _se->getResponseView();
+		if ((view.dataLen < 1) || (view.data[0] == 0) || (view.data[0] >= SE_MAX_CHANNELS))
+		{
+			return SE_CHANNEL_NONE;
+		}
+		return view.data[0];
+	}
+
+	// No channel left: the applet least recently used gives its own, unless a session is open on it
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		if ((i != index) && (_entries[i].channel != SE_CHANNEL_NONE) && (_entries[i].applet->getOpenSessions() == 0) &&
+			((victim == nullptr) || (_entries[i].lastUse < victim->lastUse)))
+		{
+			victim = &_entries[i];
+		}
+	}
+	if (victim == nullptr)
+	{
+		return SE_CHANNEL_NONE;
+	}
+	if (victim->applet->isSelected())
+	{
+		victim->applet->deselect();
+	}
+	channel = victim->channel;
+	victim->channel = SE_CHANNEL_NONE;
+	return channel;
+}
+
+bool SEAppletRegistry::add(Applet *applet)
+{
+	const uint8_t *aid;
+	uint16_t aidLen;
+
+	if ((_se == nullptr) || (applet == nullptr))
+	{
+		return false;
+	}
+
+	SETransaction transaction(_se);
+
+	aid = applet->getAid(&aidLen);
+	if ((_count == SE_REGISTRY_MAX_APPLETS) || (find(aid, aidLen) != nullptr))
+	{
+		return false;
+	}
+	applet->init(_se);
+	_entries[_count].applet = applet;
+	_entries[_count].channel = SE_CHANNEL_NONE;
+	_entries[_count].lastUse = 0;
+	_count++;
+	return true;
+}
+
+bool SEAppletRegistry::remove(Applet *applet)
+{
+	uint8_t index;
+
+	SETransaction transaction(_se);
+
+	index = indexOf(applet);
+	if (index == _count)
+	{
+		return false;
+	}
+	if (applet->isSelected())
+	{
+		applet->deselect();
+	}
+	if (_entries[index].channel != SE_CHANNEL_NONE)
+	{
+		closeChannel(_entries[index].channel);
+	}
+	_count--;
+	_entries[index] = _entries[_count];
+	return true;
+}
+
+Applet *SEAppletRegistry::find(const uint8_t *aid, uint16_t aidLen)
+{
+	const uint8_t *entryAid;
+	uint16_t entryAidLen;
+
+	SETransaction transaction(_se);
+
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		entryAid = _entries[i].applet->getAid(&entryAidLen);
+		if ((entryAidLen == aidLen) && (memcmp(entryAid, aid, aidLen) == 0))
+		{
+			return _entries[i].applet;
+		}
+	}
+	return nullptr;
+}
+
+Applet *SEAppletRegistry::use(const uint8_t *aid, uint16_t aidLen)
+{
+	SETransaction transaction(_se);
+	Applet *applet = find(aid, aidLen);
+
+	if ((applet == nullptr) || !use(applet))
+	{
+		return nullptr;
+	}
+	return applet;
+}
+
+bool SEAppletRegistry::use(Applet *applet)
+{
+	uint8_t index;
+	uint8_t channel;
+	Entry *entry;
+
+	SETransaction transaction(_se);
+
+	index = indexOf(applet);
+	if (index == _count)
+	{
+		return false;
+	}
+	entry = &_entries[index];
+	entry->lastUse = ++_clock;
+	if (applet->isSelected())
+	{
+		return true;
+	}
+
+	SEMetricsTimer timer(SE_METRICS_OP_SELECT);
+
+	if (entry->channel == SE_CHANNEL_NONE)
+	{
+		channel = takeChannel(index);
+		if (channel == SE_CHANNEL_NONE)
+		{
+			return timer.done(false);
+		}
+		if (!select(entry, channel))
+		{
+			closeChannel(channel);
+			return timer.done(false);
+		}
+		entry->channel = channel;
+	}
+	// else deselected by its user, the applet is still selected on its channel
+	return timer.done(applet->attach(entry->channel));
+}
+
+uint8_t SEAppletRegistry::getChannel(Applet *applet)
+{
+	uint8_t index;
+
+	SETransaction transaction(_se);
+
+	index = indexOf(applet);
+	return (index == _count) ? SE_CHANNEL_NONE : _entries[index].channel;
+}
+
+uint8_t SEAppletRegistry::getCount(void)
+{
+	SETransaction transaction(_se);
+
+	return _count;
+}
@@ -0,0 +1,168 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SEChannelPool.h"
+#include <chrono>
+
+#define INS_MANAGE_CHANNEL 0x70
+#define INS_SELECT 0xA4
+
+SEChannelPool::SEChannelPool(const uint8_t *aid, uint16_t aidLen) : _se(nullptr), _aid(aid), _aidLen(aidLen),
+	_closed(true), _channels(0), _available(0)
+{
+}
+
+SEChannelPool::~SEChannelPool(void)
+{
+	close();
+}
+
+bool SEChannelPool::select(uint8_t channel)
+{
+	uint16_t sw;
+
+	if (_se->transmit(seClaForChannel(0x00, channel), INS_SELECT, 0x04, 0x00, _aid, _aidLen) != ERR_NOERR)
+	{
+		return false;
+	}
+	sw = _se->getStatusWord();
+	return (sw == SW_EXECUTION_OK) || ((sw & 0xFF00) == SW_DATA_AVAILABLE) || ((sw & 0xFF00) == SW_OK);
+}
+
+void SEChannelPool::closeChannel(uint8_t channel)
+{
+	_se->transmit(0x00, INS_MANAGE_CHANNEL, 0x80, channel);
+}
+
+uint8_t SEChannelPool::open(SEInterface *se, uint8_t count)
+{
+	// All MANAGE CHANNEL and SELECT at once, the SE lock before _mutex
+	SETransaction transaction(se);
+	std::lock_guard<std::mutex> guard(_mutex);
+	SEResponseView view;
+	uint8_t opened = 0;
+	uint8_t channel;
+
+	if ((se == nullptr) || (_channels != 0))
+	{
+		return 0;
+	}
+	_se = se;
+	_closed = false;
+
+	while ((opened < count) && (opened < SE_MAX_CHANNELS - 1))
+	{
+		if ((_se->transmit(0x00, INS_MANAGE_CHANNEL, 0x00, 0x00, 0x01) != ERR_NOERR) ||
+			(_se->getStatusWord() != SW_EXECUTION_OK))
+		{
+			break;
+		}
+		view = _se->getResponseView();
+		if (view.dataLen < 1)
+		{
+			break;
+		}
+		channel = view.data[0];
+		if ((channel == 0) || (channel >= SE_MAX_CHANNELS) || (_channels & (1UL << channel)))
+		{
+			break;
+		}
+		if (!select(channel))
+		{
+			closeChannel(channel);
+			break;
+		}
+		_channels |= 1UL << channel;
+		opened++;
+	}
+	_available = _channels;
+	return opened;
+}
+
+void SEChannelPool::close(void)
+{
+	// _se only changes in open(), while no channel is open
+	SETransaction transaction(_se);
+	std::lock_guard<std::mutex> guard(_mutex);
+	uint8_t channel;
+
+	if (_se == nullptr)
+	{
+		return;
+	}
+	_closed = true;
+	for (channel = 1; channel < SE_MAX_CHANNELS; channel++)
+	{
+		if (_available & (1UL << channel))
+		{
+			closeChannel(channel);
+		}
+	}
+	_channels &= ~_available;
+	_available = 0;
+	// Waiting lessees give up
+	_released.notify_all();
+}
+
+uint8_t SEChannelPool::acquire(uint32_t timeout)
+{
+	std::unique_lock<std::mutex> guard(_mutex);
+	uint8_t channel;
+
+	if (!_released.wait_for(guard, std::chrono::milliseconds(timeout),
+		[this] { return _closed || (_available != 0); }) || _closed)
+	{
+		return SE_CHANNEL_NONE;
+	}
+	channel = (uint8_t) __builtin_ctz(_available);
+	_available &= ~(1UL << channel);
+	return channel;
+}
+
+void SEChannelPool::release(uint8_t channel, bool reselect)
+{
+	// SELECT or MANAGE CHANNEL may be sent, the SE lock before _mutex
+	SETransaction transaction(_se);
+	std::lock_guard<std::mutex> guard(_mutex);
+
+	if ((channel >= SE_MAX_CHANNELS) || !(_channels & (1UL << channel)) || (_available & (1UL << channel)))
+	{
+		return;
+	}
+	if (_closed || (reselect && !select(channel)))
+	{
+		closeChannel(channel);
+		_channels &= ~(1UL << channel);
+		return;
+	}
+	_available |= 1UL << channel;
+	_released.notify_one();
+}
+
+uint8_t SEChannelPool::getSize(void)
+{
+	std::lock_guard<std::mutex> guard(_mutex);
+
+	return (uint8_t) __builtin_popcount(_channels);
+}
+
+uint8_t SEChannelPool::getAvailable(void)
+{
+	std::lock_guard<std::mutex> guard(_mutex);
+
+	return (uint8_t) __builtin_popcount(_available);
+}
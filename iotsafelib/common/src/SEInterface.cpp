@@ -16,7 +16,63 @@
  */
 
 #include "SEInterface.h"
+#include "SEMetrics.h"
 #include <assert.h>
+#include <stdlib.h>
+#include <map>
+#include <memory>
+
+/**
+ * Response to the last command sent by one thread through one SEInterface:
+ * the receive buffer of each APDU, and the chunks joined over GET RESPONSE.
+ */
+struct SEResponseState
+{
+	uint8_t apduResponse[APDU_MAX_RESPONSE_LEN];
+	uint16_t apduResponseLen;
+	const uint8_t *response;	// apduResponse, or accumulated for a 61xx chain
+	uint16_t responseLen;		// data and status word
+	uint8_t *accumulated;		// grows up to the response ceiling + status word
+	uint16_t accumulatedCap;
+
+	SEResponseState(void) : apduResponseLen(0), response(apduResponse), responseLen(0),
+		accumulated(nullptr), accumulatedCap(0)
+	{
+	}
+
+	~SEResponseState(void)
+	{
+		free(accumulated);
+	}
+
+	SEResponseState(const SEResponseState &) = delete;
+	SEResponseState &operator=(const SEResponseState &) = delete;
+};
+
+// Response states of the calling thread by SEInterface id, freed on thread exit
+struct SEThreadResponses
+{
+	std::map<uint32_t, std::unique_ptr<SEResponseState> > states;
+	uint32_t lastId;
+	SEResponseState *last;
+
+	SEThreadResponses(void) : lastId(0), last(nullptr)
+	{
+	}
+	~SEThreadResponses(void);
+};
+
+static thread_local SEThreadResponses threadResponses;
+static thread_local bool threadResponsesDestroyed = false;
+
+SEThreadResponses::~SEThreadResponses(void)
+{
+	threadResponsesDestroyed = true;
+}
+
+// Ids are never reused: a state left behind by a destroyed instance in
+// another thread cannot be taken for the state of a new instance
+static std::atomic<uint32_t> nextId(1);
 
 /**
  * Create an instance of SEInterface
@@ -25,7 +81,82 @@
 SEInterface::SEInterface(void)
 {
 	_apduLen = 0;
-	_apduResponseLen = 0;
+	_apduExtended = false;
+#if APDU_EXTENDED_MAX_DATA_LEN > MAX_APDU_DATA_LEN
+	_extendedLength = APDU_EXTENDED_AUTO;
+#else
+	_extendedLength = APDU_EXTENDED_OFF;
+#endif
+	_timeout = APDU_DEFAULT_TIMEOUT;
+	_timedOut = false;
+	_maxResponseLen = APDU_RESPONSE_MAX_ACCUMULATED_LEN;
+	_responseTooLong = false;
+	_owner.store(std::thread::id());
+	_depth = 0;
+	_id = nextId++;
+}
+
+SEInterface::~SEInterface(void)
+{
+	// States left in other threads go with them
+	if (!threadResponsesDestroyed)
+	{
+		threadResponses.states.erase(_id);
+		if (threadResponses.lastId == _id)
+		{
+			threadResponses.lastId = 0;
+			threadResponses.last = nullptr;
+		}
+	}
+}
+
+/**
+ * Take the transaction lock: no other thread can transmit until the
+ * calling thread releases it. The lock is recursive, each lock() is
+ * released by one unlock().
+ * 
+ * @return true once the lock is held.
+ */
+bool SEInterface::lock(void)
+{
+	_lock.lock();
+	_owner.store(std::this_thread::get_id());
+	_depth++;
+	return true;
+}
+
+/**
+ * Release the transaction lock taken with lock().
+ * 
+ * @return true in case of success, false if the calling thread does not hold the lock.
+ */
+bool SEInterface::unlock(void)
+{
+	if (_owner.load() != std::this_thread::get_id())
+	{
+		return false;
+	}
+	if (--_depth == 0)
+	{
+		_owner.store(std::thread::id());
+	}
+	_lock.unlock();
+	return true;
+}
+
+SEResponseState *SEInterface::responseState(void)
+{
+	if (threadResponses.lastId != _id)
+	{
+		std::unique_ptr<SEResponseState> &state = threadResponses.states[_id];
+		if (!state)
+		{
+			state.reset(new SEResponseState());
+		}
+		threadResponses.lastId = _id;
+		threadResponses.last = state.get();
+	}
+	return threadResponses.last;
 }
 
 /**
@@ -40,15 +171,18 @@ SEInterface::SEInterface(void)
  */
 int SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2)
 {
+	SETransaction transaction(this);
+
 	_apdu[APDU_CLA_OFFSET] = cla;
 	_apdu[APDU_INS_OFFSET] = ins;
 	_apdu[APDU_P1_OFFSET] = p1;
 	_apdu[APDU_P2_OFFSET] = p2;
 	_apduLen = 4;
+	_apduExtended = false;
 	if(transmit()) {
 		return ERR_NOERR;
 	}
-	return ERR_GENERIC;
+	return transmitError();
 }
 
 /**
@@ -64,16 +198,19 @@ int SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2)
  */
 int SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t le)
 {
+	SETransaction transaction(this);
+
 	_apdu[APDU_CLA_OFFSET] = cla;
 	_apdu[APDU_INS_OFFSET] = ins;
 	_apdu[APDU_P1_OFFSET] = p1;
 	_apdu[APDU_P2_OFFSET] = p2;
 	_apdu[APDU_LE_OFFSET] = le;
 	_apduLen = 5;
+	_apduExtended = false;
 	if(transmit()) {
 		return ERR_NOERR;
 	}
-	return ERR_GENERIC;
+	return transmitError();
 }
 
 /**
@@ -90,6 +227,8 @@ int SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint
  */
 int SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, uint16_t dataLen)
 {
+	SETransaction transaction(this);
+
 	_apdu[APDU_CLA_OFFSET] = cla;
 	_apdu[APDU_INS_OFFSET] = ins;
 	_apdu[APDU_P1_OFFSET] = p1;
@@ -102,10 +241,11 @@ int SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, cons
 	}
 	memcpy(&_apdu[APDU_DATA_OFFSET], data, dataLen);
 	_apduLen = 5 + dataLen;
+	_apduExtended = false;
 	if(transmit()) {
 		return ERR_NOERR;
 	}
-	return ERR_GENERIC;
+	return transmitError();
 }
 
 /**
@@ -123,6 +263,8 @@ int SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, cons
  */
 int SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, uint16_t dataLen, uint8_t le)
 {
+	SETransaction transaction(this);
+
 	_apdu[APDU_CLA_OFFSET] = cla;
 	_apdu[APDU_INS_OFFSET] = ins;
 	_apdu[APDU_P1_OFFSET] = p1;
@@ -136,40 +278,548 @@ int SEInterface::transmit(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, cons
 	memcpy(&_apdu[APDU_DATA_OFFSET], data, dataLen);
 	_apdu[5 + dataLen] = le;
 	_apduLen = 5 + dataLen + 1;
+	_apduExtended = false;
 	if(transmit()) {
 		return ERR_NOERR;
 	}
-	return ERR_GENERIC;
+	return transmitError();
 
 }
 
-bool SEInterface::transmit(void)
+/**
+ * Transmit an APDU of any case. Short encoding is used when data and le
+ * fit, extended length encoding otherwise. When the Secure Element does
+ * not support extended length, an APDU whose data fits is sent again in
+ * short form with le limited to 256 bytes.
+ * 
+ * @param[in]  cla CLA value for APDU command 
+ * @param[in]  ins INS value for APDU command 
+ * @param[in]  p1 P1 value for APDU command 
+ * @param[in]  p2 P2 value for APDU command 
+ * @param[in]  data pointer to the data buffer for APDU command, nullptr if none
+ * @param[in]  dataLen length of the data buffer
+ * @param[in]  le expected response length up to 65536, 0 if no response data is expected
+ * @return zero in case transmit was successful, ERR_INVALID_LENGTH if the
+ *         APDU requires extended length which is not available, nonzero otherwise.
+ */
+int SEInterface::transmitExtended(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, const uint8_t *data, uint16_t dataLen, uint32_t le)
+{
+	SETransaction transaction(this);
+
+	return transmitParts(cla, ins, p1, p2, data, dataLen, nullptr, 0, le);
+}
+
+/**
+ * Transmit a payload of any length as a chain of commands and keep the
+ * response to the last one. The payload is header followed by data, both
+ * sent from the caller's buffers: a TLV tag and length built on the stack
+ * can prefix a large value without copying it. Segments use extended
+ * length when the Secure Element supports it, 255 bytes otherwise.
+ * 
+ * With APDU_CHAINING_CLA every segment but the last has the CLA chaining
+ * bit (0x10) set. With APDU_CHAINING_P1 every segment but the last has
+ * bit 0x80 of P1 cleared, the IoT Safe applet convention.
+ * 
+ * @param[in]  cla CLA value for APDU command 
+ * @param[in]  ins INS value for APDU command 
+ * @param[in]  p1 P1 value for APDU command, that of the last segment
+ * @param[in]  p2 P2 value for APDU command 
+ * @param[in]  header pointer to the first part of the payload, nullptr if none
+ * @param[in]  headerLen length of the first part of the payload
+ * @param[in]  data pointer to the second part of the payload, nullptr if none
+ * @param[in]  dataLen length of the second part of the payload
+ * @param[in]  le expected response length to the last segment, 0 if none
+ * @param[in]  chaining APDU_CHAINING_CLA or APDU_CHAINING_P1
+ * @return zero in case every segment was sent and all but the last were
+ *         answered 9000, ERR_INVALID_RESPONSE if a segment was refused
+ *         (see getStatusWord), nonzero otherwise.
+ */
+int SEInterface::transmitChained(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2,
+		const uint8_t *header, uint16_t headerLen, const uint8_t *data, uint32_t dataLen,
+		uint32_t le, uint8_t chaining)
 {
-	if (transmitApdu(_apdu, _apduLen, _apduResponse, &_apduResponseLen) == false)
+	uint32_t total = headerLen + dataLen;
+	uint32_t offset = 0;
+	uint16_t segmentMax = APDU_SHORT_MAX_DATA_LEN;
+	int ret;
+	SETransaction transaction(this);
+
+	if (((headerLen > 0) && (header == nullptr)) || ((dataLen > 0) && (data == nullptr)) ||
+		((chaining != APDU_CHAINING_CLA) && (chaining != APDU_CHAINING_P1)))
 	{
-		return false;
+		return ERR_INVALID_PARAMETERS;
+	}
+#if APDU_EXTENDED_MAX_DATA_LEN > MAX_APDU_DATA_LEN
+	if (_extendedLength != APDU_EXTENDED_OFF)
+	{
+		segmentMax = APDU_EXTENDED_MAX_DATA_LEN;
+	}
+#endif
+
+	do
+	{
+		uint32_t segmentLen = total - offset;
+		const uint8_t *part1 = nullptr;
+		uint16_t part1Len = 0;
+		const uint8_t *part2 = nullptr;
+		uint16_t part2Len = 0;
+		bool last;
+
+		if (segmentLen > segmentMax)
+		{
+			segmentLen = segmentMax;
+		}
+		last = (offset + segmentLen == total);
+
+		// The segment straddles header and data at most once
+		if (offset < headerLen)
+		{
+			part1 = header + offset;
+			part1Len = (headerLen - offset < segmentLen) ? (uint16_t) (headerLen - offset) : (uint16_t) segmentLen;
+			part2 = data;
+			part2Len = (uint16_t) (segmentLen - part1Len);
+		}
+		else
+		{
+			part1 = data + (offset - headerLen);
+			part1Len = (uint16_t) segmentLen;
+		}
+
+		if (chaining == APDU_CHAINING_CLA)
+		{
+			ret = transmitParts(last ? cla : (cla | APDU_CHAINING_CLA_BIT), ins, p1, p2,
+								part1, part1Len, part2, part2Len, last ? le : 0);
+		}
+		else
+		{
+			ret = transmitParts(cla, ins, last ? p1 : (p1 & ~APDU_CHAINING_P1_LAST), p2,
+								part1, part1Len, part2, part2Len, last ? le : 0);
+		}
+
+		// Extended length just found unsupported, nothing was accepted yet
+		if ((ret == ERR_INVALID_LENGTH) && (offset == 0) && (segmentMax > APDU_SHORT_MAX_DATA_LEN) &&
+			(_extendedLength == APDU_EXTENDED_OFF))
+		{
+			segmentMax = APDU_SHORT_MAX_DATA_LEN;
+			continue;
+		}
+		if (ret != ERR_NOERR)
+		{
+			return ret;
+		}
+		if (!last && (getStatusWord() != SW_EXECUTION_OK))
+		{
+			return ERR_INVALID_RESPONSE;
+		}
+		offset += segmentLen;
+	} while (offset < total);
+
+	return ERR_NOERR;
+}
+
+/**
+ * Transmit a batch of commands as one unit, holding the transaction
+ * lock. Each command is sent as with transmitExtended, its response
+ * data copied to its response buffer and its status word checked
+ * against sw on the bits of swMask. The batch stops at the first
+ * command which fails or is answered an unexpected status word; the
+ * commands after it are not sent (responseSw 0).
+ * 
+ * @param[in, out]  commands the commands, see SEBatchCommand
+ * @param[in]  count number of commands
+ * @param[out]  executed number of commands sent, nullptr if not needed
+ * @return zero in case every command was answered an expected status
+ *         word, ERR_INVALID_RESPONSE on an unexpected one,
+ *         ERR_INVALID_LENGTH if a response does not fit its buffer,
+ *         nonzero otherwise.
+ */
+int SEInterface::transmitBatch(SEBatchCommand *commands, uint16_t count, uint16_t *executed)
+{
+	uint16_t sent = 0;
+	int ret = ERR_NOERR;
+	SETransaction transaction(this);
+
+	if ((commands == nullptr) && (count > 0))
+	{
+		return ERR_INVALID_PARAMETERS;
+	}
+	for (uint16_t i = 0; i < count; i++)
+	{
+		commands[i].responseSw = 0;
+	}
+
+	while ((ret == ERR_NOERR) && (sent < count))
+	{
+		SEBatchCommand *command = &commands[sent];
+		SEResponseView view;
+
+		ret = transmitParts(command->cla, command->ins, command->p1, command->p2,
+							command->data, command->dataLen, nullptr, 0, command->le);
+		sent++;
+		if (ret != ERR_NOERR)
+		{
+			command->responseLen = 0;
+			break;
+		}
+
+		view = getResponseView();
+		command->responseSw = view.sw;
+		if (command->response == nullptr)
+		{
+			command->responseLen = view.dataLen;
+		}
+		else if (view.dataLen > command->responseLen)
+		{
+			command->responseLen = 0;
+			ret = ERR_INVALID_LENGTH;
+		}
+		else
+		{
+			if (view.dataLen > 0)
+			{
+				memcpy(command->response, view.data, view.dataLen);
+			}
+			command->responseLen = view.dataLen;
+		}
+
+		if ((ret == ERR_NOERR) && ((view.sw & command->swMask) != (command->sw & command->swMask)))
+		{
+			ret = ERR_INVALID_RESPONSE;
+		}
 	}
 
-	if ((_apduResponseLen == 2) && (_apduResponse[0] == SW1_WRONG_LENGTH_LE))
+	if (executed != nullptr)
 	{
-		_apdu[4] = _apduResponse[1];
-		return transmit();
+		*executed = sent;
 	}
+	return ret;
+}
+
+int SEInterface::transmitParts(uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2,
+		const uint8_t *part1, uint16_t part1Len, const uint8_t *part2, uint16_t part2Len, uint32_t le)
+{
+	uint32_t dataLen = part1Len + part2Len;
+	bool extended;
+	uint16_t off;
 
-	if ((_apduResponseLen == 2) && ((_apduResponse[0] == SW1_DATA_AVAILABLE) || (_apduResponse[0] == SW1_DATE_AVAILABLE)))
+	if ((le > 65536) || (dataLen > 0xFFFF) || ((part1Len > 0) && (part1 == nullptr)) || ((part2Len > 0) && (part2 == nullptr)))
+	{
+		return ERR_INVALID_PARAMETERS;
+	}
+	// The response has to fit in one receive buffer
+	if (le > APDU_MAX_PAYLOAD)
+	{
+		le = APDU_MAX_PAYLOAD;
+	}
+	extended = (dataLen > 255) || (le > 256);
+	if (extended && (_extendedLength == APDU_EXTENDED_OFF))
+	{
+		if (dataLen > 255)
+		{
+			return ERR_INVALID_LENGTH;
+		}
+		le = 256;
+		extended = false;
+	}
+	if (extended && (dataLen > APDU_EXTENDED_MAX_DATA_LEN))
 	{
-		_apdu[0] = 0x00 | (_apdu[0] & 0x03);
-		_apdu[1] = 0xC0;
-		_apdu[2] = 0x00;
-		_apdu[3] = 0x00;
-		_apdu[4] = _apduResponse[1];
-		_apduLen = 5;
-		return transmit();
+		return ERR_INVALID_LENGTH;
 	}
 
+	_apdu[APDU_CLA_OFFSET] = cla;
+	_apdu[APDU_INS_OFFSET] = ins;
+	_apdu[APDU_P1_OFFSET] = p1;
+	_apdu[APDU_P2_OFFSET] = p2;
+	off = APDU_LC_OFFSET;
+	if (extended)
+	{
+		// 00 Lc1 Lc2 data Le1 Le2, or 00 Le1 Le2 without data
+		_apdu[off++] = 0x00;
+		if (dataLen > 0)
+		{
+			_apdu[off++] = (uint8_t) (dataLen >> 8);
+			_apdu[off++] = (uint8_t) dataLen;
+			if (part1Len > 0)
+			{
+				memcpy(&_apdu[off], part1, part1Len);
+			}
+			if (part2Len > 0)
+			{
+				memcpy(&_apdu[off + part1Len], part2, part2Len);
+			}
+			off += dataLen;
+		}
+		if (le > 0)
+		{
+			_apdu[off++] = (uint8_t) (le >> 8);
+			_apdu[off++] = (uint8_t) le;
+		}
+	}
+	else
+	{
+		if (dataLen > 0)
+		{
+			_apdu[off++] = (uint8_t) dataLen;
+			if (part1Len > 0)
+			{
+				memcpy(&_apdu[off], part1, part1Len);
+			}
+			if (part2Len > 0)
+			{
+				memcpy(&_apdu[off + part1Len], part2, part2Len);
+			}
+			off += dataLen;
+		}
+		if (le > 0)
+		{
+			_apdu[off++] = (uint8_t) le;
+		}
+	}
+	_apduLen = off;
+	_apduExtended = extended;
+
+	if (!transmit())
+	{
+		// A modem or reader may refuse to forward an extended APDU
+		if (_timedOut || _responseTooLong || !extended || (_extendedLength != APDU_EXTENDED_AUTO))
+		{
+			return transmitError();
+		}
+		_extendedLength = APDU_EXTENDED_OFF;
+		return transmitParts(cla, ins, p1, p2, part1, part1Len, part2, part2Len, le);
+	}
+
+	if (extended && (_extendedLength == APDU_EXTENDED_AUTO))
+	{
+		if (getStatusWord() == SW_WRONG_LENGTH)
+		{
+			_extendedLength = APDU_EXTENDED_OFF;
+			return transmitParts(cla, ins, p1, p2, part1, part1Len, part2, part2Len, le);
+		}
+		_extendedLength = APDU_EXTENDED_ON;
+	}
+	return ERR_NOERR;
+}
+
+/**
+ * Set the extended length support of the Secure Element, APDU_EXTENDED_AUTO
+ * by default: the first extended APDU tells whether it is supported.
+ * 
+ * @param[in]  mode APDU_EXTENDED_AUTO, APDU_EXTENDED_ON or APDU_EXTENDED_OFF
+ */
+void SEInterface::setExtendedLength(uint8_t mode)
+{
+	SETransaction transaction(this);
+
+#if APDU_EXTENDED_MAX_DATA_LEN > MAX_APDU_DATA_LEN
+	_extendedLength = mode;
+#else
+	(void) mode;
+#endif
+}
+
+/**
+ * Returns the extended length support of the Secure Element
+ * 
+ * @return APDU_EXTENDED_AUTO while unknown, APDU_EXTENDED_ON or APDU_EXTENDED_OFF.
+ */
+uint8_t SEInterface::getExtendedLength(void)
+{
+	return _extendedLength;
+}
+
+bool SEInterface::forwardApdu(SEInterface *se, uint8_t *apdu, uint16_t apduLen, uint8_t *response, uint16_t *responseLen)
+{
+	SETransaction transaction(se);
+	bool ok;
+
+	se->_timeout = _timeout;
+	se->_timedOut = false;
+	ok = se->transmitApdu(apdu, apduLen, response, responseLen);
+	_timedOut = se->_timedOut;
+	return ok;
+}
+
+static void recordApdu(const uint8_t *apdu, uint16_t apduLen, const uint8_t *response, uint16_t responseLen,
+	uint64_t ns, bool ok, bool timedOut)
+{
+	seMetricsRecordApdu(apdu[1], apduLen, ok ? responseLen : 0, ns, !ok);
+	if (timedOut)
+	{
+		seMetricsAdd(SE_METRICS_APDU_TIMEOUTS, 1);
+	}
+	if (ok && (responseLen >= APDU_RESPONSE_LEN))
+	{
+		seMetricsRecordStatusWord((response[responseLen - 2] << 8) | response[responseLen - 1]);
+	}
+}
+
+// True if the command ends with an Le field, case 2 or 4
+static bool apduHasLe(const uint8_t *apdu, uint16_t apduLen, bool extended)
+{
+	if (!extended)
+	{
+		return (apduLen == 5) || ((apduLen > 5) && (apduLen == 6 + apdu[APDU_LC_OFFSET]));
+	}
+	// 00 Le1 Le2, or 00 Lc1 Lc2 data Le1 Le2
+	if (apduLen == 7)
+	{
+		return true;
+	}
+	return (apduLen > 7) && (apduLen == 9 + ((apdu[APDU_LC_OFFSET + 1] << 8) | apdu[APDU_LC_OFFSET + 2]));
+}
+
+bool SEInterface::transmit(void)
+{
+	SEResponseState *state = responseState();
+	uint16_t accumulatedLen = 0;
+	bool wrongLeRetried = false;
+	bool fetching = false;	// the command in _apdu is a GET RESPONSE
+	uint64_t start = 0;
+	bool ok;
+
+	_timedOut = false;
+	_responseTooLong = false;
+	state->response = state->apduResponse;
+	state->responseLen = 0;
+
+	for (;;)
+	{
+		state->apduResponseLen = sizeof(state->apduResponse);
+		if (seMetricsEnabled())
+		{
+			start = seMetricsNow();
+		}
+		ok = transmitApdu(_apdu, _apduLen, state->apduResponse, &state->apduResponseLen);
+		if (start != 0)
+		{
+			recordApdu(_apdu, _apduLen, state->apduResponse, state->apduResponseLen, seMetricsNow() - start, ok, _timedOut);
+			start = 0;
+		}
+		if (!ok)
+		{
+			return false;
+		}
+		if (state->apduResponseLen < APDU_RESPONSE_LEN)
+		{
+			break;
+		}
+
+		uint16_t dataLen = state->apduResponseLen - APDU_RESPONSE_LEN;
+		uint8_t sw1 = state->apduResponse[dataLen];
+		uint8_t sw2 = state->apduResponse[dataLen + 1];
+
+		// Without an Le field there is nothing to correct, the 6Cxx is the answer
+		if ((dataLen == 0) && (sw1 == SW1_WRONG_LENGTH_LE) && !wrongLeRetried &&
+			apduHasLe(_apdu, _apduLen, _apduExtended))
+		{
+			// Repeat the command with the exact Le, which ends the APDU
+			if (_apduExtended)
+			{
+				_apdu[_apduLen - 2] = 0x00;
+			}
+			_apdu[_apduLen - 1] = sw2;
+			wrongLeRetried = true;
+			seMetricsCount(SE_METRICS_RETRIES_6CXX, 1);
+			continue;
+		}
+
+		if ((sw1 == SW1_DATA_AVAILABLE) || (sw1 == SW1_DATE_AVAILABLE))
+		{
+			// A GET RESPONSE answered without data would loop forever
+			if (fetching && (dataLen == 0))
+			{
+				return false;
+			}
+			// Keep this chunk, then fetch the next one
+			if (!accumulate(state, state->apduResponse, dataLen, &accumulatedLen, _maxResponseLen))
+			{
+				_responseTooLong = true;
+				return false;
+			}
+			// On the channel of the command, whichever its class coding
+			_apdu[0] = seClaForChannel(0x00, seClaChannel(_apdu[0]));
+			_apdu[1] = 0xC0;
+			_apdu[2] = 0x00;
+			_apdu[3] = 0x00;
+			_apdu[4] = sw2;
+			_apduLen = 5;
+			_apduExtended = false;
+			wrongLeRetried = false;
+			fetching = true;
+			seMetricsCount(SE_METRICS_RETRIES_61XX, 1);
+			continue;
+		}
+		break;
+	}
+
+	if (accumulatedLen > 0)
+	{
+		// Last chunk and the final status word
+		if (!accumulate(state, state->apduResponse, state->apduResponseLen, &accumulatedLen, (uint32_t) _maxResponseLen + APDU_RESPONSE_LEN))
+		{
+			_responseTooLong = true;
+			return false;
+		}
+		state->response = state->accumulated;
+		state->responseLen = accumulatedLen;
+	}
+	else
+	{
+		state->responseLen = state->apduResponseLen;
+	}
 	return true;
 }
 
+bool SEInterface::accumulate(SEResponseState *state, const uint8_t *data, uint16_t dataLen, uint16_t *len, uint32_t limit)
+{
+	uint32_t needed = (uint32_t) *len + dataLen;
+
+	if (needed > limit)
+	{
+		return false;
+	}
+	if (needed > state->accumulatedCap)
+	{
+		// Grow geometrically, the ceiling and its status word bound the buffer
+		uint32_t cap = 2UL * state->accumulatedCap;
+		if (cap < needed)
+		{
+			cap = needed;
+		}
+		if (cap > (uint32_t) _maxResponseLen + APDU_RESPONSE_LEN)
+		{
+			cap = (uint32_t) _maxResponseLen + APDU_RESPONSE_LEN;
+		}
+		uint8_t *buf = (uint8_t *) realloc(state->accumulated, cap);
+		if (buf == nullptr)
+		{
+			return false;
+		}
+		state->accumulated = buf;
+		state->accumulatedCap = (uint16_t) cap;
+	}
+	if (dataLen > 0)
+	{
+		memcpy(state->accumulated + *len, data, dataLen);
+	}
+	*len = (uint16_t) needed;
+	return true;
+}
+
+int SEInterface::transmitError(void)
+{
+	if (_timedOut)
+	{
+		return ERR_TIMEOUT;
+	}
+	if (_responseTooLong)
+	{
+		return ERR_OUT_OF_MEMORY;
+	}
+	return ERR_GENERIC;
+}
+
 /**
  * Get status word from the data response received after the last 
  * successful transmit
@@ -179,11 +829,12 @@ bool SEInterface::transmit(void)
  */
 uint16_t SEInterface::getStatusWord(void)
 {
+	SEResponseState *state = responseState();
 	uint16_t sw = 0;
 
-	if (_apduResponseLen >= 2)
+	if (state->responseLen >= 2)
 	{
-		sw = (_apduResponse[_apduResponseLen - 2] << 8) | _apduResponse[_apduResponseLen - 1];
+		sw = (state->response[state->responseLen - 2] << 8) | state->response[state->responseLen - 1];
 	}
 
 	return sw;
@@ -197,15 +848,15 @@ uint16_t SEInterface::getStatusWord(void)
  */
 uint16_t SEInterface::getResponse(uint8_t *data)
 {
+	SEResponseState *state = responseState();
 	uint16_t len = 0;
 
-	if (_apduResponseLen > 2)
+	if (state->responseLen > 2)
 	{
-		len = _apduResponseLen - 2;
+		len = state->responseLen - 2;
 		if (data)
 		{
-			assert(len <= 255);
-			memcpy(data, _apduResponse, len);
+			memcpy(data, state->response, len);
 		}
 	}
 
@@ -220,18 +871,100 @@ uint16_t SEInterface::getResponse(uint8_t *data)
  */
 uint16_t SEInterface::getResponseLength(void)
 {
+	SEResponseState *state = responseState();
 	uint16_t len = 0;
 
-	if (_apduResponseLen > 2)
+	if (state->responseLen > 2)
 	{
-		len = _apduResponseLen - 2;
+		len = state->responseLen - 2;
 	}
 
 	return len;
 }
 
+/**
+ * Get the response received after the last successful transmit without
+ * copying it. The view is invalidated by the next transmit.
+ * 
+ * @return a view of the response, empty with sw 0 if there is none.
+ */
+SEResponseView SEInterface::getResponseView(void)
+{
+	SEResponseState *state = responseState();
+	SEResponseView view = { nullptr, 0, 0 };
+
+	if (state->responseLen >= 2)
+	{
+		view.dataLen = state->responseLen - 2;
+		view.data = (view.dataLen > 0) ? state->response : nullptr;
+		view.sw = (state->response[view.dataLen] << 8) | state->response[view.dataLen + 1];
+	}
+
+	return view;
+}
+
+/**
+ * Set the deadline applied to each APDU exchange with the Secure Element.
+ * 
+ * @param[in]  timeout deadline in milliseconds, 0 to wait forever
+ */
+void SEInterface::setTimeout(uint32_t timeout)
+{
+	SETransaction transaction(this);
+
+	_timeout = timeout;
+}
+
+/**
+ * Returns the deadline applied to each APDU exchange
+ * 
+ * @return the deadline in milliseconds, 0 if waiting forever.
+ */
+uint32_t SEInterface::getTimeout(void)
+{
+	return _timeout;
+}
+
+/**
+ * Set the largest response data gathered when the Secure Element
+ * announces more data with 61xx. Chunks fetched with GET RESPONSE are
+ * joined in a buffer growing up to this length, so getResponse returns
+ * the whole response; a longer one fails the transmit with
+ * ERR_OUT_OF_MEMORY.
+ * 
+ * @param[in]  maxLen the ceiling in bytes, at most 65533
+ */
+void SEInterface::setMaxResponseLength(uint16_t maxLen)
+{
+	SETransaction transaction(this);
+
+	if (maxLen > 0xFFFF - APDU_RESPONSE_LEN)
+	{
+		maxLen = 0xFFFF - APDU_RESPONSE_LEN;
+	}
+	_maxResponseLen = maxLen;
+}
+
+/**
+ * Returns the largest response data gathered over GET RESPONSE
+ * 
+ * @return the ceiling in bytes.
+ */
+uint16_t SEInterface::getMaxResponseLength(void)
+{
+	return _maxResponseLen;
+}
+
 /** C Accessors	***************************************************************/
 
+extern "C" bool SEInterface_lock(SEInterface* seiface) {
+	return seiface->lock();
+}
+
+extern "C" bool SEInterface_unlock(SEInterface* seiface) {
+	return seiface->unlock();
+}
+
 extern "C" bool SEInterface_transmit_case1(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2) {
 	return seiface->transmit(cla, ins, p1, p2);
 }
@@ -248,6 +981,22 @@ extern "C" bool SEInterface_transmit_case4(SEInterface* seiface, uint8_t cla, ui
 	return seiface->transmit(cla, ins, p1, p2, data, data_len, le);
 }
 
+extern "C" int SEInterface_transmit_extended(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t* data, uint16_t data_len, uint32_t le) {
+	return seiface->transmitExtended(cla, ins, p1, p2, data, data_len, le);
+}
+
+extern "C" void SEInterface_set_extended_length(SEInterface* seiface, uint8_t mode) {
+	seiface->setExtendedLength(mode);
+}
+
+extern "C" int SEInterface_transmit_chained(SEInterface* seiface, uint8_t cla, uint8_t ins, uint8_t p1, uint8_t p2, uint8_t* header, uint16_t header_len, uint8_t* data, uint32_t data_len, uint32_t le, uint8_t chaining) {
+	return seiface->transmitChained(cla, ins, p1, p2, header, header_len, data, data_len, le, chaining);
+}
+
+extern "C" int SEInterface_transmit_batch(SEInterface* seiface, SEBatchCommand* commands, uint16_t count, uint16_t* executed) {
+	return seiface->transmitBatch(commands, count, executed);
+}
+
 extern "C" uint16_t SEInterface_get_status_word(SEInterface* seiface) {
 	return seiface->getStatusWord();
 }
@@ -259,3 +1008,15 @@ extern "C" uint16_t SEInterface_get_response(SEInterface* seiface, uint8_t* data
 extern "C" uint16_t SEInterface_get_response_length(SEInterface* seiface) {
 	return seiface->getResponseLength();
 }
+
+extern "C" SEResponseView SEInterface_get_response_view(SEInterface* seiface) {
+	return seiface->getResponseView();
+}
+
+extern "C" void SEInterface_set_timeout(SEInterface* seiface, uint32_t timeout) {
+	seiface->setTimeout(timeout);
+}
+
+extern "C" void SEInterface_set_max_response_length(SEInterface* seiface, uint16_t max_len) {
+	seiface->setMaxResponseLength(max_len);
+}
@@ -0,0 +1,467 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SEMetrics.h"
+#include <time.h>
+
+struct SEHistogram
+{
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> sum;
+	std::atomic<uint64_t> max;
+	std::atomic<uint64_t> buckets[SE_HISTOGRAM_BUCKETS];
+};
+
+struct SEOperationMetrics
+{
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> errors;
+	SEHistogram latency;
+};
+
+struct SEInsMetrics
+{
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> errors;
+	std::atomic<uint64_t> commandBytes;
+	std::atomic<uint64_t> responseBytes;
+	SEHistogram latency;
+};
+
+std::atomic<bool> seMetricsActive(false);
+
+// Zero initialized, as any object of static storage duration
+static SEOperationMetrics operations[SE_METRICS_OP_COUNT];
+static std::atomic<SEInsMetrics *> insMetrics[256];	// allocated on the first APDU of an INS
+static std::atomic<uint32_t> statusWordKeys[SE_METRICS_MAX_STATUS_WORDS];	// sw + 1, 0 for a free slot
+static std::atomic<uint64_t> statusWordCounts[SE_METRICS_MAX_STATUS_WORDS];
+static std::atomic<uint64_t> otherStatusWords;
+static std::atomic<uint64_t> counters[SE_METRICS_COUNTER_COUNT];
+
+static const char *OPERATION_NAMES[SE_METRICS_OP_COUNT] = {
+	"select", "deselect", "get_certificate", "generate_random", "sign_init", "sign_final",
+	"sign_data", "generate_key_pair", "put_public_key", "compute_dh", "compute_prf"
+};
+
+void seMetricsEnable(bool enable)
+{
+	seMetricsActive.store(enable, std::memory_order_relaxed);
+}
+
+uint64_t seMetricsNow(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static uint32_t bucketOf(uint64_t us)
+{
+	uint32_t exponent;
+
+	if (us < SE_HISTOGRAM_SUB_COUNT)
+	{
+		return (uint32_t) us;
+	}
+	exponent = 63 - __builtin_clzll(us);
+	if (exponent > SE_HISTOGRAM_MAX_EXPONENT)
+	{
+		return SE_HISTOGRAM_BUCKETS - 1;
+	}
+	return (exponent - SE_HISTOGRAM_SUB_BITS + 1) * SE_HISTOGRAM_SUB_COUNT +
+		(uint32_t) (us >> (exponent - SE_HISTOGRAM_SUB_BITS)) - SE_HISTOGRAM_SUB_COUNT;
+}
+
+// Values of a bucket are below this bound, in us
+static uint64_t bucketLimit(uint32_t bucket)
+{
+	uint32_t shift;
+
+	if (bucket < SE_HISTOGRAM_SUB_COUNT)
+	{
+		return bucket + 1;
+	}
+	shift = bucket / SE_HISTOGRAM_SUB_COUNT - 1;
+	return (uint64_t) (SE_HISTOGRAM_SUB_COUNT + bucket % SE_HISTOGRAM_SUB_COUNT + 1) << shift;
+}
+
+static void record(SEHistogram *histogram, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	uint64_t max = histogram->max.load(std::memory_order_relaxed);
+
+	histogram->buckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+	histogram->sum.fetch_add(us, std::memory_order_relaxed);
+	histogram->count.fetch_add(1, std::memory_order_relaxed);
+	while (us > max && !histogram->max.compare_exchange_weak(max, us, std::memory_order_relaxed))
+	{
+	}
+}
+
+void seMetricsRecordOperation(uint8_t operation, uint64_t ns, bool failed)
+{
+	if (operation >= SE_METRICS_OP_COUNT)
+	{
+		return;
+	}
+	operations[operation].count.fetch_add(1, std::memory_order_relaxed);
+	if (failed)
+	{
+		operations[operation].errors.fetch_add(1, std::memory_order_relaxed);
+	}
+	record(&operations[operation].latency, ns);
+}
+
+void seMetricsRecordApdu(uint8_t ins, uint16_t commandLen, uint16_t responseLen, uint64_t ns, bool failed)
+{
+	SEInsMetrics *metrics = insMetrics[ins].load(std::memory_order_acquire);
+	SEInsMetrics *expected = nullptr;
+
+	if (metrics == nullptr)
+	{
+		// First APDU of this INS, another thread may install it first
+		metrics = new SEInsMetrics();
+		if (!insMetrics[ins].compare_exchange_strong(expected, metrics, std::memory_order_acq_rel))
+		{
+			delete metrics;
+			metrics = expected;
+		}
+	}
+	metrics->count.fetch_add(1, std::memory_order_relaxed);
+	if (failed)
+	{
+		metrics->errors.fetch_add(1, std::memory_order_relaxed);
+	}
+	metrics->commandBytes.fetch_add(commandLen, std::memory_order_relaxed);
+	metrics->responseBytes.fetch_add(responseLen, std::memory_order_relaxed);
+	record(&metrics->latency, ns);
+}
+
+void seMetricsRecordStatusWord(uint16_t sw)
+{
+	uint32_t key = (uint32_t) sw + 1;
+	uint32_t slot = (sw ^ (sw >> 8)) % SE_METRICS_MAX_STATUS_WORDS;
+	uint32_t expected;
+	uint32_t i;
+
+	// Open addressing, a slot once taken keeps its status word
+	for (i = 0; i < SE_METRICS_MAX_STATUS_WORDS; i++)
+	{
+		expected = statusWordKeys[slot].load(std::memory_order_relaxed);
+		if (expected == 0)
+		{
+			statusWordKeys[slot].compare_exchange_strong(expected, key, std::memory_order_relaxed);
+			if (expected == 0)
+			{
+				expected = key;
+			}
+		}
+		if (expected == key)
+		{
+			statusWordCounts[slot].fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		slot = (slot + 1) % SE_METRICS_MAX_STATUS_WORDS;
+	}
+	otherStatusWords.fetch_add(1, std::memory_order_relaxed);
+}
+
+void seMetricsAdd(uint8_t counter, uint64_t n)
+{
+	if (counter < SE_METRICS_COUNTER_COUNT)
+	{
+		counters[counter].fetch_add(n, std::memory_order_relaxed);
+	}
+}
+
+static void resetHistogram(SEHistogram *histogram)
+{
+	uint32_t i;
+
+	histogram->count.store(0, std::memory_order_relaxed);
+	histogram->sum.store(0, std::memory_order_relaxed);
+	histogram->max.store(0, std::memory_order_relaxed);
+	for (i = 0; i < SE_HISTOGRAM_BUCKETS; i++)
+	{
+		histogram->buckets[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void seMetricsReset(void)
+{
+	SEInsMetrics *metrics;
+	uint32_t i;
+
+	for (i = 0; i < SE_METRICS_OP_COUNT; i++)
+	{
+		operations[i].count.store(0, std::memory_order_relaxed);
+		operations[i].errors.store(0, std::memory_order_relaxed);
+		resetHistogram(&operations[i].latency);
+	}
+	for (i = 0; i < 256; i++)
+	{
+		metrics = insMetrics[i].load(std::memory_order_acquire);
+		if (metrics != nullptr)
+		{
+			metrics->count.store(0, std::memory_order_relaxed);
+			metrics->errors.store(0, std::memory_order_relaxed);
+			metrics->commandBytes.store(0, std::memory_order_relaxed);
+			metrics->responseBytes.store(0, std::memory_order_relaxed);
+			resetHistogram(&metrics->latency);
+		}
+	}
+	for (i = 0; i < SE_METRICS_MAX_STATUS_WORDS; i++)
+	{
+		statusWordKeys[i].store(0, std::memory_order_relaxed);
+		statusWordCounts[i].store(0, std::memory_order_relaxed);
+	}
+	otherStatusWords.store(0, std::memory_order_relaxed);
+	for (i = 0; i < SE_METRICS_COUNTER_COUNT; i++)
+	{
+		counters[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+static void copyHistogram(const SEHistogram *histogram, SEHistogramSnapshot *snapshot)
+{
+	uint32_t i;
+
+	snapshot->count = histogram->count.load(std::memory_order_relaxed);
+	snapshot->sum = histogram->sum.load(std::memory_order_relaxed);
+	snapshot->max = histogram->max.load(std::memory_order_relaxed);
+	for (i = 0; i < SE_HISTOGRAM_BUCKETS; i++)
+	{
+		snapshot->buckets[i] = histogram->buckets[i].load(std::memory_order_relaxed);
+	}
+}
+
+void seMetricsSnapshot(SEMetricsSnapshot *snapshot)
+{
+	SEInsMetrics *metrics;
+	SEInsSnapshot ins;
+	SEStatusWordCount sw;
+	uint32_t key;
+	uint32_t i;
+	size_t j;
+
+	for (i = 0; i < SE_METRICS_OP_COUNT; i++)
+	{
+		snapshot->operations[i].count = operations[i].count.load(std::memory_order_relaxed);
+		snapshot->operations[i].errors = operations[i].errors.load(std::memory_order_relaxed);
+		copyHistogram(&operations[i].latency, &snapshot->operations[i].latency);
+	}
+
+	snapshot->ins.clear();
+	for (i = 0; i < 256; i++)
+	{
+		metrics = insMetrics[i].load(std::memory_order_acquire);
+		if (metrics == nullptr || metrics->count.load(std::memory_order_relaxed) == 0)
+		{
+			continue;
+		}
+		ins.ins = (uint8_t) i;
+		ins.count = metrics->count.load(std::memory_order_relaxed);
+		ins.errors = metrics->errors.load(std::memory_order_relaxed);
+		ins.commandBytes = metrics->commandBytes.load(std::memory_order_relaxed);
+		ins.responseBytes = metrics->responseBytes.load(std::memory_order_relaxed);
+		copyHistogram(&metrics->latency, &ins.latency);
+		snapshot->ins.push_back(ins);
+	}
+
+	// Insertion sort by status word, a few tens of them
+	snapshot->statusWords.clear();
+	for (i = 0; i < SE_METRICS_MAX_STATUS_WORDS; i++)
+	{
+		key = statusWordKeys[i].load(std::memory_order_relaxed);
+		if (key == 0)
+		{
+			continue;
+		}
+		sw.sw = (uint16_t) (key - 1);
+		sw.count = statusWordCounts[i].load(std::memory_order_relaxed);
+		for (j = snapshot->statusWords.size(); j > 0 && snapshot->statusWords[j - 1].sw > sw.sw; j--)
+		{
+		}
+		snapshot->statusWords.insert(snapshot->statusWords.begin() + j, sw);
+	}
+	snapshot->otherStatusWords = otherStatusWords.load(std::memory_order_relaxed);
+
+	for (i = 0; i < SE_METRICS_COUNTER_COUNT; i++)
+	{
+		snapshot->counters[i] = counters[i].load(std::memory_order_relaxed);
+	}
+}
+
+uint64_t seHistogramPercentile(const SEHistogramSnapshot *histogram, double quantile)
+{
+	uint64_t rank;
+	uint64_t seen = 0;
+	uint64_t limit;
+	uint32_t i;
+
+	if (histogram->count == 0)
+	{
+		return 0;
+	}
+	quantile = (quantile < 0) ? 0 : (quantile > 1) ? 1 : quantile;
+	rank = (uint64_t) (quantile * histogram->count + 0.999999);
+	rank = (rank == 0) ? 1 : rank;
+	for (i = 0; i < SE_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += histogram->buckets[i];
+		if (seen >= rank)
+		{
+			limit = bucketLimit(i) - 1;
+			return (limit < histogram->max) ? limit : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+const char *seMetricsOperationName(uint8_t operation)
+{
+	return (operation < SE_METRICS_OP_COUNT) ? OPERATION_NAMES[operation] : "unknown";
+}
+
+/** Prometheus text exposition ***********************************************/
+
+// Bucket bounds written: powers of two from 16 us to 2^26 us (67 s), which
+// fall on histogram bucket limits
+#define PROMETHEUS_FIRST_EXPONENT 4
+#define PROMETHEUS_LAST_EXPONENT 26
+
+static void writeHeader(FILE *f, const char *name, const char *type, const char *help)
+{
+	fprintf(f, "# HELP iotsafe_%s %s\n# TYPE iotsafe_%s %s\n", name, help, name, type);
+}
+
+static void writeHistogram(FILE *f, const char *name, const char *labels, const SEHistogramSnapshot *histogram)
+{
+	uint64_t cumulative = 0;
+	uint32_t bucket = 0;
+	uint32_t exponent;
+	uint64_t bound;
+
+	for (exponent = PROMETHEUS_FIRST_EXPONENT; exponent <= PROMETHEUS_LAST_EXPONENT; exponent++)
+	{
+		bound = 1ULL << exponent;
+		while (bucket < SE_HISTOGRAM_BUCKETS && bucketLimit(bucket) <= bound)
+		{
+			cumulative += histogram->buckets[bucket++];
+		}
+		fprintf(f, "iotsafe_%s_bucket{%s,le=\"%.9g\"} %llu\n", name, labels, bound / 1e6, (unsigned long long) cumulative);
+	}
+	fprintf(f, "iotsafe_%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels, (unsigned long long) histogram->count);
+	fprintf(f, "iotsafe_%s_sum{%s} %.6f\n", name, labels, histogram->sum / 1e6);
+	fprintf(f, "iotsafe_%s_count{%s} %llu\n", name, labels, (unsigned long long) histogram->count);
+}
+
+bool seMetricsWritePrometheus(const SEMetricsSnapshot *snapshot, FILE *f)
+{
+	static const char *COUNTER_LINES[SE_METRICS_COUNTER_COUNT] = {
+		"apdu_retries_total{status=\"61xx\"}",
+		"apdu_retries_total{status=\"6cxx\"}",
+		"apdu_timeouts_total",
+		"at_commands_total",
+		"at_errors_total",
+		"uart_bytes_total{direction=\"out\"}",
+		"uart_bytes_total{direction=\"in\"}",
+		"cache_lookups_total{result=\"hit\"}",
+		"cache_lookups_total{result=\"miss\"}"
+	};
+	char labels[32];
+	uint32_t i;
+	size_t j;
+
+	writeHeader(f, "operations_total", "counter", "Operations of the ROT and Applet layers.");
+	for (i = 0; i < SE_METRICS_OP_COUNT; i++)
+	{
+		fprintf(f, "iotsafe_operations_total{operation=\"%s\"} %llu\n", OPERATION_NAMES[i],
+			(unsigned long long) snapshot->operations[i].count);
+	}
+	writeHeader(f, "operation_errors_total", "counter", "Operations which failed.");
+	for (i = 0; i < SE_METRICS_OP_COUNT; i++)
+	{
+		fprintf(f, "iotsafe_operation_errors_total{operation=\"%s\"} %llu\n", OPERATION_NAMES[i],
+			(unsigned long long) snapshot->operations[i].errors);
+	}
+	writeHeader(f, "operation_duration_seconds", "histogram", "Duration of the operations.");
+	for (i = 0; i < SE_METRICS_OP_COUNT; i++)
+	{
+		if (snapshot->operations[i].count > 0)
+		{
+			snprintf(labels, sizeof(labels), "operation=\"%s\"", OPERATION_NAMES[i]);
+			writeHistogram(f, "operation_duration_seconds", labels, &snapshot->operations[i].latency);
+		}
+	}
+
+	writeHeader(f, "apdus_total", "counter", "APDU exchanges with the Secure Element by INS.");
+	for (j = 0; j < snapshot->ins.size(); j++)
+	{
+		fprintf(f, "iotsafe_apdus_total{ins=\"%02X\"} %llu\n", snapshot->ins[j].ins, (unsigned long long) snapshot->ins[j].count);
+	}
+	writeHeader(f, "apdu_errors_total", "counter", "APDU exchanges the transport failed by INS.");
+	for (j = 0; j < snapshot->ins.size(); j++)
+	{
+		fprintf(f, "iotsafe_apdu_errors_total{ins=\"%02X\"} %llu\n", snapshot->ins[j].ins, (unsigned long long) snapshot->ins[j].errors);
+	}
+	writeHeader(f, "apdu_command_bytes_total", "counter", "Bytes of the commands by INS.");
+	for (j = 0; j < snapshot->ins.size(); j++)
+	{
+		fprintf(f, "iotsafe_apdu_command_bytes_total{ins=\"%02X\"} %llu\n", snapshot->ins[j].ins, (unsigned long long) snapshot->ins[j].commandBytes);
+	}
+	writeHeader(f, "apdu_response_bytes_total", "counter", "Bytes of the responses by INS, status words included.");
+	for (j = 0; j < snapshot->ins.size(); j++)
+	{
+		fprintf(f, "iotsafe_apdu_response_bytes_total{ins=\"%02X\"} %llu\n", snapshot->ins[j].ins, (unsigned long long) snapshot->ins[j].responseBytes);
+	}
+	writeHeader(f, "apdu_duration_seconds", "histogram", "Duration of the APDU exchanges by INS.");
+	for (j = 0; j < snapshot->ins.size(); j++)
+	{
+		snprintf(labels, sizeof(labels), "ins=\"%02X\"", snapshot->ins[j].ins);
+		writeHistogram(f, "apdu_duration_seconds", labels, &snapshot->ins[j].latency);
+	}
+
+	writeHeader(f, "status_words_total", "counter", "Status words answered by the Secure Element.");
+	for (j = 0; j < snapshot->statusWords.size(); j++)
+	{
+		fprintf(f, "iotsafe_status_words_total{sw=\"%04X\"} %llu\n", snapshot->statusWords[j].sw, (unsigned long long) snapshot->statusWords[j].count);
+	}
+	if (snapshot->otherStatusWords > 0)
+	{
+		fprintf(f, "iotsafe_status_words_total{sw=\"other\"} %llu\n", (unsigned long long) snapshot->otherStatusWords);
+	}
+
+	writeHeader(f, "apdu_retries_total", "counter", "GET RESPONSE after 61xx and commands sent again after 6Cxx.");
+	fprintf(f, "iotsafe_%s %llu\n", COUNTER_LINES[SE_METRICS_RETRIES_61XX], (unsigned long long) snapshot->counters[SE_METRICS_RETRIES_61XX]);
+	fprintf(f, "iotsafe_%s %llu\n", COUNTER_LINES[SE_METRICS_RETRIES_6CXX], (unsigned long long) snapshot->counters[SE_METRICS_RETRIES_6CXX]);
+	writeHeader(f, "apdu_timeouts_total", "counter", "APDU exchanges past their deadline.");
+	fprintf(f, "iotsafe_%s %llu\n", COUNTER_LINES[SE_METRICS_APDU_TIMEOUTS], (unsigned long long) snapshot->counters[SE_METRICS_APDU_TIMEOUTS]);
+	writeHeader(f, "at_commands_total", "counter", "AT+CSIM commands sent to the modem.");
+	fprintf(f, "iotsafe_%s %llu\n", COUNTER_LINES[SE_METRICS_AT_COMMANDS], (unsigned long long) snapshot->counters[SE_METRICS_AT_COMMANDS]);
+	writeHeader(f, "at_errors_total", "counter", "AT+CSIM commands answered ERROR or +CME ERROR.");
+	fprintf(f, "iotsafe_%s %llu\n", COUNTER_LINES[SE_METRICS_AT_ERRORS], (unsigned long long) snapshot->counters[SE_METRICS_AT_ERRORS]);
+	writeHeader(f, "uart_bytes_total", "counter", "Bytes written to and read from the modem UART.");
+	fprintf(f, "iotsafe_%s %llu\n", COUNTER_LINES[SE_METRICS_UART_BYTES_OUT], (unsigned long long) snapshot->counters[SE_METRICS_UART_BYTES_OUT]);
+	fprintf(f, "iotsafe_%s %llu\n", COUNTER_LINES[SE_METRICS_UART_BYTES_IN], (unsigned long long) snapshot->counters[SE_METRICS_UART_BYTES_IN]);
+	writeHeader(f, "cache_lookups_total", "counter", "Files looked up in the ROT container cache.");
+	fprintf(f, "iotsafe_%s %llu\n", COUNTER_LINES[SE_METRICS_CACHE_HITS], (unsigned long long) snapshot->counters[SE_METRICS_CACHE_HITS]);
+	fprintf(f, "iotsafe_%s %llu\n", COUNTER_LINES[SE_METRICS_CACHE_MISSES], (unsigned long long) snapshot->counters[SE_METRICS_CACHE_MISSES]);
+
+	return ferror(f) == 0;
+}
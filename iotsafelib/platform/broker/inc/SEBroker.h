@@ -0,0 +1,150 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_BROKER_H__
+#define __SE_BROKER_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "SEInterface.h"
+#include "SEBrokerProtocol.h"
+#include "SEBrokerShm.h"
+
+#define SE_BROKER_MAX_CLIENTS	16
+#define SE_BROKER_BACKLOG	8
+#define SE_BROKER_CHUNK_LEN	256	// response data handed out per GET RESPONSE
+
+/**
+ * Owner of a Secure Element interface (usually a GenericModem, the only
+ * process which has the modem port open) serving SEBrokerClient
+ * instances of other processes over a Unix domain socket.
+ *
+ * - Each client gets a logical channel of its own, opened on its first
+ *   command and closed when it disconnects. Commands of the client's
+ *   basic channel are sent on it, so the applet state (selection,
+ *   signature context...) of one client is not touched by the others.
+ *   When the Secure Element has no channel left, the client shares the
+ *   basic channel.
+ * - Clients are served round robin, one APDU each per round: a client
+ *   reading a large file does not hold the others off for its duration.
+ * - Each command runs through SEInterface::transmitExtended, so 61xx and
+ *   6Cxx are followed before another client's command is sent. Responses
+ *   larger than a client's receive buffer are handed back through 61xx.
+ * - Clients on the same host (SEShmClient) may attach a shared memory
+ *   region: their commands are then read, and their responses written,
+ *   in place in its rings, the client ringing an eventfd the broker polls
+ *   along with the sockets.
+ *
+ * Serving happens on a background thread between start() and stop(), or
+ * on the calling thread with run().
+ */
+class SEBroker {
+	public:
+		SEBroker(SEInterface* se);
+		~SEBroker(void);
+
+		/**
+		 * Create the listening socket, replacing a stale one.
+		 *
+		 * @param[in]  path socket path, SE_BROKER_DEFAULT_SOCKET if nullptr
+		 * @return true in case of success, false otherwise.
+		 */
+		bool open(const char* path = nullptr);
+
+		/**
+		 * Path of the listening socket
+		 */
+		const char* getSocketName(void);
+
+		/**
+		 * Serve the clients on a background thread.
+		 *
+		 * @return true in case of success, false otherwise.
+		 */
+		bool start(void);
+
+		/**
+		 * Stop the background thread started with start() or make run() return.
+		 */
+		void stop(void);
+
+		/**
+		 * Serve the clients on the calling thread until stop() is called.
+		 */
+		void run(void);
+
+		/**
+		 * Returns the number of clients connected
+		 */
+		uint32_t getClientCount(void);
+
+		/**
+		 * Returns the number of client APDUs sent to the Secure Element
+		 */
+		uint32_t getApduCount(void);
+
+	private:
+		struct Client {
+			int fd;
+			uint8_t request[SE_BROKER_REQUEST_HEADER_LEN + APDU_MAX_CMD_LEN];
+			uint16_t requestLen;	// bytes of the request received so far
+			bool assigned;		// channel below has been opened
+			uint8_t channel;	// channel of the client's basic channel, 0 if none
+			uint32_t opened;	// channels the client opened itself, bit n for channel n
+			uint8_t* pending;	// response data left to hand out through GET RESPONSE
+			uint16_t pendingLen;
+			uint16_t pendingOff;
+			uint16_t pendingSw;
+			SEShmRegion* shm;	// rings of an attached client, nullptr if none
+			int doorbell;		// eventfd the attached client rings
+			bool more;		// requests left in the ring after this round
+			uint32_t seq;		// sequence of the request being served
+			int passed[2];		// descriptors received with the request
+			uint8_t passedCount;
+		};
+
+		static void* serve(void* self);
+
+		void accept(void);
+		bool receive(Client* client);
+		bool attach(Client* client);
+		void closePassed(Client* client);
+		void serveRing(Client* client);
+		void process(Client* client, const uint8_t* apdu, uint16_t apduLen);
+		void drop(Client* client);
+		void assignChannel(Client* client);
+		void trackChannels(Client* client, uint8_t ins, uint8_t p1, uint8_t p2, SEResponseView* view);
+		bool reply(Client* client, uint8_t status, const uint8_t* data, uint16_t dataLen, uint16_t sw);
+		bool replyChunk(Client* client, uint32_t le);
+
+		SEInterface* _se;
+		int _listen;
+		int _wakeup[2];		// self pipe waking the serving thread up on stop()
+		char _path[SE_BROKER_PATH_LEN];
+		pthread_t _thread;
+		bool _running;
+		std::atomic<bool> _stop;
+
+		Client _clients[SE_BROKER_MAX_CLIENTS];
+		uint16_t _next;		// client served first in the next round
+		std::atomic<uint32_t> _clientCount;
+		std::atomic<uint32_t> _apduCount;
+		uint8_t _response[SE_BROKER_RESPONSE_HEADER_LEN + APDU_MAX_RESPONSE_LEN];
+};
+
+#endif /* __SE_BROKER_H__ */
@@ -0,0 +1,65 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_BROKER_CLIENT_H__
+#define __SE_BROKER_CLIENT_H__
+
+#include "SEInterface.h"
+#include "SEBrokerProtocol.h"
+
+
+/**
+ * Secure Element reached through an SEBroker: the APDUs go over the
+ * broker's Unix domain socket instead of a modem port, so several
+ * processes can share one SIM.
+ *
+ * The broker gives each client a logical channel of its own, on which
+ * the commands of the client's basic channel are sent: applets selected
+ * by different clients do not share their state. The broker also
+ * follows 61xx / 6Cxx on the Secure Element side, so no other client's
+ * command can come in between a command and its GET RESPONSE.
+ */
+class SEBrokerClient: public SEInterface {
+	public:
+		SEBrokerClient(void);
+		~SEBrokerClient(void);
+
+		/**
+		 * Connect to the broker.
+		 *
+		 * @param[in]  path socket of the broker, SE_BROKER_DEFAULT_SOCKET if nullptr
+		 * @return true in case of success, false otherwise.
+		 */
+		virtual bool open(const char* path = nullptr);
+
+		/**
+		 * Disconnect from the broker, which closes the client's channels.
+		 */
+		virtual void close(void);
+
+	//protected:
+
+		bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+
+	protected:
+		bool connect(void);
+
+		char _path[SE_BROKER_PATH_LEN];
+		int _fd;
+};
+
+#endif /* __SE_BROKER_CLIENT_H__ */
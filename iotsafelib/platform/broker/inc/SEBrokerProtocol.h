@@ -0,0 +1,80 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_BROKER_PROTOCOL_H__
+#define __SE_BROKER_PROTOCOL_H__
+
+#include <stdint.h>
+#include <time.h>
+
+// Frames exchanged over the broker's Unix domain socket:
+//   request:  <APDU length, 2 bytes big endian> <APDU>
+//   response: <status, 1 byte> <response length, 2 bytes big endian> <response data and SW>
+// A client has at most one request outstanding.
+//
+// A request of length SE_BROKER_ATTACH_SHM carries no APDU but a shared
+// memory region and an eventfd (SCM_RIGHTS): once the broker answered it
+// with SE_BROKER_STATUS_OK the client's APDUs go through the rings of the
+// region (see SEBrokerShm.h), the socket only tells either side the other
+// one is gone.
+
+#define SE_BROKER_DEFAULT_SOCKET	"/tmp/sebroker.sock"
+#define SE_BROKER_PATH_LEN		108	// sun_path
+#define SE_BROKER_WRITE_TIMEOUT		1000	// ms a peer has to make room for a frame
+
+#define SE_BROKER_REQUEST_HEADER_LEN	2
+#define SE_BROKER_RESPONSE_HEADER_LEN	3
+
+#define SE_BROKER_ATTACH_SHM		0xFFFF
+
+#define SE_BROKER_STATUS_OK		0x00	// response follows
+#define SE_BROKER_STATUS_FAILED		0x01	// transport error, or extended APDU not supported
+#define SE_BROKER_STATUS_TIMEOUT	0x02	// the Secure Element did not answer in time
+
+/**
+ * Milliseconds left before a deadline.
+ *
+ * @param[in]  start time the deadline counts from (CLOCK_MONOTONIC)
+ * @param[in]  timeout deadline in ms, 0 waits forever
+ * @return the time left, 0 if the deadline expired, -1 if there is none.
+ */
+int seBrokerRemainingMs(const struct timespec* start, uint32_t timeout);
+
+/**
+ * Write the whole buffer to a socket.
+ *
+ * @param[in]  fd the socket
+ * @param[in]  data bytes to write
+ * @param[in]  len number of bytes
+ * @return true in case of success, false if the peer is gone.
+ */
+bool seBrokerWrite(int fd, const uint8_t* data, unsigned long len);
+
+/**
+ * Read exactly len bytes from a socket before a deadline.
+ *
+ * @param[in]  fd the socket
+ * @param[out]  data receives the bytes
+ * @param[in]  len number of bytes
+ * @param[in]  start time the deadline counts from (CLOCK_MONOTONIC)
+ * @param[in]  timeout deadline in ms, 0 waits forever
+ * @param[out]  timedOut set true if the deadline expired
+ * @return true in case of success, false otherwise.
+ */
+bool seBrokerRead(int fd, uint8_t* data, unsigned long len, const struct timespec* start, uint32_t timeout, bool* timedOut);
+
+#endif /* __SE_BROKER_PROTOCOL_H__ */
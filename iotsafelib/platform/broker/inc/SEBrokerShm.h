@@ -0,0 +1,132 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_BROKER_SHM_H__
+#define __SE_BROKER_SHM_H__
+
+#include <stdint.h>
+#include <atomic>
+
+// Shared memory region of a client attached with SE_BROKER_ATTACH_SHM:
+// one ring carries the client's requests to the broker, the other the
+// broker's responses back. Each ring has a single producer and a single
+// consumer and no lock; frames are written and read in place.
+//
+// Frame: <length, 4 bytes> <sequence, 4 bytes> <payload>, 8 byte aligned
+//   request payload:  <APDU>
+//   response payload: <status, 1 byte> <response data and SW>
+// A response carries the sequence of its request, so the client can tell
+// the late answer to a command which timed out from the current one.
+//
+// Wake ups: the client writes to the eventfd the broker polls after each
+// request; the broker bumps `responses` after each response and wakes the
+// client with a futex on it if the client said it sleeps.
+
+#define SE_SHM_MAGIC		0x49534852	// "ISHR"
+#define SE_SHM_RING_LEN		16384		// power of two, several frames of the largest APDU
+#define SE_SHM_FRAME_HEADER_LEN	8
+#define SE_SHM_MAX_FRAME_LEN	(SE_SHM_RING_LEN / 4)
+#define SE_SHM_SPIN		50		// us a client checks the ring before going to sleep
+#define SE_SHM_HANGUP_CHECK	100		// ms a sleeping client checks the broker is still there
+
+struct SEShmRing {
+	alignas(64) std::atomic<uint32_t> head;	// written by the producer only, free running
+	alignas(64) std::atomic<uint32_t> tail;	// written by the consumer only, free running
+	alignas(64) uint8_t data[SE_SHM_RING_LEN];
+};
+
+struct SEShmRegion {
+	uint32_t magic;
+	uint32_t size;				// sizeof(SEShmRegion), checked by the broker
+	alignas(64) std::atomic<uint32_t> responses;	// futex word, bumped after each response
+	std::atomic<uint32_t> waiting;		// client sleeps on responses
+	SEShmRing request;
+	SEShmRing response;
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32-bit word");
+
+/**
+ * Reset a ring to empty.
+ *
+ * @param[in]  ring the ring
+ */
+void seShmInit(SEShmRing* ring);
+
+/**
+ * Room for the payload of the next frame, written in place before
+ * seShmCommit() publishes it. Producer side.
+ *
+ * @param[in]  ring the ring
+ * @param[in]  len payload length
+ * @return the payload, nullptr if the ring is full or len too large.
+ */
+uint8_t* seShmReserve(SEShmRing* ring, uint32_t len);
+
+/**
+ * Publish the frame returned by seShmReserve(). Producer side.
+ *
+ * @param[in]  ring the ring
+ * @param[in]  len payload length, as reserved
+ * @param[in]  seq sequence of the frame
+ */
+void seShmCommit(SEShmRing* ring, uint32_t len, uint32_t seq);
+
+/**
+ * Oldest frame of the ring, read in place until seShmRelease(). Consumer side.
+ * The frame is checked to lie within the ring, its content is the
+ * producer's.
+ *
+ * @param[in]  ring the ring
+ * @param[out]  data the payload
+ * @param[out]  len payload length
+ * @param[out]  seq sequence of the frame
+ * @return true if there is a frame, false if the ring is empty or corrupt.
+ */
+bool seShmPeek(SEShmRing* ring, const uint8_t** data, uint32_t* len, uint32_t* seq);
+
+/**
+ * Hand the frame returned by seShmPeek() back to the producer. Consumer side.
+ *
+ * @param[in]  ring the ring
+ * @param[in]  len payload length, as peeked
+ */
+void seShmRelease(SEShmRing* ring, uint32_t len);
+
+/**
+ * Returns true if the ring holds no frame
+ */
+bool seShmEmpty(SEShmRing* ring);
+
+/**
+ * Sleep until the word no longer holds the value seen, or for at most
+ * timeout ms. The word may be in memory shared between processes.
+ *
+ * @param[in]  word futex word
+ * @param[in]  seen value of the word when the caller decided to sleep
+ * @param[in]  timeout ms
+ */
+void seShmWait(std::atomic<uint32_t>* word, uint32_t seen, int timeout);
+
+/**
+ * Wake the threads sleeping in seShmWait() on the word.
+ *
+ * @param[in]  word futex word
+ */
+void seShmWake(std::atomic<uint32_t>* word);
+
+#endif /* __SE_BROKER_SHM_H__ */
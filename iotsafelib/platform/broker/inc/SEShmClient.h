@@ -0,0 +1,77 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_SHM_CLIENT_H__
+#define __SE_SHM_CLIENT_H__
+
+#include "SEBrokerClient.h"
+#include "SEBrokerShm.h"
+
+
+/**
+ * SEBrokerClient for a process on the same host as the broker: after
+ * connecting, the client hands the broker a shared memory region and
+ * its APDUs go through the rings of the region instead of the socket.
+ * The broker reads the command and writes the response in place in the
+ * region, waking the client with a futex: no socket read or write per
+ * APDU, and no wake up at all while the client is still spinning on the
+ * response ring.
+ *
+ * A broker which does not take the region is used through the socket,
+ * as by an SEBrokerClient.
+ */
+class SEShmClient: public SEBrokerClient {
+	public:
+		SEShmClient(void);
+		~SEShmClient(void);
+
+		/**
+		 * Connect to the broker and attach the shared memory rings.
+		 *
+		 * @param[in]  path socket of the broker, SE_BROKER_DEFAULT_SOCKET if nullptr
+		 * @return true in case of success, false otherwise.
+		 */
+		bool open(const char* path = nullptr);
+
+		/**
+		 * Detach the rings and disconnect from the broker, which closes the
+		 * client's channels.
+		 */
+		void close(void);
+
+		/**
+		 * Returns true if the APDUs go through shared memory, false if
+		 * through the socket
+		 */
+		bool isAttached(void);
+
+	//protected:
+
+		bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+
+	private:
+		bool attach(void);
+		void detach(void);
+		bool waitResponse(const struct timespec* start);
+
+		SEShmRegion* _shm;
+		int _doorbell;		// eventfd the broker polls
+		uint32_t _seq;		// sequence of the last request
+		bool _spin;		// more than one CPU: spin before sleeping
+};
+
+#endif /* __SE_SHM_CLIENT_H__ */
@@ -0,0 +1,672 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SEBroker.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define INS_GET_RESPONSE	0xC0
+#define INS_MANAGE_CHANNEL	0x70
+#define P1_OPEN_CHANNEL		0x00
+#define P1_CLOSE_CHANNEL	0x80
+
+static_assert(APDU_MAX_CMD_LEN <= SE_SHM_MAX_FRAME_LEN && 1 + APDU_MAX_RESPONSE_LEN <= SE_SHM_MAX_FRAME_LEN,
+	"shared memory frames too small for the APDUs");
+
+// Split a command APDU, short or extended, into its data and Le
+static bool parseApdu(const uint8_t* apdu, uint16_t len, const uint8_t** data, uint16_t* dataLen, uint32_t* le) {
+	uint16_t lc;
+
+	*data = nullptr;
+	*dataLen = 0;
+	*le = 0;
+	if(len < 4) {
+		return false;
+	}
+	if(len == 4) {
+		return true;
+	}
+	if(len == 5) {
+		*le = (apdu[4] != 0) ? apdu[4] : 256;
+		return true;
+	}
+	if(apdu[4] != 0) {
+		lc = apdu[4];
+		if(len != 5 + lc && len != 6 + lc) {
+			return false;
+		}
+		*data = &apdu[5];
+		*dataLen = lc;
+		if(len == 6 + lc) {
+			*le = (apdu[5 + lc] != 0) ? apdu[5 + lc] : 256;
+		}
+		return true;
+	}
+
+	// Extended length: 00 followed by Lc or Le on 2 bytes
+	if(len < 7) {
+		return false;
+	}
+	lc = (uint16_t) ((apdu[5] << 8) | apdu[6]);
+	if(len == 7) {
+		*le = (lc != 0) ? lc : 65536;
+		return true;
+	}
+	if(lc == 0 || (len != 7 + lc && len != 9 + lc)) {
+		return false;
+	}
+	*data = &apdu[7];
+	*dataLen = lc;
+	if(len == 9 + lc) {
+		lc = (uint16_t) ((apdu[7 + lc] << 8) | apdu[8 + lc]);
+		*le = (lc != 0) ? lc : 65536;
+	}
+	return true;
+}
+
+// CLA of a command of the client's basic channel moved to the given channel
+static uint8_t onChannel(uint8_t cla, uint8_t channel) {
+	// Further interindustry classes (channels 4 to 19) and commands already
+	// on a logical channel are sent as they are
+	if(channel == 0 || cla == 0xFF || seClaChannel(cla) != 0) {
+		return cla;
+	}
+	return seClaForChannel(cla, channel);
+}
+
+SEBroker::SEBroker(SEInterface* se) : _stop(false), _clientCount(0), _apduCount(0) {
+	uint16_t i;
+
+	_se = se;
+	_listen = -1;
+	_wakeup[0] = -1;
+	_wakeup[1] = -1;
+	_path[0] = '\0';
+	_running = false;
+	_next = 0;
+	for(i = 0; i < SE_BROKER_MAX_CLIENTS; i++) {
+		_clients[i].fd = -1;
+		_clients[i].pending = nullptr;
+		_clients[i].shm = nullptr;
+		_clients[i].doorbell = -1;
+		_clients[i].passedCount = 0;
+	}
+}
+
+SEBroker::~SEBroker(void) {
+	uint16_t i;
+
+	stop();
+	for(i = 0; i < SE_BROKER_MAX_CLIENTS; i++) {
+		drop(&_clients[i]);
+	}
+	if(_listen >= 0) {
+		::close(_listen);
+		unlink(_path);
+	}
+	if(_wakeup[0] >= 0) {
+		::close(_wakeup[0]);
+		::close(_wakeup[1]);
+	}
+}
+
+bool SEBroker::open(const char* path) {
+	struct sockaddr_un addr;
+	struct stat st;
+
+	if(_listen >= 0) {
+		return true;
+	}
+	if(path == nullptr) {
+		path = SE_BROKER_DEFAULT_SOCKET;
+	}
+	if(strlen(path) >= sizeof(_path) || pipe(_wakeup) != 0) {
+		return false;
+	}
+	snprintf(_path, sizeof(_path), "%s", path);
+
+	// A socket left behind by a broker which did not exit cleanly
+	if(stat(_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		unlink(_path);
+	}
+
+	_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(_listen < 0) {
+		return false;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, _path, strlen(_path) + 1);
+	if(bind(_listen, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(_listen, SE_BROKER_BACKLOG) != 0) {
+		::close(_listen);
+		_listen = -1;
+		return false;
+	}
+	return true;
+}
+
+const char* SEBroker::getSocketName(void) {
+	return _path;
+}
+
+uint32_t SEBroker::getClientCount(void) {
+	return _clientCount.load();
+}
+
+uint32_t SEBroker::getApduCount(void) {
+	return _apduCount.load();
+}
+
+bool SEBroker::start(void) {
+	if(_running || _listen < 0) {
+		return _running;
+	}
+	_stop = false;
+	if(pthread_create(&_thread, nullptr, serve, this) != 0) {
+		return false;
+	}
+	_running = true;
+	return true;
+}
+
+void SEBroker::stop(void) {
+	char c = 0;
+
+	_stop = true;
+	if(_wakeup[1] >= 0) {
+		if(::write(_wakeup[1], &c, 1) < 0) {
+			// The serving thread polls _stop as well
+		}
+	}
+	if(_running) {
+		pthread_join(_thread, nullptr);
+		_running = false;
+	}
+	// Drain the wake up byte
+	if(_wakeup[0] >= 0) {
+		struct pollfd fd = { _wakeup[0], POLLIN, 0 };
+		while(poll(&fd, 1, 0) > 0 && ::read(_wakeup[0], &c, 1) > 0) {
+		}
+	}
+}
+
+void* SEBroker::serve(void* self) {
+	((SEBroker*) self)->run();
+	return nullptr;
+}
+
+void SEBroker::run(void) {
+	struct pollfd fds[2 + 2 * SE_BROKER_MAX_CLIENTS];
+	int slot[SE_BROKER_MAX_CLIENTS];	// pollfd of each client, -1 if none
+	int bell[SE_BROKER_MAX_CLIENTS];	// pollfd of each client's doorbell, -1 if none
+	nfds_t count;
+	bool more;
+	uint16_t apduLen;
+	uint16_t i;
+	uint16_t k;
+
+	if(_listen < 0) {
+		return;
+	}
+	_stop = false;
+	fds[0].fd = _listen;
+	fds[0].events = POLLIN;
+	fds[1].fd = _wakeup[0];
+	fds[1].events = POLLIN;
+
+	while(!_stop) {
+		count = 2;
+		more = false;
+		for(i = 0; i < SE_BROKER_MAX_CLIENTS; i++) {
+			slot[i] = -1;
+			bell[i] = -1;
+			if(_clients[i].fd >= 0) {
+				slot[i] = (int) count;
+				fds[count].fd = _clients[i].fd;
+				fds[count].events = POLLIN;
+				fds[count].revents = 0;
+				count++;
+			}
+			if(_clients[i].fd >= 0 && _clients[i].shm != nullptr) {
+				bell[i] = (int) count;
+				fds[count].fd = _clients[i].doorbell;
+				fds[count].events = POLLIN;
+				fds[count].revents = 0;
+				count++;
+				more = more || _clients[i].more;
+			}
+		}
+		// Requests already in a ring are not rung for again
+		if(poll(fds, count, more ? 0 : -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if(fds[1].revents) {
+			break;
+		}
+
+		// One APDU per client and per round, the first one served rotating:
+		// each request is read up to its end only, what the client sent
+		// next waits for the following round
+		for(k = 0; k < SE_BROKER_MAX_CLIENTS; k++) {
+			i = (uint16_t) ((_next + k) % SE_BROKER_MAX_CLIENTS);
+			if(slot[i] < 0) {
+				continue;
+			}
+			if(_clients[i].shm != nullptr) {
+				// Nothing but the end of the connection comes on the socket
+				if(fds[slot[i]].revents != 0) {
+					drop(&_clients[i]);
+				}
+				else if(fds[bell[i]].revents != 0 || _clients[i].more) {
+					serveRing(&_clients[i]);
+				}
+				continue;
+			}
+			if(fds[slot[i]].revents == 0) {
+				continue;
+			}
+			if(!receive(&_clients[i])) {
+				drop(&_clients[i]);
+				continue;
+			}
+			if(_clients[i].requestLen < SE_BROKER_REQUEST_HEADER_LEN) {
+				continue;
+			}
+			apduLen = (uint16_t) ((_clients[i].request[0] << 8) | _clients[i].request[1]);
+			if(apduLen == SE_BROKER_ATTACH_SHM) {
+				if(!attach(&_clients[i])) {
+					drop(&_clients[i]);
+				}
+			}
+			else if(_clients[i].requestLen == SE_BROKER_REQUEST_HEADER_LEN + apduLen) {
+				_clients[i].requestLen = 0;
+				closePassed(&_clients[i]);
+				process(&_clients[i], _clients[i].request + SE_BROKER_REQUEST_HEADER_LEN, apduLen);
+			}
+		}
+		_next = (uint16_t) ((_next + 1) % SE_BROKER_MAX_CLIENTS);
+
+		if(fds[0].revents & POLLIN) {
+			accept();
+		}
+	}
+}
+
+void SEBroker::accept(void) {
+	int fd;
+	uint16_t i;
+
+	fd = ::accept4(_listen, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if(fd < 0) {
+		return;
+	}
+	for(i = 0; i < SE_BROKER_MAX_CLIENTS; i++) {
+		if(_clients[i].fd < 0) {
+			break;
+		}
+	}
+	if(i == SE_BROKER_MAX_CLIENTS) {
+		::close(fd);
+		return;
+	}
+	_clients[i].fd = fd;
+	_clients[i].requestLen = 0;
+	_clients[i].assigned = false;
+	_clients[i].channel = 0;
+	_clients[i].opened = 0;
+	_clients[i].pending = nullptr;
+	_clients[i].pendingLen = 0;
+	_clients[i].pendingOff = 0;
+	_clients[i].pendingSw = 0;
+	_clients[i].shm = nullptr;
+	_clients[i].doorbell = -1;
+	_clients[i].more = false;
+	_clients[i].seq = 0;
+	_clients[i].passedCount = 0;
+	_clientCount++;
+}
+
+// Read what has come of the request, never past its end, and the
+// descriptors passed along; false if the client is gone or sent a
+// request too large
+bool SEBroker::receive(Client* client) {
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr* cmsg;
+	unsigned long want;
+	unsigned long apduLen;
+	unsigned long j;
+	int fd;
+	ssize_t n;
+
+	for(;;) {
+		if(client->requestLen < SE_BROKER_REQUEST_HEADER_LEN) {
+			want = SE_BROKER_REQUEST_HEADER_LEN - client->requestLen;
+		}
+		else {
+			apduLen = (client->request[0] << 8) | client->request[1];
+			if(apduLen == SE_BROKER_ATTACH_SHM) {
+				return true;
+			}
+			if(apduLen > APDU_MAX_CMD_LEN) {
+				return false;
+			}
+			want = SE_BROKER_REQUEST_HEADER_LEN + apduLen - client->requestLen;
+			if(want == 0) {
+				return true;
+			}
+		}
+
+		iov.iov_base = client->request + client->requestLen;
+		iov.iov_len = want;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		n = recvmsg(client->fd, &msg, MSG_CMSG_CLOEXEC);
+		if(n > 0) {
+			for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+				if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+					continue;
+				}
+				for(j = 0; j < (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int); j++) {
+					memcpy(&fd, CMSG_DATA(cmsg) + j * sizeof(int), sizeof(int));
+					if(client->passedCount < 2) {
+						client->passed[client->passedCount++] = fd;
+					}
+					else {
+						::close(fd);
+					}
+				}
+			}
+		}
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return true;
+		}
+		if(n <= 0) {
+			return false;
+		}
+		client->requestLen += (uint16_t) n;
+	}
+}
+
+void SEBroker::process(Client* client, const uint8_t* apdu, uint16_t apduLen) {
+	const uint8_t* data;
+	uint16_t dataLen;
+	uint32_t le;
+	SEResponseView view;
+	int ret;
+	bool ok;
+
+	if(!parseApdu(apdu, apduLen, &data, &dataLen, &le)) {
+		ok = reply(client, SE_BROKER_STATUS_FAILED, nullptr, 0, 0);
+	}
+	else if(apdu[1] == INS_GET_RESPONSE && client->pending != nullptr) {
+		ok = replyChunk(client, le);
+	}
+	else {
+		free(client->pending);
+		client->pending = nullptr;
+		if(!client->assigned) {
+			assignChannel(client);
+		}
+
+		ret = _se->transmitExtended(onChannel(apdu[0], client->channel), apdu[1], apdu[2], apdu[3], data, dataLen, le);
+		_apduCount++;
+		if(ret != ERR_NOERR) {
+			ok = reply(client, (ret == ERR_TIMEOUT) ? SE_BROKER_STATUS_TIMEOUT : SE_BROKER_STATUS_FAILED, nullptr, 0, 0);
+		}
+		else {
+			view = _se->getResponseView();
+			trackChannels(client, apdu[1], apdu[2], apdu[3], &view);
+			if(view.dataLen + APDU_RESPONSE_LEN <= APDU_MAX_RESPONSE_LEN) {
+				ok = reply(client, SE_BROKER_STATUS_OK, view.data, view.dataLen, view.sw);
+			}
+			else {
+				// More than the client can receive at once, handed out through 61xx
+				client->pending = (uint8_t*) malloc(view.dataLen);
+				if(client->pending == nullptr) {
+					ok = reply(client, SE_BROKER_STATUS_FAILED, nullptr, 0, 0);
+				}
+				else {
+					memcpy(client->pending, view.data, view.dataLen);
+					client->pendingLen = view.dataLen;
+					client->pendingOff = 0;
+					client->pendingSw = view.sw;
+					ok = replyChunk(client, SE_BROKER_CHUNK_LEN);
+				}
+			}
+		}
+	}
+
+	if(!ok) {
+		drop(client);
+	}
+}
+
+bool SEBroker::reply(Client* client, uint8_t status, const uint8_t* data, uint16_t dataLen, uint16_t sw) {
+	uint16_t len = (status == SE_BROKER_STATUS_OK) ? dataLen + APDU_RESPONSE_LEN : 0;
+	uint16_t headerLen = SE_BROKER_RESPONSE_HEADER_LEN;
+	uint8_t* frame = _response;
+
+	// Written in place in the ring of an attached client
+	if(client->shm != nullptr) {
+		headerLen = 1;
+		frame = seShmReserve(&client->shm->response, headerLen + len);
+		if(frame == nullptr) {
+			return false;
+		}
+	}
+	if(status == SE_BROKER_STATUS_OK) {
+		if(dataLen > 0) {
+			memcpy(&frame[headerLen], data, dataLen);
+		}
+		frame[headerLen + dataLen] = (uint8_t) (sw >> 8);
+		frame[headerLen + dataLen + 1] = (uint8_t) sw;
+	}
+	frame[0] = status;
+	if(client->shm == nullptr) {
+		frame[1] = (uint8_t) (len >> 8);
+		frame[2] = (uint8_t) len;
+		return seBrokerWrite(client->fd, frame, headerLen + len);
+	}
+
+	seShmCommit(&client->shm->response, headerLen + len, client->seq);
+	client->shm->responses.fetch_add(1);
+	if(client->shm->waiting.load() != 0) {
+		seShmWake(&client->shm->responses);
+	}
+	return true;
+}
+
+// Map the region passed with an SE_BROKER_ATTACH_SHM request; false if
+// the client is gone
+bool SEBroker::attach(Client* client) {
+	SEShmRegion* shm = nullptr;
+	struct stat st;
+	void* region;
+	int doorbell = -1;
+	bool ok;
+
+	client->requestLen = 0;
+	if(client->passedCount == 2 && fstat(client->passed[0], &st) == 0 &&
+		(unsigned long) st.st_size >= sizeof(SEShmRegion) &&
+		fcntl(client->passed[1], F_SETFL, O_NONBLOCK) == 0) {
+		region = mmap(nullptr, sizeof(SEShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, client->passed[0], 0);
+		if(region != MAP_FAILED) {
+			shm = (SEShmRegion*) region;
+			if(shm->magic != SE_SHM_MAGIC || shm->size != sizeof(SEShmRegion)) {
+				munmap(region, sizeof(SEShmRegion));
+				shm = nullptr;
+			}
+		}
+	}
+	if(shm != nullptr) {
+		doorbell = client->passed[1];
+		client->passedCount = 1;
+	}
+	closePassed(client);
+
+	// Answered on the socket, what follows goes through the rings
+	ok = reply(client, (shm != nullptr) ? SE_BROKER_STATUS_OK : SE_BROKER_STATUS_FAILED, nullptr, 0, 0);
+	if(ok && shm != nullptr) {
+		client->shm = shm;
+		client->doorbell = doorbell;
+		client->more = false;
+	}
+	else if(shm != nullptr) {
+		munmap(shm, sizeof(SEShmRegion));
+		::close(doorbell);
+	}
+	return ok;
+}
+
+void SEBroker::closePassed(Client* client) {
+	while(client->passedCount > 0) {
+		::close(client->passed[--client->passedCount]);
+	}
+}
+
+// Serve the next request of an attached client's ring, read in place
+void SEBroker::serveRing(Client* client) {
+	const uint8_t* apdu;
+	uint64_t rung;
+	uint32_t len;
+
+	if(::read(client->doorbell, &rung, sizeof(rung)) < 0) {
+		// Not rung, requests left from the previous round
+	}
+	if(!seShmPeek(&client->shm->request, &apdu, &len, &client->seq)) {
+		client->more = false;
+		if(!seShmEmpty(&client->shm->request)) {
+			drop(client);
+		}
+		return;
+	}
+	if(len > APDU_MAX_CMD_LEN) {
+		drop(client);
+		return;
+	}
+	process(client, apdu, (uint16_t) len);
+	if(client->fd < 0) {
+		return;
+	}
+	seShmRelease(&client->shm->request, len);
+	client->more = !seShmEmpty(&client->shm->request);
+}
+
+// Next part of a pending response, 61xx while more remains
+bool SEBroker::replyChunk(Client* client, uint32_t le) {
+	uint16_t left = client->pendingLen - client->pendingOff;
+	uint16_t chunk = (left < SE_BROKER_CHUNK_LEN) ? left : SE_BROKER_CHUNK_LEN;
+	uint16_t sw = client->pendingSw;
+	const uint8_t* data = client->pending + client->pendingOff;
+	bool ok;
+
+	if(le > 0 && le < chunk) {
+		chunk = (uint16_t) le;
+	}
+	left -= chunk;
+	if(left > 0) {
+		sw = SW_DATA_AVAILABLE | ((left < SE_BROKER_CHUNK_LEN) ? left : 0x00);
+	}
+	ok = reply(client, SE_BROKER_STATUS_OK, data, chunk, sw);
+	client->pendingOff += chunk;
+	if(left == 0) {
+		free(client->pending);
+		client->pending = nullptr;
+	}
+	return ok;
+}
+
+// Open the logical channel the client's basic channel commands go to
+void SEBroker::assignChannel(Client* client) {
+	SEResponseView view;
+
+	client->assigned = true;
+	client->channel = 0;
+	if(_se->transmit(0x00, INS_MANAGE_CHANNEL, P1_OPEN_CHANNEL, 0x00, 0x01) == ERR_NOERR) {
+		view = _se->getResponseView();
+		if(view.sw == SW_EXECUTION_OK && view.dataLen == 1) {
+			client->channel = view.data[0];
+		}
+	}
+}
+
+// Remember the channels the client opens, to close them if it disconnects
+void SEBroker::trackChannels(Client* client, uint8_t ins, uint8_t p1, uint8_t p2, SEResponseView* view) {
+	if(ins != INS_MANAGE_CHANNEL || view->sw != SW_EXECUTION_OK) {
+		return;
+	}
+	if(p1 == P1_OPEN_CHANNEL) {
+		if(p2 != 0) {
+			client->opened |= 1UL << (p2 & 0x1F);
+		}
+		else if(view->dataLen == 1) {
+			client->opened |= 1UL << (view->data[0] & 0x1F);
+		}
+	}
+	else if(p1 == P1_CLOSE_CHANNEL) {
+		client->opened &= ~(1UL << (p2 & 0x1F));
+	}
+}
+
+void SEBroker::drop(Client* client) {
+	uint8_t channel;
+
+	if(client->fd < 0) {
+		return;
+	}
+	::close(client->fd);
+	client->fd = -1;
+	free(client->pending);
+	client->pending = nullptr;
+	closePassed(client);
+	if(client->shm != nullptr) {
+		munmap(client->shm, sizeof(SEShmRegion));
+		client->shm = nullptr;
+		::close(client->doorbell);
+		client->doorbell = -1;
+	}
+
+	for(channel = 1; channel < 32; channel++) {
+		if((client->opened & (1UL << channel)) && channel != client->channel) {
+			_se->transmit(0x00, INS_MANAGE_CHANNEL, P1_CLOSE_CHANNEL, channel);
+		}
+	}
+	if(client->channel != 0) {
+		_se->transmit(0x00, INS_MANAGE_CHANNEL, P1_CLOSE_CHANNEL, client->channel);
+	}
+	_clientCount--;
+}
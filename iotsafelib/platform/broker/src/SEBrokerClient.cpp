@@ -0,0 +1,121 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SEBrokerClient.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+SEBrokerClient::SEBrokerClient(void) {
+	_path[0] = '\0';
+	_fd = -1;
+}
+
+SEBrokerClient::~SEBrokerClient(void) {
+	close();
+}
+
+bool SEBrokerClient::open(const char* path) {
+	SETransaction transaction(this);
+
+	if(path == nullptr) {
+		path = SE_BROKER_DEFAULT_SOCKET;
+	}
+	if(strlen(path) >= sizeof(_path)) {
+		return false;
+	}
+	close();
+	snprintf(_path, sizeof(_path), "%s", path);
+	return connect();
+}
+
+void SEBrokerClient::close(void) {
+	SETransaction transaction(this);
+
+	if(_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+}
+
+bool SEBrokerClient::connect(void) {
+	struct sockaddr_un addr;
+
+	_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(_fd < 0) {
+		return false;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, _path, strlen(_path) + 1);
+	if(::connect(_fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+		::close(_fd);
+		_fd = -1;
+		return false;
+	}
+	return true;
+}
+
+bool SEBrokerClient::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+	uint8_t header[SE_BROKER_RESPONSE_HEADER_LEN];
+	uint16_t responseMax = *responseLen;
+	uint16_t len;
+	struct timespec start;
+	bool ok;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	_timedOut = false;
+	*responseLen = 0;
+
+	// Connection lost, or dropped after a timeout: the answer to the
+	// command which timed out must not be taken for this one's
+	if(_fd < 0 && (_path[0] == '\0' || !connect())) {
+		return false;
+	}
+
+	header[0] = (uint8_t) (apduLen >> 8);
+	header[1] = (uint8_t) apduLen;
+	if(!seBrokerWrite(_fd, header, SE_BROKER_REQUEST_HEADER_LEN) || !seBrokerWrite(_fd, apdu, apduLen)) {
+		close();
+		return false;
+	}
+
+	ok = seBrokerRead(_fd, header, SE_BROKER_RESPONSE_HEADER_LEN, &start, _timeout, &_timedOut);
+	len = (uint16_t) ((header[1] << 8) | header[2]);
+	if(ok && len > responseMax) {
+		ok = false;
+	}
+	if(ok && len > 0) {
+		ok = seBrokerRead(_fd, response, len, &start, _timeout, &_timedOut);
+	}
+	if(!ok) {
+		close();
+		return false;
+	}
+
+	if(header[0] == SE_BROKER_STATUS_TIMEOUT) {
+		_timedOut = true;
+		return false;
+	}
+	if(header[0] != SE_BROKER_STATUS_OK) {
+		return false;
+	}
+	*responseLen = len;
+	return true;
+}
@@ -0,0 +1,90 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SEBrokerProtocol.h"
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int seBrokerRemainingMs(const struct timespec* start, uint32_t timeout) {
+	struct timespec now;
+	long long left;
+
+	if(timeout == 0) {
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left = (long long) timeout -
+		((now.tv_sec - start->tv_sec) * 1000LL + (now.tv_nsec - start->tv_nsec) / 1000000LL);
+	return (left > 0) ? (int) left : 0;
+}
+
+bool seBrokerWrite(int fd, const uint8_t* data, unsigned long len) {
+	unsigned long off = 0;
+	ssize_t n;
+
+	while(off < len) {
+		n = send(fd, data + off, len - off, MSG_NOSIGNAL);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			// Non blocking socket: a peer which does not read is given up on
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				struct pollfd pfd = { fd, POLLOUT, 0 };
+				if(poll(&pfd, 1, SE_BROKER_WRITE_TIMEOUT) > 0) {
+					continue;
+				}
+			}
+			return false;
+		}
+		off += (unsigned long) n;
+	}
+	return true;
+}
+
+bool seBrokerRead(int fd, uint8_t* data, unsigned long len, const struct timespec* start, uint32_t timeout, bool* timedOut) {
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	unsigned long off = 0;
+	ssize_t n;
+	int ret;
+
+	*timedOut = false;
+	while(off < len) {
+		ret = poll(&pfd, 1, seBrokerRemainingMs(start, timeout));
+		if(ret < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		if(ret == 0) {
+			*timedOut = true;
+			return false;
+		}
+		n = ::read(fd, data + off, len - off);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			return false;
+		}
+		off += (unsigned long) n;
+	}
+	return true;
+}
@@ -0,0 +1,124 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SEBrokerShm.h"
+#include <string.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SE_SHM_WRAP	0xFFFFFFFF	// frame length of the filler up to the end of the ring
+
+static uint32_t frameSize(uint32_t len) {
+	return (SE_SHM_FRAME_HEADER_LEN + len + 7) & ~7U;
+}
+
+void seShmInit(SEShmRing* ring) {
+	ring->head.store(0);
+	ring->tail.store(0);
+}
+
+// Offset of the frame of the given size from the head, 0 if it fits
+// before the end of the ring and the room up to the end otherwise
+static uint32_t wrapSkip(uint32_t head, uint32_t size) {
+	uint32_t end = SE_SHM_RING_LEN - (head & (SE_SHM_RING_LEN - 1));
+
+	return (size > end) ? end : 0;
+}
+
+uint8_t* seShmReserve(SEShmRing* ring, uint32_t len) {
+	uint32_t head = ring->head.load(std::memory_order_relaxed);
+	uint32_t tail = ring->tail.load(std::memory_order_acquire);
+	uint32_t size = frameSize(len);
+	uint32_t skip = wrapSkip(head, size);
+
+	if(len > SE_SHM_MAX_FRAME_LEN || skip + size > SE_SHM_RING_LEN - (head - tail)) {
+		return nullptr;
+	}
+	return &ring->data[((head + skip) & (SE_SHM_RING_LEN - 1)) + SE_SHM_FRAME_HEADER_LEN];
+}
+
+void seShmCommit(SEShmRing* ring, uint32_t len, uint32_t seq) {
+	uint32_t head = ring->head.load(std::memory_order_relaxed);
+	uint32_t size = frameSize(len);
+	uint32_t skip = wrapSkip(head, size);
+	uint32_t header[2];
+
+	if(skip > 0) {
+		header[0] = SE_SHM_WRAP;
+		header[1] = 0;
+		memcpy(&ring->data[head & (SE_SHM_RING_LEN - 1)], header, sizeof(header));
+	}
+	header[0] = len;
+	header[1] = seq;
+	memcpy(&ring->data[(head + skip) & (SE_SHM_RING_LEN - 1)], header, sizeof(header));
+	ring->head.store(head + skip + size, std::memory_order_release);
+}
+
+bool seShmPeek(SEShmRing* ring, const uint8_t** data, uint32_t* len, uint32_t* seq) {
+	uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+	uint32_t head = ring->head.load(std::memory_order_acquire);
+	uint32_t header[2];
+	uint32_t offset;
+
+	// The header is copied out once: the producer may be another process,
+	// what is checked must be what is used
+	for(;;) {
+		if(head == tail || head - tail > SE_SHM_RING_LEN) {
+			return false;
+		}
+		offset = tail & (SE_SHM_RING_LEN - 1);
+		memcpy(header, &ring->data[offset], sizeof(header));
+		if(header[0] != SE_SHM_WRAP) {
+			break;
+		}
+		tail += SE_SHM_RING_LEN - offset;
+		ring->tail.store(tail, std::memory_order_release);
+	}
+	if(header[0] > SE_SHM_MAX_FRAME_LEN || frameSize(header[0]) > head - tail ||
+		offset + frameSize(header[0]) > SE_SHM_RING_LEN) {
+		return false;
+	}
+	*data = &ring->data[offset + SE_SHM_FRAME_HEADER_LEN];
+	*len = header[0];
+	*seq = header[1];
+	return true;
+}
+
+void seShmRelease(SEShmRing* ring, uint32_t len) {
+	uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+
+	ring->tail.store(tail + frameSize(len), std::memory_order_release);
+}
+
+bool seShmEmpty(SEShmRing* ring) {
+	return ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed);
+}
+
+void seShmWait(std::atomic<uint32_t>* word, uint32_t seen, int timeout) {
+	struct timespec ts;
+
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (long) (timeout % 1000) * 1000000L;
+	// Not FUTEX_PRIVATE_FLAG: the waker is another process
+	syscall(SYS_futex, (uint32_t*) word, FUTEX_WAIT, seen, &ts, nullptr, 0);
+}
+
+void seShmWake(std::atomic<uint32_t>* word) {
+	syscall(SYS_futex, (uint32_t*) word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
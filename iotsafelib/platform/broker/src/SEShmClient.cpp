@@ -0,0 +1,271 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SEShmClient.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+SEShmClient::SEShmClient(void) {
+	_shm = nullptr;
+	_doorbell = -1;
+	_seq = 0;
+	// On a single CPU the broker cannot answer while the client spins
+	_spin = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+}
+
+SEShmClient::~SEShmClient(void) {
+	close();
+}
+
+bool SEShmClient::open(const char* path) {
+	SETransaction transaction(this);
+
+	if(!SEBrokerClient::open(path)) {
+		return false;
+	}
+	// Through the socket if the broker does not take the rings
+	attach();
+	return true;
+}
+
+void SEShmClient::close(void) {
+	SETransaction transaction(this);
+
+	detach();
+	SEBrokerClient::close();
+}
+
+bool SEShmClient::isAttached(void) {
+	SETransaction transaction(this);
+
+	return _shm != nullptr;
+}
+
+bool SEShmClient::attach(void) {
+	uint8_t header[SE_BROKER_RESPONSE_HEADER_LEN];
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	char name[64];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr* cmsg;
+	struct timespec start;
+	int fds[2];
+	void* region;
+	bool timedOut;
+	bool ok;
+
+	// Only the broker gets to the region, through the descriptor passed
+	snprintf(name, sizeof(name), "/iotsafe-%d-%p", (int) getpid(), (void*) this);
+	fds[0] = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if(fds[0] < 0) {
+		return false;
+	}
+	shm_unlink(name);
+	region = MAP_FAILED;
+	if(ftruncate(fds[0], sizeof(SEShmRegion)) == 0) {
+		region = mmap(nullptr, sizeof(SEShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	}
+	_doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(region == MAP_FAILED || _doorbell < 0) {
+		if(region != MAP_FAILED) {
+			munmap(region, sizeof(SEShmRegion));
+		}
+		::close(fds[0]);
+		detach();
+		return false;
+	}
+	_shm = (SEShmRegion*) region;
+	_shm->magic = SE_SHM_MAGIC;
+	_shm->size = sizeof(SEShmRegion);
+	_shm->responses.store(0);
+	_shm->waiting.store(0);
+	seShmInit(&_shm->request);
+	seShmInit(&_shm->response);
+	fds[1] = _doorbell;
+
+	header[0] = (uint8_t) (SE_BROKER_ATTACH_SHM >> 8);
+	header[1] = (uint8_t) SE_BROKER_ATTACH_SHM;
+	iov.iov_base = header;
+	iov.iov_len = SE_BROKER_REQUEST_HEADER_LEN;
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	ok = sendmsg(_fd, &msg, MSG_NOSIGNAL) == SE_BROKER_REQUEST_HEADER_LEN;
+	::close(fds[0]);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if(ok) {
+		ok = seBrokerRead(_fd, header, SE_BROKER_RESPONSE_HEADER_LEN, &start, SE_BROKER_WRITE_TIMEOUT, &timedOut);
+	}
+	if(!ok) {
+		// A broker which does not know the request drops the connection
+		detach();
+		SEBrokerClient::close();
+		connect();
+		return false;
+	}
+	if(header[0] != SE_BROKER_STATUS_OK) {
+		detach();
+		return false;
+	}
+	return true;
+}
+
+void SEShmClient::detach(void) {
+	if(_shm != nullptr) {
+		munmap(_shm, sizeof(SEShmRegion));
+		_shm = nullptr;
+	}
+	if(_doorbell >= 0) {
+		::close(_doorbell);
+		_doorbell = -1;
+	}
+}
+
+// Spin on the response ring a little, then sleep on the futex; false on
+// timeout or if the broker is gone
+bool SEShmClient::waitResponse(const struct timespec* start) {
+	struct timespec spin;
+	struct timespec now;
+	struct pollfd pfd;
+	uint32_t seen;
+	int left;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &spin);
+	for(i = 0; _spin; i++) {
+		if(!seShmEmpty(&_shm->response)) {
+			return true;
+		}
+		if((i & 0x3F) == 0x3F) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if((now.tv_sec - spin.tv_sec) * 1000000L + (now.tv_nsec - spin.tv_nsec) / 1000L >= SE_SHM_SPIN) {
+				break;
+			}
+		}
+	}
+	for(;;) {
+		// Said before looking at the ring: a response committed after the
+		// look bumps the word and wakes the client, or makes it not sleep
+		_shm->waiting.store(1);
+		seen = _shm->responses.load();
+		if(!seShmEmpty(&_shm->response)) {
+			_shm->waiting.store(0);
+			return true;
+		}
+		left = seBrokerRemainingMs(start, _timeout);
+		if(left == 0) {
+			_shm->waiting.store(0);
+			_timedOut = true;
+			return false;
+		}
+		if(left < 0 || left > SE_SHM_HANGUP_CHECK) {
+			left = SE_SHM_HANGUP_CHECK;
+		}
+		seShmWait(&_shm->responses, seen, left);
+		_shm->waiting.store(0);
+		if(!seShmEmpty(&_shm->response)) {
+			return true;
+		}
+
+		// The broker writes nothing to the socket of an attached client,
+		// it becomes readable when the broker is gone
+		pfd.fd = _fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if(poll(&pfd, 1, 0) != 0) {
+			close();
+			return false;
+		}
+	}
+}
+
+bool SEShmClient::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+	uint16_t responseMax = *responseLen;
+	const uint8_t* data;
+	uint8_t* slot;
+	uint32_t len;
+	uint32_t seq;
+	uint8_t status;
+	uint64_t one = 1;
+	struct timespec start;
+	bool ok;
+
+	// Connection lost: connect again and attach new rings
+	if(_shm == nullptr && _fd < 0 && _path[0] != '\0' && connect()) {
+		attach();
+	}
+	if(_shm == nullptr) {
+		return SEBrokerClient::transmitApdu(apdu, apduLen, response, responseLen);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	_timedOut = false;
+	*responseLen = 0;
+
+	slot = seShmReserve(&_shm->request, apduLen);
+	if(slot == nullptr) {
+		return false;
+	}
+	memcpy(slot, apdu, apduLen);
+	seShmCommit(&_shm->request, apduLen, ++_seq);
+	if(::write(_doorbell, &one, sizeof(one)) < 0) {
+		// Only fails if the counter is full: the broker has been woken up already
+	}
+
+	for(;;) {
+		if(!waitResponse(&start)) {
+			return false;
+		}
+		while(seShmPeek(&_shm->response, &data, &len, &seq)) {
+			if(seq != _seq || len < 1) {
+				// Late answer to a command which timed out
+				seShmRelease(&_shm->response, len);
+				continue;
+			}
+			status = data[0];
+			ok = (status == SE_BROKER_STATUS_OK) && (len - 1 <= responseMax);
+			if(ok) {
+				memcpy(response, data + 1, len - 1);
+				*responseLen = (uint16_t) (len - 1);
+			}
+			if(status == SE_BROKER_STATUS_TIMEOUT) {
+				_timedOut = true;
+			}
+			seShmRelease(&_shm->response, len);
+			return ok;
+		}
+		if(!seShmEmpty(&_shm->response)) {
+			close();
+			return false;
+		}
+	}
+}
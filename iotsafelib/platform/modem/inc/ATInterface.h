@@ -20,6 +20,19 @@
 
 #include "Serial.h"
 
+// Size of the receive ring buffer, must be a power of two
+#define AT_RX_BUFFER_SIZE 1024
+// Maximum length of one line received from the modem (AT+CSIM response for 256 bytes + framing)
+#define AT_LINE_MAX_LEN 537
+// Deadline (ms) for link management commands (AT, AT+IPR, AT&K)
+#define AT_COMMAND_TIMEOUT 1000
+// Number of "AT" probes before a link setting is declared unusable
+#define AT_PROBE_ATTEMPTS 3
+
+// Default frame buffer sizing: short APDU command (header + Lc + 255 + Le) and response (256 + SW)
+#define AT_MAX_APDU_LEN 261
+#define AT_MAX_RESPONSE_LEN 258
+
 class ATInterface {
 	public:
 
@@ -29,15 +42,69 @@ class ATInterface {
 		bool open(const char *modem_port);
 		void close(void);
 
-		bool sendATCSIM(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+		// Check the modem answers "AT" with the current link settings
+		bool probe(uint32_t timeout = AT_COMMAND_TIMEOUT);
+
+		// Switch modem (AT+IPR) and local UART to baud and verify the link. If the modem does not
+		// answer at the new rate the previous one is restored, then an autobaud scan is run.
+		// Returns true only if the link runs at baud.
+		bool setBaudRate(uint32_t baud, uint32_t timeout = AT_COMMAND_TIMEOUT);
+		uint32_t getBaudRate(void);
+
+		// Probe each rate until the modem answers. A null rates list scans the standard rates.
+		// Returns the rate in use, 0 if the modem never answered (UART left at the first rate).
+		uint32_t autobaud(const uint32_t* rates = nullptr, uint16_t count = 0, uint32_t timeout = AT_COMMAND_TIMEOUT);
+
+		// Enable or disable RTS/CTS flow control on the modem (AT&K3 / AT&K0) and local UART
+		bool setFlowControl(bool enable, uint32_t timeout = AT_COMMAND_TIMEOUT);
+
+		// Grow the frame buffers for APDU commands / responses up to the given lengths,
+		// buffers never shrink. Only needed when extended length APDUs are used.
+		bool reserve(uint16_t maxApduLen, uint16_t maxResponseLen);
+
+		// Send an APDU through AT+CSIM, the whole exchange must complete within timeout (ms)
+		// responseLen holds the capacity of response on input, the response length on output
+		bool sendATCSIM(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen, uint32_t timeout = SERIAL_TIMEOUT_INFINITE);
+
+		// True if the last sendATCSIM failed because its deadline expired
+		bool hasTimedOut(void) {
+			return _timedOut;
+		}
+
+		// Select line assembly mode: buffered (default) pulls everything available from the
+		// UART in one read, byte-wise issues one read per character.
+		void setBufferedRead(bool buffered);
+
+		// Number of read calls issued to the serial layer since open
+		unsigned long int getRecvCount(void) {
+			return _recvCount;
+		}
 
 	protected:
-		bool bytesArray2HexString(uint8_t* bytes, uint16_t bytesLen, uint8_t* hexstr, uint16_t* hexstrLen);
-		bool hexString2BytesArray(uint8_t* hexstr, uint16_t hexstrLen, uint8_t* bytes, uint16_t* bytesLen);
-		bool readLine(char* data, unsigned long int* len);
+		bool readLine(char* data, unsigned long int maxLen, unsigned long int* len, uint32_t timeout = SERIAL_TIMEOUT_INFINITE);
 
 	private:
 		Serial* _serial;
+		bool _timedOut;
+
+		// Receive ring buffer, _rxHead and _rxTail are free running counters
+		bool _buffered;
+		char _rx[AT_RX_BUFFER_SIZE];
+		unsigned long int _rxHead;
+		unsigned long int _rxTail;
+		unsigned long int _recvCount;
+
+		// Preallocated frame buffers: hex encoded command and received line
+		char* _tx;
+		unsigned long int _txCap;
+		char* _line;
+		unsigned long int _lineCap;
+
+		bool fillBuffer(uint32_t timeout);
+		void discardInput(void);
+		// Send an AT command line and wait for its final result code
+		bool command(const char* cmd, uint32_t timeout);
+		bool readLineBytewise(char* data, unsigned long int maxLen, unsigned long int* len, uint32_t timeout);
 
 };
 
@@ -27,14 +27,40 @@ class GenericModem: public SEInterface {
 		GenericModem(void);
 		~GenericModem(void);
 
+		// The link methods take the transaction lock: the link never changes
+		// under an AT+CSIM exchange of another thread
 		bool open(const char *modem_port) {
+			SETransaction transaction(this);
 			return _at.open(modem_port);
 		}
 
 		void close(void) {
+			SETransaction transaction(this);
 			_at.close();
 		}
 
+		// Negotiate the UART rate with the modem, falling back to a working rate on failure
+		bool setBaudRate(uint32_t baud) {
+			SETransaction transaction(this);
+			return _at.setBaudRate(baud);
+		}
+
+		uint32_t getBaudRate(void) {
+			return _at.getBaudRate();
+		}
+
+		// Find the rate the modem currently answers at, 0 if none
+		uint32_t autobaud(void) {
+			SETransaction transaction(this);
+			return _at.autobaud();
+		}
+
+		// Enable or disable RTS/CTS hardware flow control on both ends of the link
+		bool setFlowControl(bool enable) {
+			SETransaction transaction(this);
+			return _at.setFlowControl(enable);
+		}
+
 	//protected:
 
 		bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
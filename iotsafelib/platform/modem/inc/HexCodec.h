@@ -0,0 +1,59 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __HEX_CODEC_H__
+#define __HEX_CODEC_H__
+
+#include <stdint.h>
+
+// Hex codec implementation selection
+#define HEX_CODEC_AUTO		0	// best implementation supported by the CPU
+#define HEX_CODEC_SCALAR	1	// lookup table implementation only
+
+/**
+ * Encode a bytes array as an uppercase hex string (not null terminated).
+ *
+ * @param[in]  bytes the bytes to encode
+ * @param[in]  bytesLen the number of bytes
+ * @param[out]  hexstr output buffer, must hold 2 * bytesLen characters
+ */
+void hexEncode(const uint8_t* bytes, uint16_t bytesLen, char* hexstr);
+
+/**
+ * Decode an hex string (upper or lower case) to a bytes array.
+ *
+ * @param[in]  hexstr the hex string
+ * @param[in]  hexstrLen the number of characters, must be even
+ * @param[out]  bytes output buffer, must hold hexstrLen / 2 bytes
+ * @param[out]  bytesLen the number of decoded bytes
+ * @return true in case of success, false on odd length or invalid character.
+ */
+bool hexDecode(const char* hexstr, uint16_t hexstrLen, uint8_t* bytes, uint16_t* bytesLen);
+
+/**
+ * Select the hex codec implementation, HEX_CODEC_AUTO by default.
+ *
+ * @param[in]  mode HEX_CODEC_AUTO or HEX_CODEC_SCALAR
+ */
+void hexCodecSetMode(int mode);
+
+/**
+ * Name of the implementation currently in use ("scalar", "sse2", "neon").
+ */
+const char* hexCodecName(void);
+
+#endif /* __HEX_CODEC_H__ */
@@ -18,6 +18,7 @@
 #define __LSERIAL_H__
 
 #include "Serial.h"
+#include <time.h>
 
 class LSerial: public Serial {
 	public:
@@ -26,12 +27,29 @@ class LSerial: public Serial {
 		~LSerial(void);
 
 		bool start(const char *modem_port);
-		bool send(char* data, unsigned long  int toWrite, unsigned long  int* written);
-		bool recv(char* data, unsigned long int toRead, unsigned long  int* read);
+		bool send(char* data, unsigned long  int toWrite, unsigned long  int* written, uint32_t timeout = SERIAL_TIMEOUT_INFINITE);
+		bool recv(char* data, unsigned long int toRead, unsigned long  int* read, uint32_t timeout = SERIAL_TIMEOUT_INFINITE);
 		bool stop(void);
+		bool sendv(const struct iovec* iov, int iovcnt, unsigned long  int* written, uint32_t timeout = SERIAL_TIMEOUT_INFINITE);
+		bool recvAvailable(char* data, unsigned long int maxRead, unsigned long  int* read, uint32_t timeout = SERIAL_TIMEOUT_INFINITE);
+
+		// Baud rates from 9600 up to 4000000 where supported by the platform
+		bool setBaudRate(uint32_t baud);
+		uint32_t getBaudRate(void);
+		bool setFlowControl(uint8_t flow);
+		uint8_t getFlowControl(void);
+		void flush(void);
 
 	private:
 		int32_t m_uart;
+		uint32_t m_baud;
+		uint8_t m_flow;
+
+		// Apply the link settings to the open port
+		bool configure(void);
+
+		// Block on poll() until the port is ready for events or the deadline expires.
+		bool wait(short events, const struct timespec* deadline);
 
 };
 
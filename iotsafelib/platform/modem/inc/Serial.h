@@ -19,6 +19,17 @@
 #define __SERIAL_H__
 
 #include <stdint.h>
+#include <sys/uio.h>
+
+// Timeout value (in milliseconds) meaning "wait until data arrives"
+#define SERIAL_TIMEOUT_INFINITE 0
+
+// Link default settings
+#define SERIAL_DEFAULT_BAUD_RATE 115200
+
+// Flow control modes
+#define SERIAL_FLOW_NONE 0
+#define SERIAL_FLOW_RTSCTS 1
 
 class Serial {
 	public:
@@ -27,14 +38,29 @@ class Serial {
 		virtual ~Serial(void);
 
 		virtual bool start(const char *modem_port) = 0;
-		virtual bool send(char* data, unsigned long  int toWrite, unsigned long  int* written) = 0;
-		virtual bool recv(char* data, unsigned long int toRead, unsigned long  int* read) = 0;
+		// Write toWrite bytes, waiting at most timeout (ms) for the port to take them.
+		virtual bool send(char* data, unsigned long  int toWrite, unsigned long  int* written, uint32_t timeout = SERIAL_TIMEOUT_INFINITE) = 0;
+		// Wait until toRead bytes are received or timeout (ms) expires.
+		// On timeout false is returned and read holds the bytes received so far.
+		virtual bool recv(char* data, unsigned long int toRead, unsigned long  int* read, uint32_t timeout = SERIAL_TIMEOUT_INFINITE) = 0;
 		virtual bool stop(void) = 0;
 
-	protected:
-		bool bytesArray2HexString(uint8_t* bytes, uint16_t bytesLen, uint8_t* hexstr, uint16_t* hexstrLen);
-		bool hexString2BytesArray(uint8_t* hexstr, uint16_t hexstrLen, uint8_t* bytes, uint16_t* bytesLen);
-		bool readLine(char* data, unsigned long int* len);
+		// Gather write of iovcnt buffers. Default implementation sends each buffer in turn.
+		virtual bool sendv(const struct iovec* iov, int iovcnt, unsigned long  int* written, uint32_t timeout = SERIAL_TIMEOUT_INFINITE);
+
+		// Link configuration, applied immediately when the port is open or on start otherwise.
+		// The default implementation does not support reconfiguration.
+		virtual bool setBaudRate(uint32_t baud);
+		virtual uint32_t getBaudRate(void);
+		virtual bool setFlowControl(uint8_t flow);
+		virtual uint8_t getFlowControl(void);
+
+		// Discard data received but not read yet
+		virtual void flush(void);
+
+		// Wait until at least one byte is available or timeout (ms) expires, then return
+		// up to maxRead bytes in a single call. Default implementation reads one byte.
+		virtual bool recvAvailable(char* data, unsigned long int maxRead, unsigned long  int* read, uint32_t timeout = SERIAL_TIMEOUT_INFINITE);
 
 };
 
@@ -16,77 +16,163 @@
  */
 
 #include "ATInterface.h"
+#include "HexCodec.h"
+#include "SEMetrics.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <time.h>
+#include <sys/uio.h>
 
 //#define AT_DEBUG
 
+static long long elapsedUs(const struct timespec* start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_nsec - start->tv_nsec) / 1000LL;
+}
+
+// True once the deadline started at 'start' with 'timeout' (ms) has expired
+static bool timeoutExpired(const struct timespec* start, uint32_t timeout) {
+	return (timeout != SERIAL_TIMEOUT_INFINITE) && (elapsedUs(start) >= (long long) timeout * 1000LL);
+}
+
+// Milliseconds left before the deadline expires, rounded up. Never returns 0 for
+// a finite timeout so that an expired deadline is not mistaken for SERIAL_TIMEOUT_INFINITE.
+static uint32_t remainingTimeout(const struct timespec* start, uint32_t timeout) {
+	long long left;
+
+	if(timeout == SERIAL_TIMEOUT_INFINITE) {
+		return SERIAL_TIMEOUT_INFINITE;
+	}
+
+	left = (long long) timeout * 1000LL - elapsedUs(start);
+	if(left <= 0) {
+		return 1;
+	}
+	return (uint32_t) ((left + 999LL) / 1000LL);
+}
+
 ATInterface::ATInterface(Serial* serial) {
 	_serial = serial;
+	_timedOut = false;
+	_buffered = true;
+	_rxHead = 0;
+	_rxTail = 0;
+	_recvCount = 0;
+	_tx = nullptr;
+	_txCap = 0;
+	_line = nullptr;
+	_lineCap = 0;
+	// Frame buffers are allocated once, sized for short APDUs
+	reserve(AT_MAX_APDU_LEN, AT_MAX_RESPONSE_LEN);
 }
 
 ATInterface::~ATInterface(void) {
-
+	free(_tx);
+	free(_line);
 }
 
 bool ATInterface::open(const char *modem_port) {
-	return _serial->start(modem_port);
+	_rxHead = 0;
+	_rxTail = 0;
+	_recvCount = 0;
+	if(!_serial->start(modem_port)) {
+		return false;
+	}
+	// Drop whatever the modem sent before the port was opened, e.g. the late
+	// answer to a command which timed out in a previous session
+	discardInput();
+	return true;
 }
 
 void ATInterface::close(void) {
 	_serial->stop();
+	_rxHead = 0;
+	_rxTail = 0;
 }
 
-bool ATInterface::bytesArray2HexString(uint8_t* bytes, uint16_t bytesLen, uint8_t* hexstr, uint16_t* hexstrLen) {
-	const uint8_t* hex = (const uint8_t*) "0123456789ABCDEF";
-	uint16_t i;
+void ATInterface::setBufferedRead(bool buffered) {
+	_buffered = buffered;
+}
+
+// Pull whatever the serial layer has into the free contiguous part of the ring
+bool ATInterface::fillBuffer(uint32_t timeout) {
+	unsigned long int read = 0;
+	unsigned long int head = _rxHead & (AT_RX_BUFFER_SIZE - 1);
+	unsigned long int space = AT_RX_BUFFER_SIZE - (_rxHead - _rxTail);
+	unsigned long int contiguous = AT_RX_BUFFER_SIZE - head;
 
-	*hexstrLen = 0;
-	for(i = 0; i < bytesLen; i++, *hexstrLen += 2) {
-		*hexstr = hex[(bytes[i] >> 4) & 0xF];
-		hexstr++;
-		*hexstr = hex[bytes[i] & 0xF];
-		hexstr++;
+	if(contiguous > space) {
+		contiguous = space;
 	}
 
+	_recvCount++;
+	if(!_serial->recvAvailable(&_rx[head], contiguous, &read, timeout)) {
+		return false;
+	}
+	_rxHead += read;
 	return true;
 }
 
-bool ATInterface::hexString2BytesArray(uint8_t* hexstr, uint16_t hexstrLen, uint8_t* bytes, uint16_t* bytesLen) {
-	uint8_t d;
-	uint16_t i, j;
+bool ATInterface::readLine(char* data, unsigned long int maxLen, unsigned long int* len, uint32_t timeout) {
+	unsigned long int off;
+	struct timespec start;
+	char c;
+
+	if(!_buffered) {
+		return readLineBytewise(data, maxLen, len, timeout);
+	}
 
-	*bytesLen = 0;
-	for(i = 0; i < hexstrLen; *bytesLen += 1) {
-		d = 0;
-		for(j = i + 2; i < j; i++) {
-			d <<= 4;
-			if((hexstr[i] >= '0') && (hexstr[i] <= '9')) {
-				d |= hexstr[i] - '0';
-			}
-			else if((hexstr[i] >= 'a') && (hexstr[i] <= 'f')) {
-				d |= hexstr[i] - 'a' + 10;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	off = 0;
+	do {
+		// Hand out buffered bytes up to the end of line
+		while(_rxTail != _rxHead) {
+			c = _rx[_rxTail & (AT_RX_BUFFER_SIZE - 1)];
+			_rxTail++;
+			if(off >= maxLen) {
+				// Line too long for the caller's buffer
+				return false;
 			}
-			else if((hexstr[i] >= 'A') && (hexstr[i] <= 'F')) {
-				d |= hexstr[i] - 'A' + 10;
+			data[off++] = c;
+			if(c == '\n') {
+				*len = off;
+				return true;
 			}
 		}
-		*bytes = d;
-		bytes++;
-	}
 
-	return true;
+		if(timeoutExpired(&start, timeout)) {
+			_timedOut = true;
+			return false;
+		}
+		if(!fillBuffer(remainingTimeout(&start, timeout))) {
+			_timedOut = timeoutExpired(&start, timeout);
+			return false;
+		}
+	} while(1);
 }
 
-bool ATInterface::readLine(char* data, unsigned long int* len) {
+bool ATInterface::readLineBytewise(char* data, unsigned long int maxLen, unsigned long int* len, uint32_t timeout) {
 	unsigned long int off;
 	unsigned long int read;
+	struct timespec start;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	off = 0;
 	read = 0;
 	do {
-		if(!_serial->recv(&data[off], 1, &read)) {
+		if(off >= maxLen) {
+			return false;
+		}
+		if(timeoutExpired(&start, timeout)) {
+			_timedOut = true;
+			return false;
+		}
+		_recvCount++;
+		if(!_serial->recv(&data[off], 1, &read, remainingTimeout(&start, timeout))) {
+			_timedOut = timeoutExpired(&start, timeout);
 			return false;
 		}
 		if(read) {
@@ -101,10 +187,62 @@ bool ATInterface::readLine(char* data, unsigned long int* len) {
 	return true;
 }
 
-bool ATInterface::sendATCSIM(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
-	char* buf = nullptr;
+// Compare the beginning of a received line, the line is not null terminated
+static bool lineStartsWith(const char* line, unsigned long int len, const char* prefix) {
+	unsigned long int prefixLen = strlen(prefix);
+
+	return (len >= prefixLen) && (memcmp(line, prefix, prefixLen) == 0);
+}
+
+bool ATInterface::reserve(uint16_t maxApduLen, uint16_t maxResponseLen) {
+	unsigned long int txCap = 2UL * maxApduLen;
+	// +CSIM: <length>,"<response>"\r\n
+	unsigned long int lineCap = 7 + 5 + 2 + 2UL * maxResponseLen + 3;
+	char* buf;
+
+	if(lineCap < AT_LINE_MAX_LEN) {
+		lineCap = AT_LINE_MAX_LEN;
+	}
+
+	if(txCap > _txCap) {
+		buf = (char*) realloc(_tx, txCap * sizeof(char));
+		if(buf == nullptr) {
+			return false;
+		}
+		_tx = buf;
+		_txCap = txCap;
+	}
+	if(lineCap > _lineCap) {
+		buf = (char*) realloc(_line, lineCap * sizeof(char));
+		if(buf == nullptr) {
+			return false;
+		}
+		_line = buf;
+		_lineCap = lineCap;
+	}
+	return true;
+}
+
+bool ATInterface::sendATCSIM(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen, uint32_t timeout) {
+	static const char trailer[] = "\"\r\n";
+	char header[24];
+	struct iovec frame[3];
+	#ifdef AT_DEBUG
 	uint16_t i = 0;
+	#endif
+	uint16_t responseMax = *responseLen;
 	unsigned long int off, len = 0;
+	unsigned long int hexLen;
+	struct timespec start;
+
+	// The deadline covers the whole command/response exchange
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	_timedOut = false;
+	*responseLen = 0;
+
+	if(((2UL * apduLen) > _txCap) || (_line == nullptr)) {
+		return false;
+	}
 
 	#ifdef AT_DEBUG
 	printf("SND: ");
@@ -114,53 +252,61 @@ bool ATInterface::sendATCSIM(uint8_t* apdu, uint16_t apduLen, uint8_t* response,
 	printf("\n");
 	#endif
 
-	off = 0;
-	buf = (char*) malloc(537 * sizeof(char));
+	// Header, hex payload and trailer go out in a single gather write
+	frame[0].iov_base = header;
+	frame[0].iov_len = snprintf(header, sizeof(header), "AT+CSIM=%d,\"", apduLen * 2);
+	hexEncode(apdu, apduLen, _tx);
+	frame[1].iov_base = _tx;
+	frame[1].iov_len = 2UL * apduLen;
+	frame[2].iov_base = (void*) trailer;
+	frame[2].iov_len = sizeof(trailer) - 1;
 
-	off += sprintf(&buf[off], "AT+CSIM=%d,\"", apduLen * 2);
-	for(i=0; i<apduLen; i++) {
-		off += sprintf(&buf[off], "%02X", apdu[i]);
+	seMetricsCount(SE_METRICS_AT_COMMANDS, 1);
+	if(!_serial->sendv(frame, 3, &len, remainingTimeout(&start, timeout))) {
+		_timedOut = timeoutExpired(&start, timeout);
+		return false;
 	}
-	off += sprintf(&buf[off], "\"\r\n");
-
-	_serial->send(buf, off, &len);
-	memset(buf, 0, sizeof(buf));
 
 	do {
-		readLine(buf, &len);
-		if(memcmp(buf, "ERROR\r\n", 7) == 0) {
+		if(!readLine(_line, _lineCap, &len, remainingTimeout(&start, timeout))) {
 			return false;
 		}
-		if(memcmp(buf, "+CME ERROR", 10) == 0) {
+		if(lineStartsWith(_line, len, "ERROR\r\n")) {
+			seMetricsCount(SE_METRICS_AT_ERRORS, 1);
+			return false;
+		}
+		if(lineStartsWith(_line, len, "+CME ERROR")) {
+			seMetricsCount(SE_METRICS_AT_ERRORS, 1);
 			return false;
 		}
 
-	} while((memcmp(buf, "+CSIM: ", 7) != 0));
+	} while(!lineStartsWith(_line, len, "+CSIM: "));
 	#ifdef AT_DEBUG
 	printf("Orig RCV: ");
-	printf("%s\n", buf);
+	printf("%.*s\n", (int) len, _line);
 	#endif
 
+	// +CSIM: <length>,"<response>"
 	off = 7;
-	*responseLen = 0;
-	while(buf[off] != ',') {
-		*responseLen *= 10;
-		*responseLen += buf[off] - '0';
+	hexLen = 0;
+	while((off < len) && (_line[off] >= '0') && (_line[off] <= '9') && (hexLen <= len)) {
+		hexLen *= 10;
+		hexLen += _line[off] - '0';
 		off++;
 	}
-
-	while( !(((buf[off] >= '0') && (buf[off] <= '9')) ||
-		   ((buf[off] >= 'A') && (buf[off] <= 'F')) ||
-		   ((buf[off] >= 'a') && (buf[off] <= 'f'))
-		   )) {
+	while((off < len) && ((_line[off] == ',') || (_line[off] == '"') || (_line[off] == ' '))) {
 		off++;
 	}
-
-	hexString2BytesArray((uint8_t*) &buf[off], *responseLen, response, responseLen);
+	if(((off + hexLen) > len) || ((hexLen / 2) > responseMax) ||
+		!hexDecode(&_line[off], hexLen, response, responseLen)) {
+		return false;
+	}
 
 	do {
-		readLine(buf, &len);
-	} while(memcmp(buf, "OK\r\n", 4) != 0);
+		if(!readLine(_line, _lineCap, &len, remainingTimeout(&start, timeout))) {
+			return false;
+		}
+	} while(!lineStartsWith(_line, len, "OK\r\n"));
 
 	#ifdef AT_DEBUG
 	printf("RCV: ");
@@ -170,6 +316,127 @@ bool ATInterface::sendATCSIM(uint8_t* apdu, uint16_t apduLen, uint8_t* response,
 	printf("\n");
 	#endif
 
-	free(buf);
 	return true;
 }
+
+/** Link management ***********************************************************/
+
+// Rates tried by autobaud, most likely first
+static const uint32_t AUTOBAUD_RATES[] = { 115200, 921600, 460800, 230400, 3000000, 57600, 19200, 9600 };
+
+void ATInterface::discardInput(void) {
+	_serial->flush();
+	_rxHead = 0;
+	_rxTail = 0;
+}
+
+bool ATInterface::command(const char* cmd, uint32_t timeout) {
+	unsigned long int len = 0;
+	struct iovec frame[2];
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	_timedOut = false;
+
+	frame[0].iov_base = (void*) cmd;
+	frame[0].iov_len = strlen(cmd);
+	frame[1].iov_base = (void*) "\r\n";
+	frame[1].iov_len = 2;
+	if(!_serial->sendv(frame, 2, &len, remainingTimeout(&start, timeout))) {
+		_timedOut = timeoutExpired(&start, timeout);
+		return false;
+	}
+
+	do {
+		if(!readLine(_line, _lineCap, &len, remainingTimeout(&start, timeout))) {
+			return false;
+		}
+		if(lineStartsWith(_line, len, "ERROR") || lineStartsWith(_line, len, "+CME ERROR")) {
+			return false;
+		}
+	} while(!lineStartsWith(_line, len, "OK\r\n"));
+
+	return true;
+}
+
+bool ATInterface::probe(uint32_t timeout) {
+	uint16_t i;
+
+	for(i = 0; i < AT_PROBE_ATTEMPTS; i++) {
+		// Garbage received at a wrong rate must not be taken for an answer
+		discardInput();
+		if(command("AT", timeout)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t ATInterface::getBaudRate(void) {
+	return _serial->getBaudRate();
+}
+
+uint32_t ATInterface::autobaud(const uint32_t* rates, uint16_t count, uint32_t timeout) {
+	uint16_t i;
+
+	if(rates == nullptr) {
+		rates = AUTOBAUD_RATES;
+		count = sizeof(AUTOBAUD_RATES) / sizeof(AUTOBAUD_RATES[0]);
+	}
+
+	for(i = 0; i < count; i++) {
+		if(_serial->setBaudRate(rates[i]) && probe(timeout)) {
+			return rates[i];
+		}
+	}
+
+	if(count > 0) {
+		_serial->setBaudRate(rates[0]);
+	}
+	return 0;
+}
+
+bool ATInterface::setBaudRate(uint32_t baud, uint32_t timeout) {
+	char cmd[24];
+	uint32_t previous = _serial->getBaudRate();
+
+	if(baud == previous) {
+		return probe(timeout);
+	}
+
+	snprintf(cmd, sizeof(cmd), "AT+IPR=%lu", (unsigned long) baud);
+	discardInput();
+	if(!command(cmd, timeout)) {
+		// Modem refused the rate, link unchanged
+		return false;
+	}
+
+	// The modem answers OK at the previous rate then switches
+	if(_serial->setBaudRate(baud) && probe(timeout)) {
+		return true;
+	}
+
+	// Safe fallback: previous rate, then scan
+	if(_serial->setBaudRate(previous) && probe(timeout)) {
+		return false;
+	}
+	autobaud(nullptr, 0, timeout);
+	return false;
+}
+
+bool ATInterface::setFlowControl(bool enable, uint32_t timeout) {
+	uint8_t previous = _serial->getFlowControl();
+
+	discardInput();
+	if(!command(enable ? "AT&K3" : "AT&K0", timeout)) {
+		return false;
+	}
+	if(!_serial->setFlowControl(enable ? SERIAL_FLOW_RTSCTS : SERIAL_FLOW_NONE)) {
+		return false;
+	}
+	if(probe(timeout)) {
+		return true;
+	}
+	_serial->setFlowControl(previous);
+	return false;
+}
@@ -20,6 +20,9 @@
 #include <stdio.h>
 
 GenericModem::GenericModem(void) : _at(new LSerial()) {
+	// Room for the extended length APDUs SEInterface may send; if this fails
+	// the longer AT+CSIM are refused and SEInterface falls back to short APDUs
+	_at.reserve(APDU_MAX_CMD_LEN, APDU_MAX_RESPONSE_LEN);
 }
 
 GenericModem::~GenericModem(void) {
@@ -43,7 +46,8 @@ bool GenericModem::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* respon
 	// -----
 #endif	// AT_DEBUG
 
-	ret = _at.sendATCSIM(apdu, apduLen, response, responseLen);
+	ret = _at.sendATCSIM(apdu, apduLen, response, responseLen, _timeout);
+	_timedOut = !ret && _at.hasTimedOut();
 
 #ifdef AT_DEBUG	
 	// DEBBUG
@@ -0,0 +1,305 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "HexCodec.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HEX_CODEC_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HEX_CODEC_NEON
+#include <arm_neon.h>
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+typedef void (*HexEncodeFn)(const uint8_t* bytes, uint16_t bytesLen, char* hexstr);
+typedef bool (*HexDecodeFn)(const char* hexstr, uint16_t hexstrLen, uint8_t* bytes);
+
+/** Scalar (lookup table) implementation ***************************************/
+
+// Two hex characters for each byte value
+static const char HEX_ENCODE_TABLE[] =
+	"00" "01" "02" "03" "04" "05" "06" "07"
+	"08" "09" "0A" "0B" "0C" "0D" "0E" "0F"
+	"10" "11" "12" "13" "14" "15" "16" "17"
+	"18" "19" "1A" "1B" "1C" "1D" "1E" "1F"
+	"20" "21" "22" "23" "24" "25" "26" "27"
+	"28" "29" "2A" "2B" "2C" "2D" "2E" "2F"
+	"30" "31" "32" "33" "34" "35" "36" "37"
+	"38" "39" "3A" "3B" "3C" "3D" "3E" "3F"
+	"40" "41" "42" "43" "44" "45" "46" "47"
+	"48" "49" "4A" "4B" "4C" "4D" "4E" "4F"
+	"50" "51" "52" "53" "54" "55" "56" "57"
+	"58" "59" "5A" "5B" "5C" "5D" "5E" "5F"
+	"60" "61" "62" "63" "64" "65" "66" "67"
+	"68" "69" "6A" "6B" "6C" "6D" "6E" "6F"
+	"70" "71" "72" "73" "74" "75" "76" "77"
+	"78" "79" "7A" "7B" "7C" "7D" "7E" "7F"
+	"80" "81" "82" "83" "84" "85" "86" "87"
+	"88" "89" "8A" "8B" "8C" "8D" "8E" "8F"
+	"90" "91" "92" "93" "94" "95" "96" "97"
+	"98" "99" "9A" "9B" "9C" "9D" "9E" "9F"
+	"A0" "A1" "A2" "A3" "A4" "A5" "A6" "A7"
+	"A8" "A9" "AA" "AB" "AC" "AD" "AE" "AF"
+	"B0" "B1" "B2" "B3" "B4" "B5" "B6" "B7"
+	"B8" "B9" "BA" "BB" "BC" "BD" "BE" "BF"
+	"C0" "C1" "C2" "C3" "C4" "C5" "C6" "C7"
+	"C8" "C9" "CA" "CB" "CC" "CD" "CE" "CF"
+	"D0" "D1" "D2" "D3" "D4" "D5" "D6" "D7"
+	"D8" "D9" "DA" "DB" "DC" "DD" "DE" "DF"
+	"E0" "E1" "E2" "E3" "E4" "E5" "E6" "E7"
+	"E8" "E9" "EA" "EB" "EC" "ED" "EE" "EF"
+	"F0" "F1" "F2" "F3" "F4" "F5" "F6" "F7"
+	"F8" "F9" "FA" "FB" "FC" "FD" "FE" "FF";
+
+// Nibble value for each character, 0xFF for non hex characters
+static const uint8_t HEX_DECODE_TABLE[256] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static void hexEncodeScalar(const uint8_t* bytes, uint16_t bytesLen, char* hexstr) {
+	uint16_t i;
+
+	for(i = 0; i < bytesLen; i++) {
+		memcpy(&hexstr[2 * i], &HEX_ENCODE_TABLE[2 * bytes[i]], 2);
+	}
+}
+
+static bool hexDecodeScalar(const char* hexstr, uint16_t hexstrLen, uint8_t* bytes) {
+	uint8_t h, l, err = 0;
+	uint16_t i;
+
+	for(i = 0; i < hexstrLen; i += 2) {
+		h = HEX_DECODE_TABLE[(uint8_t) hexstr[i]];
+		l = HEX_DECODE_TABLE[(uint8_t) hexstr[i + 1]];
+		// Invalid characters map to 0xFF, check once at the end
+		err |= h | l;
+		bytes[i / 2] = (uint8_t) ((h << 4) | l);
+	}
+
+	return (err & 0xF0) == 0;
+}
+
+/** SSE2 implementation ********************************************************/
+
+#ifdef HEX_CODEC_SSE2
+
+// Convert 16 nibbles to their uppercase hex characters
+__attribute__((target("sse2")))
+static inline __m128i nibblesToHexSse2(__m128i n) {
+	__m128i letter = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('A' - '0' - 10));
+	return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letter);
+}
+
+// Convert 16 hex characters to nibbles, valid is set to 0xFF for each hex character
+__attribute__((target("sse2")))
+static inline __m128i hexToNibblesSse2(__m128i c, __m128i* valid) {
+	__m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+	__m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+	__m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+	__m128i digit = _mm_and_si128(isDigit, _mm_sub_epi8(c, _mm_set1_epi8('0')));
+	__m128i alpha = _mm_and_si128(isAlpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)));
+
+	*valid = _mm_or_si128(isDigit, isAlpha);
+	return _mm_or_si128(digit, alpha);
+}
+
+__attribute__((target("sse2")))
+static void hexEncodeSse2(const uint8_t* bytes, uint16_t bytesLen, char* hexstr) {
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	uint16_t i = 0;
+
+	for(; (i + 16) <= bytesLen; i += 16) {
+		__m128i in = _mm_loadu_si128((const __m128i*) &bytes[i]);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), mask);
+		__m128i lo = _mm_and_si128(in, mask);
+		// Interleave high and low nibbles to get the characters in output order
+		_mm_storeu_si128((__m128i*) &hexstr[2 * i], nibblesToHexSse2(_mm_unpacklo_epi8(hi, lo)));
+		_mm_storeu_si128((__m128i*) &hexstr[2 * i + 16], nibblesToHexSse2(_mm_unpackhi_epi8(hi, lo)));
+	}
+
+	hexEncodeScalar(&bytes[i], bytesLen - i, &hexstr[2 * i]);
+}
+
+__attribute__((target("sse2")))
+static bool hexDecodeSse2(const char* hexstr, uint16_t hexstrLen, uint8_t* bytes) {
+	const __m128i lowByte = _mm_set1_epi16(0x00FF);
+	uint16_t i = 0;
+
+	for(; (i + 32) <= hexstrLen; i += 32) {
+		__m128i valid1, valid2;
+		__m128i n1 = hexToNibblesSse2(_mm_loadu_si128((const __m128i*) &hexstr[i]), &valid1);
+		__m128i n2 = hexToNibblesSse2(_mm_loadu_si128((const __m128i*) &hexstr[i + 16]), &valid2);
+
+		if(_mm_movemask_epi8(_mm_and_si128(valid1, valid2)) != 0xFFFF) {
+			return false;
+		}
+		// Each 16 bits lane holds (low nibble << 8) | high nibble
+		n1 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n1, lowByte), 4), _mm_srli_epi16(n1, 8));
+		n2 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n2, lowByte), 4), _mm_srli_epi16(n2, 8));
+		_mm_storeu_si128((__m128i*) &bytes[i / 2], _mm_packus_epi16(n1, n2));
+	}
+
+	return hexDecodeScalar(&hexstr[i], hexstrLen - i, &bytes[i / 2]);
+}
+
+#endif /* HEX_CODEC_SSE2 */
+
+/** NEON implementation ********************************************************/
+
+#ifdef HEX_CODEC_NEON
+
+static inline uint8x16_t nibblesToHexNeon(uint8x16_t n) {
+	uint8x16_t letter = vandq_u8(vcgtq_u8(n, vdupq_n_u8(9)), vdupq_n_u8('A' - '0' - 10));
+	return vaddq_u8(vaddq_u8(n, vdupq_n_u8('0')), letter);
+}
+
+static inline uint8x16_t hexToNibblesNeon(uint8x16_t c, uint8x16_t* valid) {
+	uint8x16_t digit = vsubq_u8(c, vdupq_n_u8('0'));
+	uint8x16_t alpha = vsubq_u8(vorrq_u8(c, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+	uint8x16_t isDigit = vcleq_u8(digit, vdupq_n_u8(9));
+	uint8x16_t isAlpha = vcleq_u8(alpha, vdupq_n_u8(5));
+
+	*valid = vorrq_u8(isDigit, isAlpha);
+	return vbslq_u8(isDigit, digit, vaddq_u8(alpha, vdupq_n_u8(10)));
+}
+
+static void hexEncodeNeon(const uint8_t* bytes, uint16_t bytesLen, char* hexstr) {
+	uint16_t i = 0;
+
+	for(; (i + 16) <= bytesLen; i += 16) {
+		uint8x16_t in = vld1q_u8(&bytes[i]);
+		uint8x16x2_t out;
+
+		out.val[0] = nibblesToHexNeon(vshrq_n_u8(in, 4));
+		out.val[1] = nibblesToHexNeon(vandq_u8(in, vdupq_n_u8(0x0F)));
+		// vst2 interleaves high and low characters
+		vst2q_u8((uint8_t*) &hexstr[2 * i], out);
+	}
+
+	hexEncodeScalar(&bytes[i], bytesLen - i, &hexstr[2 * i]);
+}
+
+static bool hexDecodeNeon(const char* hexstr, uint16_t hexstrLen, uint8_t* bytes) {
+	uint16_t i = 0;
+
+	for(; (i + 32) <= hexstrLen; i += 32) {
+		// vld2 splits high and low characters
+		uint8x16x2_t in = vld2q_u8((const uint8_t*) &hexstr[i]);
+		uint8x16_t validHi, validLo;
+		uint8x16_t hi = hexToNibblesNeon(in.val[0], &validHi);
+		uint8x16_t lo = hexToNibblesNeon(in.val[1], &validLo);
+		uint8x16_t valid = vandq_u8(validHi, validLo);
+		uint8x8_t v = vand_u8(vget_low_u8(valid), vget_high_u8(valid));
+
+		v = vpmin_u8(v, v);
+		v = vpmin_u8(v, v);
+		v = vpmin_u8(v, v);
+		if(vget_lane_u8(v, 0) != 0xFF) {
+			return false;
+		}
+		vst1q_u8(&bytes[i / 2], vorrq_u8(vshlq_n_u8(hi, 4), lo));
+	}
+
+	return hexDecodeScalar(&hexstr[i], hexstrLen - i, &bytes[i / 2]);
+}
+
+#endif /* HEX_CODEC_NEON */
+
+/** Dispatch *******************************************************************/
+
+static HexEncodeFn s_encode = hexEncodeScalar;
+static HexDecodeFn s_decode = hexDecodeScalar;
+static const char* s_name = "scalar";
+
+static void hexCodecSelect(int mode) {
+	s_encode = hexEncodeScalar;
+	s_decode = hexDecodeScalar;
+	s_name = "scalar";
+
+	if(mode == HEX_CODEC_SCALAR) {
+		return;
+	}
+
+#if defined(HEX_CODEC_SSE2)
+	if(__builtin_cpu_supports("sse2")) {
+		s_encode = hexEncodeSse2;
+		s_decode = hexDecodeSse2;
+		s_name = "sse2";
+	}
+#elif defined(HEX_CODEC_NEON)
+#if defined(__arm__)
+	// NEON is optional on 32 bits ARM
+	if((getauxval(AT_HWCAP) & HWCAP_NEON) == 0) {
+		return;
+	}
+#endif
+	s_encode = hexEncodeNeon;
+	s_decode = hexDecodeNeon;
+	s_name = "neon";
+#endif
+}
+
+// Pick the best implementation at load time
+static struct HexCodecInit {
+	HexCodecInit(void) {
+		hexCodecSelect(HEX_CODEC_AUTO);
+	}
+} s_hexCodecInit;
+
+void hexEncode(const uint8_t* bytes, uint16_t bytesLen, char* hexstr) {
+	s_encode(bytes, bytesLen, hexstr);
+}
+
+bool hexDecode(const char* hexstr, uint16_t hexstrLen, uint8_t* bytes, uint16_t* bytesLen) {
+	*bytesLen = 0;
+	if(hexstrLen & 1) {
+		return false;
+	}
+	if(!s_decode(hexstr, hexstrLen, bytes)) {
+		return false;
+	}
+	*bytesLen = hexstrLen / 2;
+	return true;
+}
+
+void hexCodecSetMode(int mode) {
+	hexCodecSelect(mode);
+}
+
+const char* hexCodecName(void) {
+	return s_name;
+}
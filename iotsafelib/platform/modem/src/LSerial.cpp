@@ -16,47 +16,202 @@
  */
 
 #include "LSerial.h"
+#include "SEMetrics.h"
 #include <cstdio>
 #include <cstring>
 
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <sys/uio.h>
 
 //#define SERIAL_DEBUG
 
 LSerial::LSerial(void) {
 	m_uart = -1;
+	m_baud = SERIAL_DEFAULT_BAUD_RATE;
+	m_flow = SERIAL_FLOW_NONE;
 }
 
 LSerial::~LSerial(void) {
 }
 
+// Compute the absolute monotonic deadline for a timeout in ms
+static void deadlineFromTimeout(uint32_t timeout, struct timespec* deadline) {
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += timeout / 1000;
+	deadline->tv_nsec += (long) (timeout % 1000) * 1000000L;
+	if(deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec += 1;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
 
-bool LSerial::start(const char *modem_port) {
-#ifdef SERIAL_DEBUG
-	printf("Opening serial port...");
+// Remaining time in ms before deadline rounded up, -1 for no deadline
+static int remainingMs(const struct timespec* deadline) {
+	struct timespec now;
+	long long ns;
+
+	if(deadline == nullptr) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (deadline->tv_sec - now.tv_sec) * 1000000000LL + (deadline->tv_nsec - now.tv_nsec);
+	if(ns <= 0) {
+		return 0;
+	}
+	return (int) ((ns + 999999LL) / 1000000LL);
+}
+
+bool LSerial::wait(short events, const struct timespec* deadline) {
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = m_uart;
+	pfd.events = events;
+	do {
+		pfd.revents = 0;
+		r = poll(&pfd, 1, remainingMs(deadline));
+	} while((r == -1) && (errno == EINTR));
+
+	if(r <= 0) {
+		// Timeout or poll failure
+		return false;
+	}
+	if(pfd.revents & (POLLERR | POLLNVAL)) {
+		return false;
+	}
+	if((pfd.revents & POLLHUP) && !(pfd.revents & events)) {
+		// Port hung up with nothing left to read
+		return false;
+	}
+	return true;
+}
+
+// Map a baud rate to its termios speed
+static bool baudToSpeed(uint32_t baud, speed_t* speed) {
+	switch(baud) {
+		case 9600: *speed = B9600; return true;
+		case 19200: *speed = B19200; return true;
+		case 38400: *speed = B38400; return true;
+		case 57600: *speed = B57600; return true;
+		case 115200: *speed = B115200; return true;
+		case 230400: *speed = B230400; return true;
+#ifdef B460800
+		case 460800: *speed = B460800; return true;
+#endif
+#ifdef B921600
+		case 921600: *speed = B921600; return true;
+#endif
+#ifdef B1000000
+		case 1000000: *speed = B1000000; return true;
+#endif
+#ifdef B1500000
+		case 1500000: *speed = B1500000; return true;
+#endif
+#ifdef B2000000
+		case 2000000: *speed = B2000000; return true;
 #endif
+#ifdef B3000000
+		case 3000000: *speed = B3000000; return true;
+#endif
+#ifdef B4000000
+		case 4000000: *speed = B4000000; return true;
+#endif
+		default: return false;
+	}
+}
 
-	const char* uart = (const char*) modem_port; //"/dev/ttyACM0";
-	int port;
+bool LSerial::configure(void) {
 	struct termios serial;
+	speed_t speed;
 
-	if((m_uart = open(uart, O_RDWR | O_NOCTTY | O_NDELAY)) >= 0) {
-		tcgetattr(m_uart, &serial);
+	if(!baudToSpeed(m_baud, &speed)) {
+		return false;
+	}
+	if(tcgetattr(m_uart, &serial) != 0) {
+		return false;
+	}
 
-		serial.c_iflag = 0;
-		serial.c_oflag = 0;
-		serial.c_lflag = 0;
-		serial.c_cflag = 0;
+	serial.c_iflag = 0;
+	serial.c_oflag = 0;
+	serial.c_lflag = 0;
+	serial.c_cflag = CS8 | CREAD;
+	if(m_flow == SERIAL_FLOW_RTSCTS) {
+		serial.c_cflag |= CRTSCTS;
+	}
+
+	serial.c_cc[VMIN] = 0;
+	serial.c_cc[VTIME] = 0;
+
+	cfsetispeed(&serial, speed);
+	cfsetospeed(&serial, speed);
+
+	// Let pending output leave at the previous settings before switching
+	return tcsetattr(m_uart, TCSADRAIN, &serial) == 0;
+}
+
+bool LSerial::setBaudRate(uint32_t baud) {
+	speed_t speed;
+	uint32_t previous = m_baud;
+
+	if(!baudToSpeed(baud, &speed)) {
+		return false;
+	}
+	m_baud = baud;
+	if((m_uart >= 0) && !configure()) {
+		m_baud = previous;
+		return false;
+	}
+	return true;
+}
 
-		serial.c_cc[VMIN] = 0;
-		serial.c_cc[VTIME] = 0;
+uint32_t LSerial::getBaudRate(void) {
+	return m_baud;
+}
 
-		serial.c_cflag = B115200 | CS8 | CREAD;
+bool LSerial::setFlowControl(uint8_t flow) {
+	uint8_t previous = m_flow;
 
-		tcsetattr(m_uart, TCSANOW, &serial); // Apply configuration
-		fcntl(m_uart, F_SETFL, 0);
+	if((flow != SERIAL_FLOW_NONE) && (flow != SERIAL_FLOW_RTSCTS)) {
+		return false;
+	}
+	m_flow = flow;
+	if((m_uart >= 0) && !configure()) {
+		m_flow = previous;
+		return false;
+	}
+	return true;
+}
+
+uint8_t LSerial::getFlowControl(void) {
+	return m_flow;
+}
+
+void LSerial::flush(void) {
+	if(m_uart >= 0) {
+		tcflush(m_uart, TCIFLUSH);
+	}
+}
+
+bool LSerial::start(const char *modem_port) {
+#ifdef SERIAL_DEBUG
+	printf("Opening serial port...");
+#endif
+
+	const char* uart = (const char*) modem_port; //"/dev/ttyACM0";
+
+	// Non-blocking: with RTS/CTS a modem holding CTS must not block write()
+	// past the exchange deadline, poll() does the waiting
+	if((m_uart = open(uart, O_RDWR | O_NOCTTY | O_NONBLOCK)) >= 0) {
+		if(!configure()) { // Apply configuration
+			close(m_uart);
+			m_uart = -1;
+			return false;
+		}
 
 #ifdef SERIAL_DEBUG
 		printf("Found serial %s %d\r\n", uart, m_uart);
@@ -68,21 +223,34 @@ bool LSerial::start(const char *modem_port) {
 	return false;
 }
 
-bool LSerial::send(char* data, unsigned long int toWrite, unsigned long  int* size) {
+bool LSerial::send(char* data, unsigned long int toWrite, unsigned long  int* size, uint32_t timeout) {
 	unsigned long int i;
 	int w;
+	struct timespec deadline;
 	
 	if(m_uart < 0) {
 		return false;
 	}
+
+	if(timeout != SERIAL_TIMEOUT_INFINITE) {
+		deadlineFromTimeout(timeout, &deadline);
+	}
 	
 	for(i=0; i<toWrite;) {
 		w = write(m_uart, &data[i], (toWrite - i));
+		if((w == -1) && ((errno == EAGAIN) || (errno == EINTR))) {
+			// Output held back, e.g. by CTS: wait for room until the deadline
+			if(!wait(POLLOUT, (timeout != SERIAL_TIMEOUT_INFINITE) ? &deadline : nullptr)) {
+				return false;
+			}
+			continue;
+		}
 		if(w == -1) {
 			return false;
 		}
 		else if(w) {
 			i += w;
+			seMetricsCount(SE_METRICS_UART_BYTES_OUT, w);
 		}
 		
 	}
@@ -107,23 +275,100 @@ bool LSerial::send(char* data, unsigned long int toWrite, unsigned long  int* si
 	return true;
 }
 
-bool LSerial::recv(char* data, unsigned long int toRead, unsigned long int* size) {
+bool LSerial::sendv(const struct iovec* iov, int iovcnt, unsigned long int* size, uint32_t timeout) {
+	struct iovec local[8];
+	unsigned long int total = 0;
+	int i, first = 0;
+	ssize_t w;
+	struct timespec deadline;
+
+	*size = 0;
+	if((m_uart < 0) || (iovcnt > 8)) {
+		return false;
+	}
+
+	if(timeout != SERIAL_TIMEOUT_INFINITE) {
+		deadlineFromTimeout(timeout, &deadline);
+	}
+
+	for(i = 0; i < iovcnt; i++) {
+		local[i] = iov[i];
+		total += iov[i].iov_len;
+	}
+
+	while(first < iovcnt) {
+		w = writev(m_uart, &local[first], iovcnt - first);
+		if((w == -1) && ((errno == EAGAIN) || (errno == EINTR))) {
+			if(!wait(POLLOUT, (timeout != SERIAL_TIMEOUT_INFINITE) ? &deadline : nullptr)) {
+				return false;
+			}
+			continue;
+		}
+		if(w == -1) {
+			return false;
+		}
+		seMetricsCount(SE_METRICS_UART_BYTES_OUT, w);
+		// Skip what was written, a short write may stop in the middle of a buffer
+		while((first < iovcnt) && ((size_t) w >= local[first].iov_len)) {
+			w -= local[first].iov_len;
+			first++;
+		}
+		if(first < iovcnt) {
+			local[first].iov_base = (char*) local[first].iov_base + w;
+			local[first].iov_len -= w;
+		}
+	}
+
+	*size = total;
+
+	#ifdef SERIAL_DEBUG
+	printf("> ");
+	for(i = 0; i < iovcnt; i++) {
+		unsigned long int j;
+		const char* data = (const char*) iov[i].iov_base;
+		for(j = 0; j < iov[i].iov_len; j++) {
+			if((data[j] != '\r') && (data[j] != '\n')) {
+				printf("%c", data[j]);
+			}
+		}
+	}
+	printf("\n");
+	#endif
+
+	return true;
+}
+
+bool LSerial::recv(char* data, unsigned long int toRead, unsigned long int* size, uint32_t timeout) {
 	unsigned long int i;
 	int r;
+	struct timespec deadline;
 	
+	*size = 0;
 	if(m_uart < 0) {
 		return false;
 	}
+
+	if(timeout != SERIAL_TIMEOUT_INFINITE) {
+		deadlineFromTimeout(timeout, &deadline);
+	}
 	
 	for(i=0; i<toRead;) {
-		r = read(m_uart, &data[i], (toRead - i));
-		if(r == -1) {
+		// Sleep in poll() until the UART has data instead of spinning on read()
+		if(!wait(POLLIN, (timeout != SERIAL_TIMEOUT_INFINITE) ? &deadline : nullptr)) {
+			*size = i;
 			return false;
 		}
-		else if(r) {
-			i += r;
+		r = read(m_uart, &data[i], (toRead - i));
+		if((r == -1) && ((errno == EAGAIN) || (errno == EINTR))) {
+			continue;
 		}
-		
+		if(r <= 0) {
+			// Error, or end of file although poll() reported the port readable
+			*size = i;
+			return false;
+		}
+		i += r;
+		seMetricsCount(SE_METRICS_UART_BYTES_IN, r);
 	}
 
 	*size = toRead;
@@ -145,6 +390,52 @@ bool LSerial::recv(char* data, unsigned long int toRead, unsigned long int* size
 	return true;
 }
 
+bool LSerial::recvAvailable(char* data, unsigned long int maxRead, unsigned long int* size, uint32_t timeout) {
+	int r;
+	struct timespec deadline;
+
+	*size = 0;
+	if(m_uart < 0) {
+		return false;
+	}
+	if(maxRead == 0) {
+		return true;
+	}
+
+	if(timeout != SERIAL_TIMEOUT_INFINITE) {
+		deadlineFromTimeout(timeout, &deadline);
+	}
+
+	do {
+		if(!wait(POLLIN, (timeout != SERIAL_TIMEOUT_INFINITE) ? &deadline : nullptr)) {
+			return false;
+		}
+		// One read() drains whatever the UART has buffered, up to maxRead
+		r = read(m_uart, data, maxRead);
+	} while((r == -1) && ((errno == EAGAIN) || (errno == EINTR)));
+
+	if(r <= 0) {
+		return false;
+	}
+	*size = r;
+	seMetricsCount(SE_METRICS_UART_BYTES_IN, r);
+
+	#ifdef SERIAL_DEBUG
+	{
+		unsigned long int i;
+		printf("< ");
+		for(i=0; i<*size; i++) {
+			if((data[i] != '\r') && (data[i] != '\n')) {
+				printf("%c", data[i]);
+			}
+		}
+		printf("\n");
+	}
+	#endif
+
+	return true;
+}
+
 bool LSerial::stop(void) {
 #ifdef SERIAL_DEBUG
 	printf("Closing serial port...");
@@ -157,5 +448,6 @@ bool LSerial::stop(void) {
 	if(m_uart >= 0)
 		close(m_uart);
 #endif
+	m_uart = -1;
 	return true;
 }
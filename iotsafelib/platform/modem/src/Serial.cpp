@@ -28,3 +28,45 @@ Serial::Serial(void) {
 
 Serial::~Serial(void) {
 }
+
+bool Serial::setBaudRate(uint32_t baud) {
+	return baud == SERIAL_DEFAULT_BAUD_RATE;
+}
+
+uint32_t Serial::getBaudRate(void) {
+	return SERIAL_DEFAULT_BAUD_RATE;
+}
+
+bool Serial::setFlowControl(uint8_t flow) {
+	return flow == SERIAL_FLOW_NONE;
+}
+
+uint8_t Serial::getFlowControl(void) {
+	return SERIAL_FLOW_NONE;
+}
+
+void Serial::flush(void) {
+}
+
+bool Serial::sendv(const struct iovec* iov, int iovcnt, unsigned long int* written, uint32_t timeout) {
+	unsigned long int len;
+	int i;
+
+	// Each buffer gets the whole timeout, subclasses with a gather write do better
+	*written = 0;
+	for(i = 0; i < iovcnt; i++) {
+		if(!send((char*) iov[i].iov_base, iov[i].iov_len, &len, timeout)) {
+			return false;
+		}
+		*written += len;
+	}
+	return true;
+}
+
+bool Serial::recvAvailable(char* data, unsigned long int maxRead, unsigned long int* read, uint32_t timeout) {
+	*read = 0;
+	if(maxRead == 0) {
+		return true;
+	}
+	return recv(data, 1, read, timeout);
+}
@@ -0,0 +1,141 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __FAKE_MODEM_H__
+#define __FAKE_MODEM_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include "IoTSafeSimulator.h"
+
+#define FAKE_MODEM_PORT_LEN		64
+#define FAKE_MODEM_LINE_LEN		(2 * APDU_MAX_CMD_LEN + 32)	// AT+CSIM carrying an extended APDU
+#define FAKE_MODEM_URC_LEN		64
+#define FAKE_MODEM_DEFAULT_BAUD_RATE	115200
+#define FAKE_MODEM_BITS_PER_BYTE	10	// start + 8 data + stop bits
+
+/**
+ * Modem emulated on a pseudo-terminal: it answers the AT commands used by
+ * ATInterface (AT, ATE0/ATE1, AT+IPR, AT&K0/AT&K3, AT+CSIM) and forwards the
+ * AT+CSIM APDUs to an IoTSafeSimulator. GenericModem opens the slave side
+ * (getPortName) like a real modem port, so the whole serial / AT / hex path
+ * runs end to end without hardware.
+ *
+ * Serving happens on a background thread between start() and stop(), or on
+ * the calling thread with run().
+ */
+class FakeModem {
+	public:
+		FakeModem(IoTSafeSimulator* sim);
+		~FakeModem(void);
+
+		/**
+		 * Create the pseudo-terminal.
+		 *
+		 * @return true in case of success, false otherwise.
+		 */
+		bool open(void);
+
+		/**
+		 * Path of the port to give to GenericModem::open, e.g. /dev/pts/3
+		 */
+		const char* getPortName(void);
+
+		/**
+		 * Echo received characters back, on by default like ATE1.
+		 */
+		void setEcho(bool echo);
+
+		/**
+		 * Model the UART: each byte sent or received costs 10 bit times at the
+		 * rate negotiated with AT+IPR (115200 initially). Off by default.
+		 */
+		void setUartModel(bool enable);
+
+		/**
+		 * Fixed delay added before answering each AT+CSIM, the time the modem
+		 * and the SIM take to process the APDU.
+		 *
+		 * @param[in]  us delay in microseconds
+		 */
+		void setCommandDelay(uint32_t us);
+
+		/**
+		 * Emit an unsolicited result code every 'period' AT+CSIM, alternately
+		 * before the +CSIM line and between the +CSIM line and OK.
+		 *
+		 * @param[in]  urc the URC, e.g. "+CREG: 1", nullptr to disable
+		 * @param[in]  period number of AT+CSIM between two URCs
+		 */
+		void setUrc(const char* urc, uint32_t period);
+
+		/**
+		 * Serve the port on a background thread.
+		 *
+		 * @return true in case of success, false otherwise.
+		 */
+		bool start(void);
+
+		/**
+		 * Stop the background thread started with start() or make run() return.
+		 */
+		void stop(void);
+
+		/**
+		 * Serve the port on the calling thread until stop() is called.
+		 */
+		void run(void);
+
+		/**
+		 * Returns the number of AT commands answered
+		 */
+		uint32_t getCommandCount(void);
+
+	private:
+		static void* serve(void* self);
+
+		void handle(char* line, unsigned long len);
+		bool csim(const char* args, unsigned long len);
+		bool write(const char* data, unsigned long len, bool paced = true);
+		bool writeLine(const char* line);
+		void wire(unsigned long bytes);
+
+		IoTSafeSimulator* _sim;
+		int _master;
+		int _slave;
+		int _wakeup[2];		// self pipe waking the serving thread up on stop()
+		char _port[FAKE_MODEM_PORT_LEN];
+		pthread_t _thread;
+		bool _running;
+		volatile bool _stop;
+
+		bool _echo;
+		bool _uartModel;
+		uint32_t _baud;
+		uint32_t _commandDelay;
+		char _urc[FAKE_MODEM_URC_LEN];
+		uint32_t _urcPeriod;
+		uint32_t _csimCount;
+		uint32_t _commandCount;
+
+		char _line[FAKE_MODEM_LINE_LEN];
+		unsigned long _lineLen;
+		uint8_t _apdu[FAKE_MODEM_LINE_LEN / 2];
+		uint8_t _response[APDU_MAX_RESPONSE_LEN];
+};
+
+#endif /* __FAKE_MODEM_H__ */
@@ -0,0 +1,208 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __IOTSAFE_SIMULATOR_H__
+#define __IOTSAFE_SIMULATOR_H__
+
+#include "SEInterface.h"
+
+// Response emulation modes, may be combined
+#define SIM_RESPONSE_DIRECT		0x00	// response data returned along with the status word
+#define SIM_RESPONSE_61XX		0x01	// response data announced with 61xx, fetched with GET RESPONSE
+#define SIM_RESPONSE_6CXX		0x02	// case 2 commands first rejected with 6Cxx carrying the Le to use
+
+#define SIM_MAX_CHANNELS		20	// basic channel + 19 logical channels
+#define SIM_MAX_READ_LEN		255	// largest chunk returned by READ BINARY
+#define SIM_MAX_ID_LEN			0x20	// largest container id
+#define SIM_MAX_CHAINED_LEN		4096	// largest payload accepted through command chaining
+#define SIM_MAX_AID_LEN			16	// largest AID
+
+#ifdef __cplusplus
+
+struct IoTSafeSimulatorStore;
+
+/**
+ * Software implementation of the IoT SAFE applet, running in process on
+ * OpenSSL. It answers the APDUs issued by ROT the way the applet on a SIM
+ * does, so the library can be exercised without a modem.
+ *
+ * Out of the box it holds:
+ *  - an ECC P-256 key pair in private key container CONTAINER_ID_KEY (1)
+ *  - a self signed certificate of this key in file container CONTAINER_ID_CERT_CLIENT (2)
+ * Other containers are created on demand by GENERATE KEY PAIR and
+ * PUT PUBLIC KEY, or provisioned with putFile / putSecret / generateKey.
+ */
+class IoTSafeSimulator: public SEInterface {
+	public:
+		IoTSafeSimulator(void);
+		~IoTSafeSimulator(void);
+
+		/**
+		 * Select how response data is returned to the terminal.
+		 *
+		 * @param[in]  mode SIM_RESPONSE_DIRECT or a combination of SIM_RESPONSE_61XX and SIM_RESPONSE_6CXX
+		 */
+		void setResponseMode(uint8_t mode);
+
+		/**
+		 * Accept extended length APDUs, on by default. When off they are
+		 * rejected with 6700 like on a Secure Element supporting short APDUs only.
+		 *
+		 * @param[in]  enable true to accept extended length APDUs
+		 */
+		void setExtendedLengthSupport(bool enable);
+
+		/**
+		 * Number of logical channels MANAGE CHANNEL can open,
+		 * SIM_MAX_CHANNELS - 1 by default. Many SIMs only have 3.
+		 *
+		 * @param[in]  count 1 to SIM_MAX_CHANNELS - 1
+		 */
+		void setChannelLimit(uint8_t count);
+
+		/**
+		 * Answer SELECT of another AID as well, standing for a second
+		 * applet of the card, e.g. an operator applet. The same applet
+		 * runs behind it.
+		 *
+		 * @param[in]  aid the AID
+		 * @param[in]  aidLen length of the AID, up to SIM_MAX_AID_LEN
+		 * @return true in case of success, false otherwise.
+		 */
+		bool setOtherAid(const uint8_t* aid, uint16_t aidLen);
+
+		/**
+		 * Create or replace a file container.
+		 *
+		 * @param[in]  fileId the container id
+		 * @param[in]  fileIdLen length of the container id
+		 * @param[in]  data the file content
+		 * @param[in]  dataLen length of the file content
+		 * @return true in case of success, false otherwise.
+		 */
+		bool putFile(const uint8_t* fileId, uint16_t fileIdLen, const uint8_t* data, uint16_t dataLen);
+
+		/**
+		 * Create or replace a secret container (pre-shared key used by the PRF).
+		 *
+		 * @param[in]  secretId the container id
+		 * @param[in]  secretIdLen length of the container id
+		 * @param[in]  secret the secret value
+		 * @param[in]  secretLen length of the secret value
+		 * @return true in case of success, false otherwise.
+		 */
+		bool putSecret(const uint8_t* secretId, uint16_t secretIdLen, const uint8_t* secret, uint16_t secretLen);
+
+		/**
+		 * Generate a new ECC P-256 key pair in a private key container.
+		 *
+		 * @param[in]  keyId the container id
+		 * @param[in]  keyIdLen length of the container id
+		 * @return true in case of success, false otherwise.
+		 */
+		bool generateKey(const uint8_t* keyId, uint16_t keyIdLen);
+
+		/**
+		 * Export the public part of a key container as an uncompressed EC point.
+		 * Private key containers are looked up first, then public key containers.
+		 *
+		 * @param[in]  keyId the container id
+		 * @param[in]  keyIdLen length of the container id
+		 * @param[out]  point output buffer
+		 * @param[in, out]  pointLen capacity of point on input, length of the point on output
+		 * @return true in case of success, false otherwise.
+		 */
+		bool getPublicKey(const uint8_t* keyId, uint16_t keyIdLen, uint8_t* point, uint16_t* pointLen);
+
+		/**
+		 * Returns the number of APDUs processed since creation
+		 */
+		uint32_t getApduCount(void);
+
+		// Public so that transports such as FakeModem can forward raw APDUs
+		bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+
+	private:
+		// Per channel applet state
+		typedef struct {
+			bool open;
+			bool selected;
+			uint8_t session;	// session in progress, SIM_SESSION_* in the implementation
+			uint8_t mode;		// signature mode of operation
+			uint16_t hashAlgo;	// signature hash algorithm
+			uint16_t keyIdLen;	// key of the session in progress
+			uint8_t keyId[SIM_MAX_ID_LEN];
+			uint16_t chainedLen;	// data received through command chaining
+			uint8_t chained[SIM_MAX_CHAINED_LEN];
+		} Channel;
+
+		// Process one command, data and Le as decoded from the APDU (le is 256
+		// for 00, 65536 for extended 0000)
+		void process(Channel* ch, uint8_t ins, uint8_t p1, uint8_t p2,
+			const uint8_t* data, uint16_t dataLen, uint32_t le, bool hasLe);
+
+		// Instruction handlers, each one fills _out / _outLen / _sw
+		void select(Channel* ch, uint8_t p1, const uint8_t* data, uint16_t dataLen);
+		void manageChannel(uint8_t p1, uint8_t p2);
+		void getData(uint8_t p1, uint8_t p2, const uint8_t* data, uint16_t dataLen);
+		void readBinary(uint16_t offset, const uint8_t* data, uint16_t dataLen, uint32_t le);
+		void getRandom(uint32_t le);
+		void generateKeyPair(const uint8_t* data, uint16_t dataLen);
+		void computeSignatureInit(Channel* ch, uint8_t p1, const uint8_t* data, uint16_t dataLen);
+		void computeSignatureUpdate(Channel* ch, uint8_t p1, const uint8_t* data, uint16_t dataLen);
+		void putPublicKeyInit(Channel* ch, uint8_t p1, const uint8_t* data, uint16_t dataLen);
+		void putPublicKeyUpdate(Channel* ch, uint8_t p1, const uint8_t* data, uint16_t dataLen);
+		void computeDH(const uint8_t* data, uint16_t dataLen);
+		void computePRF(uint8_t p1, const uint8_t* data, uint16_t dataLen);
+		bool chain(Channel* ch, const uint8_t* data, uint16_t dataLen);
+		bool joinChained(const uint8_t* data, uint16_t dataLen);
+
+		void status(uint16_t sw);
+
+		IoTSafeSimulatorStore* _store;
+		Channel _channels[SIM_MAX_CHANNELS];
+		uint8_t _mode;
+		uint32_t _apduCount;
+		bool _extendedSupport;	// extended length APDUs accepted
+		uint8_t _channelLimit;	// logical channels MANAGE CHANNEL can open
+		uint8_t _otherAid[SIM_MAX_AID_LEN];	// see setOtherAid
+		uint16_t _otherAidLen;
+		bool _extendedApdu;	// the command being processed is an extended one
+
+		// Response of the command being processed
+		uint8_t _out[APDU_MAX_PAYLOAD];
+		uint16_t _outLen;
+		uint16_t _sw;
+
+		// Response data waiting for GET RESPONSE, 61xx emulation
+		uint8_t _pending[APDU_MAX_PAYLOAD];
+		uint16_t _pendingLen;
+		uint16_t _pendingOffset;
+		Channel* _pendingChannel;
+
+		// Command received through ISO (CLA) chaining so far
+		uint8_t _claChained[SIM_MAX_CHAINED_LEN];
+		uint16_t _claChainedLen;
+
+		// Header of the case 2 command rejected with 6Cxx, 6Cxx emulation
+		uint8_t _wrongLe[4];
+		bool _wrongLeSent;
+};
+
+#endif /* __cplusplus */
+
+#endif /* __IOTSAFE_SIMULATOR_H__ */
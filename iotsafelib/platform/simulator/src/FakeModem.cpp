@@ -0,0 +1,359 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	// ptsname_r
+#endif
+
+#include "FakeModem.h"
+#include "HexCodec.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+static bool startsWith(const char* line, const char* prefix) {
+	return strncmp(line, prefix, strlen(prefix)) == 0;
+}
+
+static void sleepUs(unsigned long long us) {
+	struct timespec ts;
+
+	if(us == 0) {
+		return;
+	}
+	ts.tv_sec = us / 1000000ULL;
+	ts.tv_nsec = (us % 1000000ULL) * 1000ULL;
+	while(nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+	}
+}
+
+FakeModem::FakeModem(IoTSafeSimulator* sim) {
+	_sim = sim;
+	_master = -1;
+	_slave = -1;
+	_wakeup[0] = -1;
+	_wakeup[1] = -1;
+	_port[0] = '\0';
+	_running = false;
+	_stop = false;
+	_echo = true;
+	_uartModel = false;
+	_baud = FAKE_MODEM_DEFAULT_BAUD_RATE;
+	_commandDelay = 0;
+	_urc[0] = '\0';
+	_urcPeriod = 0;
+	_csimCount = 0;
+	_commandCount = 0;
+	_lineLen = 0;
+}
+
+FakeModem::~FakeModem(void) {
+	stop();
+	if(_slave >= 0) {
+		::close(_slave);
+	}
+	if(_master >= 0) {
+		::close(_master);
+	}
+	if(_wakeup[0] >= 0) {
+		::close(_wakeup[0]);
+		::close(_wakeup[1]);
+	}
+}
+
+bool FakeModem::open(void) {
+	struct termios tty;
+
+	if(_master >= 0) {
+		return true;
+	}
+	_master = posix_openpt(O_RDWR | O_NOCTTY);
+	if(_master < 0) {
+		return false;
+	}
+	if(grantpt(_master) != 0 || unlockpt(_master) != 0 || ptsname_r(_master, _port, sizeof(_port)) != 0 ||
+		pipe(_wakeup) != 0) {
+		::close(_master);
+		_master = -1;
+		return false;
+	}
+
+	// Keep the slave open: the master side sees a hangup each time the last
+	// slave descriptor is closed, i.e. whenever the client closes the port.
+	_slave = ::open(_port, O_RDWR | O_NOCTTY);
+	if(_slave < 0 || tcgetattr(_slave, &tty) != 0) {
+		return false;
+	}
+	cfmakeraw(&tty);
+	tcsetattr(_slave, TCSANOW, &tty);
+	return true;
+}
+
+const char* FakeModem::getPortName(void) {
+	return _port;
+}
+
+void FakeModem::setEcho(bool echo) {
+	_echo = echo;
+}
+
+void FakeModem::setUartModel(bool enable) {
+	_uartModel = enable;
+}
+
+void FakeModem::setCommandDelay(uint32_t us) {
+	_commandDelay = us;
+}
+
+void FakeModem::setUrc(const char* urc, uint32_t period) {
+	if(urc == nullptr || period == 0) {
+		_urc[0] = '\0';
+		_urcPeriod = 0;
+		return;
+	}
+	snprintf(_urc, sizeof(_urc), "%s", urc);
+	_urcPeriod = period;
+}
+
+uint32_t FakeModem::getCommandCount(void) {
+	return _commandCount;
+}
+
+bool FakeModem::start(void) {
+	if(_running || !open()) {
+		return _running;
+	}
+	_stop = false;
+	if(pthread_create(&_thread, nullptr, serve, this) != 0) {
+		return false;
+	}
+	_running = true;
+	return true;
+}
+
+void FakeModem::stop(void) {
+	char c = 0;
+
+	_stop = true;
+	if(_wakeup[1] >= 0) {
+		if(::write(_wakeup[1], &c, 1) < 0) {
+			// The serving thread polls _stop as well
+		}
+	}
+	if(_running) {
+		pthread_join(_thread, nullptr);
+		_running = false;
+	}
+	// Drain the wake up byte
+	if(_wakeup[0] >= 0) {
+		struct pollfd fd = { _wakeup[0], POLLIN, 0 };
+		while(poll(&fd, 1, 0) > 0 && ::read(_wakeup[0], &c, 1) > 0) {
+		}
+	}
+}
+
+void* FakeModem::serve(void* self) {
+	((FakeModem*) self)->run();
+	return nullptr;
+}
+
+void FakeModem::run(void) {
+	struct pollfd fds[2];
+	char buf[256];
+	ssize_t n;
+	ssize_t i;
+
+	if(!open()) {
+		return;
+	}
+	_stop = false;
+	_lineLen = 0;
+	fds[0].fd = _master;
+	fds[0].events = POLLIN;
+	fds[1].fd = _wakeup[0];
+	fds[1].events = POLLIN;
+
+	while(!_stop) {
+		if(poll(fds, 2, -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if(fds[1].revents) {
+			break;
+		}
+		if(!(fds[0].revents & POLLIN)) {
+			continue;
+		}
+		n = ::read(_master, buf, sizeof(buf));
+		if(n <= 0) {
+			continue;
+		}
+		// Echo goes out while the command comes in, it costs no extra time
+		if(_echo) {
+			write(buf, n, false);
+		}
+		// Commands end with CR, LF is ignored
+		for(i = 0; i < n; i++) {
+			if(buf[i] == '\r') {
+				_line[_lineLen] = '\0';
+				if(_lineLen > 0) {
+					handle(_line, _lineLen);
+				}
+				_lineLen = 0;
+			}
+			else if(buf[i] != '\n' && _lineLen < sizeof(_line) - 1) {
+				_line[_lineLen++] = buf[i];
+			}
+		}
+	}
+}
+
+// Time the given number of bytes take on the modeled UART
+void FakeModem::wire(unsigned long bytes) {
+	if(_uartModel) {
+		sleepUs((unsigned long long) bytes * FAKE_MODEM_BITS_PER_BYTE * 1000000ULL / _baud);
+	}
+}
+
+bool FakeModem::write(const char* data, unsigned long len, bool paced) {
+	ssize_t n;
+
+	if(paced) {
+		wire(len);
+	}
+	while(len > 0) {
+		n = ::write(_master, data, len);
+		if(n < 0) {
+			if(errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool FakeModem::writeLine(const char* line) {
+	char buf[FAKE_MODEM_URC_LEN + 8];
+	int len = snprintf(buf, sizeof(buf), "\r\n%s\r\n", line);
+
+	return write(buf, len);
+}
+
+void FakeModem::handle(char* line, unsigned long len) {
+	uint32_t baud;
+
+	_commandCount++;
+	// The command itself took time to arrive
+	wire(len + 1);
+
+	if(strcmp(line, "AT") == 0 || strcmp(line, "AT&K0") == 0 || strcmp(line, "AT&K3") == 0) {
+		writeLine("OK");
+	}
+	else if(strcmp(line, "ATE0") == 0 || strcmp(line, "ATE1") == 0) {
+		_echo = (line[3] == '1');
+		writeLine("OK");
+	}
+	else if(strcmp(line, "AT+IPR?") == 0) {
+		char ipr[24];
+		snprintf(ipr, sizeof(ipr), "+IPR: %lu", (unsigned long) _baud);
+		writeLine(ipr);
+		writeLine("OK");
+	}
+	else if(startsWith(line, "AT+IPR=")) {
+		baud = (uint32_t) strtoul(line + 7, nullptr, 10);
+		if(baud == 0) {
+			writeLine("ERROR");
+			return;
+		}
+		// OK goes out at the previous rate, then the modem switches
+		writeLine("OK");
+		_baud = baud;
+	}
+	else if(startsWith(line, "AT+CSIM=")) {
+		if(!csim(line + 8, len - 8)) {
+			writeLine("ERROR");
+		}
+	}
+	else {
+		writeLine("ERROR");
+	}
+}
+
+// AT+CSIM=<length>,"<command>"
+bool FakeModem::csim(const char* args, unsigned long len) {
+	char* end;
+	unsigned long hexLen = strtoul(args, &end, 10);
+	const char* hex;
+	uint16_t apduLen = 0;
+	uint16_t responseLen = sizeof(_response);
+	bool urc;
+
+	if(*end != ',' || end[1] != '"') {
+		return false;
+	}
+	hex = end + 2;
+	if(hexLen > sizeof(_apdu) * 2 || (unsigned long) (hex - args) + hexLen + 1 != len || hex[hexLen] != '"') {
+		return false;
+	}
+	if(!hexDecode(hex, (uint16_t) hexLen, _apdu, &apduLen)) {
+		return false;
+	}
+	{
+		// The simulator may also be driven in process by other threads
+		SETransaction transaction(_sim);
+
+		if(!_sim->transmitApdu(_apdu, apduLen, _response, &responseLen)) {
+			return false;
+		}
+	}
+
+	sleepUs(_commandDelay);
+
+	_csimCount++;
+	urc = (_urcPeriod != 0) && ((_csimCount % _urcPeriod) == 0);
+	if(urc && ((_csimCount / _urcPeriod) & 1)) {
+		writeLine(_urc);
+	}
+
+	// +CSIM: <length>,"<response>"
+	char out[16 + 2 * APDU_MAX_RESPONSE_LEN];
+	int off = snprintf(out, sizeof(out), "\r\n+CSIM: %d,\"", responseLen * 2);
+	hexEncode(_response, responseLen, out + off);
+	off += responseLen * 2;
+	out[off++] = '"';
+	out[off++] = '\r';
+	out[off++] = '\n';
+	if(!write(out, off)) {
+		return false;
+	}
+
+	if(urc && !((_csimCount / _urcPeriod) & 1)) {
+		writeLine(_urc);
+	}
+	return writeLine("OK");
+}
@@ -0,0 +1,1119 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "IoTSafeSimulator.h"
+#include "ROT.h"
+#include <map>
+#include <vector>
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+
+// Status words
+#define SIM_SW_OK				0x9000
+#define SIM_SW_WRONG_LENGTH			0x6700
+#define SIM_SW_CHANNEL_NOT_SUPPORTED		0x6881
+#define SIM_SW_CONDITIONS_NOT_SATISFIED		0x6985
+#define SIM_SW_WRONG_DATA			0x6A80
+#define SIM_SW_FUNCTION_NOT_SUPPORTED		0x6A81
+#define SIM_SW_FILE_NOT_FOUND			0x6A82
+#define SIM_SW_INCORRECT_P1P2			0x6A86
+#define SIM_SW_REFERENCED_DATA_NOT_FOUND	0x6A88
+#define SIM_SW_WRONG_OFFSET			0x6B00
+#define SIM_SW_INS_NOT_SUPPORTED		0x6D00
+#define SIM_SW_CLA_NOT_SUPPORTED		0x6E00
+
+// Sessions
+#define SIM_SESSION_NONE			0
+#define SIM_SESSION_SIGN			1
+#define SIM_SESSION_PUT_PUBLIC_KEY		2
+
+// Chaining, P1 of COMPUTE SIGNATURE UPDATE and PUT PUBLIC KEY UPDATE
+#define SIM_LAST_BLOCK				0x80
+#define SIM_CLA_CHAINING			0x10
+
+#define SIM_EC_COORDINATE_LEN			32
+#define SIM_EC_POINT_LEN			(1 + 2 * SIM_EC_COORDINATE_LEN)
+
+// AID of the IoT SAFE applet
+static const uint8_t AID[] = { 0xA0, 0x00, 0x00, 0x00, 0x30, 0x53, 0xF1, 0x24, 0x01, 0x77, 0x01, 0x01, 0x49, 0x53, 0x41 };
+
+// SubjectPublicKeyInfo header of an uncompressed P-256 point
+static const uint8_t P256_SPKI_HEADER[] = {
+	0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x02, 0x01, 0x06, 0x08, 0x2A,
+	0x86, 0x48, 0xCE, 0x3D, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00 };
+
+typedef std::vector<uint8_t> Bytes;
+
+// Containers of the applet
+struct IoTSafeSimulatorStore {
+	std::map<Bytes, EVP_PKEY*> privateKeys;
+	std::map<Bytes, EVP_PKEY*> publicKeys;
+	std::map<Bytes, Bytes> files;
+	std::map<Bytes, Bytes> secrets;
+};
+
+/** Helpers *******************************************************************/
+
+/**
+ * Look for a tag within a list of BER-TLV with single byte tags.
+ *
+ * @return true if found, false if absent or if the list is malformed.
+ */
+static bool findTag(const uint8_t* data, uint16_t dataLen, uint8_t tag, const uint8_t** value, uint16_t* valueLen)
+{
+	uint32_t index = 0;
+
+	while (index + 2 <= dataLen) {
+		uint8_t t = data[index++];
+		uint32_t len = data[index++];
+
+		if (len == 0x81) {
+			if (index + 1 > dataLen) {
+				return false;
+			}
+			len = data[index++];
+		}
+		else if (len == 0x82) {
+			if (index + 2 > dataLen) {
+				return false;
+			}
+			len = (data[index] << 8) | data[index + 1];
+			index += 2;
+		}
+		else if (len > 0x80) {
+			return false;
+		}
+		if (index + len > dataLen) {
+			return false;
+		}
+		if (t == tag) {
+			*value = data + index;
+			*valueLen = (uint16_t)len;
+			return true;
+		}
+		index += len;
+	}
+	return false;
+}
+
+static Bytes toBytes(const uint8_t* data, uint16_t dataLen)
+{
+	return Bytes(data, data + dataLen);
+}
+
+static EVP_PKEY* generateEcKey(void)
+{
+	EVP_PKEY* pkey = nullptr;
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+
+	if (ctx != nullptr &&
+		EVP_PKEY_keygen_init(ctx) > 0 &&
+		EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1) > 0) {
+		EVP_PKEY_keygen(ctx, &pkey);
+	}
+	EVP_PKEY_CTX_free(ctx);
+	return pkey;
+}
+
+// Uncompressed point of a P-256 key, SIM_EC_POINT_LEN bytes
+static bool exportPoint(EVP_PKEY* pkey, uint8_t* point)
+{
+	uint8_t spki[sizeof(P256_SPKI_HEADER) + SIM_EC_POINT_LEN];
+	uint8_t* p = spki;
+
+	if (i2d_PUBKEY(pkey, nullptr) != sizeof(spki)) {
+		return false;
+	}
+	i2d_PUBKEY(pkey, &p);
+	if (memcmp(spki, P256_SPKI_HEADER, sizeof(P256_SPKI_HEADER)) != 0) {
+		return false;
+	}
+	memcpy(point, spki + sizeof(P256_SPKI_HEADER), SIM_EC_POINT_LEN);
+	return true;
+}
+
+static EVP_PKEY* importPoint(const uint8_t* point, uint16_t pointLen)
+{
+	uint8_t spki[sizeof(P256_SPKI_HEADER) + SIM_EC_POINT_LEN];
+	const uint8_t* p = spki;
+
+	if (pointLen != SIM_EC_POINT_LEN || point[0] != 0x04) {
+		return nullptr;
+	}
+	memcpy(spki, P256_SPKI_HEADER, sizeof(P256_SPKI_HEADER));
+	memcpy(spki + sizeof(P256_SPKI_HEADER), point, SIM_EC_POINT_LEN);
+	return d2i_PUBKEY(nullptr, &p, sizeof(spki));
+}
+
+// Self signed certificate of a key, DER encoded
+static Bytes selfSignedCertificate(EVP_PKEY* pkey)
+{
+	Bytes der;
+	X509* cert = X509_new();
+
+	if (cert == nullptr) {
+		return der;
+	}
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 10L * 365 * 24 * 3600);
+	X509_NAME* name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC, (const unsigned char*)"IoT SAFE", -1, -1, 0);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"IoT SAFE Simulator", -1, -1, 0);
+	X509_set_issuer_name(cert, name);
+	X509_set_pubkey(cert, pkey);
+	if (X509_sign(cert, pkey, EVP_sha256()) > 0) {
+		int len = i2d_X509(cert, nullptr);
+		if (len > 0) {
+			der.resize(len);
+			uint8_t* p = der.data();
+			i2d_X509(cert, &p);
+		}
+	}
+	X509_free(cert);
+	return der;
+}
+
+static const EVP_MD* hashAlgorithm(uint16_t hashAlgo)
+{
+	switch (hashAlgo) {
+	case HASH_SHA256:
+		return EVP_sha256();
+	case HASH_SHA384:
+		return EVP_sha384();
+	case HASH_SHA512:
+		return EVP_sha512();
+	}
+	return nullptr;
+}
+
+// TLS 1.2 PRF with SHA-256 (RFC 5246 section 5)
+static bool tlsPrf(const uint8_t* secret, uint16_t secretLen, const uint8_t* lblSeed, uint16_t lblSeedLen,
+	uint8_t* out, uint16_t outLen)
+{
+	uint8_t a[EVP_MAX_MD_SIZE + MAX_APDU_DATA_LEN];
+	uint8_t block[EVP_MAX_MD_SIZE];
+	unsigned int aLen;
+	unsigned int blockLen;
+	uint16_t done = 0;
+
+	// A(1)
+	if (HMAC(EVP_sha256(), secret, secretLen, lblSeed, lblSeedLen, a, &aLen) == nullptr) {
+		return false;
+	}
+	while (done < outLen) {
+		// HMAC(secret, A(i) + seed)
+		memcpy(a + aLen, lblSeed, lblSeedLen);
+		if (HMAC(EVP_sha256(), secret, secretLen, a, aLen + lblSeedLen, block, &blockLen) == nullptr) {
+			return false;
+		}
+		uint32_t left = outLen - done;
+		uint16_t n = (left < blockLen) ? left : blockLen;
+		memcpy(out + done, block, n);
+		done += n;
+		// A(i + 1)
+		if (HMAC(EVP_sha256(), secret, secretLen, a, aLen, block, &aLen) == nullptr) {
+			return false;
+		}
+		memcpy(a, block, aLen);
+	}
+	return true;
+}
+
+/** IoTSafeSimulator **********************************************************/
+
+IoTSafeSimulator::IoTSafeSimulator(void)
+{
+	_store = new IoTSafeSimulatorStore();
+	memset(_channels, 0, sizeof(_channels));
+	_channels[0].open = true;
+	_mode = SIM_RESPONSE_DIRECT;
+	_apduCount = 0;
+	_extendedSupport = true;
+	_channelLimit = SIM_MAX_CHANNELS - 1;
+	_otherAidLen = 0;
+	_extendedApdu = false;
+	_outLen = 0;
+	_sw = 0;
+	_pendingLen = 0;
+	_pendingOffset = 0;
+	_pendingChannel = nullptr;
+	_wrongLeSent = false;
+	_claChainedLen = 0;
+
+	// Default provisioning: the client key and its certificate
+	const uint8_t keyId[] = { CONTAINER_ID_KEY };
+	const uint8_t certId[] = { CONTAINER_ID_CERT_CLIENT };
+	if (generateKey(keyId, sizeof(keyId))) {
+		Bytes cert = selfSignedCertificate(_store->privateKeys[toBytes(keyId, sizeof(keyId))]);
+		if (!cert.empty()) {
+			_store->files[toBytes(certId, sizeof(certId))] = cert;
+		}
+	}
+}
+
+IoTSafeSimulator::~IoTSafeSimulator(void)
+{
+	for (auto& key : _store->privateKeys) {
+		EVP_PKEY_free(key.second);
+	}
+	for (auto& key : _store->publicKeys) {
+		EVP_PKEY_free(key.second);
+	}
+	delete _store;
+}
+
+/**
+ * Select how response data is returned to the terminal.
+ *
+ * @param[in]  mode SIM_RESPONSE_DIRECT or a combination of SIM_RESPONSE_61XX and SIM_RESPONSE_6CXX
+ */
+void IoTSafeSimulator::setResponseMode(uint8_t mode)
+{
+	_mode = mode;
+	_pendingLen = 0;
+	_wrongLeSent = false;
+}
+
+/**
+ * Accept extended length APDUs, on by default. When off they are
+ * rejected with 6700 like on a Secure Element supporting short APDUs only.
+ *
+ * @param[in]  enable true to accept extended length APDUs
+ */
+void IoTSafeSimulator::setExtendedLengthSupport(bool enable)
+{
+	_extendedSupport = enable;
+}
+
+/**
+ * Number of logical channels MANAGE CHANNEL can open,
+ * SIM_MAX_CHANNELS - 1 by default.
+ *
+ * @param[in]  count 1 to SIM_MAX_CHANNELS - 1
+ */
+void IoTSafeSimulator::setChannelLimit(uint8_t count)
+{
+	if (count > 0 && count < SIM_MAX_CHANNELS) {
+		_channelLimit = count;
+	}
+}
+
+/**
+ * Answer SELECT of another AID as well, standing for a second applet.
+ *
+ * @param[in]  aid the AID
+ * @param[in]  aidLen length of the AID, up to SIM_MAX_AID_LEN
+ * @return true in case of success, false otherwise.
+ */
+bool IoTSafeSimulator::setOtherAid(const uint8_t* aid, uint16_t aidLen)
+{
+	if (aidLen > SIM_MAX_AID_LEN) {
+		return false;
+	}
+	memcpy(_otherAid, aid, aidLen);
+	_otherAidLen = aidLen;
+	return true;
+}
+
+/**
+ * Create or replace a file container.
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool IoTSafeSimulator::putFile(const uint8_t* fileId, uint16_t fileIdLen, const uint8_t* data, uint16_t dataLen)
+{
+	if (fileId == nullptr || fileIdLen == 0 || fileIdLen > SIM_MAX_ID_LEN || (data == nullptr && dataLen > 0)) {
+		return false;
+	}
+	_store->files[toBytes(fileId, fileIdLen)] = toBytes(data, dataLen);
+	return true;
+}
+
+/**
+ * Create or replace a secret container.
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool IoTSafeSimulator::putSecret(const uint8_t* secretId, uint16_t secretIdLen, const uint8_t* secret, uint16_t secretLen)
+{
+	if (secretId == nullptr || secretIdLen == 0 || secretIdLen > SIM_MAX_ID_LEN || secret == nullptr || secretLen == 0) {
+		return false;
+	}
+	_store->secrets[toBytes(secretId, secretIdLen)] = toBytes(secret, secretLen);
+	return true;
+}
+
+/**
+ * Generate a new ECC P-256 key pair in a private key container.
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool IoTSafeSimulator::generateKey(const uint8_t* keyId, uint16_t keyIdLen)
+{
+	if (keyId == nullptr || keyIdLen == 0 || keyIdLen > SIM_MAX_ID_LEN) {
+		return false;
+	}
+	EVP_PKEY* pkey = generateEcKey();
+	if (pkey == nullptr) {
+		return false;
+	}
+	EVP_PKEY*& slot = _store->privateKeys[toBytes(keyId, keyIdLen)];
+	EVP_PKEY_free(slot);
+	slot = pkey;
+	return true;
+}
+
+/**
+ * Export the public part of a key container as an uncompressed EC point.
+ *
+ * @return true in case of success, false otherwise.
+ */
+bool IoTSafeSimulator::getPublicKey(const uint8_t* keyId, uint16_t keyIdLen, uint8_t* point, uint16_t* pointLen)
+{
+	Bytes id = toBytes(keyId, keyIdLen);
+	EVP_PKEY* pkey = nullptr;
+
+	if (_store->privateKeys.count(id)) {
+		pkey = _store->privateKeys[id];
+	}
+	else if (_store->publicKeys.count(id)) {
+		pkey = _store->publicKeys[id];
+	}
+	if (pkey == nullptr || *pointLen < SIM_EC_POINT_LEN || !exportPoint(pkey, point)) {
+		return false;
+	}
+	*pointLen = SIM_EC_POINT_LEN;
+	return true;
+}
+
+/**
+ * Returns the number of APDUs processed since creation
+ */
+uint32_t IoTSafeSimulator::getApduCount(void)
+{
+	return _apduCount;
+}
+
+bool IoTSafeSimulator::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen)
+{
+	const uint8_t* data = nullptr;
+	uint16_t dataLen = 0;
+	uint32_t le = 0;
+	bool hasLe = false;
+
+	if (apdu == nullptr || apduLen < 4) {
+		return false;
+	}
+	_apduCount++;
+	_outLen = 0;
+	_sw = SIM_SW_OK;
+
+	uint8_t cla = apdu[APDU_CLA_OFFSET];
+	uint8_t ins = apdu[APDU_INS_OFFSET];
+	uint8_t p1 = apdu[APDU_P1_OFFSET];
+	uint8_t p2 = apdu[APDU_P2_OFFSET];
+
+	// Decode the extended APDU cases: 00 Le1 Le2 (2E), 00 Lc1 Lc2 data (3E)
+	// or 00 Lc1 Lc2 data Le1 Le2 (4E), Le 0000 standing for 65536
+	_extendedApdu = (apduLen >= 7) && (apdu[APDU_LC_OFFSET] == 0x00);
+	if (_extendedApdu) {
+		if (!_extendedSupport) {
+			status(SIM_SW_WRONG_LENGTH);
+		}
+		else if (apduLen == 7) {
+			le = (apdu[5] << 8) | apdu[6];
+			le = le ? le : 65536;
+			hasLe = true;
+		}
+		else {
+			dataLen = (apdu[5] << 8) | apdu[6];
+			data = apdu + 7;
+			if (dataLen == 0 || (apduLen != 7 + dataLen && apduLen != 9 + dataLen)) {
+				status(SIM_SW_WRONG_LENGTH);
+				dataLen = 0;
+			}
+			else if (apduLen == 9 + dataLen) {
+				le = (apdu[apduLen - 2] << 8) | apdu[apduLen - 1];
+				le = le ? le : 65536;
+				hasLe = true;
+			}
+		}
+	}
+	// Decode the short APDU cases
+	else if (apduLen == 5) {
+		le = apdu[APDU_LE_OFFSET] ? apdu[APDU_LE_OFFSET] : 256;
+		hasLe = true;
+	}
+	else if (apduLen > 5) {
+		dataLen = apdu[APDU_LC_OFFSET];
+		data = apdu + APDU_DATA_OFFSET;
+		if (dataLen == 0 || (apduLen != 5 + dataLen && apduLen != 6 + dataLen)) {
+			status(SIM_SW_WRONG_LENGTH);
+			dataLen = 0;
+		}
+		else if (apduLen == 6 + dataLen) {
+			le = apdu[apduLen - 1] ? apdu[apduLen - 1] : 256;
+			hasLe = true;
+		}
+	}
+
+	// Logical channel, first interindustry (0 to 3) or further interindustry (4 to 19) encoding
+	Channel* ch = nullptr;
+	if (_sw == SIM_SW_OK) {
+		if ((cla & 0x80) != 0) {
+			status(SIM_SW_CLA_NOT_SUPPORTED);
+		}
+		else {
+			uint8_t channel = (cla & 0x40) ? (4 + (cla & 0x0F)) : (cla & 0x03);
+			if (channel >= SIM_MAX_CHANNELS || !_channels[channel].open) {
+				status(SIM_SW_CHANNEL_NOT_SUPPORTED);
+			}
+			else {
+				ch = &_channels[channel];
+			}
+		}
+	}
+
+	if (ch != nullptr) {
+		if (ins == 0xC0) {
+			// GET RESPONSE, on the channel of the command which left data
+			if (_pendingLen == 0 || _pendingChannel != ch) {
+				status(SIM_SW_CONDITIONS_NOT_SATISFIED);
+			}
+			else {
+				uint16_t available = _pendingLen - _pendingOffset;
+				uint16_t n = (le < available) ? (uint16_t)le : available;
+				memcpy(_out, _pending + _pendingOffset, n);
+				_outLen = n;
+				_pendingOffset += n;
+				available -= n;
+				if (available == 0) {
+					_pendingLen = 0;
+				}
+				else {
+					_sw = SW_DATA_AVAILABLE | (available > 0xFF ? 0x00 : available);
+				}
+			}
+		}
+		else if ((_mode & SIM_RESPONSE_6CXX) && apduLen == 5 &&
+			!(_wrongLeSent && memcmp(_wrongLe, apdu, sizeof(_wrongLe)) == 0)) {
+			// Ask the terminal to repeat the command with the exact Le
+			memcpy(_wrongLe, apdu, sizeof(_wrongLe));
+			_wrongLeSent = true;
+			status((SW1_WRONG_LENGTH_LE << 8) | apdu[APDU_LE_OFFSET]);
+		}
+		else if ((cla & SIM_CLA_CHAINING) != 0) {
+			// ISO command chaining: segments are joined and processed with the last one
+			if (!joinChained(data, dataLen)) {
+				status(SIM_SW_WRONG_LENGTH);
+			}
+		}
+		else {
+			_wrongLeSent = false;
+			_pendingLen = 0;
+			if (_claChainedLen > 0) {
+				// Last segment of a chain
+				if (joinChained(data, dataLen)) {
+					data = _claChained;
+					dataLen = _claChainedLen;
+				}
+				else {
+					status(SIM_SW_WRONG_LENGTH);
+				}
+				_claChainedLen = 0;
+			}
+			if (_sw == SIM_SW_OK) {
+				process(ch, ins, p1, p2, data, dataLen, le, hasLe);
+			}
+
+			if ((_mode & SIM_RESPONSE_61XX) && _outLen > 0 && _sw == SIM_SW_OK) {
+				memcpy(_pending, _out, _outLen);
+				_pendingLen = _outLen;
+				_pendingOffset = 0;
+				_pendingChannel = ch;
+				_sw = SW_DATA_AVAILABLE | (_outLen > 0xFF ? 0x00 : _outLen);
+				_outLen = 0;
+			}
+		}
+	}
+
+	if (*responseLen < _outLen + APDU_RESPONSE_LEN) {
+		return false;
+	}
+	memcpy(response, _out, _outLen);
+	response[_outLen] = (uint8_t)(_sw >> 8);
+	response[_outLen + 1] = (uint8_t)(_sw & 0xFF);
+	*responseLen = _outLen + APDU_RESPONSE_LEN;
+	return true;
+}
+
+void IoTSafeSimulator::process(Channel* ch, uint8_t ins, uint8_t p1, uint8_t p2,
+	const uint8_t* data, uint16_t dataLen, uint32_t le, bool hasLe)
+{
+	// Instructions outside of the applet
+	if (ins == 0xA4) {
+		select(ch, p1, data, dataLen);
+		return;
+	}
+	if (ins == 0x70) {
+		manageChannel(p1, p2);
+		return;
+	}
+
+	if (!ch->selected) {
+		status(SIM_SW_CONDITIONS_NOT_SATISFIED);
+		return;
+	}
+
+	switch (ins) {
+	case 0xCB:
+		getData(p1, p2, data, dataLen);
+		break;
+	case 0xB0:
+		readBinary((p1 << 8) | p2, data, dataLen, hasLe ? le : 256);
+		break;
+	case 0x84:
+		if (!hasLe || dataLen > 0) {
+			status(SIM_SW_WRONG_LENGTH);
+		}
+		else {
+			getRandom(le);
+		}
+		break;
+	case 0xB9:
+		generateKeyPair(data, dataLen);
+		break;
+	case 0x2A:
+		computeSignatureInit(ch, p1, data, dataLen);
+		break;
+	case 0x2B:
+		computeSignatureUpdate(ch, p1, data, dataLen);
+		break;
+	case 0x24:
+		putPublicKeyInit(ch, p1, data, dataLen);
+		break;
+	case 0xD8:
+		putPublicKeyUpdate(ch, p1, data, dataLen);
+		break;
+	case 0x46:
+		computeDH(data, dataLen);
+		break;
+	case 0x48:
+		computePRF(p1, data, dataLen);
+		break;
+	default:
+		status(SIM_SW_INS_NOT_SUPPORTED);
+		break;
+	}
+
+	// A response longer than the expected one is truncated to Le
+	if (hasLe && _outLen > le) {
+		_outLen = le;
+	}
+}
+
+void IoTSafeSimulator::status(uint16_t sw)
+{
+	_sw = sw;
+	_outLen = 0;
+}
+
+// SELECT by AID
+void IoTSafeSimulator::select(Channel* ch, uint8_t p1, const uint8_t* data, uint16_t dataLen)
+{
+	if (p1 != 0x04) {
+		status(SIM_SW_INCORRECT_P1P2);
+		return;
+	}
+	if ((dataLen != sizeof(AID) || memcmp(data, AID, sizeof(AID)) != 0) &&
+		(_otherAidLen == 0 || dataLen != _otherAidLen || memcmp(data, _otherAid, _otherAidLen) != 0)) {
+		ch->selected = false;
+		status(SIM_SW_FILE_NOT_FOUND);
+		return;
+	}
+	ch->selected = true;
+	ch->session = SIM_SESSION_NONE;
+	ch->chainedLen = 0;
+}
+
+// MANAGE CHANNEL open (P1 = 00) or close (P1 = 80, P2 = channel)
+void IoTSafeSimulator::manageChannel(uint8_t p1, uint8_t p2)
+{
+	if (p1 == 0x00 && p2 == 0x00) {
+		for (uint8_t i = 1; i <= _channelLimit; i++) {
+			if (!_channels[i].open) {
+				memset(&_channels[i], 0, sizeof(Channel));
+				_channels[i].open = true;
+				_out[0] = i;
+				_outLen = 1;
+				return;
+			}
+		}
+		status(SIM_SW_FUNCTION_NOT_SUPPORTED);
+	}
+	else if (p1 == 0x80 && p2 > 0 && p2 < SIM_MAX_CHANNELS && _channels[p2].open) {
+		memset(&_channels[p2], 0, sizeof(Channel));
+	}
+	else {
+		status(SIM_SW_INCORRECT_P1P2);
+	}
+}
+
+// GET DATA of a file container (tag C3)
+void IoTSafeSimulator::getData(uint8_t p1, uint8_t p2, const uint8_t* data, uint16_t dataLen)
+{
+	const uint8_t* id;
+	uint16_t idLen;
+
+	if (p1 != 0xC3 && p2 != 0xC3) {
+		status(SIM_SW_INCORRECT_P1P2);
+		return;
+	}
+	if (!findTag(data, dataLen, 0x83, &id, &idLen) || idLen > SIM_MAX_ID_LEN) {
+		status(SIM_SW_WRONG_DATA);
+		return;
+	}
+	auto file = _store->files.find(toBytes(id, idLen));
+	if (file == _store->files.end()) {
+		status(SIM_SW_REFERENCED_DATA_NOT_FOUND);
+		return;
+	}
+
+	uint16_t size = (uint16_t)file->second.size();
+	uint16_t index = 0;
+	_out[index++] = 0xC3;
+	_out[index++] = 2 + idLen + 4;
+	_out[index++] = 0x83;
+	_out[index++] = idLen;
+	memcpy(_out + index, id, idLen);
+	index += idLen;
+	_out[index++] = 0x20;
+	_out[index++] = 0x02;
+	_out[index++] = (uint8_t)(size >> 8);
+	_out[index++] = (uint8_t)(size & 0xFF);
+	_outLen = index;
+}
+
+// READ BINARY of a file container
+void IoTSafeSimulator::readBinary(uint16_t offset, const uint8_t* data, uint16_t dataLen, uint32_t le)
+{
+	const uint8_t* id;
+	uint16_t idLen;
+
+	if (!findTag(data, dataLen, 0x83, &id, &idLen)) {
+		status(SIM_SW_WRONG_DATA);
+		return;
+	}
+	auto file = _store->files.find(toBytes(id, idLen));
+	if (file == _store->files.end()) {
+		status(SIM_SW_REFERENCED_DATA_NOT_FOUND);
+		return;
+	}
+	if (offset > file->second.size()) {
+		status(SIM_SW_WRONG_OFFSET);
+		return;
+	}
+
+	uint16_t n = (uint16_t)(file->second.size() - offset);
+	if (n > le) {
+		n = le;
+	}
+	// The applet reads up to 255 bytes per short APDU
+	if (!_extendedApdu && n > SIM_MAX_READ_LEN) {
+		n = SIM_MAX_READ_LEN;
+	}
+	if (n > sizeof(_out)) {
+		n = sizeof(_out);
+	}
+	memcpy(_out, file->second.data() + offset, n);
+	_outLen = n;
+}
+
+// GET RANDOM
+void IoTSafeSimulator::getRandom(uint32_t le)
+{
+	if (le > sizeof(_out)) {
+		le = sizeof(_out);
+	}
+	if (RAND_bytes(_out, le) != 1) {
+		status(SIM_SW_CONDITIONS_NOT_SATISFIED);
+		return;
+	}
+	_outLen = le;
+}
+
+// GENERATE KEY PAIR, ECC P-256 only
+void IoTSafeSimulator::generateKeyPair(const uint8_t* data, uint16_t dataLen)
+{
+	const uint8_t* id;
+	uint16_t idLen;
+
+	if (!findTag(data, dataLen, 0x84, &id, &idLen) || idLen == 0 || idLen > SIM_MAX_ID_LEN) {
+		status(SIM_SW_REFERENCED_DATA_NOT_FOUND);
+		return;
+	}
+	if (!generateKey(id, idLen)) {
+		status(SIM_SW_CONDITIONS_NOT_SATISFIED);
+		return;
+	}
+
+	EVP_PKEY* pkey = _store->privateKeys[toBytes(id, idLen)];
+	uint16_t index = 0;
+	// Private and public key containers share the same id
+	_out[index++] = 0x84;
+	_out[index++] = idLen;
+	memcpy(_out + index, id, idLen);
+	index += idLen;
+	_out[index++] = 0x85;
+	_out[index++] = idLen;
+	memcpy(_out + index, id, idLen);
+	index += idLen;
+	// Public key data: 34 { 49 { 86 point } }
+	_out[index++] = 0x34;
+	_out[index++] = 4 + SIM_EC_POINT_LEN;
+	_out[index++] = 0x49;
+	_out[index++] = 2 + SIM_EC_POINT_LEN;
+	_out[index++] = 0x86;
+	_out[index++] = SIM_EC_POINT_LEN;
+	if (!exportPoint(pkey, _out + index)) {
+		status(SIM_SW_CONDITIONS_NOT_SATISFIED);
+		return;
+	}
+	index += SIM_EC_POINT_LEN;
+	_outLen = index;
+}
+
+// COMPUTE SIGNATURE INIT (P1 = 00) and session closing (P1 = 01)
+void IoTSafeSimulator::computeSignatureInit(Channel* ch, uint8_t p1, const uint8_t* data, uint16_t dataLen)
+{
+	const uint8_t* value;
+	uint16_t valueLen;
+
+	if (p1 == 0x01) {
+		ch->session = SIM_SESSION_NONE;
+		ch->chainedLen = 0;
+		return;
+	}
+	if (p1 != 0x00) {
+		status(SIM_SW_INCORRECT_P1P2);
+		return;
+	}
+
+	// Key, by id only
+	if (!findTag(data, dataLen, 0x84, &value, &valueLen) || valueLen > SIM_MAX_ID_LEN ||
+		_store->privateKeys.count(toBytes(value, valueLen)) == 0) {
+		status(SIM_SW_REFERENCED_DATA_NOT_FOUND);
+		return;
+	}
+	memcpy(ch->keyId, value, valueLen);
+	ch->keyIdLen = valueLen;
+
+	// Mode of operation, the intermediate hash of the last block mode cannot be resumed
+	if (!findTag(data, dataLen, 0xA1, &value, &valueLen) || valueLen != 1) {
+		status(SIM_SW_WRONG_DATA);
+		return;
+	}
+	if (value[0] != OPERATION_MODE_FULL_TEXT && value[0] != OPERATION_MODE_PADDING) {
+		status(SIM_SW_FUNCTION_NOT_SUPPORTED);
+		return;
+	}
+	ch->mode = value[0];
+
+	if (!findTag(data, dataLen, 0x91, &value, &valueLen) || valueLen != 2 ||
+		hashAlgorithm((value[0] << 8) | value[1]) == nullptr) {
+		status(SIM_SW_WRONG_DATA);
+		return;
+	}
+	ch->hashAlgo = (value[0] << 8) | value[1];
+
+	if (!findTag(data, dataLen, 0x92, &value, &valueLen) || valueLen != 1) {
+		status(SIM_SW_WRONG_DATA);
+		return;
+	}
+	if (value[0] != SIGN_ECDSA) {
+		status(SIM_SW_FUNCTION_NOT_SUPPORTED);
+		return;
+	}
+
+	ch->session = SIM_SESSION_SIGN;
+	ch->chainedLen = 0;
+}
+
+// Accumulate the data of a chained command
+// Append a CLA chained segment, the chain is dropped when too long
+bool IoTSafeSimulator::joinChained(const uint8_t* data, uint16_t dataLen)
+{
+	if (_claChainedLen + dataLen > sizeof(_claChained)) {
+		_claChainedLen = 0;
+		return false;
+	}
+	memcpy(_claChained + _claChainedLen, data, dataLen);
+	_claChainedLen += dataLen;
+	return true;
+}
+
+bool IoTSafeSimulator::chain(Channel* ch, const uint8_t* data, uint16_t dataLen)
+{
+	if (ch->chainedLen + dataLen > SIM_MAX_CHAINED_LEN) {
+		ch->session = SIM_SESSION_NONE;
+		ch->chainedLen = 0;
+		status(SIM_SW_WRONG_LENGTH);
+		return false;
+	}
+	memcpy(ch->chained + ch->chainedLen, data, dataLen);
+	ch->chainedLen += dataLen;
+	return true;
+}
+
+// COMPUTE SIGNATURE UPDATE, the signature is returned as 33 { r || s }
+void IoTSafeSimulator::computeSignatureUpdate(Channel* ch, uint8_t p1, const uint8_t* data, uint16_t dataLen)
+{
+	const uint8_t* value;
+	uint16_t valueLen;
+	uint8_t digest[EVP_MAX_MD_SIZE];
+	unsigned int digestLen = 0;
+
+	if (ch->session != SIM_SESSION_SIGN) {
+		status(SIM_SW_CONDITIONS_NOT_SATISFIED);
+		return;
+	}
+	if (!chain(ch, data, dataLen) || (p1 & SIM_LAST_BLOCK) == 0) {
+		return;
+	}
+	ch->session = SIM_SESSION_NONE;
+
+	if (ch->mode == OPERATION_MODE_PADDING) {
+		if (!findTag(ch->chained, ch->chainedLen, 0x9E, &value, &valueLen) || valueLen == 0 || valueLen > EVP_MAX_MD_SIZE) {
+			status(SIM_SW_WRONG_DATA);
+			return;
+		}
+		memcpy(digest, value, valueLen);
+		digestLen = valueLen;
+	}
+	else {
+		if (!findTag(ch->chained, ch->chainedLen, 0x9B, &value, &valueLen) ||
+			EVP_Digest(value, valueLen, digest, &digestLen, hashAlgorithm(ch->hashAlgo), nullptr) != 1) {
+			status(SIM_SW_WRONG_DATA);
+			return;
+		}
+	}
+	ch->chainedLen = 0;
+
+	EVP_PKEY* pkey = _store->privateKeys[toBytes(ch->keyId, ch->keyIdLen)];
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(pkey, nullptr);
+	uint8_t der[80];
+	size_t derLen = sizeof(der);
+	ECDSA_SIG* sig = nullptr;
+
+	if (ctx != nullptr &&
+		EVP_PKEY_sign_init(ctx) > 0 &&
+		EVP_PKEY_sign(ctx, der, &derLen, digest, digestLen) > 0) {
+		const uint8_t* p = der;
+		sig = d2i_ECDSA_SIG(nullptr, &p, derLen);
+	}
+	EVP_PKEY_CTX_free(ctx);
+	if (sig == nullptr) {
+		status(SIM_SW_CONDITIONS_NOT_SATISFIED);
+		return;
+	}
+
+	const BIGNUM* r;
+	const BIGNUM* s;
+	ECDSA_SIG_get0(sig, &r, &s);
+	_out[0] = 0x33;
+	_out[1] = 2 * SIM_EC_COORDINATE_LEN;
+	BN_bn2binpad(r, _out + 2, SIM_EC_COORDINATE_LEN);
+	BN_bn2binpad(s, _out + 2 + SIM_EC_COORDINATE_LEN, SIM_EC_COORDINATE_LEN);
+	_outLen = 2 + 2 * SIM_EC_COORDINATE_LEN;
+	ECDSA_SIG_free(sig);
+}
+
+// PUT PUBLIC KEY INIT (P1 = 00) and session closing (P1 = 01)
+void IoTSafeSimulator::putPublicKeyInit(Channel* ch, uint8_t p1, const uint8_t* data, uint16_t dataLen)
+{
+	const uint8_t* id;
+	uint16_t idLen;
+
+	if (p1 == 0x01) {
+		ch->session = SIM_SESSION_NONE;
+		ch->chainedLen = 0;
+		return;
+	}
+	if (p1 != 0x00) {
+		status(SIM_SW_INCORRECT_P1P2);
+		return;
+	}
+
+	if (!findTag(data, dataLen, 0x85, &id, &idLen) || idLen == 0 || idLen > SIM_MAX_ID_LEN) {
+		status(SIM_SW_REFERENCED_DATA_NOT_FOUND);
+		return;
+	}
+	memcpy(ch->keyId, id, idLen);
+	ch->keyIdLen = idLen;
+	ch->session = SIM_SESSION_PUT_PUBLIC_KEY;
+	ch->chainedLen = 0;
+}
+
+// PUT PUBLIC KEY UPDATE, public key data 34 { 49 { 86 point } }
+void IoTSafeSimulator::putPublicKeyUpdate(Channel* ch, uint8_t p1, const uint8_t* data, uint16_t dataLen)
+{
+	const uint8_t* keyData;
+	uint16_t keyDataLen;
+	const uint8_t* publicKey;
+	uint16_t publicKeyLen;
+	const uint8_t* point;
+	uint16_t pointLen;
+
+	if (ch->session != SIM_SESSION_PUT_PUBLIC_KEY) {
+		status(SIM_SW_CONDITIONS_NOT_SATISFIED);
+		return;
+	}
+	if (!chain(ch, data, dataLen) || (p1 & SIM_LAST_BLOCK) == 0) {
+		return;
+	}
+	ch->session = SIM_SESSION_NONE;
+
+	EVP_PKEY* pkey = nullptr;
+	if (findTag(ch->chained, ch->chainedLen, 0x34, &keyData, &keyDataLen) &&
+		findTag(keyData, keyDataLen, 0x49, &publicKey, &publicKeyLen) &&
+		findTag(publicKey, publicKeyLen, 0x86, &point, &pointLen)) {
+		pkey = importPoint(point, pointLen);
+	}
+	ch->chainedLen = 0;
+	if (pkey == nullptr) {
+		status(SIM_SW_WRONG_DATA);
+		return;
+	}
+
+	EVP_PKEY*& slot = _store->publicKeys[toBytes(ch->keyId, ch->keyIdLen)];
+	EVP_PKEY_free(slot);
+	slot = pkey;
+}
+
+// COMPUTE DH, the shared secret is the x coordinate
+void IoTSafeSimulator::computeDH(const uint8_t* data, uint16_t dataLen)
+{
+	const uint8_t* privId;
+	uint16_t privIdLen;
+	const uint8_t* pubId;
+	uint16_t pubIdLen;
+
+	if (!findTag(data, dataLen, 0x84, &privId, &privIdLen) || !findTag(data, dataLen, 0x85, &pubId, &pubIdLen)) {
+		status(SIM_SW_REFERENCED_DATA_NOT_FOUND);
+		return;
+	}
+	auto priv = _store->privateKeys.find(toBytes(privId, privIdLen));
+	auto pub = _store->publicKeys.find(toBytes(pubId, pubIdLen));
+	if (priv == _store->privateKeys.end() || pub == _store->publicKeys.end()) {
+		status(SIM_SW_REFERENCED_DATA_NOT_FOUND);
+		return;
+	}
+
+	EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(priv->second, nullptr);
+	size_t len = sizeof(_out);
+	bool ret = ctx != nullptr &&
+		EVP_PKEY_derive_init(ctx) > 0 &&
+		EVP_PKEY_derive_set_peer(ctx, pub->second) > 0 &&
+		EVP_PKEY_derive(ctx, _out, &len) > 0;
+	EVP_PKEY_CTX_free(ctx);
+	if (!ret) {
+		status(SIM_SW_CONDITIONS_NOT_SATISFIED);
+		return;
+	}
+	_outLen = (uint16_t)len;
+}
+
+// PSEUDO RANDOM FUNCTION, TLS 1.2 PRF with SHA-256
+void IoTSafeSimulator::computePRF(uint8_t p1, const uint8_t* data, uint16_t dataLen)
+{
+	const uint8_t* lblSeed;
+	uint16_t lblSeedLen;
+	const uint8_t* value;
+	uint16_t valueLen;
+	uint8_t secret[2 * MAX_APDU_DATA_LEN + 4];
+	uint16_t secretLen = 0;
+
+	if (!findTag(data, dataLen, 0xD2, &lblSeed, &lblSeedLen) ||
+		!findTag(data, dataLen, 0xD3, &value, &valueLen) || valueLen != 1 || value[0] == 0) {
+		status(SIM_SW_WRONG_DATA);
+		return;
+	}
+	uint16_t outLen = value[0];
+	if (lblSeedLen > MAX_APDU_DATA_LEN) {
+		status(SIM_SW_WRONG_DATA);
+		return;
+	}
+
+	if (p1 == PRF_MODE_GENERAL) {
+		if (!findTag(data, dataLen, 0xD1, &value, &valueLen) || valueLen > MAX_APDU_DATA_LEN) {
+			status(SIM_SW_WRONG_DATA);
+			return;
+		}
+		memcpy(secret, value, valueLen);
+		secretLen = valueLen;
+	}
+	else if (p1 == PRF_MODE_PSK_PLAIN || p1 == PRF_MODE_PSK_ECDHE) {
+		if (!findTag(data, dataLen, 0x86, &value, &valueLen)) {
+			status(SIM_SW_REFERENCED_DATA_NOT_FOUND);
+			return;
+		}
+		auto psk = _store->secrets.find(toBytes(value, valueLen));
+		if (psk == _store->secrets.end() || psk->second.size() > MAX_APDU_DATA_LEN) {
+			status(SIM_SW_REFERENCED_DATA_NOT_FOUND);
+			return;
+		}
+
+		// Premaster secret of RFC 4279 (plain) or RFC 5489 (ECDHE):
+		// other_secret length, other_secret, psk length, psk
+		uint16_t otherLen = (uint16_t)psk->second.size();
+		const uint8_t* other = nullptr;
+		if (p1 == PRF_MODE_PSK_ECDHE) {
+			if (!findTag(data, dataLen, 0xD4, &other, &otherLen) || otherLen > MAX_APDU_DATA_LEN) {
+				status(SIM_SW_WRONG_DATA);
+				return;
+			}
+		}
+		secret[secretLen++] = (uint8_t)(otherLen >> 8);
+		secret[secretLen++] = (uint8_t)(otherLen & 0xFF);
+		if (other != nullptr) {
+			memcpy(secret + secretLen, other, otherLen);
+		}
+		else {
+			memset(secret + secretLen, 0, otherLen);
+		}
+		secretLen += otherLen;
+		secret[secretLen++] = (uint8_t)(psk->second.size() >> 8);
+		secret[secretLen++] = (uint8_t)(psk->second.size() & 0xFF);
+		memcpy(secret + secretLen, psk->second.data(), psk->second.size());
+		secretLen += psk->second.size();
+	}
+	else {
+		status(SIM_SW_INCORRECT_P1P2);
+		return;
+	}
+
+	if (!tlsPrf(secret, secretLen, lblSeed, lblSeedLen, _out, outLen)) {
+		status(SIM_SW_CONDITIONS_NOT_SATISFIED);
+		return;
+	}
+	_outLen = outLen;
+}
@@ -0,0 +1,153 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_FAULT_INJECTOR_H__
+#define __SE_FAULT_INJECTOR_H__
+
+#include <random>
+#include <vector>
+#include "SEInterface.h"
+#include "SETrace.h"
+
+#define SE_FAULT_6CXX		0	// Le refused once with 6Cxx, the response served on the retry
+#define SE_FAULT_61XX		1	// response data announced with 61xx, served through GET RESPONSE
+#define SE_FAULT_TRANSPORT	2	// command lost before the Secure Element, transport error
+#define SE_FAULT_DROP		3	// response lost after the Secure Element processed the command
+#define SE_FAULT_STALL		4	// response held back for the stall time, timing out past the deadline
+#define SE_FAULT_COUNT		5
+
+#define SE_FAULT_ANY_INS	-1	// profile of the INS without one of their own
+
+
+/**
+ * Secure Element interface delaying and disturbing the exchanges of
+ * another one (usually the IoTSafeSimulator), so load tests see the
+ * timing and the faults of a SIM behind a modem without hardware:
+ *
+ * - Latency: each exchange takes a time drawn from the profile of its
+ *   INS, uniform between two bounds or drawn from the link times of a
+ *   recorded trace (calibrate()). The wrapped interface's own time is
+ *   part of it.
+ * - Status words: 6Cxx and 61xx, as a card would answer them, which the
+ *   layers above must follow.
+ * - Transport faults: lost commands, lost responses and stalls, which
+ *   time out (ERR_TIMEOUT) when they last past the deadline.
+ *
+ * Each INS may have a profile of its own, the others use the
+ * SE_FAULT_ANY_INS one. Draws come from a seeded generator, so a load
+ * test can be run again with the same faults.
+ */
+class SEFaultInjector: public SEInterface {
+	public:
+		SEFaultInjector(SEInterface* se);
+		~SEFaultInjector(void);
+
+		/**
+		 * Seed the generator the latencies and faults are drawn from.
+		 *
+		 * @param[in]  seed the seed
+		 */
+		void setSeed(uint32_t seed);
+
+		/**
+		 * Latency uniform between two bounds.
+		 *
+		 * @param[in]  ins INS of the commands, SE_FAULT_ANY_INS for the default profile
+		 * @param[in]  minUs lower bound in us
+		 * @param[in]  maxUs upper bound in us
+		 */
+		void setLatency(int ins, uint32_t minUs, uint32_t maxUs);
+
+		/**
+		 * Latencies and fault rates taken from a trace recorded by
+		 * SETraceRecorder: for each INS of the trace, the latency is drawn
+		 * from its recorded link times, and the rates of SE_FAULT_DROP and
+		 * SE_FAULT_STALL are those of its failed and timed out exchanges.
+		 * The default profile gets those of the whole trace.
+		 *
+		 * @param[in]  path trace file
+		 * @return true in case of success, false if it is not a trace or is empty.
+		 */
+		bool calibrate(const char* path);
+
+		/**
+		 * Probability of a fault.
+		 *
+		 * @param[in]  fault SE_FAULT_6CXX, SE_FAULT_61XX, SE_FAULT_TRANSPORT, SE_FAULT_DROP or SE_FAULT_STALL
+		 * @param[in]  rate probability per exchange, 0 to 1
+		 * @param[in]  ins INS of the commands, SE_FAULT_ANY_INS for the default profile
+		 */
+		void setFaultRate(uint8_t fault, double rate, int ins = SE_FAULT_ANY_INS);
+
+		/**
+		 * Scale the latencies, 1 by default.
+		 *
+		 * @param[in]  scale factor, 0 for no latency
+		 */
+		void setTimeScale(double scale);
+
+		/**
+		 * Time a stall holds the response back, APDU_DEFAULT_TIMEOUT by
+		 * default: past the deadline the exchange times out.
+		 *
+		 * @param[in]  ms stall in ms
+		 */
+		void setStallTime(uint32_t ms);
+
+		/**
+		 * Returns the number of faults of a kind injected
+		 */
+		uint32_t getFaultCount(uint8_t fault);
+
+	//protected:
+
+		bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+
+	private:
+		struct Profile {
+			bool hasLatency;		// else the default profile's
+			uint32_t minUs;
+			uint32_t maxUs;
+			std::vector<uint32_t> samples;	// recorded latencies in us, drawn from if any
+			double rates[SE_FAULT_COUNT];	// negative: the default profile's
+		};
+
+		Profile* profile(int ins);
+		uint64_t drawLatency(uint8_t ins);
+		bool draw(uint8_t fault, uint8_t ins);
+		bool servePending(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+		void clearPending(void);
+
+		SEInterface* _se;
+		std::mt19937 _random;
+		Profile _default;
+		Profile _profiles[256];
+		double _scale;
+		uint32_t _stall;
+		uint32_t _counts[SE_FAULT_COUNT];
+
+		// Response held back by a 6Cxx or 61xx
+		uint8_t _pending[APDU_MAX_RESPONSE_LEN];
+		uint16_t _pendingLen;		// response data, SW excluded
+		uint16_t _pendingOff;
+		uint16_t _pendingSw;
+		uint8_t _pendingFault;		// SE_FAULT_6CXX or SE_FAULT_61XX, SE_FAULT_COUNT if none
+		uint8_t _pendingCommand[APDU_CMD_HEADER_LEN + MAX_APDU_DATA_LEN];	// command refused with 6Cxx, Le excluded
+		uint16_t _pendingCommandLen;
+};
+
+#endif /* __SE_FAULT_INJECTOR_H__ */
@@ -0,0 +1,102 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_TRACE_H__
+#define __SE_TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// APDU trace file, written by SETraceRecorder and served by SETraceReplay:
+//   <SETraceHeader> then one record per APDU exchange:
+//   <SETraceRecord> <command> <response>, padded to 8 bytes
+// Integers are in host byte order and records 8 byte aligned, so a trace
+// is read in place once mapped.
+//
+// Timings are in ns: `link` is the time spent in the decorated transport
+// (modem, UART, Secure Element), `host` the time between the end of the
+// previous exchange and this command, spent in the layers above (APDU
+// encoding, response parsing, application).
+
+#define SE_TRACE_MAGIC		"IOTSTRC1"
+#define SE_TRACE_MAGIC_LEN	8
+#define SE_TRACE_VERSION	1
+
+#define SE_TRACE_FAILED		0x01	// the transport failed, no response
+#define SE_TRACE_TIMED_OUT	0x02	// the transport deadline expired
+
+typedef struct SETraceHeader {
+	char magic[SE_TRACE_MAGIC_LEN];
+	uint32_t version;
+	uint32_t headerLen;	// sizeof(SETraceHeader), where the first record starts
+	uint64_t startTime;	// wall clock of the trace start, ns since the epoch
+	uint64_t reserved;
+} SETraceHeader;
+
+typedef struct SETraceRecord {
+	uint64_t start;		// command sent, ns since the trace start
+	uint64_t link;		// ns spent in the transport
+	uint64_t host;		// ns since the previous exchange ended
+	uint16_t commandLen;
+	uint16_t responseLen;
+	uint8_t flags;		// SE_TRACE_FAILED, SE_TRACE_TIMED_OUT
+	uint8_t reserved[3];
+} SETraceRecord;
+
+#define SE_TRACE_ALIGN(len)	(((len) + 7) & ~7UL)
+
+/**
+ * Size of a record with its command and response, padding included
+ */
+static inline unsigned long seTraceRecordSize(const SETraceRecord* record) {
+	return SE_TRACE_ALIGN(sizeof(SETraceRecord) + record->commandLen + record->responseLen);
+}
+
+/**
+ * Map a trace file read only and check its header.
+ *
+ * @param[in]  path trace file
+ * @param[out]  len length of the mapping
+ * @return the mapping, to release with munmap, nullptr if the file is not a trace.
+ */
+const uint8_t* seTraceMap(const char* path, size_t* len);
+
+/**
+ * Next record of a mapped trace. A record cut short (recorder killed)
+ * ends the trace.
+ *
+ * @param[in]  map the mapping
+ * @param[in]  len length of the mapping
+ * @param[in, out]  offset offset of the record, 0 for the first one; set to the following record
+ * @return the record, nullptr at the end of the trace.
+ */
+const SETraceRecord* seTraceNext(const uint8_t* map, size_t len, size_t* offset);
+
+/**
+ * Returns the CLOCK_MONOTONIC time in ns
+ */
+uint64_t seTraceNow(void);
+
+/**
+ * Wait until a CLOCK_MONOTONIC time: sleep, then spin over the end of
+ * the wait, a sleep overshooting by tens of us.
+ *
+ * @param[in]  end time in ns
+ */
+void seTraceWaitUntil(uint64_t end);
+
+#endif /* __SE_TRACE_H__ */
@@ -0,0 +1,74 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_TRACE_RECORDER_H__
+#define __SE_TRACE_RECORDER_H__
+
+#include <stdio.h>
+#include "SEInterface.h"
+#include "SETrace.h"
+
+
+/**
+ * Secure Element interface recording the APDU exchanges of another one
+ * (usually a GenericModem) to a trace file, see SETrace.h. Every command
+ * and response of the wrapped transport is written with its timings, so
+ * a workload captured in the field can be served again by SETraceReplay
+ * without modem nor SIM.
+ *
+ * Records are buffered, the file is complete once close() returned.
+ */
+class SETraceRecorder: public SEInterface {
+	public:
+		SETraceRecorder(SEInterface* se);
+		~SETraceRecorder(void);
+
+		/**
+		 * Start recording to a file, replacing it.
+		 *
+		 * @param[in]  path trace file
+		 * @return true in case of success, false otherwise.
+		 */
+		bool open(const char* path);
+
+		/**
+		 * Flush and close the trace file. Exchanges still go to the wrapped
+		 * interface, unrecorded.
+		 *
+		 * @return true if every record was written, false otherwise.
+		 */
+		bool close(void);
+
+		/**
+		 * Returns the number of exchanges recorded
+		 */
+		uint32_t getRecordCount(void);
+
+	//protected:
+
+		bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+
+	private:
+		SEInterface* _se;
+		FILE* _file;
+		bool _failed;			// a record could not be written
+		uint32_t _count;
+		uint64_t _start;		// trace start, CLOCK_MONOTONIC ns
+		uint64_t _end;			// end of the previous exchange, ns since the trace start
+};
+
+#endif /* __SE_TRACE_RECORDER_H__ */
@@ -0,0 +1,103 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#ifndef __SE_TRACE_REPLAY_H__
+#define __SE_TRACE_REPLAY_H__
+
+#include <stddef.h>
+#include <unordered_map>
+#include <vector>
+#include "SEInterface.h"
+#include "SETrace.h"
+
+
+/**
+ * Secure Element interface answering from a trace recorded by
+ * SETraceRecorder: the library and the application above run against a
+ * workload captured in the field, without modem nor SIM, to measure
+ * changes of the host side (encoding, parsing, caching...).
+ *
+ * A command is answered by the next record if it holds the same command,
+ * else by the next record holding the same command further on (or from
+ * the start of the trace): a change which spares commands, such as a
+ * cache, still replays. A command found nowhere is answered by the next
+ * record if it has the same header (CLA INS P1 P2), e.g. a signature of
+ * other data, and fails otherwise.
+ *
+ * The response comes after the link time recorded times the time scale:
+ * the host side gets the Secure Element latency it had in the field.
+ * The trace is mapped and its records read in place, not loaded.
+ */
+class SETraceReplay: public SEInterface {
+	public:
+		SETraceReplay(void);
+		~SETraceReplay(void);
+
+		/**
+		 * Map a trace file.
+		 *
+		 * @param[in]  path trace file
+		 * @return true in case of success, false if it is not a trace.
+		 */
+		bool open(const char* path);
+
+		/**
+		 * Unmap the trace.
+		 */
+		void close(void);
+
+		/**
+		 * Scale the recorded link times, 1 by default.
+		 *
+		 * @param[in]  scale 1 for the recorded timing, 0 to answer at once
+		 */
+		void setTimeScale(double scale);
+
+		/**
+		 * Serve the trace from its first record again.
+		 */
+		void rewind(void);
+
+		/**
+		 * Returns the number of records of the trace
+		 */
+		uint32_t getRecordCount(void);
+
+		/**
+		 * Returns the number of commands which matched no record
+		 */
+		uint32_t getMissCount(void);
+
+	//protected:
+
+		bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen);
+
+	private:
+		const SETraceRecord* record(uint32_t index);
+		bool sameCommand(uint32_t index, const uint8_t* apdu, uint16_t apduLen);
+		int32_t find(const uint8_t* apdu, uint16_t apduLen);
+
+		const uint8_t* _map;
+		size_t _mapLen;
+		std::vector<size_t> _records;	// offset of each record
+		std::unordered_map<uint64_t, std::vector<uint32_t> > _index;	// command hash to records
+		uint32_t _next;		// record expected next
+		uint32_t _misses;
+		double _scale;
+};
+
+#endif /* __SE_TRACE_REPLAY_H__ */
@@ -0,0 +1,299 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SEFaultInjector.h"
+#include <string.h>
+#include <sys/mman.h>
+
+#define INS_GET_RESPONSE	0xC0
+
+SEFaultInjector::SEFaultInjector(SEInterface* se) {
+	uint16_t i;
+	uint8_t fault;
+
+	_se = se;
+	_default.hasLatency = true;
+	_default.minUs = 0;
+	_default.maxUs = 0;
+	for(fault = 0; fault < SE_FAULT_COUNT; fault++) {
+		_default.rates[fault] = 0;
+		_counts[fault] = 0;
+	}
+	for(i = 0; i < 256; i++) {
+		_profiles[i].hasLatency = false;
+		_profiles[i].minUs = 0;
+		_profiles[i].maxUs = 0;
+		for(fault = 0; fault < SE_FAULT_COUNT; fault++) {
+			_profiles[i].rates[fault] = -1;
+		}
+	}
+	_scale = 1.0;
+	_stall = APDU_DEFAULT_TIMEOUT;
+	clearPending();
+}
+
+SEFaultInjector::~SEFaultInjector(void) {
+}
+
+void SEFaultInjector::setSeed(uint32_t seed) {
+	SETransaction transaction(this);
+
+	_random.seed(seed);
+}
+
+SEFaultInjector::Profile* SEFaultInjector::profile(int ins) {
+	return (ins < 0 || ins > 0xFF) ? &_default : &_profiles[ins];
+}
+
+void SEFaultInjector::setLatency(int ins, uint32_t minUs, uint32_t maxUs) {
+	SETransaction transaction(this);
+	Profile* p = profile(ins);
+
+	p->hasLatency = true;
+	p->minUs = (minUs < maxUs) ? minUs : maxUs;
+	p->maxUs = (minUs < maxUs) ? maxUs : minUs;
+	p->samples.clear();
+}
+
+bool SEFaultInjector::calibrate(const char* path) {
+	SETransaction transaction(this);
+	const SETraceRecord* record;
+	const uint8_t* map;
+	size_t len;
+	size_t offset = 0;
+	uint32_t counts[257];	// exchanges per INS, then of the whole trace
+	uint32_t dropped[257];
+	uint32_t stalled[257];
+	std::vector<uint32_t> samples[257];
+	Profile* p;
+	uint8_t ins;
+	uint16_t i;
+
+	map = seTraceMap(path, &len);
+	if(map == nullptr) {
+		return false;
+	}
+	memset(counts, 0, sizeof(counts));
+	memset(dropped, 0, sizeof(dropped));
+	memset(stalled, 0, sizeof(stalled));
+	while((record = seTraceNext(map, len, &offset)) != nullptr) {
+		ins = (record->commandLen > 1) ? ((const uint8_t*) (record + 1))[1] : 0;
+		counts[ins]++;
+		counts[256]++;
+		if(record->flags & SE_TRACE_TIMED_OUT) {
+			stalled[ins]++;
+			stalled[256]++;
+		}
+		else if(record->flags & SE_TRACE_FAILED) {
+			dropped[ins]++;
+			dropped[256]++;
+		}
+		else {
+			// The latency of the exchanges which were answered
+			samples[ins].push_back((uint32_t) (record->link / 1000));
+			samples[256].push_back((uint32_t) (record->link / 1000));
+		}
+	}
+	munmap((void*) map, len);
+	if(counts[256] == 0) {
+		return false;
+	}
+
+	for(i = 0; i <= 256; i++) {
+		if(counts[i] == 0) {
+			continue;
+		}
+		p = (i == 256) ? &_default : &_profiles[i];
+		if(!samples[i].empty()) {
+			p->hasLatency = true;
+			p->samples.swap(samples[i]);
+		}
+		p->rates[SE_FAULT_DROP] = (double) dropped[i] / counts[i];
+		p->rates[SE_FAULT_STALL] = (double) stalled[i] / counts[i];
+	}
+	return true;
+}
+
+void SEFaultInjector::setFaultRate(uint8_t fault, double rate, int ins) {
+	SETransaction transaction(this);
+
+	if(fault >= SE_FAULT_COUNT) {
+		return;
+	}
+	profile(ins)->rates[fault] = (rate < 0) ? 0 : (rate > 1) ? 1 : rate;
+}
+
+void SEFaultInjector::setTimeScale(double scale) {
+	SETransaction transaction(this);
+
+	_scale = (scale > 0) ? scale : 0;
+}
+
+void SEFaultInjector::setStallTime(uint32_t ms) {
+	SETransaction transaction(this);
+
+	_stall = ms;
+}
+
+uint32_t SEFaultInjector::getFaultCount(uint8_t fault) {
+	SETransaction transaction(this);
+
+	return (fault < SE_FAULT_COUNT) ? _counts[fault] : 0;
+}
+
+// Latency of an exchange in ns
+uint64_t SEFaultInjector::drawLatency(uint8_t ins) {
+	Profile* p = _profiles[ins].hasLatency ? &_profiles[ins] : &_default;
+	uint32_t us;
+
+	if(!p->samples.empty()) {
+		us = p->samples[std::uniform_int_distribution<size_t>(0, p->samples.size() - 1)(_random)];
+	}
+	else {
+		us = std::uniform_int_distribution<uint32_t>(p->minUs, p->maxUs)(_random);
+	}
+	return (uint64_t) ((double) us * 1000.0 * _scale);
+}
+
+bool SEFaultInjector::draw(uint8_t fault, uint8_t ins) {
+	double rate = (_profiles[ins].rates[fault] >= 0) ? _profiles[ins].rates[fault] : _default.rates[fault];
+
+	if(rate <= 0 || std::uniform_real_distribution<double>(0, 1)(_random) >= rate) {
+		return false;
+	}
+	_counts[fault]++;
+	return true;
+}
+
+void SEFaultInjector::clearPending(void) {
+	_pendingFault = SE_FAULT_COUNT;
+	_pendingLen = 0;
+	_pendingOff = 0;
+	_pendingSw = 0;
+	_pendingCommandLen = 0;
+}
+
+// Answer from the response held back: the retry with the Le told by
+// 6Cxx, or a GET RESPONSE after 61xx
+bool SEFaultInjector::servePending(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+	uint16_t chunk;
+	uint16_t left;
+	uint16_t sw;
+
+	if(_pendingFault == SE_FAULT_6CXX) {
+		if(apduLen != _pendingCommandLen + 1 || memcmp(apdu, _pendingCommand, _pendingCommandLen) != 0 ||
+			apdu[_pendingCommandLen] != (uint8_t) _pendingLen || _pendingLen + APDU_RESPONSE_LEN > *responseLen) {
+			return false;
+		}
+		chunk = _pendingLen;
+		sw = _pendingSw;
+	}
+	else if(_pendingFault == SE_FAULT_61XX) {
+		if(apduLen < 4 || apdu[1] != INS_GET_RESPONSE) {
+			return false;
+		}
+		left = _pendingLen - _pendingOff;
+		chunk = (apduLen == 5 && apdu[4] != 0) ? apdu[4] : 256;
+		chunk = (chunk < left) ? chunk : left;
+		if(chunk + APDU_RESPONSE_LEN > *responseLen) {
+			return false;
+		}
+		left -= chunk;
+		sw = (left > 0) ? (uint16_t) (SW_DATA_AVAILABLE | ((left < 256) ? left : 0x00)) : _pendingSw;
+	}
+	else {
+		return false;
+	}
+
+	memcpy(response, &_pending[_pendingOff], chunk);
+	response[chunk] = (uint8_t) (sw >> 8);
+	response[chunk + 1] = (uint8_t) sw;
+	*responseLen = chunk + APDU_RESPONSE_LEN;
+	_pendingOff += chunk;
+	if(_pendingOff == _pendingLen) {
+		clearPending();
+	}
+	return true;
+}
+
+bool SEFaultInjector::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+	uint64_t start = seTraceNow();
+	uint8_t ins = (apduLen > 1) ? apdu[1] : 0;
+	uint64_t latency = drawLatency(ins);
+	uint16_t dataLen;
+	uint16_t le;
+	bool shortLe;
+	bool ok;
+
+	_timedOut = false;
+	if(servePending(apdu, apduLen, response, responseLen)) {
+		seTraceWaitUntil(start + latency);
+		return true;
+	}
+	clearPending();
+
+	if(draw(SE_FAULT_TRANSPORT, ins)) {
+		*responseLen = 0;
+		seTraceWaitUntil(start + latency);
+		return false;
+	}
+	ok = forwardApdu(_se, apdu, apduLen, response, responseLen);
+	if(!ok) {
+		seTraceWaitUntil(start + latency);
+		return false;
+	}
+
+	if(draw(SE_FAULT_DROP, ins)) {
+		*responseLen = 0;
+		seTraceWaitUntil(start + latency);
+		return false;
+	}
+	if(draw(SE_FAULT_STALL, ins)) {
+		latency += (uint64_t) _stall * 1000000ULL;
+		if(_timeout != 0 && latency > (uint64_t) _timeout * 1000000ULL) {
+			*responseLen = 0;
+			seTraceWaitUntil(start + (uint64_t) _timeout * 1000000ULL);
+			_timedOut = true;
+			return false;
+		}
+	}
+
+	// Response data held back, as a card answering 6Cxx or 61xx would
+	dataLen = (*responseLen > APDU_RESPONSE_LEN) ? *responseLen - APDU_RESPONSE_LEN : 0;
+	shortLe = (apduLen == 5) || (apduLen > 5 && apdu[4] != 0 && apduLen == 6 + apdu[4]);
+	le = shortLe ? apdu[apduLen - 1] : 0;
+	if(dataLen > 0 && dataLen <= 256 && shortLe && le != (uint8_t) dataLen &&
+		apduLen - 1 <= (int) sizeof(_pendingCommand) && draw(SE_FAULT_6CXX, ins)) {
+		_pendingFault = SE_FAULT_6CXX;
+		memcpy(_pendingCommand, apdu, apduLen - 1);
+		_pendingCommandLen = apduLen - 1;
+	}
+	else if(dataLen > 0 && draw(SE_FAULT_61XX, ins)) {
+		_pendingFault = SE_FAULT_61XX;
+	}
+	if(_pendingFault != SE_FAULT_COUNT) {
+		memcpy(_pending, response, dataLen);
+		_pendingLen = dataLen;
+		_pendingSw = (uint16_t) ((response[dataLen] << 8) | response[dataLen + 1]);
+		response[0] = (_pendingFault == SE_FAULT_6CXX) ? SW1_WRONG_LENGTH_LE : SW1_DATA_AVAILABLE;
+		response[1] = (uint8_t) dataLen;
+		*responseLen = APDU_RESPONSE_LEN;
+	}
+
+	seTraceWaitUntil(start + latency);
+	return true;
+}
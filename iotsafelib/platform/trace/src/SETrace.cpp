@@ -0,0 +1,95 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SETrace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SPIN_NS 100000ULL	// end of a wait spun rather than slept
+
+const uint8_t* seTraceMap(const char* path, size_t* len) {
+	const SETraceHeader* header;
+	struct stat st;
+	void* map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return nullptr;
+	}
+	if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SETraceHeader)) {
+		close(fd);
+		return nullptr;
+	}
+	map = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		return nullptr;
+	}
+
+	header = (const SETraceHeader*) map;
+	if(memcmp(header->magic, SE_TRACE_MAGIC, SE_TRACE_MAGIC_LEN) != 0 ||
+		header->version != SE_TRACE_VERSION || header->headerLen < sizeof(SETraceHeader) ||
+		SE_TRACE_ALIGN(header->headerLen) != header->headerLen) {
+		munmap(map, (size_t) st.st_size);
+		return nullptr;
+	}
+	*len = (size_t) st.st_size;
+	return (const uint8_t*) map;
+}
+
+const SETraceRecord* seTraceNext(const uint8_t* map, size_t len, size_t* offset) {
+	const SETraceRecord* record;
+
+	if(*offset == 0) {
+		*offset = ((const SETraceHeader*) map)->headerLen;
+	}
+	if(*offset > len || len - *offset < sizeof(SETraceRecord)) {
+		return nullptr;
+	}
+	record = (const SETraceRecord*) (map + *offset);
+	if(seTraceRecordSize(record) > len - *offset) {
+		return nullptr;
+	}
+	*offset += seTraceRecordSize(record);
+	return record;
+}
+
+uint64_t seTraceNow(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+void seTraceWaitUntil(uint64_t end) {
+	struct timespec deadline;
+
+	if(end > seTraceNow() + SPIN_NS) {
+		deadline.tv_sec = (time_t) ((end - SPIN_NS) / 1000000000ULL);
+		deadline.tv_nsec = (long) ((end - SPIN_NS) % 1000000000ULL);
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {
+		}
+	}
+	while(seTraceNow() < end) {
+	}
+}
@@ -0,0 +1,109 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SETraceRecorder.h"
+#include <string.h>
+#include <time.h>
+
+SETraceRecorder::SETraceRecorder(SEInterface* se) {
+	_se = se;
+	_file = nullptr;
+	_failed = false;
+	_count = 0;
+	_end = 0;
+	_start = 0;
+}
+
+SETraceRecorder::~SETraceRecorder(void) {
+	close();
+}
+
+bool SETraceRecorder::open(const char* path) {
+	SETransaction transaction(this);
+	SETraceHeader header;
+	struct timespec now;
+
+	close();
+	_file = fopen(path, "wb");
+	if(_file == nullptr) {
+		return false;
+	}
+	_start = seTraceNow();
+	clock_gettime(CLOCK_REALTIME, &now);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SE_TRACE_MAGIC, SE_TRACE_MAGIC_LEN);
+	header.version = SE_TRACE_VERSION;
+	header.headerLen = sizeof(header);
+	header.startTime = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+	_failed = fwrite(&header, sizeof(header), 1, _file) != 1;
+	_count = 0;
+	_end = 0;
+	return !_failed;
+}
+
+bool SETraceRecorder::close(void) {
+	SETransaction transaction(this);
+	bool ok = !_failed;
+
+	if(_file == nullptr) {
+		return true;
+	}
+	if(fclose(_file) != 0) {
+		ok = false;
+	}
+	_file = nullptr;
+	return ok;
+}
+
+uint32_t SETraceRecorder::getRecordCount(void) {
+	SETransaction transaction(this);
+
+	return _count;
+}
+
+bool SETraceRecorder::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+	static const uint8_t padding[8] = { 0 };
+	SETraceRecord record;
+	uint64_t start;
+	unsigned long len;
+	bool ok;
+
+	if(_file == nullptr) {
+		return forwardApdu(_se, apdu, apduLen, response, responseLen);
+	}
+
+	start = seTraceNow() - _start;
+	ok = forwardApdu(_se, apdu, apduLen, response, responseLen);
+	memset(&record, 0, sizeof(record));
+	record.start = start;
+	record.link = seTraceNow() - _start - start;
+	record.host = (_count > 0) ? start - _end : 0;
+	record.commandLen = apduLen;
+	record.responseLen = ok ? *responseLen : 0;
+	record.flags = (ok ? 0 : SE_TRACE_FAILED) | (_timedOut ? SE_TRACE_TIMED_OUT : 0);
+	_end = start + record.link;
+
+	len = seTraceRecordSize(&record) - (sizeof(record) + record.commandLen + record.responseLen);
+	if(fwrite(&record, sizeof(record), 1, _file) != 1 ||
+		fwrite(apdu, 1, record.commandLen, _file) != record.commandLen ||
+		fwrite(response, 1, record.responseLen, _file) != record.responseLen ||
+		fwrite(padding, 1, len, _file) != len) {
+		_failed = true;
+	}
+	_count++;
+	return ok;
+}
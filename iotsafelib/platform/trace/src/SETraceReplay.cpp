@@ -0,0 +1,179 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include "SETraceReplay.h"
+#include <algorithm>
+#include <string.h>
+#include <sys/mman.h>
+
+// FNV-1a of a command
+static uint64_t hashCommand(const uint8_t* apdu, uint16_t apduLen) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	uint16_t i;
+
+	for(i = 0; i < apduLen; i++) {
+		hash = (hash ^ apdu[i]) * 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+SETraceReplay::SETraceReplay(void) {
+	_map = nullptr;
+	_mapLen = 0;
+	_next = 0;
+	_misses = 0;
+	_scale = 1.0;
+}
+
+SETraceReplay::~SETraceReplay(void) {
+	close();
+}
+
+bool SETraceReplay::open(const char* path) {
+	SETransaction transaction(this);
+	const SETraceRecord* rec;
+	size_t offset = 0;
+
+	close();
+	_map = seTraceMap(path, &_mapLen);
+	if(_map == nullptr) {
+		return false;
+	}
+	while((rec = seTraceNext(_map, _mapLen, &offset)) != nullptr) {
+		_index[hashCommand((const uint8_t*) (rec + 1), rec->commandLen)].push_back((uint32_t) _records.size());
+		_records.push_back((size_t) ((const uint8_t*) rec - _map));
+	}
+	return true;
+}
+
+void SETraceReplay::close(void) {
+	SETransaction transaction(this);
+
+	if(_map != nullptr) {
+		munmap((void*) _map, _mapLen);
+		_map = nullptr;
+		_mapLen = 0;
+	}
+	_records.clear();
+	_index.clear();
+	_next = 0;
+	_misses = 0;
+}
+
+void SETraceReplay::setTimeScale(double scale) {
+	SETransaction transaction(this);
+
+	_scale = (scale > 0) ? scale : 0;
+}
+
+void SETraceReplay::rewind(void) {
+	SETransaction transaction(this);
+
+	_next = 0;
+	_misses = 0;
+}
+
+uint32_t SETraceReplay::getRecordCount(void) {
+	SETransaction transaction(this);
+
+	return (uint32_t) _records.size();
+}
+
+uint32_t SETraceReplay::getMissCount(void) {
+	SETransaction transaction(this);
+
+	return _misses;
+}
+
+const SETraceRecord* SETraceReplay::record(uint32_t index) {
+	return (const SETraceRecord*) (_map + _records[index]);
+}
+
+bool SETraceReplay::sameCommand(uint32_t index, const uint8_t* apdu, uint16_t apduLen) {
+	const SETraceRecord* rec = record(index);
+
+	return rec->commandLen == apduLen && memcmp(rec + 1, apdu, apduLen) == 0;
+}
+
+// Record answering the command, -1 if none
+int32_t SETraceReplay::find(const uint8_t* apdu, uint16_t apduLen) {
+	std::unordered_map<uint64_t, std::vector<uint32_t> >::const_iterator entry;
+	std::vector<uint32_t>::const_iterator it;
+	const SETraceRecord* rec;
+
+	if(_next < _records.size() && sameCommand(_next, apdu, apduLen)) {
+		return (int32_t) _next;
+	}
+
+	// The same command further on, else from the start
+	entry = _index.find(hashCommand(apdu, apduLen));
+	if(entry != _index.end()) {
+		it = std::lower_bound(entry->second.begin(), entry->second.end(), _next);
+		for(; it != entry->second.end(); ++it) {
+			if(sameCommand(*it, apdu, apduLen)) {
+				return (int32_t) *it;
+			}
+		}
+		for(it = entry->second.begin(); it != entry->second.end() && *it < _next; ++it) {
+			if(sameCommand(*it, apdu, apduLen)) {
+				return (int32_t) *it;
+			}
+		}
+	}
+
+	// Same header, other data
+	if(_next < _records.size()) {
+		rec = record(_next);
+		if(apduLen >= 4 && rec->commandLen >= 4 && memcmp(rec + 1, apdu, 4) == 0) {
+			return (int32_t) _next;
+		}
+	}
+	return -1;
+}
+
+bool SETraceReplay::transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+	const SETraceRecord* rec;
+	uint64_t start = seTraceNow();
+	int32_t index;
+
+	_timedOut = false;
+
+	index = find(apdu, apduLen);
+	if(index < 0) {
+		_misses++;
+		*responseLen = 0;
+		return false;
+	}
+	rec = record((uint32_t) index);
+	_next = (uint32_t) index + 1;
+
+	// The link latency the host had in the field
+	seTraceWaitUntil(start + (uint64_t) ((double) rec->link * _scale));
+
+	if(rec->flags & SE_TRACE_FAILED) {
+		_timedOut = (rec->flags & SE_TRACE_TIMED_OUT) != 0;
+		*responseLen = 0;
+		return false;
+	}
+	if(rec->responseLen > *responseLen) {
+		*responseLen = 0;
+		return false;
+	}
+	memcpy(response, (const uint8_t*) (rec + 1) + rec->commandLen, rec->responseLen);
+	*responseLen = rec->responseLen;
+	return true;
+}
@@ -0,0 +1,152 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "ROT.h"
+#include "GenericModem.h"
+#include "IoTSafeSimulator.h"
+#include "SEBroker.h"
+#include "SEBrokerClient.h"
+#include "SEShmClient.h"
+
+// Compare the transports of a broker on the same host: the socket of an
+// SEBrokerClient and the shared memory rings of an SEShmClient. The
+// broker runs in a child process and serves the software applet, or the
+// modem given, so the figures are those of the transport (plus the
+// Secure Element's own time with a modem). Each iteration is a GET
+// RANDOM of the given length on the IoT SAFE applet.
+//
+// usage: brokerbenchmark [iterations] [modem_port]
+
+#define DEFAULT_ITERATIONS 20000
+#define SOCKET_PATH "/tmp/brokerbenchmark.sock"
+
+static const uint16_t LENGTHS[] = { 16, 240 };
+
+static void run(const char* name, SEInterface* se, uint16_t len, int iterations) {
+	std::vector<double> latencies;
+	uint8_t random[256];
+	double total = 0;
+	int i;
+
+	ROT* rot = new ROT();
+	rot->init(se);
+	if(!rot->select(true)) {
+		printf("%-8s  cannot select applet!\n", name);
+		delete rot;
+		return;
+	}
+	latencies.reserve(iterations);
+	for(i = 0; i < iterations; i++) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if(rot->generateRandom(random, len) == ERR_NOERR) {
+			latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+			total += latencies.back();
+		}
+	}
+	delete rot;
+	if(latencies.empty()) {
+		printf("%-8s  %4u  no APDU went through!\n", name, len);
+		return;
+	}
+	std::sort(latencies.begin(), latencies.end());
+	printf("%-8s  %4u  %6d/%-6d %10.1f %8.1f %8.1f %8.1f\n", name, len, (int) latencies.size(), iterations,
+		latencies.size() * 1e6 / total, total / latencies.size(),
+		latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]);
+}
+
+// The broker, owner of the Secure Element
+static void serve(const char* port) {
+	GenericModem modem;
+	IoTSafeSimulator simulator;
+	SEInterface* se = &simulator;
+
+	if(port != nullptr) {
+		if(!modem.open(port) || modem.autobaud() == 0) {
+			printf("Error modem not found on %s!\n", port);
+			exit(-1);
+		}
+		se = &modem;
+	}
+	SEBroker broker(se);
+	if(!broker.open(SOCKET_PATH)) {
+		printf("Error cannot create %s!\n", SOCKET_PATH);
+		exit(-1);
+	}
+	broker.run();
+	exit(0);
+}
+
+template <class Client> static bool connect(Client* client) {
+	int i;
+
+	for(i = 0; i < 500; i++) {
+		if(client->open(SOCKET_PATH)) {
+			return true;
+		}
+		usleep(10000);
+	}
+	return false;
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = (argc > 1) ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+	const char* port = (argc > 2) ? argv[2] : nullptr;
+	SEBrokerClient socketClient;
+	SEShmClient shmClient;
+	unsigned int i;
+	pid_t broker;
+
+	unlink(SOCKET_PATH);
+	broker = fork();
+	if(broker < 0) {
+		return -1;
+	}
+	if(broker == 0) {
+		serve(port);
+	}
+
+	if(!connect(&socketClient) || !connect(&shmClient)) {
+		printf("Error broker not reachable!\n");
+		kill(broker, SIGKILL);
+		return -1;
+	}
+	if(!shmClient.isAttached()) {
+		printf("Error shared memory not attached!\n");
+	}
+
+	printf("%-8s  %4s  %13s %10s %8s %8s %8s\n", "link", "len", "ok/total", "APDU/s", "mean us", "p50 us", "p99 us");
+	for(i = 0; i < sizeof(LENGTHS) / sizeof(LENGTHS[0]); i++) {
+		run("socket", &socketClient, LENGTHS[i], iterations);
+		run("shm", &shmClient, LENGTHS[i], iterations);
+	}
+
+	socketClient.close();
+	shmClient.close();
+	kill(broker, SIGKILL);
+	waitpid(broker, nullptr, 0);
+	unlink(SOCKET_PATH);
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "HexCodec.h"
+
+// Compare the AT+CSIM hex codec against the per-byte sprintf / branchy
+// per-nibble code it replaced, for a full 256 bytes APDU payload.
+
+#define PAYLOAD_LEN 256
+#define ITERATIONS 200000
+
+static volatile uint8_t sink;
+
+// Former ATInterface::sendATCSIM encoding
+static void legacyEncode(const uint8_t* bytes, uint16_t bytesLen, char* hexstr) {
+	unsigned long int off = 0;
+	uint16_t i;
+
+	for(i=0; i<bytesLen; i++) {
+		off += sprintf(&hexstr[off], "%02X", bytes[i]);
+	}
+}
+
+// Former ATInterface::hexString2BytesArray
+static void legacyDecode(const char* hexstr, uint16_t hexstrLen, uint8_t* bytes, uint16_t* bytesLen) {
+	uint8_t d;
+	uint16_t i, j;
+
+	*bytesLen = 0;
+	for(i = 0; i < hexstrLen; *bytesLen += 1) {
+		d = 0;
+		for(j = i + 2; i < j; i++) {
+			d <<= 4;
+			if((hexstr[i] >= '0') && (hexstr[i] <= '9')) {
+				d |= hexstr[i] - '0';
+			}
+			else if((hexstr[i] >= 'a') && (hexstr[i] <= 'f')) {
+				d |= hexstr[i] - 'a' + 10;
+			}
+			else if((hexstr[i] >= 'A') && (hexstr[i] <= 'F')) {
+				d |= hexstr[i] - 'A' + 10;
+			}
+		}
+		*bytes = d;
+		bytes++;
+	}
+}
+
+static uint8_t payload[PAYLOAD_LEN];
+static char hex[2 * PAYLOAD_LEN + 1];
+static uint8_t decoded[PAYLOAD_LEN];
+
+static void report(const char* name, std::chrono::steady_clock::time_point start) {
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	printf("%-16s %10.1f ns/APDU %8.2f ns/byte\n", name, ns / ITERATIONS, ns / ITERATIONS / PAYLOAD_LEN);
+}
+
+static void benchCodec(const char* encName, const char* decName) {
+	std::chrono::steady_clock::time_point start;
+	uint16_t len;
+	int i;
+
+	start = std::chrono::steady_clock::now();
+	for(i = 0; i < ITERATIONS; i++) {
+		payload[0] = (uint8_t) i;
+		hexEncode(payload, PAYLOAD_LEN, hex);
+		sink = hex[0];
+	}
+	report(encName, start);
+
+	start = std::chrono::steady_clock::now();
+	for(i = 0; i < ITERATIONS; i++) {
+		hexDecode(hex, 2 * PAYLOAD_LEN, decoded, &len);
+		sink = decoded[i % PAYLOAD_LEN];
+	}
+	report(decName, start);
+}
+
+int main(int argc, char *argv[])
+{
+	std::chrono::steady_clock::time_point start;
+	uint16_t len;
+	int i;
+
+	for(i = 0; i < PAYLOAD_LEN; i++) {
+		payload[i] = (uint8_t) rand();
+	}
+
+	start = std::chrono::steady_clock::now();
+	for(i = 0; i < ITERATIONS; i++) {
+		payload[0] = (uint8_t) i;
+		legacyEncode(payload, PAYLOAD_LEN, hex);
+		sink = hex[0];
+	}
+	report("legacy encode", start);
+
+	start = std::chrono::steady_clock::now();
+	for(i = 0; i < ITERATIONS; i++) {
+		legacyDecode(hex, 2 * PAYLOAD_LEN, decoded, &len);
+		sink = decoded[i % PAYLOAD_LEN];
+	}
+	report("legacy decode", start);
+
+	hexCodecSetMode(HEX_CODEC_SCALAR);
+	benchCodec("scalar encode", "scalar decode");
+
+	hexCodecSetMode(HEX_CODEC_AUTO);
+	if(strcmp(hexCodecName(), "scalar") != 0) {
+		printf("--- %s\n", hexCodecName());
+		benchCodec("simd encode", "simd decode");
+	}
+
+	return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include "ROT.h"
+#include "GenericModem.h"
+
+// Measure APDU throughput of the modem link for each UART setting.
+// Each iteration is a GET RANDOM of RANDOM_LEN bytes on the IoT SAFE applet.
+//
+// usage: linkbenchmark [port] [iterations]
+
+#define RANDOM_LEN 240
+#define DEFAULT_ITERATIONS 50
+
+static const uint32_t RATES[] = { 115200, 230400, 460800, 921600, 3000000 };
+
+static GenericModem modem;
+
+static void run(ROT* rot, uint32_t baud, bool flow, int iterations) {
+	uint8_t random[RANDOM_LEN];
+	int i, done = 0;
+
+	if(!modem.setFlowControl(flow)) {
+		printf("%9lu  %-4s  flow control not supported\n", (unsigned long) baud, flow ? "on" : "off");
+		return;
+	}
+	if(!modem.setBaudRate(baud)) {
+		printf("%9lu  %-4s  rate not supported, link at %lu\n", (unsigned long) baud, flow ? "on" : "off", (unsigned long) modem.getBaudRate());
+		return;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(i = 0; i < iterations; i++) {
+		if(rot->generateRandom(random, RANDOM_LEN) == ERR_NOERR) {
+			done++;
+		}
+	}
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// Command header + Le, response data + SW
+	double bytes = (double) done * (APDU_CMD_HEADER_LEN + RANDOM_LEN + APDU_RESPONSE_LEN);
+	printf("%9lu  %-4s  %6d/%-6d %10.1f %10.1f\n", (unsigned long) baud, flow ? "on" : "off",
+		done, iterations, bytes / s, done / s);
+}
+
+int main(int argc, char *argv[])
+{
+	const char* port = (argc > 1) ? argv[1] : "/dev/ttyACM0";
+	int iterations = (argc > 2) ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+	uint32_t initial;
+	unsigned int i;
+
+	if(!modem.open(port)) {
+		printf("Error modem not found on %s!\n", port);
+		return -1;
+	}
+	initial = modem.autobaud();
+	if(initial == 0) {
+		printf("Error modem does not answer!\n");
+		return -1;
+	}
+
+	ROT* rot = new ROT();
+	rot->init(&modem);
+	if(!rot->select(true)) {
+		printf("Error: cannot select applet!\n");
+		return -1;
+	}
+
+	printf("%9s  %-4s  %13s %10s %10s\n", "baud", "rts", "ok/total", "APDU B/s", "APDU/s");
+	for(i = 0; i < sizeof(RATES) / sizeof(RATES[0]); i++) {
+		run(rot, RATES[i], false, iterations);
+		run(rot, RATES[i], true, iterations);
+	}
+
+	// Leave the modem at the rate it was found at
+	modem.setFlowControl(false);
+	modem.setBaudRate(initial);
+	delete rot;
+	modem.close();
+	return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <chrono>
+#include "ROT.h"
+#include "IoTSafeSimulator.h"
+#include "SEMetrics.h"
+
+// Cost of the metrics: GET RANDOM through ROT on the software applet with
+// the metrics off and on, and the recording of one APDU on its own.
+
+#define ITERATIONS 200000
+
+static volatile uint32_t sink;
+
+static double perCall(std::chrono::steady_clock::time_point start, int count) {
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+static void benchRandom(ROT* rot, const char* name) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint8_t random[32];
+	int i;
+
+	for(i = 0; i < ITERATIONS; i++) {
+		rot->generateRandom(random, sizeof(random));
+		sink = random[0];
+	}
+	printf("%-20s %8.2f ns/operation\n", name, perCall(start, ITERATIONS));
+}
+
+int main(void)
+{
+	IoTSafeSimulator sim;
+	SEMetricsSnapshot snapshot;
+	std::chrono::steady_clock::time_point start;
+	ROT rot;
+	int i;
+
+	rot.init(&sim);
+	if(!rot.select(true)) {
+		fprintf(stderr, "Error: cannot select the applet!\n");
+		return -1;
+	}
+
+	seMetricsEnable(false);
+	benchRandom(&rot, "random, metrics off");
+	seMetricsEnable(true);
+	benchRandom(&rot, "random, metrics on");
+
+	start = std::chrono::steady_clock::now();
+	for(i = 0; i < ITERATIONS; i++) {
+		seMetricsRecordApdu(0x84, 5, 34, 1000 + i, false);
+		seMetricsRecordStatusWord(0x9000);
+	}
+	printf("%-20s %8.2f ns/APDU\n", "record", perCall(start, ITERATIONS));
+
+	seMetricsSnapshot(&snapshot);
+	printf("p50 %llu us, p99 %llu us of GET RANDOM\n",
+		(unsigned long long) seHistogramPercentile(&snapshot.operations[SE_METRICS_OP_GENERATE_RANDOM].latency, 0.5),
+		(unsigned long long) seHistogramPercentile(&snapshot.operations[SE_METRICS_OP_GENERATE_RANDOM].latency, 0.99));
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "SETlv.h"
+
+// Compare the response parsing of ROT before SETlvReader, unchecked index
+// arithmetic, against the bounds checked reader on the responses of the
+// hot operations: container length (tag 20 within C3) and key pair.
+
+#define ITERATIONS 2000000
+
+static volatile uint32_t sink;
+
+static const uint8_t CONTAINER[] = {
+	0xC3, 0x14,
+		0x73, 0x04, 'c', 'e', 'r', 't',
+		0x83, 0x01, 0x02,
+		0x60, 0x01, 0x01,
+		0x4A, 0x01, 0x00,
+		0x21, 0x01, 0x03,
+		0x20, 0x02, 0x01, 0x52
+};
+
+static uint8_t keyPair[3 + 3 + 2 + 0x45];
+
+// Former ROT::getFileLength walk
+static uint16_t legacyFileLength(const uint8_t* data, uint16_t len) {
+	uint16_t result = 0;
+	uint16_t index = (data[0] == 0xC3) ? 2 : 0;
+
+	while(result == 0 && index + 1 < len) {
+		if(data[index] == 0x20) {
+			if(index + 3 >= len) {
+				break;
+			}
+			result = (data[index + 2] << 8) + data[index + 3];
+		}
+		else {
+			index = index + 2 + data[index + 1];
+		}
+	}
+	return result;
+}
+
+static uint16_t readerFileLength(const uint8_t* data, uint16_t len) {
+	SETlvReader reader(data, len);
+	SETlvView tlv;
+
+	if(len > 0 && data[0] == 0xC3) {
+		if(!reader.next(&tlv)) {
+			return 0;
+		}
+		reader = SETlvReader(tlv);
+	}
+	return (reader.find(0x20, &tlv) && tlv.len == 2) ? (tlv.value[0] << 8) | tlv.value[1] : 0;
+}
+
+// Former ROT::generateKeypair walk
+static uint32_t legacyKeyPair(const uint8_t* data, uint16_t len) {
+	uint16_t index = 0;
+	uint32_t lens = 0;
+
+	(void) len;
+	if(data[index++] == 0x84) {
+		lens += data[index++];
+		index += data[index - 1];
+	}
+	if(data[index++] == 0x85) {
+		lens += data[index++];
+		index += data[index - 1];
+	}
+	if(data[index++] == 0x34) {
+		lens += data[index++];
+	}
+	return lens;
+}
+
+static uint32_t readerKeyPair(const uint8_t* data, uint16_t len) {
+	SETlvReader reader(data, len);
+	SETlvView tlv;
+	uint32_t lens = 0;
+
+	while(reader.next(&tlv)) {
+		lens += tlv.len;
+	}
+	return reader.error() ? 0 : lens;
+}
+
+static void bench(const char* name, uint32_t (*parse)(const uint8_t*, uint16_t), const uint8_t* data, uint16_t len) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	uint32_t total = 0;
+	int i;
+
+	for(i = 0; i < ITERATIONS; i++) {
+		total += parse(data, len);
+		sink = total;
+	}
+	printf("%-20s %8.2f ns/response\n", name,
+		std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ITERATIONS);
+}
+
+static uint32_t legacyContainer(const uint8_t* data, uint16_t len) {
+	return legacyFileLength(data, len);
+}
+
+static uint32_t readerContainer(const uint8_t* data, uint16_t len) {
+	return readerFileLength(data, len);
+}
+
+int main(void)
+{
+	uint16_t i = 0;
+
+	keyPair[i++] = 0x84;
+	keyPair[i++] = 0x01;
+	keyPair[i++] = 0x04;
+	keyPair[i++] = 0x85;
+	keyPair[i++] = 0x01;
+	keyPair[i++] = 0x04;
+	keyPair[i++] = 0x34;
+	keyPair[i++] = 0x45;
+	memset(keyPair + i, 0x5A, 0x45);
+
+	bench("legacy container", legacyContainer, CONTAINER, sizeof(CONTAINER));
+	bench("reader container", readerContainer, CONTAINER, sizeof(CONTAINER));
+	bench("legacy key pair", legacyKeyPair, keyPair, sizeof(keyPair));
+	bench("reader key pair", readerKeyPair, keyPair, sizeof(keyPair));
+	return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "ROT.h"
+#include "GenericModem.h"
+#include "IoTSafeSimulator.h"
+#include "SETraceRecorder.h"
+#include "SETraceReplay.h"
+
+// Host side cost of the library on a recorded workload: the workload
+// (select, certificate read, signature, random) is recorded once against
+// the software applet or a modem, then replayed without them, at the
+// recorded link timing or scaled. What the replay takes beyond the link
+// time is the host side: APDU encoding, response parsing, application.
+//
+// usage: tracebenchmark record trace [modem_port]
+//        tracebenchmark replay trace [scale] [iterations]
+
+#define DEFAULT_ITERATIONS 1000
+
+static bool workload(SEInterface* se) {
+	uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+	uint8_t certId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_CERT_CLIENT};
+	uint8_t data[64];
+	uint8_t signature[0x60];
+	uint16_t signatureLen = sizeof(signature);
+	uint8_t random[32];
+	uint8_t* cert = nullptr;
+	uint16_t certLen = 0;
+	bool ok;
+
+	ROT* rot = new ROT();
+	rot->init(se);
+	memset(data, 0x5A, sizeof(data));
+	ok = rot->select(true) &&
+		rot->getCertificateByContainerId(certId, CONTAINER_ID_LENGTH, &cert, &certLen) == ERR_NOERR &&
+		rot->signData(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA, data, sizeof(data), signature, &signatureLen) == ERR_NOERR &&
+		rot->generateRandom(random, sizeof(random)) == ERR_NOERR;
+	free(cert);
+	delete rot;
+	return ok;
+}
+
+static int record(const char* path, const char* port) {
+	GenericModem modem;
+	IoTSafeSimulator simulator;
+	SEInterface* se = &simulator;
+
+	if(port != nullptr) {
+		if(!modem.open(port) || modem.autobaud() == 0) {
+			printf("Error modem not found on %s!\n", port);
+			return -1;
+		}
+		se = &modem;
+	}
+	SETraceRecorder recorder(se);
+	if(!recorder.open(path)) {
+		printf("Error cannot create %s!\n", path);
+		return -1;
+	}
+	if(!workload(&recorder)) {
+		printf("Error workload failed!\n");
+		return -1;
+	}
+	printf("%u exchanges recorded to %s\n", recorder.getRecordCount(), path);
+	return recorder.close() ? 0 : -1;
+}
+
+static int replay(const char* path, double scale, int iterations) {
+	SETraceReplay replay;
+	int i, done = 0;
+
+	if(!replay.open(path)) {
+		printf("Error %s is not a trace!\n", path);
+		return -1;
+	}
+	replay.setTimeScale(scale);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(i = 0; i < iterations; i++) {
+		replay.rewind();
+		if(workload(&replay)) {
+			done++;
+		}
+	}
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%-8s %6s %13s %12s %8s\n", "scale", "APDUs", "ok/total", "us/workload", "misses");
+	printf("%-8.2f %6u %6d/%-6d %12.1f %8u\n", scale, replay.getRecordCount(), done, iterations,
+		s * 1e6 / iterations, replay.getMissCount());
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc >= 3 && strcmp(argv[1], "record") == 0) {
+		return record(argv[2], (argc > 3) ? argv[3] : nullptr);
+	}
+	if(argc >= 3 && strcmp(argv[1], "replay") == 0) {
+		return replay(argv[2], (argc > 3) ? atof(argv[3]) : 1.0, (argc > 4) ? atoi(argv[4]) : DEFAULT_ITERATIONS);
+	}
+	printf("usage: %s record trace [modem_port]\n", argv[0]);
+	printf("       %s replay trace [scale] [iterations]\n", argv[0]);
+	return -1;
+}
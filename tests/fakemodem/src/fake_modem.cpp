@@ -0,0 +1,88 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "FakeModem.h"
+
+// Fake modem answering AT+CSIM with the software IoT SAFE applet, on a
+// pseudo-terminal. Prints the port to open, e.g. linkbenchmark /dev/pts/3,
+// and serves it until interrupted.
+//
+// usage: fakemodem [-e] [-u] [-d delay_us] [-r urc] [-p period] [-m 61xx|6cxx]
+//   -e  no echo (ATE0)
+//   -u  model the UART timing at the rate negotiated with AT+IPR
+//   -d  processing delay added to each AT+CSIM, in microseconds
+//   -r  URC to interleave with the AT+CSIM responses, e.g. "+CREG: 1"
+//   -p  number of AT+CSIM between two URCs (default 1)
+//   -m  response data through GET RESPONSE (61xx) or first Le rejected (6cxx)
+
+static IoTSafeSimulator sim;
+static FakeModem modem(&sim);
+
+static void onSignal(int sig) {
+	(void) sig;
+	modem.stop();
+}
+
+int main(int argc, char *argv[])
+{
+	const char* urc = nullptr;
+	uint32_t period = 1;
+	int opt;
+
+	while((opt = getopt(argc, argv, "eud:r:p:m:")) != -1) {
+		switch(opt) {
+		case 'e':
+			modem.setEcho(false);
+			break;
+		case 'u':
+			modem.setUartModel(true);
+			break;
+		case 'd':
+			modem.setCommandDelay((uint32_t) strtoul(optarg, nullptr, 10));
+			break;
+		case 'r':
+			urc = optarg;
+			break;
+		case 'p':
+			period = (uint32_t) strtoul(optarg, nullptr, 10);
+			break;
+		case 'm':
+			sim.setResponseMode((optarg[0] == '6' && optarg[1] == '1') ? SIM_RESPONSE_61XX : SIM_RESPONSE_6CXX);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-e] [-u] [-d delay_us] [-r urc] [-p period] [-m 61xx|6cxx]\n", argv[0]);
+			return -1;
+		}
+	}
+	modem.setUrc(urc, period);
+
+	if(!modem.open()) {
+		fprintf(stderr, "Error: cannot create the pseudo-terminal!\n");
+		return -1;
+	}
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	printf("%s\n", modem.getPortName());
+	fflush(stdout);
+	modem.run();
+	return 0;
+}
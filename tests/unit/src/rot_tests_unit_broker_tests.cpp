@@ -0,0 +1,352 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "CppUTest/TestHarness.h"
+
+#include "ROT.h"
+#include "IoTSafeSimulator.h"
+#include "SEBroker.h"
+#include "SEBrokerClient.h"
+#include "SEShmClient.h"
+
+#define BROKER_CLIENTS 4
+#define BROKER_ROUNDS 25
+
+// Clients of other processes reach the simulator through the broker socket
+static IoTSafeSimulator brokerSim;
+static SEBroker broker(&brokerSim);
+static char brokerPath[SE_BROKER_PATH_LEN];
+
+// Wait for the broker to notice the clients which went away
+static bool waitForClients(uint32_t count)
+{
+    for (int i = 0; i < 200 && broker.getClientCount() != count; i++) {
+        usleep(5000);
+    }
+    return broker.getClientCount() == count;
+}
+
+// Answers GET DATA with BIG_RESPONSE_LEN bytes through a 61xx chain, more
+// than an SEInterface receives at once
+#define BIG_RESPONSE_LEN 3000
+
+class BigResponseSE: public SEInterface {
+    public:
+        BigResponseSE(void) : _offset(0) {}
+
+        bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen) {
+            uint16_t len = 0;
+            uint16_t left;
+
+            (void) apduLen;
+            if (apdu[1] == 0x70) {
+                // MANAGE CHANNEL, channel 1 opened or closed
+                if (apdu[2] == 0x00) {
+                    response[len++] = 0x01;
+                }
+                response[len++] = 0x90;
+                response[len++] = 0x00;
+                *responseLen = len;
+                return true;
+            }
+            if (apdu[1] == 0xCA) {
+                _offset = 0;
+            }
+            left = BIG_RESPONSE_LEN - _offset;
+            len = (left < 256) ? left : 256;
+            for (uint16_t i = 0; i < len; i++) {
+                response[i] = (uint8_t) (_offset + i);
+            }
+            _offset += len;
+            left -= len;
+            response[len] = (left > 0) ? 0x61 : 0x90;
+            response[len + 1] = (left > 0) ? ((left < 256) ? left : 0x00) : 0x00;
+            *responseLen = len + 2;
+            return true;
+        }
+
+    private:
+        uint16_t _offset;
+};
+
+TEST_GROUP(BrokerTests)
+{
+    void setup()
+    {
+        snprintf(brokerPath, sizeof(brokerPath), "/tmp/iotsafe-tests-%d.sock", (int) getpid());
+        CHECK_TRUE(broker.open(brokerPath));
+        CHECK_TRUE(broker.start());
+    }
+
+    void teardown()
+    {
+        CHECK_TRUE(waitForClients(0));
+        broker.stop();
+    }
+};
+
+TEST(BrokerTests, ChannelPerClient) {
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t hash[32];
+    uint8_t signature[0x60];
+    uint16_t signatureLen = sizeof(signature);
+    SEBrokerClient clientA;
+    SEBrokerClient clientB;
+    ROT rotA;
+    ROT rotB;
+
+    CHECK_TRUE(clientA.open(brokerPath));
+    CHECK_TRUE(clientB.open(brokerPath));
+    rotA.init(&clientA);
+    rotB.init(&clientB);
+    CHECK_TRUE(rotA.select(true));
+    CHECK_TRUE(rotB.select(true));
+
+    // B's whole signature ends the signature session of its channel only
+    CHECK_EQUAL(ERR_NOERR, rotA.signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA));
+    CHECK_EQUAL(ERR_NOERR, rotB.signData(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA,
+                                         keyId, sizeof(keyId), signature, &signatureLen));
+    signatureLen = sizeof(signature);
+    memset(hash, 0x5A, sizeof(hash));
+    CHECK_EQUAL(ERR_NOERR, rotA.signFinal(hash, sizeof(hash), signature, &signatureLen));
+}
+
+TEST(BrokerTests, ChannelsClosedOnDisconnect) {
+    uint8_t random[16];
+
+    {
+        SEBrokerClient client;
+        ROT rot;
+
+        CHECK_TRUE(client.open(brokerPath));
+        rot.init(&client);
+        CHECK_TRUE(rot.select(false));
+        CHECK_EQUAL(ERR_NOERR, rot.generateRandom(random, sizeof(random)));
+        CHECK_TRUE(waitForClients(1));
+    }
+    CHECK_TRUE(waitForClients(0));
+
+    // Both the broker's channel and the client's own are free again
+    CHECK_EQUAL(ERR_NOERR, brokerSim.transmit(0x00, 0x70, 0x00, 0x00, 0x01));
+    CHECK_EQUAL(SW_EXECUTION_OK, brokerSim.getStatusWord());
+    CHECK_EQUAL(1, brokerSim.getResponse(random));
+    CHECK_EQUAL(1, random[0]);
+    CHECK_EQUAL(ERR_NOERR, brokerSim.transmit(0x00, 0x70, 0x80, 0x01));
+}
+
+TEST(BrokerTests, ClientsShareOneSecureElement) {
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    uint32_t count = broker.getApduCount();
+
+    // Separate connections, as separate processes would have
+    for (int t = 0; t < BROKER_CLIENTS; t++) {
+        threads.push_back(std::thread([t, &failures]() {
+            SEBrokerClient client;
+            ROT rot;
+            uint8_t random[BROKER_CLIENTS * 16];
+            uint16_t len = (t + 1) * 16;
+
+            if (!client.open(brokerPath)) {
+                failures++;
+                return;
+            }
+            rot.init(&client);
+            if (!rot.select(true)) {
+                failures++;
+            }
+            for (int i = 0; i < BROKER_ROUNDS; i++) {
+                if (rot.generateRandom(random, len) != ERR_NOERR) {
+                    failures++;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    CHECK_EQUAL(0, failures.load());
+    CHECK_TRUE(broker.getApduCount() >= count + BROKER_CLIENTS * (BROKER_ROUNDS + 1));
+}
+
+TEST(BrokerTests, LargeFileThroughBroker) {
+    uint8_t certId[CONTAINER_ID_LENGTH] = {0x10};
+    uint8_t content[1500];
+    uint8_t* cert = NULL;
+    uint16_t certLen = 0;
+    SEBrokerClient client;
+    ROT rot;
+
+    // The broker follows the 61xx chain on the Secure Element side
+    for (uint16_t i = 0; i < sizeof(content); i++) {
+        content[i] = (uint8_t) i;
+    }
+    {
+        // The broker may be using the simulator
+        SETransaction transaction(&brokerSim);
+        CHECK_TRUE(brokerSim.putFile(certId, CONTAINER_ID_LENGTH, content, sizeof(content)));
+        brokerSim.setResponseMode(SIM_RESPONSE_61XX);
+    }
+    CHECK_TRUE(client.open(brokerPath));
+    rot.init(&client);
+    CHECK_TRUE(rot.select(true));
+    CHECK_EQUAL(ERR_NOERR, rot.getCertificateByContainerId(certId, CONTAINER_ID_LENGTH, &cert, &certLen));
+    brokerSim.lock();
+    brokerSim.setResponseMode(SIM_RESPONSE_DIRECT);
+    brokerSim.unlock();
+    CHECK_EQUAL(sizeof(content) + 1, certLen);
+    MEMCMP_EQUAL(content, cert, sizeof(content));
+    free(cert);
+}
+
+TEST(BrokerTests, ResponseLargerThanClientBuffer) {
+    char path[SE_BROKER_PATH_LEN];
+    BigResponseSE big;
+    SEBroker bigBroker(&big);
+    SEBrokerClient client;
+    uint8_t expected[BIG_RESPONSE_LEN];
+    SEResponseView view;
+
+    // The broker joins the chain, then hands it out again through 61xx
+    snprintf(path, sizeof(path), "/tmp/iotsafe-tests-big-%d.sock", (int) getpid());
+    CHECK_TRUE(bigBroker.open(path));
+    CHECK_TRUE(bigBroker.start());
+    CHECK_TRUE(client.open(path));
+    CHECK_EQUAL(ERR_NOERR, client.transmit(0x00, 0xCA, 0x00, 0x00, 0x00));
+    view = client.getResponseView();
+    CHECK_EQUAL(SW_EXECUTION_OK, view.sw);
+    CHECK_EQUAL(BIG_RESPONSE_LEN, view.dataLen);
+    for (uint16_t i = 0; i < BIG_RESPONSE_LEN; i++) {
+        expected[i] = (uint8_t) i;
+    }
+    MEMCMP_EQUAL(expected, view.data, BIG_RESPONSE_LEN);
+    client.close();
+    bigBroker.stop();
+}
+
+TEST(BrokerTests, SharedMemoryRingWraps) {
+    // Static: new would not honour alignas(64) before C++17
+    static SEShmRing ringStorage;
+    SEShmRing* ring = &ringStorage;
+    uint8_t frame[SE_SHM_MAX_FRAME_LEN];
+    const uint8_t* data;
+    uint32_t len;
+    uint32_t seq;
+    uint32_t frameSeq;
+    uint8_t* slot;
+
+    // Frames of odd sizes wrap around the end of the ring many times
+    seShmInit(ring);
+    CHECK_TRUE(seShmEmpty(ring));
+    CHECK_TRUE(seShmReserve(ring, SE_SHM_MAX_FRAME_LEN + 1) == nullptr);
+    for (uint32_t i = 0; i < 200; i++) {
+        len = (i * 997) % SE_SHM_MAX_FRAME_LEN;
+        for (uint32_t j = 0; j < len; j++) {
+            frame[j] = (uint8_t) (i + j);
+        }
+        slot = seShmReserve(ring, len);
+        CHECK_TRUE(slot != nullptr);
+        memcpy(slot, frame, len);
+        seShmCommit(ring, len, i);
+        CHECK_TRUE(seShmPeek(ring, &data, &len, &seq));
+        CHECK_EQUAL(i, seq);
+        CHECK_EQUAL((i * 997) % SE_SHM_MAX_FRAME_LEN, len);
+        MEMCMP_EQUAL(frame, data, len);
+        seShmRelease(ring, len);
+        CHECK_TRUE(seShmEmpty(ring));
+    }
+
+    // Full until the consumer releases the frames
+    for (seq = 0; seShmReserve(ring, 1000) != nullptr; seq++) {
+        seShmCommit(ring, 1000, seq);
+    }
+    CHECK_TRUE(seq >= SE_SHM_RING_LEN / 1008 - 1);
+    for (uint32_t i = 0; i < seq; i++) {
+        CHECK_TRUE(seShmPeek(ring, &data, &len, &frameSeq));
+        CHECK_EQUAL(i, frameSeq);
+        seShmRelease(ring, len);
+    }
+    CHECK_TRUE(seShmEmpty(ring));
+    CHECK_TRUE(seShmReserve(ring, 1000) != nullptr);
+}
+
+TEST(BrokerTests, SharedMemoryClients) {
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+
+    // Clients on the rings and clients on the socket side by side
+    for (int t = 0; t < BROKER_CLIENTS; t++) {
+        threads.push_back(std::thread([t, &failures]() {
+            SEShmClient shmClient;
+            SEBrokerClient socketClient;
+            SEBrokerClient* client = (t % 2 == 0) ? &shmClient : &socketClient;
+            ROT rot;
+            uint8_t random[BROKER_CLIENTS * 16];
+            uint16_t len = (t + 1) * 16;
+
+            if (!client->open(brokerPath) || (t % 2 == 0 && !shmClient.isAttached())) {
+                failures++;
+                return;
+            }
+            rot.init(client);
+            if (!rot.select(true)) {
+                failures++;
+            }
+            for (int i = 0; i < BROKER_ROUNDS; i++) {
+                if (rot.generateRandom(random, len) != ERR_NOERR) {
+                    failures++;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    CHECK_EQUAL(0, failures.load());
+}
+
+TEST(BrokerTests, SharedMemoryLargeResponse) {
+    char path[SE_BROKER_PATH_LEN];
+    BigResponseSE big;
+    SEBroker bigBroker(&big);
+    SEShmClient client;
+    SEResponseView view;
+
+    // Chunks handed out through 61xx in the response ring
+    snprintf(path, sizeof(path), "/tmp/iotsafe-tests-big-%d.sock", (int) getpid());
+    CHECK_TRUE(bigBroker.open(path));
+    CHECK_TRUE(bigBroker.start());
+    CHECK_TRUE(client.open(path));
+    CHECK_TRUE(client.isAttached());
+    for (int round = 0; round < 3; round++) {
+        CHECK_EQUAL(ERR_NOERR, client.transmit(0x00, 0xCA, 0x00, 0x00, 0x00));
+        view = client.getResponseView();
+        CHECK_EQUAL(SW_EXECUTION_OK, view.sw);
+        CHECK_EQUAL(BIG_RESPONSE_LEN, view.dataLen);
+        for (uint16_t i = 0; i < BIG_RESPONSE_LEN; i++) {
+            CHECK_EQUAL((uint8_t) i, view.data[i]);
+        }
+    }
+    client.close();
+    bigBroker.stop();
+}
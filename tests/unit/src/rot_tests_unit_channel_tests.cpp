@@ -0,0 +1,481 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "CppUTest/TestHarness.h"
+
+#include "ROT.h"
+#include "IoTSafeSimulator.h"
+#include "SEAppletRegistry.h"
+#include "SEChannelPool.h"
+
+static const uint8_t HASH[32] = {
+    0x77, 0x12, 0xaa, 0xe3, 0xbb, 0xaa, 0xe5, 0xc0, 0x07, 0x47, 0x5a, 0x73, 0x36, 0xf3, 0xdd, 0xe0,
+    0xbc, 0x63, 0x38, 0x0a, 0x34, 0x8d, 0x23, 0x90, 0xc3, 0x51, 0x9e, 0x78, 0x2e, 0x9a, 0x82, 0x98};
+
+static IoTSafeSimulator* sim = NULL;
+static SEChannelPool* pool = NULL;
+
+TEST_GROUP(ChannelPoolTests)
+{
+    void setup()
+    {
+        ROT rot;
+        uint16_t aidLen;
+        const uint8_t* aid = rot.getAid(&aidLen);
+
+        sim = new IoTSafeSimulator();
+        pool = new SEChannelPool(aid, aidLen);
+    }
+
+    void teardown()
+    {
+        delete pool;
+        delete sim;
+    }
+};
+
+TEST(ChannelPoolTests, ClaEncoding) {
+    for (uint8_t channel = 0; channel < 4; channel++)
+    {
+        CHECK_EQUAL(channel, seClaForChannel(0x00, channel));
+        CHECK_EQUAL(0x10 | channel, seClaForChannel(0x10, channel));
+    }
+    CHECK_EQUAL(0x40, seClaForChannel(0x00, 4));
+    CHECK_EQUAL(0x4F, seClaForChannel(0x00, 19));
+    CHECK_EQUAL(0x51, seClaForChannel(0x10, 5));
+    CHECK_EQUAL(0xC2, seClaForChannel(0x80, 6));
+    // Secure messaging bits have no room in the further interindustry coding
+    CHECK_EQUAL(0x0C | 2, seClaForChannel(0x0C, 2));
+    CHECK_EQUAL(0x40, seClaForChannel(0x0C, 4));
+    for (uint8_t channel = 0; channel < SE_MAX_CHANNELS; channel++)
+    {
+        CHECK_EQUAL(channel, seClaChannel(seClaForChannel(0x00, channel)));
+        CHECK_EQUAL(channel, seClaChannel(seClaForChannel(0x10, channel)));
+    }
+}
+
+TEST(ChannelPoolTests, LeasesEveryChannel) {
+    uint8_t channels[SE_MAX_CHANNELS];
+    uint8_t random[32];
+
+    // Channels 4 to 19 need the further interindustry class coding
+    CHECK_EQUAL(SE_MAX_CHANNELS - 1, pool->open(sim, SE_MAX_CHANNELS));
+    CHECK_EQUAL(SE_MAX_CHANNELS - 1, pool->getSize());
+    for (int i = 0; i < SE_MAX_CHANNELS - 1; i++)
+    {
+        ROT rot;
+
+        channels[i] = pool->acquire(0);
+        CHECK(channels[i] != SE_CHANNEL_NONE);
+        rot.init(sim);
+        CHECK_TRUE(rot.attach(channels[i]));
+        CHECK_EQUAL(ERR_NOERR, rot.generateRandom(random, sizeof(random)));
+    }
+    CHECK_EQUAL(0, pool->getAvailable());
+    CHECK_EQUAL(SE_CHANNEL_NONE, pool->acquire(10));
+
+    for (int i = 0; i < SE_MAX_CHANNELS - 1; i++)
+    {
+        pool->release(channels[i]);
+    }
+    CHECK_EQUAL(SE_MAX_CHANNELS - 1, pool->getAvailable());
+
+    // Closed channels can be opened again
+    pool->close();
+    CHECK_EQUAL(0, pool->getSize());
+    CHECK_EQUAL(SE_CHANNEL_NONE, pool->acquire(0));
+    CHECK_EQUAL(3, pool->open(sim, 3));
+}
+
+TEST(ChannelPoolTests, RecycledWithoutReselect) {
+    uint8_t random[32];
+    uint32_t apdus;
+
+    CHECK_EQUAL(2, pool->open(sim, 2));
+    apdus = sim->getApduCount();
+    for (int i = 0; i < 10; i++)
+    {
+        SEChannelLease lease(pool);
+        ROT rot;
+
+        rot.init(sim);
+        CHECK_TRUE(rot.attach(lease.getChannel()));
+        CHECK_EQUAL(ERR_NOERR, rot.generateRandom(random, sizeof(random)));
+        // Leaves the channel open for the pool
+        CHECK_FALSE(rot.deselect());
+    }
+    // GET RANDOM only, no MANAGE CHANNEL nor SELECT
+    CHECK_EQUAL(apdus + 10, sim->getApduCount());
+    CHECK_EQUAL(2, pool->getAvailable());
+
+    // A reselected channel goes back to the pool after one SELECT
+    {
+        SEChannelLease lease(pool);
+        lease.setReselect();
+    }
+    CHECK_EQUAL(apdus + 11, sim->getApduCount());
+    CHECK_EQUAL(2, pool->getAvailable());
+}
+
+TEST(ChannelPoolTests, GetResponseOnExtendedChannel) {
+    uint8_t channels[6];
+    uint8_t random[64];
+    ROT rot;
+
+    // GET RESPONSE must go on channel 5, not on channel 1
+    sim->setResponseMode(SIM_RESPONSE_61XX);
+    CHECK_EQUAL(6, pool->open(sim, 6));
+    for (int i = 0; i < 6; i++)
+    {
+        channels[i] = pool->acquire(0);
+    }
+    CHECK_EQUAL(6, channels[5]);
+    rot.init(sim);
+    CHECK_TRUE(rot.attach(5));
+    CHECK_EQUAL(ERR_NOERR, rot.generateRandom(random, sizeof(random)));
+    CHECK_EQUAL(sizeof(random), rot.getResponseLength());
+    for (int i = 0; i < 6; i++)
+    {
+        pool->release(channels[i]);
+    }
+}
+
+TEST(ChannelPoolTests, InterleavedSessions) {
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t signature[0x60];
+    uint16_t signatureLen = sizeof(signature);
+    uint8_t random[32];
+    ROT hashRot;
+    ROT textRot;
+    ROT randomRot;
+
+    CHECK_EQUAL(3, pool->open(sim, 3));
+    SEChannelLease hashLease(pool);
+    SEChannelLease textLease(pool);
+    SEChannelLease randomLease(pool);
+
+    hashRot.init(sim);
+    textRot.init(sim);
+    randomRot.init(sim);
+    CHECK_TRUE(hashRot.attach(hashLease.getChannel()));
+    CHECK_TRUE(textRot.attach(textLease.getChannel()));
+    CHECK_TRUE(randomRot.attach(randomLease.getChannel()));
+
+    // A full text signature and a random between the hash signature init
+    // and final, each session on its own channel
+    CHECK_EQUAL(ERR_NOERR, hashRot.signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA));
+    CHECK_EQUAL(ERR_NOERR, textRot.signData(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA,
+                                            HASH, sizeof(HASH), signature, &signatureLen));
+    CHECK_EQUAL(ERR_NOERR, randomRot.generateRandom(random, sizeof(random)));
+    signatureLen = sizeof(signature);
+    CHECK_EQUAL(ERR_NOERR, hashRot.signFinal(HASH, sizeof(HASH), signature, &signatureLen));
+}
+
+#define POOL_THREADS 8
+#define POOL_ROUNDS 50
+
+TEST(ChannelPoolTests, SharedBetweenThreads) {
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+
+    // More threads than channels, some wait for a lease
+    CHECK_EQUAL(4, pool->open(sim, 4));
+    for (int t = 0; t < POOL_THREADS; t++)
+    {
+        threads.push_back(std::thread([&failures]() {
+            uint8_t random[32];
+
+            for (int i = 0; i < POOL_ROUNDS; i++)
+            {
+                SEChannelLease lease(pool);
+                ROT rot;
+
+                rot.init(sim);
+                if (!rot.attach(lease.getChannel()) || rot.generateRandom(random, sizeof(random)) != ERR_NOERR)
+                {
+                    failures++;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
+    CHECK_EQUAL(0, failures.load());
+    CHECK_EQUAL(4, pool->getAvailable());
+}
+
+TEST(ChannelPoolTests, ReleasedUnderTransaction) {
+    uint8_t held;
+    uint8_t reselected;
+
+    CHECK_EQUAL(2, pool->open(sim, 2));
+    held = pool->acquire(0);
+    reselected = pool->acquire(0);
+
+    // The reselect waits for the SE lock held here, without holding the
+    // pool mutex which the release under the lock needs
+    sim->lock();
+    std::thread other([reselected]() { pool->release(reselected, true); });
+    usleep(50000);
+    pool->release(held);
+    sim->unlock();
+    other.join();
+    CHECK_EQUAL(2, pool->getAvailable());
+}
+
+static char statePath[64];
+
+TEST_GROUP(WarmStartTests)
+{
+    void setup()
+    {
+        snprintf(statePath, sizeof(statePath), "/tmp/iotsafe-tests-%d.state", (int) getpid());
+        unlink(statePath);
+        sim = new IoTSafeSimulator();
+    }
+
+    void teardown()
+    {
+        unlink(statePath);
+        delete sim;
+    }
+};
+
+// Sign with the key in CONTAINER_ID_KEY through rot
+static void checkSign(ROT* rot)
+{
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t signature[0x60];
+    uint16_t signatureLen = sizeof(signature);
+
+    CHECK_EQUAL(ERR_NOERR, rot->signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA));
+    CHECK_EQUAL(ERR_NOERR, rot->signFinal(HASH, sizeof(HASH), signature, &signatureLen));
+}
+
+// Selects the applet as a new process would, returns the number of APDUs sent
+static uint32_t warmSelect(ROT** rot)
+{
+    uint32_t count = sim->getApduCount();
+
+    *rot = new ROT();
+    (*rot)->init(sim);
+    CHECK_TRUE((*rot)->selectWarm(statePath));
+    return sim->getApduCount() - count;
+}
+
+TEST(WarmStartTests, ReusesChannel) {
+    ROT* rot;
+
+    // MANAGE CHANNEL and SELECT, then the channel outlives the process
+    CHECK_EQUAL(2, warmSelect(&rot));
+    CHECK_EQUAL(0, access(statePath, R_OK));
+    checkSign(rot);
+    delete rot;
+
+    // SELECT only
+    CHECK_EQUAL(1, warmSelect(&rot));
+    checkSign(rot);
+    delete rot;
+    CHECK_EQUAL(1, warmSelect(&rot));
+
+    // deselect() closes the channel for good
+    CHECK_FALSE(rot->deselect());
+    CHECK_TRUE(access(statePath, F_OK) != 0);
+    delete rot;
+    CHECK_EQUAL(2, warmSelect(&rot));
+    delete rot;
+}
+
+TEST(WarmStartTests, RestoresExtendedLength) {
+    ROT* rot;
+
+    CHECK_EQUAL(2, warmSelect(&rot));
+    sim->setExtendedLength(APDU_EXTENDED_OFF);
+    delete rot;
+
+    // Recorded when the instance is destroyed, restored if still unknown
+    sim->setExtendedLength(APDU_EXTENDED_AUTO);
+    CHECK_EQUAL(1, warmSelect(&rot));
+    CHECK_EQUAL(APDU_EXTENDED_OFF, sim->getExtendedLength());
+    delete rot;
+}
+
+TEST(WarmStartTests, CollectsStaleChannel) {
+    static const uint8_t otherAid[] = {0xA0, 0x00, 0x00, 0x00, 0x01};
+    uint8_t channel;
+    ROT* rot;
+
+    CHECK_EQUAL(2, warmSelect(&rot));
+    delete rot;
+
+    // The channel was closed, e.g. by a card reset: no MANAGE CHANNEL close
+    CHECK_EQUAL(ERR_NOERR, sim->transmit(0x00, 0x70, 0x80, 0x01));
+    CHECK_EQUAL(1 + 2, warmSelect(&rot));
+    checkSign(rot);
+    delete rot;
+
+    // Another applet was selected on it: selected back on the same channel
+    CHECK_EQUAL(ERR_NOERR, sim->transmit(0x01, 0xA4, 0x04, 0x00, otherAid, sizeof(otherAid)));
+    CHECK_EQUAL(1, warmSelect(&rot));
+    checkSign(rot);
+    delete rot;
+
+    // Only the recorded channel is open besides the basic one
+    CHECK_EQUAL(ERR_NOERR, sim->transmit(0x00, 0x70, 0x00, 0x00, 0x01));
+    CHECK_EQUAL(1, sim->getResponse(&channel));
+    CHECK_EQUAL(2, channel);
+}
+
+TEST(WarmStartTests, IgnoresInvalidState) {
+    ROT* rot;
+    FILE* f;
+
+    // Not a state file, then the state of another applet
+    f = fopen(statePath, "w");
+    CHECK_TRUE(f != NULL);
+    fputs("garbage\n", f);
+    fclose(f);
+    CHECK_EQUAL(2, warmSelect(&rot));
+    delete rot;
+
+    f = fopen(statePath, "w");
+    CHECK_TRUE(f != NULL);
+    fputs("iotsafe-channel 1 1 0 A000000001\n", f);
+    fclose(f);
+    CHECK_EQUAL(2, warmSelect(&rot));
+    checkSign(rot);
+    delete rot;
+}
+
+// Second applet of the simulated card
+static const uint8_t OPERATOR_AID[] = {0xA0, 0x00, 0x00, 0x00, 0x87, 0x10, 0x02, 0xFF, 0x33};
+
+static SEAppletRegistry* registry = NULL;
+static ROT* iotSafe = NULL;
+static ROT* operatorApplet = NULL;
+
+TEST_GROUP(AppletRegistryTests)
+{
+    void setup()
+    {
+        sim = new IoTSafeSimulator();
+        CHECK_TRUE(sim->setOtherAid(OPERATOR_AID, sizeof(OPERATOR_AID)));
+        registry = new SEAppletRegistry(sim);
+        iotSafe = new ROT();
+        operatorApplet = new ROT(OPERATOR_AID, sizeof(OPERATOR_AID));
+        CHECK_TRUE(registry->add(iotSafe));
+        CHECK_TRUE(registry->add(operatorApplet));
+    }
+
+    void teardown()
+    {
+        delete registry;
+        delete operatorApplet;
+        delete iotSafe;
+        delete sim;
+    }
+};
+
+// APDUs sent to have applet ready
+static uint32_t useApplet(Applet* applet)
+{
+    uint32_t count = sim->getApduCount();
+
+    CHECK_TRUE(registry->use(applet));
+    return sim->getApduCount() - count;
+}
+
+TEST(AppletRegistryTests, SwitchesWithoutSelect) {
+    uint16_t aidLen;
+    const uint8_t* aid = iotSafe->getAid(&aidLen);
+    uint8_t random[16];
+    ROT duplicate;
+
+    CHECK_EQUAL(2, registry->getCount());
+    CHECK_FALSE(registry->add(&duplicate));
+    POINTERS_EQUAL(iotSafe, registry->find(aid, aidLen));
+    POINTERS_EQUAL(operatorApplet, registry->find(OPERATOR_AID, sizeof(OPERATOR_AID)));
+
+    // MANAGE CHANNEL and SELECT once each
+    CHECK_EQUAL(2, useApplet(iotSafe));
+    POINTERS_EQUAL(operatorApplet, registry->use(OPERATOR_AID, sizeof(OPERATOR_AID)));
+    CHECK_EQUAL(1, registry->getChannel(iotSafe));
+    CHECK_EQUAL(2, registry->getChannel(operatorApplet));
+
+    // Then nothing but the commands
+    uint32_t count = sim->getApduCount();
+    for (int i = 0; i < 10; i++)
+    {
+        ROT* rot = (i & 1) ? operatorApplet : iotSafe;
+        CHECK_TRUE(registry->use(rot));
+        CHECK_EQUAL(ERR_NOERR, rot->generateRandom(random, sizeof(random)));
+    }
+    CHECK_EQUAL(count + 10, sim->getApduCount());
+
+    // Deselected by its user, it is attached again
+    CHECK_FALSE(iotSafe->deselect());
+    CHECK_EQUAL(0, useApplet(iotSafe));
+    CHECK_EQUAL(ERR_NOERR, iotSafe->generateRandom(random, sizeof(random)));
+}
+
+TEST(AppletRegistryTests, TakesOverLeastRecentlyUsed) {
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t signature[0x60];
+    uint16_t signatureLen = sizeof(signature);
+    uint8_t random[16];
+
+    // One logical channel: each switch is a refused MANAGE CHANNEL and a SELECT on channel 1
+    sim->setChannelLimit(1);
+    CHECK_EQUAL(2, useApplet(iotSafe));
+    CHECK_EQUAL(2, useApplet(operatorApplet));
+    CHECK_FALSE(iotSafe->isSelected());
+    CHECK_EQUAL(SE_CHANNEL_NONE, registry->getChannel(iotSafe));
+    CHECK_EQUAL(1, registry->getChannel(operatorApplet));
+    CHECK_EQUAL(ERR_NOERR, operatorApplet->generateRandom(random, sizeof(random)));
+    CHECK_EQUAL(2, useApplet(iotSafe));
+    CHECK_EQUAL(1, registry->getChannel(iotSafe));
+
+    // Not while a signature session is open on it
+    CHECK_EQUAL(ERR_NOERR, iotSafe->signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA));
+    CHECK_FALSE(registry->use(operatorApplet));
+    CHECK_EQUAL(ERR_NOERR, iotSafe->signFinal(HASH, sizeof(HASH), signature, &signatureLen));
+    CHECK_EQUAL(2, useApplet(operatorApplet));
+}
+
+TEST(AppletRegistryTests, RemoveClosesChannel) {
+    uint8_t channel;
+
+    CHECK_EQUAL(2, useApplet(iotSafe));
+    CHECK_EQUAL(2, useApplet(operatorApplet));
+    CHECK_TRUE(registry->remove(iotSafe));
+    CHECK_FALSE(registry->remove(iotSafe));
+    CHECK_FALSE(iotSafe->isSelected());
+    CHECK_EQUAL(1, registry->getCount());
+    CHECK_FALSE(registry->use(iotSafe));
+
+    // Channel 1 is free again
+    CHECK_EQUAL(ERR_NOERR, sim->transmit(0x00, 0x70, 0x00, 0x00, 0x01));
+    CHECK_EQUAL(1, sim->getResponse(&channel));
+    CHECK_EQUAL(1, channel);
+}
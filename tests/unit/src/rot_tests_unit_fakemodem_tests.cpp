@@ -0,0 +1,121 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "CppUTest/TestHarness.h"
+
+#include "ROT.h"
+#include "GenericModem.h"
+#include "LSerial.h"
+#include "FakeModem.h"
+
+// Whole modem path: LSerial, ATInterface, AT+CSIM hex framing, over a pty
+static IoTSafeSimulator fakeSim;
+static FakeModem fakeModem(&fakeSim);
+static GenericModem ptyModem;
+
+TEST_GROUP(FakeModemTests)
+{
+    void setup()
+    {
+        fakeModem.setEcho(true);
+        fakeModem.setCommandDelay(0);
+        fakeModem.setUrc(NULL, 0);
+        CHECK_TRUE(fakeModem.start());
+        CHECK_TRUE(ptyModem.open(fakeModem.getPortName()));
+        ptyModem.setTimeout(APDU_DEFAULT_TIMEOUT);
+    }
+
+    void teardown()
+    {
+        ptyModem.close();
+        fakeModem.stop();
+    }
+};
+
+TEST(FakeModemTests, RotOverAtCsim) {
+    uint8_t random[240];
+    ROT rot;
+
+    // Echo on and URCs around the +CSIM responses, as a real modem may do
+    fakeModem.setUrc("+CREG: 1", 1);
+    rot.init(&ptyModem);
+    CHECK_TRUE(rot.select(true));
+    for (int i = 0; i < 4; i++) {
+        CHECK_EQUAL(ERR_NOERR, rot.generateRandom(random, sizeof(random)));
+    }
+}
+
+TEST(FakeModemTests, ExtendedLengthOverAtCsim) {
+    uint8_t certId[CONTAINER_ID_LENGTH] = {0x10};
+    uint8_t content[2000];
+    uint8_t* cert = NULL;
+    uint16_t certLen = 0;
+    ROT rot;
+
+    // The whole file in a single AT+CSIM of about 4 KB of hex
+    memset(content, 0xA5, sizeof(content));
+    CHECK_TRUE(fakeSim.putFile(certId, CONTAINER_ID_LENGTH, content, sizeof(content)));
+    rot.init(&ptyModem);
+    CHECK_TRUE(rot.select(true));
+    CHECK_EQUAL(ERR_NOERR, rot.getCertificateByContainerId(certId, CONTAINER_ID_LENGTH, &cert, &certLen));
+    CHECK_EQUAL(APDU_EXTENDED_ON, ptyModem.getExtendedLength());
+    CHECK_EQUAL(sizeof(content) + 1, certLen);
+    MEMCMP_EQUAL(content, cert, sizeof(content));
+    free(cert);
+}
+
+TEST(FakeModemTests, BaudRateNegotiation) {
+    CHECK_TRUE(ptyModem.setBaudRate(921600));
+    CHECK_EQUAL(921600, ptyModem.getBaudRate());
+    CHECK_TRUE(ptyModem.setFlowControl(true));
+    CHECK_TRUE(ptyModem.setFlowControl(false));
+    CHECK_TRUE(ptyModem.setBaudRate(115200));
+}
+
+TEST(FakeModemTests, SlowCommandTimesOut) {
+    fakeModem.setCommandDelay(300000);
+    ptyModem.setTimeout(100);
+    CHECK_EQUAL(ERR_TIMEOUT, ptyModem.transmit(0x00, 0x84, 0x00, 0x00, 0x10));
+}
+
+TEST(FakeModemTests, StuckOutputTimesOut) {
+    static char data[1 << 20];
+    unsigned long int written = 0;
+    struct timespec start, end;
+    LSerial serial;
+
+    // Nobody reads the master side: once the pty buffer is full, write() cannot
+    // go on, as with a modem holding CTS
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    CHECK_TRUE(master >= 0);
+    CHECK_EQUAL(0, grantpt(master));
+    CHECK_EQUAL(0, unlockpt(master));
+    CHECK_TRUE(serial.start(ptsname(master)));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK_FALSE(serial.send(data, sizeof(data), &written, 100));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    CHECK_TRUE((end.tv_sec - start.tv_sec) < 2);
+
+    serial.stop();
+    close(master);
+}
@@ -0,0 +1,98 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+#include "HexCodec.h"
+
+static const int CODEC_MODES[] = {HEX_CODEC_SCALAR, HEX_CODEC_AUTO};
+
+TEST_GROUP(HexCodecTests)
+{
+    void teardown()
+    {
+        hexCodecSetMode(HEX_CODEC_AUTO);
+    }
+};
+
+TEST(HexCodecTests, EncodeMatchesSprintf) {
+    uint8_t bytes[300];
+    char hex[600];
+    char expected[601];
+
+    for (uint16_t i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t)(i * 7 + 3);
+        sprintf(&expected[2 * i], "%02X", bytes[i]);
+    }
+
+    for (int mode : CODEC_MODES) {
+        hexCodecSetMode(mode);
+        // Lengths around the vector width exercise the scalar tail
+        for (uint16_t len = 0; len <= sizeof(bytes); len += 13) {
+            memset(hex, 0, sizeof(hex));
+            hexEncode(bytes, len, hex);
+            MEMCMP_EQUAL(expected, hex, 2 * len);
+        }
+    }
+}
+
+TEST(HexCodecTests, DecodeRoundTrip) {
+    uint8_t bytes[256];
+    uint8_t decoded[256];
+    char hex[512];
+    uint16_t len = 0;
+
+    for (uint16_t i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t) i;
+    }
+
+    for (int mode : CODEC_MODES) {
+        hexCodecSetMode(mode);
+        hexEncode(bytes, sizeof(bytes), hex);
+        // Lower case is accepted as well
+        for (uint16_t i = 0; i < sizeof(hex); i += 3) {
+            if (hex[i] >= 'A') {
+                hex[i] += 'a' - 'A';
+            }
+        }
+        CHECK_TRUE(hexDecode(hex, sizeof(hex), decoded, &len));
+        CHECK_EQUAL(sizeof(bytes), len);
+        MEMCMP_EQUAL(bytes, decoded, sizeof(bytes));
+    }
+}
+
+TEST(HexCodecTests, DecodeRejectsInvalidInput) {
+    char hex[64];
+    uint8_t decoded[32];
+    uint16_t len = 0;
+    const char invalid[] = {'G', 'g', ' ', '"', '/', ':', '@', '`', '\0', (char) 0xC1};
+
+    for (int mode : CODEC_MODES) {
+        hexCodecSetMode(mode);
+        memset(hex, '9', sizeof(hex));
+        CHECK_FALSE(hexDecode(hex, 63, decoded, &len));
+        for (char c : invalid) {
+            for (uint16_t pos = 0; pos < sizeof(hex); pos += 7) {
+                memset(hex, 'a', sizeof(hex));
+                hex[pos] = c;
+                CHECK_FALSE(hexDecode(hex, sizeof(hex), decoded, &len));
+                CHECK_EQUAL(0, len);
+            }
+        }
+    }
+}
@@ -0,0 +1,254 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CppUTest/TestHarness.h"
+
+#include "ROT.h"
+#include "GenericModem.h"
+#include "FakeModem.h"
+#include "IoTSafeSimulator.h"
+#include "SEMetrics.h"
+
+TEST_GROUP(MetricsTests)
+{
+    void setup()
+    {
+        seMetricsReset();
+        seMetricsEnable(true);
+    }
+
+    void teardown()
+    {
+        seMetricsEnable(false);
+        seMetricsReset();
+    }
+};
+
+static const SEInsSnapshot *findIns(const SEMetricsSnapshot &snapshot, uint8_t ins)
+{
+    for (size_t i = 0; i < snapshot.ins.size(); i++)
+    {
+        if (snapshot.ins[i].ins == ins)
+        {
+            return &snapshot.ins[i];
+        }
+    }
+    return nullptr;
+}
+
+static uint64_t statusWordCount(const SEMetricsSnapshot &snapshot, uint16_t sw)
+{
+    for (size_t i = 0; i < snapshot.statusWords.size(); i++)
+    {
+        if (snapshot.statusWords[i].sw == sw)
+        {
+            return snapshot.statusWords[i].count;
+        }
+    }
+    return 0;
+}
+
+// Select, certificate read and two randoms
+static void runWorkload(SEInterface *se)
+{
+    uint8_t certId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_CERT_CLIENT};
+    uint8_t random[32];
+    uint8_t *cert = nullptr;
+    uint16_t certLen = 0;
+    ROT rot;
+
+    rot.init(se);
+    CHECK_TRUE(rot.select(true));
+    CHECK_EQUAL(ERR_NOERR, rot.getCertificateByContainerId(certId, CONTAINER_ID_LENGTH, &cert, &certLen));
+    CHECK_EQUAL(ERR_NOERR, rot.generateRandom(random, sizeof(random)));
+    CHECK_EQUAL(ERR_NOERR, rot.generateRandom(random, sizeof(random)));
+    free(cert);
+}
+
+TEST(MetricsTests, CountsOperationsAndApdus) {
+    IoTSafeSimulator sim;
+    SEMetricsSnapshot snapshot;
+    const SEInsSnapshot *random;
+    uint64_t apdus = 0;
+
+    runWorkload(&sim);
+    seMetricsSnapshot(&snapshot);
+
+    CHECK_EQUAL(1, snapshot.operations[SE_METRICS_OP_SELECT].count);
+    CHECK_EQUAL(1, snapshot.operations[SE_METRICS_OP_GET_CERTIFICATE].count);
+    CHECK_EQUAL(2, snapshot.operations[SE_METRICS_OP_GENERATE_RANDOM].count);
+    CHECK_EQUAL(2, snapshot.operations[SE_METRICS_OP_GENERATE_RANDOM].latency.count);
+    CHECK_EQUAL(0, snapshot.operations[SE_METRICS_OP_GENERATE_RANDOM].errors);
+    CHECK_EQUAL(0, snapshot.operations[SE_METRICS_OP_SIGN_INIT].count);
+
+    // GET RANDOM: 5 bytes out, 32 bytes and the status word back
+    random = findIns(snapshot, 0x84);
+    CHECK(random != nullptr);
+    CHECK_EQUAL(2, random->count);
+    CHECK_EQUAL(2 * 5, random->commandBytes);
+    CHECK_EQUAL(2 * (32 + 2), random->responseBytes);
+    CHECK(findIns(snapshot, 0xA4) != nullptr);
+
+    for (size_t i = 0; i < snapshot.ins.size(); i++)
+    {
+        apdus += snapshot.ins[i].count;
+        CHECK_EQUAL(0, snapshot.ins[i].errors);
+    }
+    CHECK_EQUAL(apdus, statusWordCount(snapshot, 0x9000));
+    CHECK_EQUAL(0, snapshot.counters[SE_METRICS_RETRIES_61XX]);
+    CHECK_EQUAL(0, snapshot.counters[SE_METRICS_RETRIES_6CXX]);
+}
+
+TEST(MetricsTests, CountsRetries) {
+    IoTSafeSimulator sim;
+    SEMetricsSnapshot snapshot;
+
+    sim.setResponseMode(SIM_RESPONSE_61XX | SIM_RESPONSE_6CXX);
+    runWorkload(&sim);
+    seMetricsSnapshot(&snapshot);
+
+    CHECK(snapshot.counters[SE_METRICS_RETRIES_61XX] > 0);
+    CHECK(snapshot.counters[SE_METRICS_RETRIES_6CXX] > 0);
+    CHECK(findIns(snapshot, 0xC0) != nullptr);
+    CHECK_EQUAL(snapshot.counters[SE_METRICS_RETRIES_61XX], findIns(snapshot, 0xC0)->count);
+    CHECK_EQUAL(2, snapshot.operations[SE_METRICS_OP_GENERATE_RANDOM].count);
+    CHECK_EQUAL(0, snapshot.operations[SE_METRICS_OP_GENERATE_RANDOM].errors);
+}
+
+TEST(MetricsTests, CountsFailures) {
+    IoTSafeSimulator sim;
+    SEMetricsSnapshot snapshot;
+    uint8_t certId[CONTAINER_ID_LENGTH] = {0x7F};
+    uint8_t *cert = nullptr;
+    uint16_t certLen = 0;
+    ROT rot;
+
+    rot.init(&sim);
+    CHECK_TRUE(rot.select(true));
+    CHECK(rot.getCertificateByContainerId(certId, CONTAINER_ID_LENGTH, &cert, &certLen) != ERR_NOERR);
+    CHECK_EQUAL(ERR_INVALID_PARAMETERS, rot.generateKeyPairByContainerId(certId, CONTAINER_ID_LENGTH, nullptr));
+    seMetricsSnapshot(&snapshot);
+
+    CHECK_EQUAL(1, snapshot.operations[SE_METRICS_OP_GET_CERTIFICATE].errors);
+    CHECK_EQUAL(1, snapshot.operations[SE_METRICS_OP_GENERATE_KEY_PAIR].errors);
+    CHECK_EQUAL(0, snapshot.operations[SE_METRICS_OP_SELECT].errors);
+    CHECK(snapshot.statusWords.size() > 1);
+    free(cert);
+}
+
+TEST(MetricsTests, DisabledRecordsNothing) {
+    IoTSafeSimulator sim;
+    SEMetricsSnapshot snapshot;
+
+    seMetricsEnable(false);
+    runWorkload(&sim);
+    seMetricsSnapshot(&snapshot);
+
+    for (int i = 0; i < SE_METRICS_OP_COUNT; i++)
+    {
+        CHECK_EQUAL(0, snapshot.operations[i].count);
+    }
+    CHECK_EQUAL(0, snapshot.statusWords.size());
+    for (int i = 0; i < SE_METRICS_COUNTER_COUNT; i++)
+    {
+        CHECK_EQUAL(0, snapshot.counters[i]);
+    }
+}
+
+TEST(MetricsTests, Percentiles) {
+    SEMetricsSnapshot snapshot;
+    const SEHistogramSnapshot *latency;
+    uint64_t p50;
+
+    // 1 to 1000 us
+    for (uint64_t us = 1; us <= 1000; us++)
+    {
+        seMetricsRecordOperation(SE_METRICS_OP_COMPUTE_DH, us * 1000, false);
+    }
+    seMetricsRecordOperation(SE_METRICS_OP_COMPUTE_PRF, 5000, false);
+    seMetricsSnapshot(&snapshot);
+    latency = &snapshot.operations[SE_METRICS_OP_COMPUTE_DH].latency;
+
+    CHECK_EQUAL(1000, latency->count);
+    CHECK_EQUAL(500500, latency->sum);
+    CHECK_EQUAL(1000, latency->max);
+    // Small values are exact, larger ones within a bucket width of 12.5%
+    CHECK_EQUAL(1, seHistogramPercentile(latency, 0));
+    CHECK_EQUAL(5, seHistogramPercentile(latency, 0.005));
+    p50 = seHistogramPercentile(latency, 0.5);
+    CHECK(p50 >= 500 && p50 <= 500 * 9 / 8);
+    CHECK_EQUAL(1000, seHistogramPercentile(latency, 1));
+    CHECK_EQUAL(5, seHistogramPercentile(&snapshot.operations[SE_METRICS_OP_COMPUTE_PRF].latency, 0.99));
+    CHECK_EQUAL(0, seHistogramPercentile(&snapshot.operations[SE_METRICS_OP_SIGN_DATA].latency, 0.99));
+}
+
+TEST(MetricsTests, WritesPrometheus) {
+    IoTSafeSimulator sim;
+    SEMetricsSnapshot snapshot;
+    char *text = nullptr;
+    size_t textLen = 0;
+    FILE *f;
+
+    runWorkload(&sim);
+    seMetricsSnapshot(&snapshot);
+    f = open_memstream(&text, &textLen);
+    CHECK(f != nullptr);
+    CHECK_TRUE(seMetricsWritePrometheus(&snapshot, f));
+    fclose(f);
+
+    CHECK(strstr(text, "# TYPE iotsafe_operations_total counter\n") != nullptr);
+    CHECK(strstr(text, "iotsafe_operations_total{operation=\"generate_random\"} 2\n") != nullptr);
+    CHECK(strstr(text, "iotsafe_operation_duration_seconds_bucket{operation=\"generate_random\",le=\"+Inf\"} 2\n") != nullptr);
+    CHECK(strstr(text, "iotsafe_operation_duration_seconds_count{operation=\"generate_random\"} 2\n") != nullptr);
+    CHECK(strstr(text, "iotsafe_apdus_total{ins=\"84\"} 2\n") != nullptr);
+    CHECK(strstr(text, "iotsafe_apdu_response_bytes_total{ins=\"84\"} 68\n") != nullptr);
+    CHECK(strstr(text, "iotsafe_status_words_total{sw=\"9000\"}") != nullptr);
+    CHECK(strstr(text, "iotsafe_uart_bytes_total{direction=\"out\"} 0\n") != nullptr);
+    // Operations never run have no histogram
+    CHECK(strstr(text, "operation_duration_seconds_count{operation=\"sign_init\"}") == nullptr);
+    free(text);
+}
+
+TEST(MetricsTests, CountsModemTraffic) {
+    static IoTSafeSimulator sim;
+    static FakeModem fakeModem(&sim);
+    static GenericModem modem;
+    SEMetricsSnapshot snapshot;
+    uint8_t random[32];
+    ROT rot;
+
+    fakeModem.setCommandDelay(0);
+    CHECK_TRUE(fakeModem.start());
+    CHECK_TRUE(modem.open(fakeModem.getPortName()));
+    modem.setTimeout(APDU_DEFAULT_TIMEOUT);
+    rot.init(&modem);
+    CHECK_TRUE(rot.select(true));
+    seMetricsReset();
+    CHECK_EQUAL(ERR_NOERR, rot.generateRandom(random, sizeof(random)));
+    seMetricsSnapshot(&snapshot);
+    modem.close();
+    fakeModem.stop();
+
+    // AT+CSIM=10,"0084000020"\r\n then +CSIM: 68,"<34 bytes>"\r\n and OK
+    CHECK_EQUAL(1, snapshot.counters[SE_METRICS_AT_COMMANDS]);
+    CHECK_EQUAL(0, snapshot.counters[SE_METRICS_AT_ERRORS]);
+    CHECK_EQUAL(12 + 10 + 3, snapshot.counters[SE_METRICS_UART_BYTES_OUT]);
+    CHECK(snapshot.counters[SE_METRICS_UART_BYTES_IN] >= 15 + 68);
+}
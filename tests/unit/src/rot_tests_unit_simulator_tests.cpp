@@ -0,0 +1,729 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include "CppUTest/TestHarness.h"
+
+#include "ROT.h"
+#include "IoTSafeSimulator.h"
+
+static IoTSafeSimulator* _sim = NULL;
+static ROT* _simRot = NULL;
+
+// TLS 1.2 PRF vector, also used against the applet on SIM
+static const uint8_t PRF_SECRET[] = {
+    0xC0, 0x48, 0x5B, 0x05, 0x48, 0x63, 0xF6, 0xDF, 0xA4, 0x58, 0x78, 0x97, 0x68, 0xB9, 0x03, 0x5C,
+    0x6C, 0xAC, 0xB1, 0x60, 0xDD, 0x1A, 0x01, 0x83, 0x48, 0x11, 0xF5, 0x78, 0x33, 0x09, 0xDB, 0x81};
+
+static const uint8_t PRF_SEED[] = {
+    0xCE, 0x15, 0xB4, 0x4D, 0x68, 0x44, 0x0B, 0x65, 0x26, 0x24, 0x24, 0x4D, 0xB8, 0xD2, 0xFB, 0x7D,
+    0xD6, 0x01, 0xC7, 0x59, 0xE9, 0xEB, 0x62, 0x7F, 0xB1, 0x05, 0x29, 0xAB, 0x0D, 0xB7, 0x60, 0x49};
+
+static const uint8_t PRF_EXPECTED[] = {
+    0xa1, 0xf0, 0x2a, 0x76, 0x6d, 0xa0, 0x4c, 0x8f, 0xd8, 0x3a, 0x40, 0xe3, 0x58, 0x26, 0x75, 0x28,
+    0xf8, 0xd8, 0x15, 0xc4, 0x8e, 0x3d, 0xc3, 0x53, 0xd5, 0x5f, 0xe3, 0x86, 0x1c, 0x35, 0x06, 0x22,
+    0xc7, 0x8b, 0x48, 0xfe, 0x6f, 0x49, 0xf6, 0xe1, 0x3e, 0x1b, 0x6b, 0x17, 0x5c, 0xfe, 0x59, 0xfb};
+
+static const uint8_t HASH[] = {
+    0x77, 0x12, 0xaa, 0xe3, 0xbb, 0xaa, 0xe5, 0xc0, 0x07, 0x47, 0x5a, 0x73, 0x36, 0xf3, 0xdd, 0xe0,
+    0xbc, 0x63, 0x38, 0x0a, 0x34, 0x8d, 0x23, 0x90, 0xc3, 0x51, 0x9e, 0x78, 0x2e, 0x9a, 0x82, 0x98};
+
+// Verify a signature of hash with the certificate in CONTAINER_ID_CERT_CLIENT
+static bool verifyWithCertificate(ROT* rot, const uint8_t* hash, uint16_t hashLen,
+                                  const uint8_t* signature, uint16_t signatureLen)
+{
+    uint8_t certId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_CERT_CLIENT};
+    uint8_t* cert = NULL;
+    uint16_t certLen = 0;
+
+    CHECK_EQUAL(ERR_NOERR, rot->getCertificateByContainerId(certId, CONTAINER_ID_LENGTH, &cert, &certLen));
+
+    const uint8_t* p = cert;
+    X509* x509 = d2i_X509(NULL, &p, certLen - 1);
+    free(cert);
+    CHECK_TRUE(x509 != NULL);
+    EVP_PKEY* pkey = X509_get_pubkey(x509);
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    bool verified = EVP_PKEY_verify_init(ctx) > 0 &&
+        EVP_PKEY_verify(ctx, signature, signatureLen, hash, hashLen) == 1;
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(pkey);
+    X509_free(x509);
+    return verified;
+}
+
+// Sign HASH with the key in CONTAINER_ID_KEY and check it against the certificate
+static void checkSignature(void)
+{
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t signature[0x60];
+    uint16_t signatureLen = sizeof(signature);
+
+    CHECK_EQUAL(ERR_NOERR, _simRot->signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA));
+    CHECK_EQUAL(ERR_NOERR, _simRot->signFinal(HASH, sizeof(HASH), signature, &signatureLen));
+    CHECK_TRUE(verifyWithCertificate(_simRot, HASH, sizeof(HASH), signature, signatureLen));
+}
+
+TEST_GROUP(SimulatorTests)
+{
+    void setup()
+    {
+        _sim = new IoTSafeSimulator();
+        _simRot = new ROT();
+        _simRot->init(_sim);
+        CHECK_TRUE(_simRot->select(true));
+    }
+
+    void teardown()
+    {
+        delete _simRot;
+        delete _sim;
+    }
+};
+
+TEST(SimulatorTests, GenerateRandom) {
+    uint8_t random1[32];
+    uint8_t random2[32];
+
+    CHECK_EQUAL(ERR_NOERR, _simRot->generateRandom(random1, sizeof(random1)));
+    CHECK_EQUAL(ERR_NOERR, _simRot->generateRandom(random2, sizeof(random2)));
+    CHECK_FALSE(memcmp(random1, random2, sizeof(random1)) == 0);
+}
+
+TEST(SimulatorTests, ComputePRF) {
+    uint8_t data[sizeof(PRF_EXPECTED)];
+    const char* label = "extended master secret";
+
+    CHECK_EQUAL(ERR_NOERR, _simRot->computePRFwithSecret(PRF_SECRET, sizeof(PRF_SECRET),
+                            (const uint8_t*)label, strlen(label),
+                            PRF_SEED, sizeof(PRF_SEED),
+                            data, sizeof(data)));
+    MEMCMP_EQUAL(PRF_EXPECTED, data, sizeof(PRF_EXPECTED));
+}
+
+TEST(SimulatorTests, SignatureMatchesCertificate) {
+    checkSignature();
+}
+
+TEST(SimulatorTests, GenerateKeypairAndComputeDH) {
+    uint8_t clEph[CONTAINER_ID_LENGTH] = {CONTAINER_ID_CLIENT_EPHEMERAL_KEY};
+    uint8_t svrEph[CONTAINER_ID_LENGTH] = {CONTAINER_ID_SERVER_EPHEMERAL_KEY};
+    RotKeyPair kp;
+
+    CHECK_EQUAL(ERR_NOERR, _simRot->generateKeyPairByContainerId(clEph, CONTAINER_ID_LENGTH, &kp));
+    CHECK_EQUAL(ECC_PUBLIC_KEY_LEN, kp.pub_key_data_len);
+
+    // Server side key, generated in a second simulator to get at its point
+    IoTSafeSimulator server;
+    uint8_t serverKey[4 + 65] = {0x49, 0x43, 0x86, 0x41};
+    uint16_t pointLen = 65;
+    CHECK_TRUE(server.generateKey(svrEph, CONTAINER_ID_LENGTH));
+    CHECK_TRUE(server.getPublicKey(svrEph, CONTAINER_ID_LENGTH, serverKey + 4, &pointLen));
+    CHECK_EQUAL(ERR_NOERR, _simRot->putServerPublicKey(svrEph, CONTAINER_ID_LENGTH, serverKey, 4 + 65));
+
+    uint8_t sharedSecret[0x60];
+    uint16_t sharedSecretLen = sizeof(sharedSecret);
+    CHECK_EQUAL(ERR_NOERR, _simRot->computeDHforKeypair(clEph, CONTAINER_ID_LENGTH, svrEph, CONTAINER_ID_LENGTH,
+                                                        sharedSecret, &sharedSecretLen));
+    CHECK_EQUAL(32, sharedSecretLen);
+
+    // Same secret computed the other way round
+    uint8_t clientKey[4 + 65] = {0x49, 0x43, 0x86, 0x41};
+    memcpy(clientKey + 4, kp.pub_key_data + 4, 65);
+    ROT serverRot;
+    serverRot.init(&server);
+    CHECK_TRUE(serverRot.select(true));
+    CHECK_EQUAL(ERR_NOERR, serverRot.putServerPublicKey(clEph, CONTAINER_ID_LENGTH, clientKey, 4 + 65));
+    uint8_t serverSecret[0x60];
+    uint16_t serverSecretLen = sizeof(serverSecret);
+    CHECK_EQUAL(ERR_NOERR, serverRot.computeDHforKeypair(svrEph, CONTAINER_ID_LENGTH, clEph, CONTAINER_ID_LENGTH,
+                                                         serverSecret, &serverSecretLen));
+    CHECK_EQUAL(sharedSecretLen, serverSecretLen);
+    MEMCMP_EQUAL(sharedSecret, serverSecret, sharedSecretLen);
+}
+
+TEST(SimulatorTests, GetResponseEmulation) {
+    uint8_t random[32];
+
+    _sim->setResponseMode(SIM_RESPONSE_61XX);
+    uint32_t count = _sim->getApduCount();
+    CHECK_EQUAL(ERR_NOERR, _simRot->generateRandom(random, sizeof(random)));
+    // GET RANDOM answered 61xx, then GET RESPONSE
+    CHECK_EQUAL(count + 2, _sim->getApduCount());
+    checkSignature();
+}
+
+TEST(SimulatorTests, WrongLengthEmulation) {
+    uint8_t random[32];
+
+    _sim->setResponseMode(SIM_RESPONSE_6CXX);
+    uint32_t count = _sim->getApduCount();
+    CHECK_EQUAL(ERR_NOERR, _simRot->generateRandom(random, sizeof(random)));
+    // GET RANDOM answered 6Cxx, then repeated with the exact Le
+    CHECK_EQUAL(count + 2, _sim->getApduCount());
+}
+
+// Card answering 6C10 to everything, recording the last command sent
+class WrongLengthCard : public SEInterface
+{
+public:
+    uint8_t lastApdu[64];
+    uint16_t lastApduLen;
+    uint32_t apduCount;
+
+    WrongLengthCard(void) : lastApduLen(0), apduCount(0) {}
+
+protected:
+    bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen)
+    {
+        memcpy(lastApdu, apdu, apduLen);
+        lastApduLen = apduLen;
+        apduCount++;
+        response[0] = 0x6C;
+        response[1] = 0x10;
+        *responseLen = 2;
+        return true;
+    }
+};
+
+TEST(SimulatorTests, WrongLengthWithoutLe) {
+    static const uint8_t data[] = {0x01, 0x02, 0x03};
+    WrongLengthCard card;
+
+    // Case 1: no Le to correct, P2 must not be rewritten
+    card.transmit(0x80, 0xCA, 0x00, 0x00);
+    CHECK_EQUAL(1, card.apduCount);
+    CHECK_EQUAL(0x6C10, card.getStatusWord());
+
+    // Case 3: no Le to correct, the last data byte must not be rewritten
+    card.transmit(0x80, 0xDA, 0x00, 0x00, data, sizeof(data));
+    CHECK_EQUAL(2, card.apduCount);
+    CHECK_EQUAL(0x6C10, card.getStatusWord());
+    CHECK_EQUAL(0x03, card.lastApdu[card.lastApduLen - 1]);
+
+    // Case 4: repeated once with the exact Le
+    card.transmit(0x80, 0xDA, 0x00, 0x00, data, sizeof(data), 0x00);
+    CHECK_EQUAL(4, card.apduCount);
+    CHECK_EQUAL(0x10, card.lastApdu[card.lastApduLen - 1]);
+    CHECK_EQUAL(0x03, card.lastApdu[card.lastApduLen - 2]);
+}
+
+// Card answering every command with a COMPUTE SIGNATURE response of r and
+// s, each of scalarLen bytes
+class SignatureCard : public SEInterface
+{
+public:
+    uint16_t scalarLen;
+
+    SignatureCard(uint16_t len) : scalarLen(len) {}
+
+protected:
+    bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen)
+    {
+        uint16_t index = 0;
+
+        response[index++] = 0x33;
+        response[index++] = 0x81;
+        response[index++] = 2 * scalarLen;
+        memset(response + index, 0x01, scalarLen);           // r
+        memset(response + index + scalarLen, 0x80, scalarLen);  // s, padded in DER
+        index += 2 * scalarLen;
+        response[index++] = 0x90;
+        response[index++] = 0x00;
+        *responseLen = index;
+        return true;
+    }
+};
+
+TEST(SimulatorTests, SignatureBounds) {
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t signature[160];
+    uint16_t signatureLen;
+
+    // P-521: 68 bytes for r, 69 for s, a SEQUENCE length in long form
+    SignatureCard card(ECC_MAX_SCALAR_LEN);
+    ROT rot;
+    rot.init(&card);
+    CHECK_TRUE(rot.attach(1));
+    CHECK_EQUAL(ERR_NOERR, rot.signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA512_WITH_ECDSA));
+    signatureLen = 3 + 68 + 69 - 1;
+    CHECK_EQUAL(ERR_INVALID_LENGTH, rot.signFinal(HASH, sizeof(HASH), signature, &signatureLen));
+    signatureLen = 3 + 68 + 69;
+    CHECK_EQUAL(ERR_NOERR, rot.signFinal(HASH, sizeof(HASH), signature, &signatureLen));
+    CHECK_EQUAL(3 + 68 + 69, signatureLen);
+    CHECK_EQUAL(0x30, signature[0]);
+    CHECK_EQUAL(0x81, signature[1]);
+    CHECK_EQUAL(68 + 69, signature[2]);
+    CHECK_EQUAL(0x02, signature[3]);
+    CHECK_EQUAL(ECC_MAX_SCALAR_LEN, signature[4]);
+    CHECK_EQUAL(0x02, signature[3 + 68]);
+    CHECK_EQUAL(ECC_MAX_SCALAR_LEN + 1, signature[3 + 68 + 1]);
+    CHECK_EQUAL(0x00, signature[3 + 68 + 2]);
+
+    // Larger than any supported curve
+    card.scalarLen = ECC_MAX_SCALAR_LEN + 1;
+    signatureLen = sizeof(signature);
+    CHECK_EQUAL(ERR_INVALID_RESPONSE, rot.signFinal(HASH, sizeof(HASH), signature, &signatureLen));
+}
+
+TEST(SimulatorTests, LogicalChannel) {
+    uint8_t random[32];
+    ROT rot;
+
+    rot.init(_sim);
+    CHECK_TRUE(rot.select(false));
+    CHECK_EQUAL(ERR_NOERR, rot.generateRandom(random, sizeof(random)));
+    rot.deselect();
+    CHECK_FALSE(rot.isSelected());
+}
+
+// Read a 1500 bytes certificate, returns the number of APDUs it took
+static uint32_t readLargeCertificate(IoTSafeSimulator* sim, ROT* rot)
+{
+    uint8_t certId[CONTAINER_ID_LENGTH] = {0x10};
+    uint8_t content[1500];
+    uint8_t* cert = NULL;
+    uint16_t certLen = 0;
+
+    for (uint16_t i = 0; i < sizeof(content); i++) {
+        content[i] = (uint8_t)i;
+    }
+    CHECK_TRUE(sim->putFile(certId, CONTAINER_ID_LENGTH, content, sizeof(content)));
+    uint32_t count = sim->getApduCount();
+    CHECK_EQUAL(ERR_NOERR, rot->getCertificateByContainerId(certId, CONTAINER_ID_LENGTH, &cert, &certLen));
+    count = sim->getApduCount() - count;
+    CHECK_EQUAL(sizeof(content) + 1, certLen);
+    MEMCMP_EQUAL(content, cert, sizeof(content));
+    free(cert);
+    return count;
+}
+
+TEST(SimulatorTests, ExtendedLengthRead) {
+    uint32_t extended = readLargeCertificate(_sim, _simRot);
+    CHECK_EQUAL(APDU_EXTENDED_ON, _sim->getExtendedLength());
+
+    // Same read on a Secure Element without extended length: the extended
+    // READ BINARY is rejected, then the file comes 255 bytes at a time
+    IoTSafeSimulator shortOnly;
+    ROT rot;
+    shortOnly.setExtendedLengthSupport(false);
+    rot.init(&shortOnly);
+    CHECK_TRUE(rot.select(true));
+    uint32_t fallback = readLargeCertificate(&shortOnly, &rot);
+    CHECK_EQUAL(APDU_EXTENDED_OFF, shortOnly.getExtendedLength());
+    CHECK_EQUAL(extended + 6, fallback);
+
+    // Known not supported, no more attempt
+    CHECK_EQUAL(extended + 5, readLargeCertificate(&shortOnly, &rot));
+}
+
+TEST(SimulatorTests, ExtendedLengthCommandData) {
+    uint8_t data[600];
+
+    // Case 2E
+    CHECK_EQUAL(ERR_NOERR, _sim->transmitExtended(0x00, 0x84, 0x00, 0x00, NULL, 0, 1024));
+    CHECK_EQUAL(SW_EXECUTION_OK, _sim->getStatusWord());
+    CHECK_EQUAL(1024, _sim->getResponseLength());
+    CHECK_EQUAL(APDU_EXTENDED_ON, _sim->getExtendedLength());
+
+    // Case 4E, once extended length is known to work 6700 comes from the command
+    memset(data, 0, sizeof(data));
+    CHECK_EQUAL(ERR_NOERR, _sim->transmitExtended(0x00, 0x84, 0x00, 0x00, data, sizeof(data), 16));
+    CHECK_EQUAL(SW_WRONG_LENGTH, _sim->getStatusWord());
+
+    // Data which cannot be sent in short APDUs
+    _sim->setExtendedLength(APDU_EXTENDED_OFF);
+    CHECK_EQUAL(ERR_INVALID_LENGTH, _sim->transmitExtended(0x00, 0x84, 0x00, 0x00, data, sizeof(data), 16));
+}
+
+// Sign a 1000 bytes message, returns the number of APDUs it took
+static uint32_t signLargeMessage(IoTSafeSimulator* sim, ROT* rot)
+{
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t message[1000];
+    uint8_t hash[32];
+    uint8_t signature[0x60];
+    uint16_t signatureLen = sizeof(signature);
+
+    for (uint16_t i = 0; i < sizeof(message); i++) {
+        message[i] = (uint8_t)(i * 7);
+    }
+    uint32_t count = sim->getApduCount();
+    CHECK_EQUAL(ERR_NOERR, rot->signData(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA,
+                                         message, sizeof(message), signature, &signatureLen));
+    count = sim->getApduCount() - count;
+    CHECK_TRUE(EVP_Digest(message, sizeof(message), hash, NULL, EVP_sha256(), NULL) == 1);
+    CHECK_TRUE(verifyWithCertificate(rot, hash, sizeof(hash), signature, signatureLen));
+    return count;
+}
+
+TEST(SimulatorTests, FullTextSignatureChained) {
+    // COMPUTE SIGNATURE INIT, then the whole message in one extended APDU
+    CHECK_EQUAL(2, signLargeMessage(_sim, _simRot));
+
+    // Short APDUs only: 9B 82 03 E8 and the message, 1004 bytes in 4 segments
+    // after the rejected extended one
+    IoTSafeSimulator shortOnly;
+    ROT rot;
+    shortOnly.setExtendedLengthSupport(false);
+    rot.init(&shortOnly);
+    CHECK_TRUE(rot.select(true));
+    CHECK_EQUAL(1 + 1 + 4, signLargeMessage(&shortOnly, &rot));
+    CHECK_EQUAL(1 + 4, signLargeMessage(&shortOnly, &rot));
+}
+
+TEST(SimulatorTests, FullTextSignatureBufferTooSmall) {
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t signature[0x60];
+    uint16_t signatureLen = 8;
+    uint8_t hash[32];
+
+    // A P-256 signature takes 70 to 72 bytes: nothing written
+    memset(signature, 0xAA, sizeof(signature));
+    CHECK_EQUAL(ERR_INVALID_LENGTH, _simRot->signData(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA,
+                                                      HASH, sizeof(HASH), signature, &signatureLen));
+    CHECK_EQUAL(8, signatureLen);
+    for (uint16_t i = 0; i < sizeof(signature); i++) {
+        CHECK_EQUAL(0xAA, signature[i]);
+    }
+
+    // The session ended all the same
+    signatureLen = sizeof(signature);
+    CHECK_EQUAL(ERR_NOERR, _simRot->signData(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA,
+                                             HASH, sizeof(HASH), signature, &signatureLen));
+    CHECK_TRUE(EVP_Digest(HASH, sizeof(HASH), hash, NULL, EVP_sha256(), NULL) == 1);
+    CHECK_TRUE(verifyWithCertificate(_simRot, hash, sizeof(hash), signature, signatureLen));
+}
+
+TEST(SimulatorTests, ClaChaining) {
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t payload[2 + sizeof(HASH) + 4 + 500];
+    uint8_t response[0x60];
+
+    // Hash to sign (9E) followed by an unknown TLV the applet skips
+    memset(payload, 0, sizeof(payload));
+    payload[0] = 0x9E;
+    payload[1] = sizeof(HASH);
+    memcpy(payload + 2, HASH, sizeof(HASH));
+    payload[2 + sizeof(HASH)] = 0xC0;
+    payload[3 + sizeof(HASH)] = 0x82;
+    payload[4 + sizeof(HASH)] = 500 >> 8;
+    payload[5 + sizeof(HASH)] = 500 & 0xFF;
+
+    _sim->setExtendedLength(APDU_EXTENDED_OFF);
+    CHECK_EQUAL(ERR_NOERR, _simRot->signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA));
+    uint32_t count = _sim->getApduCount();
+    CHECK_EQUAL(ERR_NOERR, _simRot->transmitChained(0x00, 0x2B, 0x80, 0x00, NULL, 0, payload, sizeof(payload),
+                                                    256, APDU_CHAINING_CLA));
+    CHECK_EQUAL(count + 3, _sim->getApduCount());
+    CHECK_EQUAL(SW_EXECUTION_OK, _simRot->getStatusWord());
+    CHECK_EQUAL(2 + 0x40, _simRot->getResponse(response));
+    CHECK_EQUAL(0x33, response[0]);
+}
+
+TEST(SimulatorTests, GetResponseAccumulation) {
+    uint32_t direct = readLargeCertificate(_sim, _simRot);
+
+    // The 1500 bytes come back in 256 bytes chunks, joined in one response;
+    // the file length (GET DATA) needs one GET RESPONSE as well
+    _sim->setResponseMode(SIM_RESPONSE_61XX);
+    CHECK_EQUAL(direct + 1 + 6, readLargeCertificate(_sim, _simRot));
+}
+
+TEST(SimulatorTests, ResponseCeiling) {
+    _sim->setResponseMode(SIM_RESPONSE_61XX);
+    _sim->setMaxResponseLength(1000);
+    CHECK_EQUAL(ERR_OUT_OF_MEMORY, _sim->transmitExtended(0x00, 0x84, 0x00, 0x00, NULL, 0, 1024));
+
+    _sim->setMaxResponseLength(1024);
+    CHECK_EQUAL(ERR_NOERR, _sim->transmitExtended(0x00, 0x84, 0x00, 0x00, NULL, 0, 1024));
+    CHECK_EQUAL(SW_EXECUTION_OK, _sim->getStatusWord());
+    CHECK_EQUAL(1024, _sim->getResponseLength());
+}
+
+TEST(SimulatorTests, ResponseView) {
+    uint8_t copy[1024];
+
+    CHECK_TRUE(_simRot->transmit(0x00, 0x84, 0x00, 0x00, 32));
+    SEResponseView view = _simRot->getResponseView();
+    CHECK_EQUAL(SW_EXECUTION_OK, view.sw);
+    CHECK_EQUAL(32, view.dataLen);
+    CHECK_EQUAL(32, _simRot->getResponse(copy));
+    MEMCMP_EQUAL(copy, view.data, 32);
+
+    // A response joined from 61xx chunks is viewed in one piece
+    _sim->setResponseMode(SIM_RESPONSE_61XX);
+    CHECK_EQUAL(ERR_NOERR, _sim->transmitExtended(0x00, 0x84, 0x00, 0x00, NULL, 0, 1024));
+    view = _sim->getResponseView();
+    CHECK_EQUAL(SW_EXECUTION_OK, view.sw);
+    CHECK_EQUAL(1024, view.dataLen);
+    CHECK_EQUAL(1024, _sim->getResponse(copy));
+    MEMCMP_EQUAL(copy, view.data, 1024);
+
+    // Status word only
+    CHECK_EQUAL(ERR_NOERR, _sim->transmit(0x00, 0x2B, 0x80, 0x00));
+    view = _sim->getResponseView();
+    CHECK_TRUE(view.sw != 0);
+    CHECK_EQUAL(0, view.dataLen);
+    POINTERS_EQUAL(NULL, view.data);
+}
+
+TEST(SimulatorTests, BatchEarlyAbort) {
+    uint8_t random1[16];
+    uint8_t random2[300];
+    uint8_t small[8];
+    uint16_t executed = 0;
+    SEBatchCommand batch[3] = {
+        { 0x00, 0x84, 0x00, 0x00, NULL, 0, sizeof(random1), SW_EXECUTION_OK, SE_BATCH_SW_EXACT,
+          random1, sizeof(random1), 0 },
+        { 0x00, 0x99, 0x00, 0x00, NULL, 0, 0, 0, SE_BATCH_SW_ANY, NULL, 0, 0 },
+        { 0x00, 0x84, 0x00, 0x00, NULL, 0, sizeof(random2), SW_EXECUTION_OK, SE_BATCH_SW_EXACT,
+          random2, sizeof(random2), 0 },
+    };
+
+    // Every command sent, the unknown instruction accepted by its predicate
+    CHECK_EQUAL(ERR_NOERR, _simRot->transmitBatch(batch, 3, &executed));
+    CHECK_EQUAL(3, executed);
+    CHECK_EQUAL(SW_EXECUTION_OK, batch[0].responseSw);
+    CHECK_EQUAL(sizeof(random1), batch[0].responseLen);
+    CHECK_EQUAL(0x6D00, batch[1].responseSw);
+    CHECK_EQUAL(sizeof(random2), batch[2].responseLen);
+
+    // The batch stops at the first unexpected status word
+    batch[1].sw = SW_EXECUTION_OK;
+    batch[1].swMask = SE_BATCH_SW_SW1;
+    uint32_t count = _sim->getApduCount();
+    CHECK_EQUAL(ERR_INVALID_RESPONSE, _simRot->transmitBatch(batch, 3, &executed));
+    CHECK_EQUAL(2, executed);
+    CHECK_EQUAL(count + 2, _sim->getApduCount());
+    CHECK_EQUAL(SW_EXECUTION_OK, batch[0].responseSw);
+    CHECK_EQUAL(0x6D00, batch[1].responseSw);
+    CHECK_EQUAL(0, batch[2].responseSw);
+
+    // A response larger than its buffer
+    batch[0].response = small;
+    batch[0].responseLen = sizeof(small);
+    CHECK_EQUAL(ERR_INVALID_LENGTH, _simRot->transmitBatch(batch, 3, NULL));
+    CHECK_EQUAL(0, batch[0].responseLen);
+}
+
+#define SHARED_THREADS 4
+#define SHARED_ROUNDS 50
+
+TEST(SimulatorTests, SharedBetweenThreads) {
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+
+    // Each thread reads its own response length after every command
+    for (int t = 0; t < SHARED_THREADS; t++)
+    {
+        threads.push_back(std::thread([t, &failures]() {
+            ROT rot;
+            uint8_t random[SHARED_THREADS * 16];
+            uint16_t len = (t + 1) * 16;
+
+            rot.init(_sim);
+            if (!rot.select(true))
+            {
+                failures++;
+            }
+            for (int i = 0; i < SHARED_ROUNDS; i++)
+            {
+                if (rot.generateRandom(random, len) != ERR_NOERR || rot.getResponseLength() != len)
+                {
+                    failures++;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
+    CHECK_EQUAL(0, failures.load());
+}
+
+TEST(SimulatorTests, TransactionAcrossThreads) {
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t random[16];
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+
+    // Full text signatures from other threads between signInit and
+    // signFinal would replace the hash mode signature context
+    for (int t = 0; t < SHARED_THREADS; t++)
+    {
+        threads.push_back(std::thread([&failures, &keyId]() {
+            ROT rot;
+            uint8_t signature[0x60];
+
+            rot.init(_sim);
+            if (!rot.select(true))
+            {
+                failures++;
+            }
+            for (int i = 0; i < SHARED_ROUNDS / 5; i++)
+            {
+                uint16_t signatureLen = sizeof(signature);
+                if (rot.signData(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA,
+                                 HASH, sizeof(HASH), signature, &signatureLen) != ERR_NOERR)
+                {
+                    failures++;
+                }
+            }
+        }));
+    }
+    for (int i = 0; i < SHARED_ROUNDS / 5; i++)
+    {
+        uint8_t signature[0x60];
+        uint16_t signatureLen = sizeof(signature);
+
+        CHECK_TRUE(_simRot->lock());
+        int init = _simRot->signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA);
+        int final = _simRot->signFinal(HASH, sizeof(HASH), signature, &signatureLen);
+        CHECK_TRUE(_simRot->unlock());
+        CHECK_EQUAL(ERR_NOERR, init);
+        CHECK_EQUAL(ERR_NOERR, final);
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+    {
+        threads[t].join();
+    }
+    CHECK_EQUAL(0, failures.load());
+
+    // Only the owner releases the lock
+    CHECK_TRUE(_sim->lock());
+    bool released = true;
+    std::thread other([&released]() { released = _sim->unlock(); });
+    other.join();
+    CHECK_FALSE(released);
+    CHECK_TRUE(_sim->unlock());
+    CHECK_FALSE(_sim->unlock());
+    CHECK_EQUAL(ERR_NOERR, _simRot->generateRandom(random, sizeof(random)));
+}
+
+TEST(SimulatorTests, SessionTracking) {
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t signature[0x60];
+    uint16_t signatureLen = sizeof(signature);
+
+    // Nothing open, nothing sent
+    uint32_t count = _sim->getApduCount();
+    _simRot->closeSessions();
+    CHECK_EQUAL(count, _sim->getApduCount());
+
+    // A finished signature leaves no session behind
+    checkSignature();
+    CHECK_EQUAL(0, _simRot->getOpenSessions());
+    count = _sim->getApduCount();
+    _simRot->closeSessions();
+    CHECK_EQUAL(count, _sim->getApduCount());
+
+    // An interrupted one is closed with a single APDU, and cannot be resumed
+    CHECK_EQUAL(ERR_NOERR, _simRot->signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA));
+    CHECK_EQUAL(ERR_NOERR, _simRot->signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA));
+    CHECK_EQUAL(1, _simRot->getOpenSessions());
+    count = _sim->getApduCount();
+    _simRot->closeSessions();
+    CHECK_EQUAL(count + 1, _sim->getApduCount());
+    CHECK_EQUAL(0, _simRot->getOpenSessions());
+    CHECK_FALSE(_simRot->signFinal(HASH, sizeof(HASH), signature, &signatureLen) == ERR_NOERR);
+
+    // The sweep does not depend on the tracking
+    count = _sim->getApduCount();
+    _simRot->sweepSessions();
+    CHECK_EQUAL(count + APPLET_SWEEP_SESSIONS, _sim->getApduCount());
+
+    // Deselecting closes what is still open
+    CHECK_EQUAL(ERR_NOERR, _simRot->signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA));
+    count = _sim->getApduCount();
+    _simRot->deselect();
+    CHECK_EQUAL(count + 1, _sim->getApduCount());
+    CHECK_EQUAL(0, _simRot->getOpenSessions());
+}
+
+// Read the client certificate, returns the number of APDUs sent
+static uint32_t readCertificate(uint8_t** cert, uint16_t* certLen)
+{
+    uint8_t certId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_CERT_CLIENT};
+    uint32_t count = _sim->getApduCount();
+
+    *cert = NULL;
+    *certLen = 0;
+    CHECK_EQUAL(ERR_NOERR, _simRot->getCertificateByContainerId(certId, CONTAINER_ID_LENGTH, cert, certLen));
+    return _sim->getApduCount() - count;
+}
+
+TEST(SimulatorTests, CertificateCache) {
+    uint8_t certId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_CERT_CLIENT};
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_CLIENT_EPHEMERAL_KEY};
+    const uint8_t newCert[] = {0x30, 0x03, 0x02, 0x01, 0x05};
+    RotKeyPair kp;
+    uint8_t* first;
+    uint8_t* cert;
+    uint16_t firstLen;
+    uint16_t certLen;
+
+    // Off by default
+    CHECK_TRUE(readCertificate(&first, &firstLen) > 0);
+    CHECK_TRUE(readCertificate(&cert, &certLen) > 0);
+    free(cert);
+
+    // Read once, then no APDU
+    _simRot->setCache(ROT_CACHE_ON);
+    CHECK_TRUE(readCertificate(&cert, &certLen) > 0);
+    free(cert);
+    CHECK_EQUAL(0, readCertificate(&cert, &certLen));
+    CHECK_EQUAL(firstLen, certLen);
+    MEMCMP_EQUAL(first, cert, certLen);
+    free(cert);
+    checkSignature();
+    CHECK_EQUAL(0, readCertificate(&cert, &certLen));
+    free(cert);
+
+    // Emptied by a key pair generation
+    CHECK_EQUAL(ERR_NOERR, _simRot->generateKeyPairByContainerId(keyId, CONTAINER_ID_LENGTH, &kp));
+    CHECK_TRUE(readCertificate(&cert, &certLen) > 0);
+    free(cert);
+
+    // A file changed behind the cache needs invalidateCache(), or revalidation
+    CHECK_TRUE(_sim->putFile(certId, sizeof(certId), newCert, sizeof(newCert)));
+    CHECK_EQUAL(0, readCertificate(&cert, &certLen));
+    CHECK_EQUAL(firstLen, certLen);
+    free(cert);
+    _simRot->setCache(ROT_CACHE_REVALIDATE);
+    CHECK_TRUE(readCertificate(&cert, &certLen) > 1);
+    CHECK_EQUAL(sizeof(newCert) + 1, certLen);
+    MEMCMP_EQUAL(newCert, cert, sizeof(newCert));
+    free(cert);
+
+    // Revalidated with one GET DATA
+    CHECK_EQUAL(1, readCertificate(&cert, &certLen));
+    CHECK_EQUAL(sizeof(newCert) + 1, certLen);
+    free(cert);
+
+    _simRot->setCache(ROT_CACHE_OFF);
+    CHECK_TRUE(readCertificate(&cert, &certLen) > 1);
+    free(cert);
+    free(first);
+}
@@ -0,0 +1,302 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include "CppUTest/TestHarness.h"
+
+#include "ROT.h"
+#include "IoTSafeSimulator.h"
+#include "SETlv.h"
+
+TEST_GROUP(TlvTests)
+{
+};
+
+TEST(TlvTests, SizesAtCompileTime) {
+    static_assert(seTlvSize(0) == 0, "an empty optional TLV is left out");
+    static_assert(seTlvSize(1, 2, 1) == 10, "mode, hash and signature algorithms");
+
+    CHECK_EQUAL(2 + 3 + 2 + 16, seTlvSize(3, 0, 16));
+}
+
+TEST(TlvTests, BuildsCommand) {
+    static const uint8_t expected[] = {
+        0x84, 0x01, 0x02,
+        0xA1, 0x01, 0x03,
+        0x91, 0x02, 0x00, 0x01,
+        0x9D, 0x04, 0x12, 0x34, 0x56, 0x78,
+        0xD2, 0x00
+    };
+    static const uint8_t keyId[] = {0x02};
+    uint8_t cmd[32];
+    SETlvBuilder tlv(cmd);
+
+    tlv.addOptional(0x84, keyId, sizeof(keyId))
+       .addOptional(0x74, nullptr, 0)
+       .addUint8(0xA1, 0x03)
+       .addUint16(0x91, 0x0001)
+       .addUint32(0x9D, 0x12345678)
+       .add(0xD2, nullptr, 0);
+    CHECK_EQUAL(ERR_NOERR, tlv.error());
+    CHECK_EQUAL(sizeof(expected), tlv.length());
+    MEMCMP_EQUAL(expected, tlv.data(), sizeof(expected));
+}
+
+TEST(TlvTests, BerLengthHeaders) {
+    static const uint32_t lengths[] = {0x7F, 0x80, 0xFF, 0x100, 0xFFFF, 0x10000};
+    static const uint8_t expected[][5] = {
+        {0x9B, 0x7F},
+        {0x9B, 0x81, 0x80},
+        {0x9B, 0x81, 0xFF},
+        {0x9B, 0x82, 0x01, 0x00},
+        {0x9B, 0x82, 0xFF, 0xFF},
+        {0x9B, 0x83, 0x01, 0x00, 0x00}
+    };
+    static const uint16_t expectedLen[] = {2, 3, 3, 4, 4, 5};
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        uint8_t cmd[8];
+        SETlvBuilder tlv(cmd);
+
+        tlv.addHeader(0x9B, lengths[i]);
+        CHECK_EQUAL(ERR_NOERR, tlv.error());
+        CHECK_EQUAL(expectedLen[i], tlv.length());
+        MEMCMP_EQUAL(expected[i], tlv.data(), expectedLen[i]);
+    }
+}
+
+TEST(TlvTests, FirstErrorKept) {
+    static const uint8_t value[8] = {0};
+    uint8_t cmd[8];
+    SETlvBuilder overflow(cmd);
+    SETlvBuilder missing(cmd);
+
+    // Nothing is written past the buffer, nor after the first error
+    overflow.add(0x84, value, 4).add(0x85, value, 4).addOptional(0x86, nullptr, 1);
+    CHECK_EQUAL(ERR_INVALID_LENGTH, overflow.error());
+    CHECK_EQUAL(6, overflow.length());
+
+    missing.addOptional(0x84, nullptr, 1).add(0x85, value, 1);
+    CHECK_EQUAL(ERR_INVALID_PARAMETERS, missing.error());
+    CHECK_EQUAL(0, missing.length());
+}
+
+TEST(TlvTests, ReadsBerTlvs) {
+    static const uint8_t response[] = {
+        0xC3, 0x0F,
+            0x83, 0x01, 0x02,
+            0x9F, 0x21, 0x01, 0x07,
+            0x20, 0x02, 0x01, 0x52,
+            0x5F, 0x80, 0x01, 0x00,
+        0x34, 0x81, 0x80
+    };
+    uint8_t buffer[sizeof(response) + 0x80];
+    SETlvView tlv;
+    SETlvView inner;
+
+    memcpy(buffer, response, sizeof(response));
+    memset(buffer + sizeof(response), 0xAA, 0x80);
+    SETlvReader reader(buffer, sizeof(buffer));
+
+    // Nested TLVs, two and three bytes tags
+    CHECK_TRUE(reader.next(&tlv));
+    CHECK_EQUAL(0xC3, tlv.tag);
+    SETlvReader nested(tlv);
+    CHECK_TRUE(nested.find(0x9F21, &inner));
+    CHECK_EQUAL(1, inner.len);
+    CHECK_EQUAL(0x07, inner.value[0]);
+    CHECK_TRUE(nested.find(0x20, &inner));
+    CHECK_EQUAL(2, inner.len);
+    CHECK_TRUE(inner.value == buffer + 11);
+    CHECK_TRUE(nested.next(&inner));
+    CHECK_EQUAL(0x5F8001, inner.tag);
+    CHECK_EQUAL(0, inner.len);
+    CHECK_FALSE(nested.next(&inner));
+    CHECK_FALSE(nested.error());
+
+    // Long form length
+    CHECK_TRUE(reader.next(&tlv));
+    CHECK_EQUAL(0x34, tlv.tag);
+    CHECK_EQUAL(0x80, tlv.len);
+    CHECK_FALSE(reader.next(&tlv));
+    CHECK_FALSE(reader.error());
+}
+
+TEST(TlvTests, RefusesMalformed) {
+    static const uint8_t malformed[][6] = {
+        {0x20, 0x03, 0x01, 0x02},       // value past the end
+        {0x20, 0x81},                   // length past the end
+        {0x20, 0x80, 0x00, 0x00},       // indefinite length
+        {0x20, 0x85, 0x00, 0x00, 0x00}, // five length bytes
+        {0x9F, 0x81, 0x81, 0x01, 0x00}, // four tag bytes
+        {0x9F}                          // tag past the end
+    };
+    static const uint32_t lengths[] = {4, 2, 4, 5, 5, 1};
+    SETlvView tlv;
+    uint32_t len;
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        SETlvReader reader(malformed[i], lengths[i]);
+
+        CHECK_FALSE(reader.next(&tlv));
+        CHECK_TRUE(reader.error());
+    }
+    CHECK_EQUAL(3, seTlvReadLength((const uint8_t*) "\x82\x01\x00", 3, &len));
+    CHECK_EQUAL(0x100, len);
+    CHECK_EQUAL(0, seTlvReadLength((const uint8_t*) "\x82\x01", 2, &len));
+}
+
+// Walks the TLVs of a buffer and the ones nested in their values
+static void walk(const uint8_t* data, uint32_t len, int depth)
+{
+    SETlvReader reader(data, len);
+    SETlvView tlv;
+
+    while (reader.next(&tlv)) {
+        CHECK_TRUE(tlv.value >= data && tlv.value + tlv.len <= data + len);
+        if (depth < 4) {
+            walk(tlv.value, tlv.len, depth + 1);
+        }
+    }
+}
+
+TEST(TlvTests, RandomBuffersStayInBounds) {
+    std::mt19937 random(1);
+
+    // Buffers allocated to their exact size, any read past them is caught
+    // when built with the address sanitizer
+    for (int i = 0; i < 2000; i++) {
+        uint32_t len = random() % 64;
+        uint8_t* buffer = (uint8_t*) malloc(len + 1);
+        for (uint32_t j = 0; j < len; j++) {
+            buffer[j] = (uint8_t) random();
+            // Mostly lengths which fit, so the walk goes deep
+            if (j % 2 == 1 && random() % 4 != 0) {
+                buffer[j] = (uint8_t) (random() % (len - j));
+            }
+        }
+        walk(buffer, len, 0);
+        free(buffer);
+    }
+}
+
+// Forwards to the simulator and corrupts the data of its responses
+class MutatingSE : public SEInterface {
+public:
+    MutatingSE(SEInterface* se) : _se(se), _random(7), _rate(0) {}
+
+    void setRate(int percent)
+    {
+        _rate = percent;
+    }
+
+protected:
+    bool transmitApdu(uint8_t* apdu, uint16_t apduLen, uint8_t* response, uint16_t* responseLen)
+    {
+        uint16_t dataLen;
+
+        if (!forwardApdu(_se, apdu, apduLen, response, responseLen)) {
+            return false;
+        }
+        if (*responseLen <= APDU_RESPONSE_LEN || (int) (_random() % 100) >= _rate) {
+            return true;
+        }
+        dataLen = *responseLen - APDU_RESPONSE_LEN;
+        switch (_random() % 4) {
+        case 0:
+            // Any byte
+            response[_random() % dataLen] = (uint8_t) _random();
+            break;
+        case 1:
+            // A length byte, if the data is TLVs
+            response[_random() % dataLen | 1] = (uint8_t) (0x7E + _random() % 8);
+            break;
+        case 2:
+            // Truncated data, same status word
+            memmove(response + dataLen / 2, response + dataLen, APDU_RESPONSE_LEN);
+            *responseLen = dataLen / 2 + APDU_RESPONSE_LEN;
+            break;
+        default:
+            // No data
+            memmove(response, response + dataLen, APDU_RESPONSE_LEN);
+            *responseLen = APDU_RESPONSE_LEN;
+            break;
+        }
+        return true;
+    }
+
+private:
+    SEInterface* _se;
+    std::mt19937 _random;
+    int _rate;
+};
+
+TEST(TlvTests, CorruptedResponses) {
+    static const uint8_t hash[32] = {0x5A};
+    uint8_t certId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_CERT_CLIENT};
+    uint8_t keyId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_KEY};
+    uint8_t ephId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_CLIENT_EPHEMERAL_KEY};
+    IoTSafeSimulator sim;
+    MutatingSE se(&sim);
+    ROT rot;
+    RotKeyPair kp;
+    int passed = 0;
+
+    rot.init(&se);
+    CHECK_TRUE(rot.select(true));
+    se.setRate(60);
+
+    // Every operation either fails or gives bounded results
+    for (int i = 0; i < 300; i++) {
+        uint8_t* cert = NULL;
+        uint16_t certLen = 0;
+        uint8_t signature[0x60];
+        uint16_t signatureLen = sizeof(signature);
+        int result;
+
+        switch (i % 3) {
+        case 0:
+            result = rot.getCertificateByContainerId(certId, CONTAINER_ID_LENGTH, &cert, &certLen);
+            free(cert);
+            break;
+        case 1:
+            result = rot.signInit(keyId, CONTAINER_ID_LENGTH, ROT_ALGO_SHA256_WITH_ECDSA);
+            if (result == ERR_NOERR) {
+                result = rot.signFinal(hash, sizeof(hash), signature, &signatureLen);
+            }
+            if (result == ERR_NOERR) {
+                CHECK_TRUE(signatureLen <= sizeof(signature));
+            }
+            break;
+        default:
+            memset(&kp, 0, sizeof(kp));
+            result = rot.generateKeyPairByContainerId(ephId, CONTAINER_ID_LENGTH, &kp);
+            if (result == ERR_NOERR) {
+                CHECK_TRUE(kp.priv_key_id_len <= MAX_CONTAINER_ID_LEN);
+                CHECK_TRUE(kp.pub_key_id_len <= MAX_CONTAINER_ID_LEN);
+            }
+            break;
+        }
+        passed += (result == ERR_NOERR);
+    }
+
+    // Untouched responses still parse
+    CHECK_TRUE(passed > 0);
+    se.setRate(0);
+    CHECK_EQUAL(ERR_NOERR, rot.generateKeyPairByContainerId(ephId, CONTAINER_ID_LENGTH, &kp));
+}
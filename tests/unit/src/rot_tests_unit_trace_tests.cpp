@@ -0,0 +1,316 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "CppUTest/TestHarness.h"
+
+#include "ROT.h"
+#include "IoTSafeSimulator.h"
+#include "SETraceRecorder.h"
+#include "SETraceReplay.h"
+#include "SEFaultInjector.h"
+
+static char tracePath[64];
+
+TEST_GROUP(TraceTests)
+{
+    void setup()
+    {
+        snprintf(tracePath, sizeof(tracePath), "/tmp/iotsafe-tests-%d.trc", (int) getpid());
+    }
+
+    void teardown()
+    {
+        unlink(tracePath);
+    }
+};
+
+// Select, certificate read and random through the given interface
+static void runWorkload(SEInterface* se, uint8_t* random, uint8_t** cert, uint16_t* certLen)
+{
+    uint8_t certId[CONTAINER_ID_LENGTH] = {CONTAINER_ID_CERT_CLIENT};
+    ROT rot;
+
+    rot.init(se);
+    CHECK_TRUE(rot.select(true));
+    CHECK_EQUAL(ERR_NOERR, rot.getCertificateByContainerId(certId, CONTAINER_ID_LENGTH, cert, certLen));
+    CHECK_EQUAL(ERR_NOERR, rot.generateRandom(random, 32));
+}
+
+TEST(TraceTests, RecordAndReplay) {
+    IoTSafeSimulator sim;
+    SETraceRecorder recorder(&sim);
+    SETraceReplay replay;
+    uint8_t random[32];
+    uint8_t replayed[32];
+    uint8_t* cert = NULL;
+    uint8_t* replayedCert = NULL;
+    uint16_t certLen = 0;
+    uint16_t replayedCertLen = 0;
+
+    CHECK_TRUE(recorder.open(tracePath));
+    runWorkload(&recorder, random, &cert, &certLen);
+    CHECK_TRUE(recorder.getRecordCount() >= 4);
+    CHECK_TRUE(recorder.close());
+
+    // Same responses without the Secure Element, at once
+    CHECK_TRUE(replay.open(tracePath));
+    CHECK_EQUAL(recorder.getRecordCount(), replay.getRecordCount());
+    replay.setTimeScale(0);
+    for (int round = 0; round < 2; round++) {
+        replay.rewind();
+        runWorkload(&replay, replayed, &replayedCert, &replayedCertLen);
+        CHECK_EQUAL(0, replay.getMissCount());
+        MEMCMP_EQUAL(random, replayed, sizeof(random));
+        CHECK_EQUAL(certLen, replayedCertLen);
+        MEMCMP_EQUAL(cert, replayedCert, certLen);
+        free(replayedCert);
+        replayedCert = NULL;
+        replayedCertLen = 0;
+    }
+    free(cert);
+}
+
+TEST(TraceTests, ReplayMatchesCommands) {
+    IoTSafeSimulator sim;
+    SETraceRecorder recorder(&sim);
+    SETraceReplay replay;
+    SEResponseView view;
+    uint8_t random[16];
+
+    CHECK_TRUE(recorder.open(tracePath));
+    recorder.transmit(0x00, 0xA4, 0x04, 0x00, (const uint8_t*) "\xA0\x00\x00\x00\x30\x53\xF1\x24\x01\x77\x01\x01\x49\x53\x41", 15);
+    recorder.transmit(0x00, 0x84, 0x00, 0x00, 16);
+    CHECK_EQUAL(SW_EXECUTION_OK, recorder.getStatusWord());
+    CHECK_EQUAL(16, recorder.getResponse(random));
+    CHECK_TRUE(recorder.close());
+
+    // Commands spared by the host are skipped
+    CHECK_TRUE(replay.open(tracePath));
+    replay.setTimeScale(0);
+    CHECK_EQUAL(ERR_NOERR, replay.transmit(0x00, 0x84, 0x00, 0x00, 16));
+    view = replay.getResponseView();
+    CHECK_EQUAL(SW_EXECUTION_OK, view.sw);
+    CHECK_EQUAL(16, view.dataLen);
+    MEMCMP_EQUAL(random, view.data, 16);
+
+    // A command recorded nowhere fails
+    CHECK_TRUE(replay.transmit(0x00, 0xCA, 0x00, 0x00, 1) != ERR_NOERR);
+    CHECK_EQUAL(1, replay.getMissCount());
+
+    // Other data with a recorded header is answered by the next record
+    replay.rewind();
+    CHECK_EQUAL(ERR_NOERR, replay.transmit(0x00, 0xA4, 0x04, 0x00, (const uint8_t*) "\xA0\x00", 2));
+    CHECK_EQUAL(SW_EXECUTION_OK, replay.getStatusWord());
+}
+
+// Appends one exchange to a trace file written by hand
+static void writeRecord(FILE* f, uint64_t link, uint8_t flags, const uint8_t* command, uint16_t commandLen,
+                        const uint8_t* response, uint16_t responseLen)
+{
+    static const uint8_t padding[8] = {0};
+    SETraceRecord record;
+
+    memset(&record, 0, sizeof(record));
+    record.link = link;
+    record.commandLen = commandLen;
+    record.responseLen = responseLen;
+    record.flags = flags;
+    fwrite(&record, sizeof(record), 1, f);
+    fwrite(command, 1, commandLen, f);
+    if (responseLen > 0) {
+        fwrite(response, 1, responseLen, f);
+    }
+    fwrite(padding, 1, seTraceRecordSize(&record) - sizeof(record) - commandLen - responseLen, f);
+}
+
+TEST(TraceTests, ReplayAtRecordedTiming) {
+    static const uint8_t getRandom[] = {0x00, 0x84, 0x00, 0x00, 0x02};
+    static const uint8_t random[] = {0x12, 0x34, 0x90, 0x00};
+    static const uint8_t getData[] = {0x00, 0xCA, 0x00, 0x00, 0x01};
+    SETraceReplay replay;
+    SETraceHeader header;
+    struct timespec start;
+    struct timespec end;
+    double elapsed;
+    FILE* f;
+
+    // Not a trace
+    f = fopen(tracePath, "wb");
+    CHECK_TRUE(f != NULL);
+    fputs("not a trace", f);
+    fclose(f);
+    CHECK_FALSE(replay.open(tracePath));
+
+    // 20 ms link, then a timeout; the last record cut short is ignored
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SE_TRACE_MAGIC, SE_TRACE_MAGIC_LEN);
+    header.version = SE_TRACE_VERSION;
+    header.headerLen = sizeof(header);
+    f = fopen(tracePath, "wb");
+    CHECK_TRUE(f != NULL);
+    fwrite(&header, sizeof(header), 1, f);
+    writeRecord(f, 20000000, 0, getRandom, sizeof(getRandom), random, sizeof(random));
+    writeRecord(f, 0, SE_TRACE_FAILED | SE_TRACE_TIMED_OUT, getData, sizeof(getData), NULL, 0);
+    fwrite(&header, 8, 1, f);
+    fclose(f);
+
+    CHECK_TRUE(replay.open(tracePath));
+    CHECK_EQUAL(2, replay.getRecordCount());
+    for (int round = 0; round < 2; round++) {
+        replay.rewind();
+        replay.setTimeScale(round == 0 ? 1.0 : 0.5);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        CHECK_EQUAL(ERR_NOERR, replay.transmit(0x00, 0x84, 0x00, 0x00, 2));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        CHECK_TRUE(elapsed >= (round == 0 ? 20.0 : 10.0));
+        CHECK_EQUAL(0x9000, replay.getStatusWord());
+        CHECK_EQUAL(ERR_TIMEOUT, replay.transmit(0x00, 0xCA, 0x00, 0x00, 1));
+    }
+}
+
+TEST_GROUP(FaultInjectionTests)
+{
+    void setup()
+    {
+        snprintf(tracePath, sizeof(tracePath), "/tmp/iotsafe-tests-%d.trc", (int) getpid());
+    }
+
+    void teardown()
+    {
+        unlink(tracePath);
+    }
+};
+
+static double elapsedMs(const struct timespec* start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+TEST(FaultInjectionTests, StatusWordsFollowed) {
+    IoTSafeSimulator sim;
+    SEFaultInjector injector(&sim);
+    uint8_t random[32];
+    uint8_t* cert = NULL;
+    uint8_t* expected = NULL;
+    uint16_t certLen = 0;
+    uint16_t expectedLen = 0;
+
+    // Every response through 6Cxx or 61xx: the library follows both
+    runWorkload(&sim, random, &expected, &expectedLen);
+    injector.setFaultRate(SE_FAULT_6CXX, 0.5);
+    injector.setFaultRate(SE_FAULT_61XX, 1.0);
+    for (int round = 0; round < 4; round++) {
+        runWorkload(&injector, random, &cert, &certLen);
+        CHECK_EQUAL(expectedLen, certLen);
+        MEMCMP_EQUAL(expected, cert, certLen);
+        free(cert);
+        cert = NULL;
+        certLen = 0;
+    }
+    CHECK_TRUE(injector.getFaultCount(SE_FAULT_6CXX) > 0);
+    CHECK_TRUE(injector.getFaultCount(SE_FAULT_61XX) > 0);
+    free(expected);
+}
+
+TEST(FaultInjectionTests, TransportFaults) {
+    IoTSafeSimulator sim;
+    SEFaultInjector injector(&sim);
+    ROT rot;
+    uint8_t random[16];
+    struct timespec start;
+
+    rot.init(&injector);
+    CHECK_TRUE(rot.select(true));
+
+    // Lost command, lost response, only for GET RANDOM
+    injector.setFaultRate(SE_FAULT_TRANSPORT, 1.0, 0x84);
+    CHECK_TRUE(rot.generateRandom(random, sizeof(random)) != ERR_NOERR);
+    injector.setFaultRate(SE_FAULT_TRANSPORT, 0, 0x84);
+    injector.setFaultRate(SE_FAULT_DROP, 1.0, 0x84);
+    CHECK_TRUE(rot.generateRandom(random, sizeof(random)) != ERR_NOERR);
+    injector.setFaultRate(SE_FAULT_DROP, 0, 0x84);
+    CHECK_EQUAL(1, injector.getFaultCount(SE_FAULT_TRANSPORT));
+    CHECK_EQUAL(1, injector.getFaultCount(SE_FAULT_DROP));
+
+    // A stall within the deadline only delays the response
+    injector.setFaultRate(SE_FAULT_STALL, 1.0);
+    injector.setStallTime(20);
+    injector.setTimeout(100);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK_EQUAL(ERR_NOERR, injector.transmit(0x00, 0x84, 0x00, 0x00, 16));
+    CHECK_TRUE(elapsedMs(&start) >= 20);
+
+    // Past it the exchange times out at the deadline
+    injector.setStallTime(1000);
+    injector.setTimeout(50);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK_EQUAL(ERR_TIMEOUT, injector.transmit(0x00, 0x84, 0x00, 0x00, 16));
+    CHECK_TRUE(elapsedMs(&start) >= 50);
+    CHECK_TRUE(elapsedMs(&start) < 1000);
+}
+
+TEST(FaultInjectionTests, LatencyCalibratedFromTrace) {
+    static const uint8_t getRandom[] = {0x00, 0x84, 0x00, 0x00, 0x02};
+    static const uint8_t random[] = {0x12, 0x34, 0x90, 0x00};
+    IoTSafeSimulator sim;
+    SEFaultInjector injector(&sim);
+    SETraceHeader header;
+    struct timespec start;
+    FILE* f;
+
+    CHECK_FALSE(injector.calibrate(tracePath));
+
+    // GET RANDOM took 30 ms in the field, other commands answered at once
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SE_TRACE_MAGIC, SE_TRACE_MAGIC_LEN);
+    header.version = SE_TRACE_VERSION;
+    header.headerLen = sizeof(header);
+    f = fopen(tracePath, "wb");
+    CHECK_TRUE(f != NULL);
+    fwrite(&header, sizeof(header), 1, f);
+    for (int i = 0; i < 4; i++) {
+        writeRecord(f, 30000000, 0, getRandom, sizeof(getRandom), random, sizeof(random));
+    }
+    fclose(f);
+    CHECK_TRUE(injector.calibrate(tracePath));
+    injector.setLatency(SE_FAULT_ANY_INS, 0, 0);
+
+    CHECK_EQUAL(ERR_NOERR, injector.transmit(0x00, 0xA4, 0x04, 0x00, (const uint8_t*) "\xA0\x00\x00\x00\x30\x53\xF1\x24\x01\x77\x01\x01\x49\x53\x41", 15));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK_EQUAL(ERR_NOERR, injector.transmit(0x00, 0x84, 0x00, 0x00, 16));
+    CHECK_TRUE(elapsedMs(&start) >= 30);
+    CHECK_EQUAL(SW_EXECUTION_OK, injector.getStatusWord());
+
+    // Scaled, and uniform bounds of its own
+    injector.setTimeScale(0.5);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK_EQUAL(ERR_NOERR, injector.transmit(0x00, 0x84, 0x00, 0x00, 16));
+    CHECK_TRUE(elapsedMs(&start) >= 15);
+    injector.setTimeScale(1);
+    injector.setLatency(0x84, 5000, 5000);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CHECK_EQUAL(ERR_NOERR, injector.transmit(0x00, 0x84, 0x00, 0x00, 16));
+    CHECK_TRUE(elapsedMs(&start) >= 5);
+}
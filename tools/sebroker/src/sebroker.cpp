@@ -0,0 +1,282 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "GenericModem.h"
+#include "IoTSafeSimulator.h"
+#include "SEBroker.h"
+#include "SEFaultInjector.h"
+#include "SEMetrics.h"
+#include "SETraceRecorder.h"
+
+// Broker daemon: owns the modem port and serves SEBrokerClient instances
+// of other processes over a Unix domain socket until interrupted.
+//
+// usage: sebroker [-s socket] [-b baud] [-k] [-t timeout_ms] [-T trace]
+//                 [-C trace] [-l min_ms:max_ms] [-f fault=rate,...] [-m file]
+//                 (modem_port | -S)
+//   -s  socket path (default /tmp/sebroker.sock)
+//   -b  UART rate to negotiate with the modem
+//   -k  RTS/CTS hardware flow control
+//   -t  deadline of one APDU exchange with the SIM, in milliseconds
+//   -T  record the APDU exchanges with the SIM to a trace file (see SETrace.h)
+//   -C  model the SIM latency and faults on a recorded trace (see SEFaultInjector.h)
+//   -l  add a latency drawn between min_ms and max_ms to every exchange
+//   -f  inject faults: 6c, 61, transport, drop or stall, at a rate in [0, 1]
+//   -m  write the metrics (see SEMetrics.h) to a Prometheus textfile every
+//       METRICS_PERIOD seconds, e.g. for the node_exporter textfile collector
+//   -S  serve the software IoT SAFE applet instead of a modem
+
+#define METRICS_PERIOD 5
+
+static SEBroker* broker = nullptr;
+static volatile sig_atomic_t stopping = 0;
+static bool serving = false;	// run() on the main thread
+
+static void onSignal(int sig) {
+	(void) sig;
+	stopping = 1;
+	if(serving && broker != nullptr) {
+		broker->stop();
+	}
+}
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s [-s socket] [-b baud] [-k] [-t timeout_ms] [-T trace]\n"
+		"\t[-C trace] [-l min_ms:max_ms] [-f fault=rate,...] [-m file] (modem_port | -S)\n", name);
+}
+
+// Written aside then renamed, a collector never reads half a file
+static bool writeMetrics(const char* path) {
+	SEMetricsSnapshot snapshot;
+	char tmp[256];
+	FILE* f;
+	bool ok;
+
+	if(snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp)) {
+		return false;
+	}
+	f = fopen(tmp, "w");
+	if(f == nullptr) {
+		return false;
+	}
+	seMetricsSnapshot(&snapshot);
+	ok = seMetricsWritePrometheus(&snapshot, f);
+	ok = (fclose(f) == 0) && ok;
+	if(!ok || rename(tmp, path) != 0) {
+		unlink(tmp);
+		return false;
+	}
+	return true;
+}
+
+// Parses "6c=0.1,stall=0.01" into the injector
+static bool setFaults(SEFaultInjector* injector, char* list) {
+	static const char* names[SE_FAULT_COUNT] = {"6c", "61", "transport", "drop", "stall"};
+	char* save = nullptr;
+	char* item;
+	char* rate;
+	uint8_t fault;
+
+	for(item = strtok_r(list, ",", &save); item != nullptr; item = strtok_r(nullptr, ",", &save)) {
+		rate = strchr(item, '=');
+		if(rate == nullptr) {
+			return false;
+		}
+		*rate++ = '\0';
+		for(fault = 0; fault < SE_FAULT_COUNT && strcmp(item, names[fault]) != 0; fault++);
+		if(fault == SE_FAULT_COUNT) {
+			return false;
+		}
+		injector->setFaultRate(fault, strtod(rate, nullptr));
+	}
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char* path = nullptr;
+	const char* trace = nullptr;
+	const char* calibration = nullptr;
+	const char* latency = nullptr;
+	const char* metrics = nullptr;
+	char* faults = nullptr;
+	uint32_t baud = 0;
+	uint32_t timeout = APDU_DEFAULT_TIMEOUT;
+	bool flowControl = false;
+	bool simulator = false;
+	SEInterface* se;
+	GenericModem* modem = nullptr;
+	SEFaultInjector* injector = nullptr;
+	SETraceRecorder* recorder = nullptr;
+	int opt;
+
+	while((opt = getopt(argc, argv, "s:b:kt:T:C:l:f:m:S")) != -1) {
+		switch(opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 'b':
+			baud = (uint32_t) strtoul(optarg, nullptr, 10);
+			break;
+		case 'k':
+			flowControl = true;
+			break;
+		case 't':
+			timeout = (uint32_t) strtoul(optarg, nullptr, 10);
+			break;
+		case 'T':
+			trace = optarg;
+			break;
+		case 'C':
+			calibration = optarg;
+			break;
+		case 'l':
+			latency = optarg;
+			break;
+		case 'f':
+			faults = optarg;
+			break;
+		case 'm':
+			metrics = optarg;
+			break;
+		case 'S':
+			simulator = true;
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if(simulator == (optind < argc)) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if(metrics != nullptr) {
+		seMetricsEnable(true);
+	}
+
+	if(simulator) {
+		se = new IoTSafeSimulator();
+	}
+	else {
+		modem = new GenericModem();
+		if(!modem->open(argv[optind])) {
+			fprintf(stderr, "Error: cannot open %s!\n", argv[optind]);
+			delete modem;
+			return -1;
+		}
+		if(baud != 0 && !modem->setBaudRate(baud)) {
+			fprintf(stderr, "Warning: rate %u refused, running at %u\n", baud, modem->getBaudRate());
+		}
+		if(flowControl && !modem->setFlowControl(true)) {
+			fprintf(stderr, "Warning: flow control refused\n");
+		}
+		se = modem;
+	}
+	se->setTimeout(timeout);
+
+	// A SIM of the field in front of the one at hand
+	if(calibration != nullptr || latency != nullptr || faults != nullptr) {
+		injector = new SEFaultInjector(se);
+		if(calibration != nullptr && !injector->calibrate(calibration)) {
+			fprintf(stderr, "Error: cannot calibrate on %s!\n", calibration);
+			delete injector;
+			delete se;
+			return -1;
+		}
+		if(latency != nullptr) {
+			char* end;
+			uint32_t minMs = (uint32_t) strtoul(latency, &end, 10);
+			uint32_t maxMs = (*end == ':') ? (uint32_t) strtoul(end + 1, nullptr, 10) : minMs;
+			injector->setLatency(SE_FAULT_ANY_INS, minMs * 1000, maxMs * 1000);
+		}
+		if(faults != nullptr && !setFaults(injector, faults)) {
+			fprintf(stderr, "Error: invalid faults %s!\n", faults);
+			delete injector;
+			delete se;
+			return -1;
+		}
+		injector->setTimeout(timeout);
+	}
+
+	// The broker's exchanges go to the SIM through the recorder
+	if(trace != nullptr) {
+		recorder = new SETraceRecorder((injector != nullptr) ? (SEInterface*) injector : se);
+		if(!recorder->open(trace)) {
+			fprintf(stderr, "Error: cannot create %s!\n", trace);
+			delete recorder;
+			delete injector;
+			delete se;
+			return -1;
+		}
+		recorder->setTimeout(timeout);
+	}
+
+	broker = new SEBroker((recorder != nullptr) ? (SEInterface*) recorder :
+		(injector != nullptr) ? (SEInterface*) injector : se);
+	if(!broker->open(path)) {
+		fprintf(stderr, "Error: cannot listen on %s!\n", broker->getSocketName());
+		delete broker;
+		delete recorder;
+		delete injector;
+		delete se;
+		return -1;
+	}
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("%s\n", broker->getSocketName());
+	fflush(stdout);
+	if(metrics == nullptr) {
+		serving = true;
+		broker->run();
+	}
+	else if(broker->start()) {
+		// The main thread writes the metrics while the broker serves
+		while(!stopping) {
+			if(!writeMetrics(metrics)) {
+				fprintf(stderr, "Warning: cannot write %s\n", metrics);
+			}
+			sleep(METRICS_PERIOD);
+		}
+		broker->stop();
+		writeMetrics(metrics);
+	}
+	else {
+		fprintf(stderr, "Error: cannot start the broker!\n");
+	}
+
+	delete broker;
+	broker = nullptr;
+	if(recorder != nullptr && !recorder->close()) {
+		fprintf(stderr, "Error: trace %s incomplete!\n", trace);
+	}
+	delete recorder;
+	delete injector;
+	if(modem != nullptr) {
+		modem->close();
+	}
+	delete se;
+	return 0;
+}
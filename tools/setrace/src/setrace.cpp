@@ -0,0 +1,129 @@
+/*
+ *    Copyright (c) 2019 - 2020, Thales DIS Singapore, Inc
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "SETrace.h"
+
+// Summary of an APDU trace recorded by SETraceRecorder (sebroker -T):
+// link (transport and SIM) and host timings overall and per INS, and
+// with -v every exchange.
+//
+// usage: setrace [-v] trace
+
+struct Stats {
+	uint32_t count;
+	uint32_t failed;
+	uint64_t link;
+	uint64_t maxLink;
+};
+
+static void usage(const char* name) {
+	fprintf(stderr, "usage: %s [-v] trace\n", name);
+}
+
+static void dump(const uint8_t* data, uint16_t len) {
+	uint16_t i;
+
+	for(i = 0; i < len; i++) {
+		printf("%02X", data[i]);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const SETraceHeader* header;
+	const SETraceRecord* record;
+	const uint8_t* map;
+	size_t len;
+	const uint8_t* command;
+	std::vector<uint64_t> links;
+	Stats ins[256];
+	Stats total;
+	Stats* s;
+	uint64_t host = 0;
+	size_t offset = 0;
+	bool verbose = false;
+	time_t seconds;
+	int i;
+
+	if(argc == 3 && strcmp(argv[1], "-v") == 0) {
+		verbose = true;
+	}
+	else if(argc != 2) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	map = seTraceMap(argv[argc - 1], &len);
+	if(map == nullptr) {
+		fprintf(stderr, "Error: %s is not a trace!\n", argv[argc - 1]);
+		return -1;
+	}
+	header = (const SETraceHeader*) map;
+
+	memset(ins, 0, sizeof(ins));
+	memset(&total, 0, sizeof(total));
+	while((record = seTraceNext(map, len, &offset)) != nullptr) {
+		command = (const uint8_t*) (record + 1);
+		s = &ins[(record->commandLen > 1) ? command[1] : 0];
+		s->count++;
+		s->link += record->link;
+		s->maxLink = std::max(s->maxLink, record->link);
+		total.count++;
+		total.link += record->link;
+		total.maxLink = std::max(total.maxLink, record->link);
+		if(record->flags & SE_TRACE_FAILED) {
+			s->failed++;
+			total.failed++;
+		}
+		host += record->host;
+		links.push_back(record->link);
+
+		if(verbose) {
+			printf("%12.3f ms  link %9.1f us  host %9.1f us  %s", record->start / 1e6, record->link / 1e3, record->host / 1e3,
+				(record->flags & SE_TRACE_TIMED_OUT) ? "TIMEOUT " : (record->flags & SE_TRACE_FAILED) ? "FAILED " : "");
+			dump(command, record->commandLen);
+			printf(" -> ");
+			dump(command + record->commandLen, record->responseLen);
+			printf("\n");
+		}
+	}
+
+	seconds = (time_t) (header->startTime / 1000000000ULL);
+	printf("recorded     %s", ctime(&seconds));
+	printf("exchanges    %u (%u failed)\n", total.count, total.failed);
+	if(total.count == 0) {
+		return 0;
+	}
+	std::sort(links.begin(), links.end());
+	printf("link         %.1f ms total, mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+		total.link / 1e6, total.link / 1e3 / total.count, links[links.size() / 2] / 1e3,
+		links[links.size() * 99 / 100] / 1e3, total.maxLink / 1e3);
+	printf("host         %.1f ms total between exchanges\n", host / 1e6);
+	printf("\n%4s %8s %8s %12s %12s\n", "INS", "count", "failed", "mean us", "max us");
+	for(i = 0; i < 256; i++) {
+		if(ins[i].count > 0) {
+			printf("  %02X %8u %8u %12.1f %12.1f\n", i, ins[i].count, ins[i].failed,
+				ins[i].link / 1e3 / ins[i].count, ins[i].maxLink / 1e3);
+		}
+	}
+	return 0;
+}